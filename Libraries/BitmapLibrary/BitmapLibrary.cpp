@@ -9,6 +9,7 @@
 #include <stdlib.h>
 
 #include "BitmapLibrary.hpp"
+#include "Blitter.hpp"
 
 
 extern void operator delete(void* p);
@@ -45,6 +46,7 @@ namespace BitmapLibrary
 		memcpy(this->ActualBMP, (void*) Fileptr, this->Header->FileSize);
 
 		// check the DIBType.
+		this->DIB = 0;
 		switch(*((uint32_t*)((uint64_t) Fileptr + 14)))
 		{
 			case 40:
@@ -67,104 +69,94 @@ namespace BitmapLibrary
 				// not supported.
 				break;
 		}
-	}
-
-	void BitmapImage::RenderSlow(uint16_t x, uint16_t y, void (*r)(uint16_t, uint16_t, uint32_t))
-	{
-		switch(this->DIB->GetBitsPerPixel())
-		{
-			case 32:
-				this->Render32Slow(x, y, r);
-				break;
-
-			case 24:
-				this->Render24(x, y, r);
-				break;
 
-			default:
-				break;
-		}
+		this->Decode();
 	}
 
-	void BitmapImage::Render(uint16_t x, uint16_t y, uint32_t fw, uint32_t* fb)
+	BitmapImage::~BitmapImage()
 	{
-		if(this->DIB->GetBitsPerPixel() == 32)
-			this->Render32(x, y, fw, fb);
+		delete[] this->Pixels;
+		delete this->DIB;
+		delete[] (uint8_t*) this->ActualBMP;
+		delete this->Header;
 	}
 
-	void BitmapImage::Render32Slow(uint16_t x, uint16_t y, void (*r)(uint16_t, uint16_t, uint32_t))
+	// bitmaps are stored bottom row first unless the height is negative, with rows padded to 4 bytes. converting the
+	// whole thing up front (walking the rows backwards if need be) means drawing it is just a clipped copy.
+	void BitmapImage::Decode()
 	{
-		uint32_t imght = (uint32_t) __abs(this->DIB->GetBitmapHeight());
-		uint64_t ptr = (uint64_t) this->ActualBMP + this->Header->BitmapArrayOffset;
-
-		uint64_t rowsize = ((this->DIB->GetBitsPerPixel() * (uint64_t) this->DIB->GetBitmapWidth() + 31) / 32) * 4;
+		this->Pixels = 0;
+		this->Width = 0;
+		this->Height = 0;
 
-		uint16_t oposx = x;
-		uint16_t posx = oposx;
-		uint16_t posy = y + (this->DIB->Type == InfoHeaderV1 && (this->DIB->GetBitmapHeight() < 0 ? 0 : this->DIB->GetBitmapHeight()));
+		if(!this->DIB)
+			return;
 
-		for(uint32_t d = 0; d < imght; d++)
-		{
-			for(uint32_t w = 0; w < rowsize / (this->DIB->GetBitsPerPixel() / 8); w++)
-			{
-				r(posx, posy, *((uint32_t*) ptr));
-				ptr += this->DIB->GetBitsPerPixel() / 8;
-				posx++;
-			}
-			posx = oposx;
-			posy++;
-		}
-	}
+		uint32_t bpp = this->DIB->GetBitsPerPixel();
+		int32_t width = this->DIB->GetBitmapWidth();
+		int32_t height = this->DIB->GetBitmapHeight();
 
-	void BitmapImage::Render24(uint16_t x, uint16_t y, void (*r)(uint16_t, uint16_t, uint32_t))
-	{
-		uint32_t imght = (uint32_t) __abs(this->DIB->GetBitmapHeight());
-		uint64_t ptr = (uint64_t) this->ActualBMP + this->Header->BitmapArrayOffset;
+		if((bpp != 24 && bpp != 32) || width <= 0 || height == 0)
+			return;
 
-		uint64_t rowsize = ((this->DIB->GetBitsPerPixel() * (uint64_t) this->DIB->GetBitmapWidth() + 31) / 32) * 4;
+		uint64_t rows = (uint64_t) (height < 0 ? -(int64_t) height : height);
+		uint64_t rowsize = ((bpp * (uint64_t) width + 31) / 32) * 4;
 
-		uint16_t oposx = x;
-		uint16_t posx = oposx;
-		uint16_t posy = y + (this->DIB->Type == InfoHeaderV1 && (this->DIB->GetBitmapHeight() < 0 ? 0 : this->DIB->GetBitmapHeight()));
+		if(this->Header->BitmapArrayOffset + (rowsize * rows) > this->Header->FileSize)
+			return;
 
+		uint8_t* bits = (uint8_t*) this->ActualBMP + this->Header->BitmapArrayOffset;
+		int64_t stride = (int64_t) rowsize;
 
-		for(uint32_t d = 0; d < imght; d++)
+		if(height > 0)
 		{
-			for(uint32_t w = 0; w < rowsize / (this->DIB->GetBitsPerPixel() / 8); w++)
-			{
-				r(posx, posy, (*((uint32_t*) ptr) & 0xFFFFFF));
-				ptr += this->DIB->GetBitsPerPixel() / 8;
-				posx++;
-			}
-			posx = oposx;
-			posy--;
+			bits += rowsize * (rows - 1);
+			stride = -stride;
 		}
-	}
-
 
+		this->Width = (uint32_t) width;
+		this->Height = (uint32_t) rows;
+		this->Pixels = new uint32_t[(uint64_t) this->Width * this->Height];
 
+		if(bpp == 24)
+		{
+			Blitter::Convert24To32(this->Pixels, this->Width, bits, stride, this->Width, this->Height);
+		}
+		else
+		{
+			for(uint64_t y = 0; y < this->Height; y++)
+				Blitter::Copy32(this->Pixels + (y * this->Width), (uint32_t*) (bits + ((int64_t) y * stride)), this->Width);
+		}
+	}
 
-	void BitmapImage::Render32(uint16_t x, uint16_t y, uint32_t fw, uint32_t* fb)
+	void BitmapImage::RenderSlow(uint16_t x, uint16_t y, void (*r)(uint16_t, uint16_t, uint32_t))
 	{
-		uint32_t imght = (uint32_t) __abs(this->DIB->GetBitmapHeight());
-		uint64_t ptr = (uint64_t) this->ActualBMP + this->Header->BitmapArrayOffset;
+		if(!this->Pixels)
+			return;
 
-		uint64_t rowsize = ((this->DIB->GetBitsPerPixel() * (uint64_t) this->DIB->GetBitmapWidth() + 31) / 32) * 4;
+		for(uint32_t d = 0; d < this->Height; d++)
+		{
+			uint32_t* row = this->Pixels + ((uint64_t) d * this->Width);
+			for(uint32_t w = 0; w < this->Width; w++)
+				r((uint16_t) (x + w), (uint16_t) (y + d), row[w]);
+		}
+	}
 
+	void BitmapImage::Render(uint16_t x, uint16_t y, uint32_t fw, uint32_t* fb)
+	{
+		// no height to clip against, so the caller had better have room below.
+		this->Render(x, y, fw, (uint32_t) y + this->Height, fb);
+	}
 
-		// make sure the image will fit.
-		if(rowsize > fw * (32 / 8))
+	void BitmapImage::Render(uint16_t x, uint16_t y, uint32_t fw, uint32_t fh, uint32_t* fb)
+	{
+		if(!this->Pixels)
 			return;
 
-		for(uint32_t d = 0; d < imght; d++)
-		{
-			uint64_t pos = (y * fw + x) * 4;
-			memcpy((void*)((uint64_t) fb + pos), (void*) ptr, rowsize);
-
-			ptr += (this->DIB->GetBitsPerPixel() / 8) * (rowsize / (this->DIB->GetBitsPerPixel() / 8));
+		Blitter::Surface dst { fb, fw, fh, fw };
+		Blitter::Surface src { this->Pixels, this->Width, this->Height, this->Width };
 
-			y++;
-		}
+		Blitter::CopyRect(&dst, x, y, &src, 0, 0, this->Width, this->Height);
 	}
 
 
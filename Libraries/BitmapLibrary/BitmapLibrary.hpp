@@ -89,21 +89,29 @@ namespace BitmapLibrary
 	{
 		public:
 			BitmapImage(void* fp);
+			~BitmapImage();
 
+			// it owns everything it points to.
+			BitmapImage(const BitmapImage&) = delete;
+			BitmapImage& operator = (const BitmapImage&) = delete;
 
 			BitmapHeader* Header;
 			BitmapDIB* DIB;
 
 			void* ActualBMP;
 
+			// decoded once when the image is loaded: 32bpp, top row first, Width pixels to a row.
+			// null if the format isn't one we understand.
+			uint32_t* Pixels;
+			uint32_t Width;
+			uint32_t Height;
+
 			void RenderSlow(uint16_t x, uint16_t y, void (*r)(uint16_t, uint16_t, uint32_t));
 			void Render(uint16_t x, uint16_t y, uint32_t windowwidth, uint32_t* fb);
+			void Render(uint16_t x, uint16_t y, uint32_t windowwidth, uint32_t windowheight, uint32_t* fb);
 
 		private:
-			void Render32Slow(uint16_t x, uint16_t y, void (*r)(uint16_t, uint16_t, uint32_t));
-			void Render32(uint16_t x, uint16_t y, uint32_t windowwidth, uint32_t* address);
-
-			void Render24(uint16_t x, uint16_t y, void (*r)(uint16_t, uint16_t, uint32_t));
+			void Decode();
 	};
 }
 
@@ -0,0 +1,248 @@
+// Blitter.cpp
+// Copyright (c) 2013 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+
+
+#include <string.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+#include "Blitter.hpp"
+
+// every x86_64 chip has sse2, so that's the baseline; the 24 to 32bpp conversion wants pshufb, which needs ssse3,
+// and falls back to a plain loop without it. the ssse3 kernel is compiled for ssse3 on its own, so the rest of the
+// library doesn't need it to run.
+
+namespace BitmapLibrary {
+namespace Blitter
+{
+	static void (*ConvertRow)(uint32_t* dst, const uint8_t* src, uint64_t count) = 0;
+	static void (*CopyRow)(uint32_t* dst, const uint32_t* src, uint64_t count) = 0;
+	static void (*BlendRow)(uint32_t* dst, const uint32_t* src, uint64_t count) = 0;
+
+	static int64_t min(int64_t a, int64_t b) { return a < b ? a : b; }
+
+
+
+	static inline uint32_t Blend(uint32_t src, uint32_t dst)
+	{
+		uint32_t a = src >> 24;
+		if(a == 0xFF)	return src;
+		if(a == 0)		return dst;
+
+		// red and blue, then alpha and green, two at a time; (x + 128 + ((x + 128) >> 8)) >> 8 is x / 255, rounded.
+		uint32_t inv = 255 - a;
+		uint32_t rb = (dst & 0x00FF00FF) * inv + 0x00800080;
+		uint32_t ag = ((dst >> 8) & 0x00FF00FF) * inv + 0x00800080;
+
+		rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+		ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+
+		return src + rb + ag;
+	}
+
+	static void ConvertRowGeneric(uint32_t* dst, const uint8_t* src, uint64_t count)
+	{
+		for(uint64_t i = 0; i < count; i++, src += 3)
+			dst[i] = 0xFF000000 | ((uint32_t) src[2] << 16) | ((uint32_t) src[1] << 8) | src[0];
+	}
+
+	static void BlendRowGeneric(uint32_t* dst, const uint32_t* src, uint64_t count)
+	{
+		for(uint64_t i = 0; i < count; i++)
+			dst[i] = Blend(src[i], dst[i]);
+	}
+
+	// 16 pixels (48 bytes, three loads) at a time: pshufb spreads 12 bytes out to 4 pixels, and palignr lines the
+	// next 12 up at the bottom of a register. nothing past the last pixel is ever read.
+	__attribute__((target("ssse3")))
+	static void ConvertRowSSSE3(uint32_t* dst, const uint8_t* src, uint64_t count)
+	{
+		const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+
+		uint64_t i = 0;
+		for(; i + 16 <= count; i += 16, src += 48)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*) (src + 0));
+			__m128i b = _mm_loadu_si128((const __m128i*) (src + 16));
+			__m128i c = _mm_loadu_si128((const __m128i*) (src + 32));
+
+			__m128i p0 = _mm_shuffle_epi8(a, shuffle);
+			__m128i p1 = _mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), shuffle);
+			__m128i p2 = _mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), shuffle);
+			__m128i p3 = _mm_shuffle_epi8(_mm_srli_si128(c, 4), shuffle);
+
+			_mm_storeu_si128((__m128i*) (dst + i + 0), _mm_or_si128(p0, alpha));
+			_mm_storeu_si128((__m128i*) (dst + i + 4), _mm_or_si128(p1, alpha));
+			_mm_storeu_si128((__m128i*) (dst + i + 8), _mm_or_si128(p2, alpha));
+			_mm_storeu_si128((__m128i*) (dst + i + 12), _mm_or_si128(p3, alpha));
+		}
+
+		ConvertRowGeneric(dst + i, src, count - i);
+	}
+
+	static void CopyRowSSE2(uint32_t* dst, const uint32_t* src, uint64_t count)
+	{
+		uint64_t i = 0;
+		for(; i + 16 <= count; i += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*) (src + i + 0));
+			__m128i b = _mm_loadu_si128((const __m128i*) (src + i + 4));
+			__m128i c = _mm_loadu_si128((const __m128i*) (src + i + 8));
+			__m128i d = _mm_loadu_si128((const __m128i*) (src + i + 12));
+
+			_mm_storeu_si128((__m128i*) (dst + i + 0), a);
+			_mm_storeu_si128((__m128i*) (dst + i + 4), b);
+			_mm_storeu_si128((__m128i*) (dst + i + 8), c);
+			_mm_storeu_si128((__m128i*) (dst + i + 12), d);
+		}
+
+		// bitmap rows aren't necessarily aligned, so let memcpy deal with the tail.
+		memcpy(dst + i, src + i, (count - i) * sizeof(uint32_t));
+	}
+
+	// widen to 16 bits a channel, multiply by the inverse alpha, divide by 255 with the same rounding trick as
+	// Blend(), and pack back down. groups of 4 that are all opaque or all clear skip the arithmetic.
+	static void BlendRowSSE2(uint32_t* dst, const uint32_t* src, uint64_t count)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i alphas = _mm_set1_epi32((int) 0xFF000000);
+		const __m128i ff = _mm_set1_epi16(0xFF);
+		const __m128i half = _mm_set1_epi16(0x80);
+
+		uint64_t i = 0;
+		for(; i + 4 <= count; i += 4)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+			__m128i a = _mm_and_si128(s, alphas);
+
+			int opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(a, alphas));
+			if(opaque == 0xFFFF)
+			{
+				_mm_storeu_si128((__m128i*) (dst + i), s);
+				continue;
+			}
+
+			int clear = _mm_movemask_epi8(_mm_cmpeq_epi32(a, zero));
+			if(clear == 0xFFFF)
+				continue;
+
+			__m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+
+			__m128i slo = _mm_unpacklo_epi8(s, zero);
+			__m128i shi = _mm_unpackhi_epi8(s, zero);
+			__m128i dlo = _mm_unpacklo_epi8(d, zero);
+			__m128i dhi = _mm_unpackhi_epi8(d, zero);
+
+			// each pixel's alpha across all four of its lanes, then 255 - that.
+			__m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xFF), 0xFF);
+			__m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xFF), 0xFF);
+			alo = _mm_xor_si128(alo, ff);
+			ahi = _mm_xor_si128(ahi, ff);
+
+			dlo = _mm_add_epi16(_mm_mullo_epi16(dlo, alo), half);
+			dhi = _mm_add_epi16(_mm_mullo_epi16(dhi, ahi), half);
+			dlo = _mm_srli_epi16(_mm_add_epi16(dlo, _mm_srli_epi16(dlo, 8)), 8);
+			dhi = _mm_srli_epi16(_mm_add_epi16(dhi, _mm_srli_epi16(dhi, 8)), 8);
+
+			__m128i out = _mm_packus_epi16(_mm_add_epi16(slo, dlo), _mm_add_epi16(shi, dhi));
+			_mm_storeu_si128((__m128i*) (dst + i), out);
+		}
+
+		BlendRowGeneric(dst + i, src + i, count - i);
+	}
+
+
+
+	static void ExecuteCPUID(uint32_t function, uint32_t* ecx, uint32_t* edx)
+	{
+		uint32_t eax = 0, ebx = 0;
+		asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(*ecx), "=d"(*edx) : "a"(function), "c"(0));
+	}
+
+	void Initialise()
+	{
+		uint32_t ecx = 0, edx = 0;
+		ExecuteCPUID(1, &ecx, &edx);
+
+		bool ssse3 = ecx & (1 << 9);
+
+		CopyRow		= CopyRowSSE2;
+		BlendRow	= BlendRowSSE2;
+
+		// EnsureInitialised() only looks at this one, so it goes last, once the others are visible.
+		__sync_synchronize();
+		ConvertRow	= ssse3 ? ConvertRowSSSE3 : ConvertRowGeneric;
+	}
+
+	static inline void EnsureInitialised()
+	{
+		// racing here just means two threads pick the same kernels; anyone who sees ConvertRow set sees the rest too.
+		if(__builtin_expect(ConvertRow == 0, 0))
+			Initialise();
+	}
+
+	void Convert24To32(uint32_t* dst, const uint8_t* src, uint64_t count)
+	{
+		EnsureInitialised();
+		ConvertRow(dst, src, count);
+	}
+
+	void Copy32(uint32_t* dst, const uint32_t* src, uint64_t count)
+	{
+		EnsureInitialised();
+		CopyRow(dst, src, count);
+	}
+
+	void BlendPremultiplied(uint32_t* dst, const uint32_t* src, uint64_t count)
+	{
+		EnsureInitialised();
+		BlendRow(dst, src, count);
+	}
+
+	void Convert24To32(uint32_t* dst, uint64_t dststride, const uint8_t* src, int64_t srcstride, uint64_t width, uint64_t height)
+	{
+		EnsureInitialised();
+		for(uint64_t y = 0; y < height; y++)
+			ConvertRow(dst + (y * dststride), src + ((int64_t) y * srcstride), width);
+	}
+
+
+
+	// trims the rect to what's inside both surfaces, moving the other side's corner along with it.
+	static bool Clip(const Surface* dst, int64_t* dx, int64_t* dy, const Surface* src, int64_t* sx, int64_t* sy, int64_t* w, int64_t* h)
+	{
+		if(*sx < 0)	{ *dx -= *sx; *w += *sx; *sx = 0; }
+		if(*sy < 0)	{ *dy -= *sy; *h += *sy; *sy = 0; }
+		if(*dx < 0)	{ *sx -= *dx; *w += *dx; *dx = 0; }
+		if(*dy < 0)	{ *sy -= *dy; *h += *dy; *dy = 0; }
+
+		*w = min(*w, min((int64_t) src->width - *sx, (int64_t) dst->width - *dx));
+		*h = min(*h, min((int64_t) src->height - *sy, (int64_t) dst->height - *dy));
+
+		return *w > 0 && *h > 0;
+	}
+
+	void CopyRect(Surface* dst, int64_t dx, int64_t dy, const Surface* src, int64_t sx, int64_t sy, int64_t w, int64_t h)
+	{
+		if(!Clip(dst, &dx, &dy, src, &sx, &sy, &w, &h))
+			return;
+
+		EnsureInitialised();
+		for(int64_t y = 0; y < h; y++)
+			CopyRow(dst->pixels + ((dy + y) * dst->stride) + dx, src->pixels + ((sy + y) * src->stride) + sx, (uint64_t) w);
+	}
+
+	void BlendRect(Surface* dst, int64_t dx, int64_t dy, const Surface* src, int64_t sx, int64_t sy, int64_t w, int64_t h)
+	{
+		if(!Clip(dst, &dx, &dy, src, &sx, &sy, &w, &h))
+			return;
+
+		EnsureInitialised();
+		for(int64_t y = 0; y < h; y++)
+			BlendRow(dst->pixels + ((dy + y) * dst->stride) + dx, src->pixels + ((sy + y) * src->stride) + sx, (uint64_t) w);
+	}
+}
+}
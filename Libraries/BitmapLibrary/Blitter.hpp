@@ -0,0 +1,42 @@
+// Blitter.hpp
+// Copyright (c) 2013 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+
+#pragma once
+
+#include <stdint.h>
+
+namespace BitmapLibrary
+{
+	namespace Blitter
+	{
+		// 32bpp pixels are 0xAARRGGBB, which is also how a 24bpp bitmap's BGR bytes read in memory.
+		// strides are in pixels for 32bpp surfaces, and in bytes for 24bpp ones (rows are padded to 4 bytes).
+
+		struct Surface
+		{
+			uint32_t* pixels;
+			uint64_t width;
+			uint64_t height;
+			uint64_t stride;
+		};
+
+		// picks the kernels from cpuid. everything below calls it if nobody has yet.
+		void Initialise();
+
+		// one row each. alpha comes out as 0xFF.
+		void Convert24To32(uint32_t* dst, const uint8_t* src, uint64_t count);
+		void Copy32(uint32_t* dst, const uint32_t* src, uint64_t count);
+
+		// dst = src + dst * (255 - src.alpha) / 255, with src premultiplied.
+		void BlendPremultiplied(uint32_t* dst, const uint32_t* src, uint64_t count);
+
+		// whole images; a negative source stride walks the rows backwards, which is how bottom-up bitmaps get flipped.
+		void Convert24To32(uint32_t* dst, uint64_t dststride, const uint8_t* src, int64_t srcstride, uint64_t width, uint64_t height);
+
+		// the w * h rect at (sx, sy) in 'src' to (dx, dy) in 'dst', clipped against both.
+		void CopyRect(Surface* dst, int64_t dx, int64_t dy, const Surface* src, int64_t sx, int64_t sy, int64_t w, int64_t h);
+		void BlendRect(Surface* dst, int64_t dx, int64_t dy, const Surface* src, int64_t sx, int64_t sy, int64_t w, int64_t h);
+	}
+}
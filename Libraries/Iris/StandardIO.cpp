@@ -547,15 +547,14 @@ namespace Kernel {
 namespace Console
 {
 	void PrintChar(uint8_t c);
+	void PrintString(const char* str, uint64_t length);
 }
 }
 
 
 static size_t ConsolePrintCallback(void* user, const char* string, size_t stringlen)
 {
-	for(size_t i = 0; i < stringlen; i++)
-		Kernel::Console::PrintChar(string[i]);
-
+	Kernel::Console::PrintString(string, stringlen);
 	return stringlen;
 }
 
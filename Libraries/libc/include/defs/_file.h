@@ -7,6 +7,7 @@
 #pragma once
 
 #include "../stdint.h"
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,6 +16,9 @@ extern "C" {
 #define __LASTOP_READ	1
 #define __LASTOP_WRITE	2
 
+#define __FILE_EOF		0x80
+#define __FILE_ERR		0x40
+
 
 struct _FILE
 {
@@ -32,10 +36,30 @@ struct _FILE
 	uint8_t bufmode;
 	uint8_t lastop;
 	uint8_t indicatorflags;
+
+	// set when 'buffer' came from malloc() and must be freed by us.
+	uint8_t ownsbuffer;
+
+	// unbuffered streams still need somewhere to put ungetc() and single-byte reads.
+	uint8_t shortbuf[1];
+
+	// all open streams are chained together so fflush(NULL) and exit() can find them.
+	struct _FILE* next;
 };
 
 typedef struct _FILE FILE;
 
+// internal, in stdio/_buffer.cpp
+void __initfile(FILE* str, uint64_t fd, uint8_t bufmode);
+void __linkfile(FILE* str);
+void __unlinkfile(FILE* str);
+void __setupbuf(FILE* str);
+int __flushbuf(FILE* str);
+void __dropreadbuf(FILE* str);
+size_t __fillbuf(FILE* str);
+size_t __writeall(FILE* str, const uint8_t* buf, size_t len);
+extern FILE* __openfiles;
+
 #ifdef __cplusplus
 }
 #endif
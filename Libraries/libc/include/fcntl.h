@@ -15,6 +15,8 @@ extern "C" {
 #define O_CREATE		(1 << 2)
 #define O_TRUNC		(1 << 3)
 #define O_APPEND		(1 << 4)
+#define O_NONBLOCK	(1 << 5)
+#define O_EXCL		(1 << 6)
 
 #define O_RDONLY		O_READ
 #define O_WRONLY		O_WRITE
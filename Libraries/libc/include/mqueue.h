@@ -5,11 +5,14 @@
 #include "sys/ipc.h"
 #include "sys/types.h"
 #include "fcntl.h"
+#include "time.h"
+#pragma once
 
 __BEGIN_DECLS
 
 
-#define __PREFIX_LENGTH	9	// "/dev/_mq/"
+// priorities are 0 to MQ_PRIO_MAX - 1; higher ones are received first.
+#define MQ_PRIO_MAX		32
 
 typedef long mqd_t;
 struct mq_attr
@@ -27,6 +30,8 @@ mqd_t mq_open(const char*, int, ...);
 ssize_t mq_receive(mqd_t, char*, size_t, unsigned int*);
 int mq_send(mqd_t, const char *, size_t, unsigned int);
 int mq_setattr(mqd_t, const struct mq_attr*, struct mq_attr*);
+ssize_t mq_timedreceive(mqd_t, char*, size_t, unsigned int*, const struct timespec*);
+int mq_timedsend(mqd_t, const char*, size_t, unsigned int, const struct timespec*);
 int mq_unlink(const char*);
 
 __END_DECLS
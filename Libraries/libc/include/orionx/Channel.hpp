@@ -0,0 +1,120 @@
+// Channel.hpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+
+
+#include <stdint.h>
+#pragma once
+
+// shared-memory ring channels: one producer, one consumer, and no copying through the kernel.
+// CreateChannel() and OpenChannel() map the same pages into both processes -- a header page, then the ring itself,
+// mapped twice back to back, so any span of up to 'size' bytes is contiguous no matter where it starts.
+
+// 'head' is only written by the producer and 'tail' only by the consumer; both count bytes since the channel was
+// created. the kernel only gets involved when one side has to sleep because the ring is empty (or full).
+
+// the kernel uses this header too.
+
+#define CHANNEL_HEADER_SIZE		0x1000
+#define CHANNEL_MAX_SIZE		0x400000
+#define CHANNEL_NAME_MAX		64
+
+// for ChannelWait() and ChannelWake()
+#define CHANNEL_DATA			0
+#define CHANNEL_SPACE			1
+
+namespace Library
+{
+	struct ChannelHeader
+	{
+		// on separate cache lines, so the two sides don't fight over them.
+		volatile uint64_t head;
+		uint8_t _pad0[56];
+
+		volatile uint64_t tail;
+		uint8_t _pad1[56];
+
+		uint64_t size;
+
+		// set by a side that's about to sleep, so the other side knows to make the syscall to wake it.
+		volatile uint32_t readerwaiting;
+		volatile uint32_t writerwaiting;
+
+		// set by the kernel once either side closes it (or exits); ChannelWait() fails with EPIPE from then on.
+		volatile uint32_t closed;
+
+		// note: the other side can write any of this. one that doesn't trust it gets the size from ChannelSize(),
+		// and keeps its own copy of the index it owns.
+	};
+
+	namespace Channel
+	{
+		inline uint8_t* Data(ChannelHeader* ch)
+		{
+			return (uint8_t*) ch + CHANNEL_HEADER_SIZE;
+		}
+
+		inline uint64_t Used(ChannelHeader* ch)
+		{
+			return ch->head - ch->tail;
+		}
+
+		// producer: somewhere to put 'len' bytes, or 0 if the ring doesn't have that much room yet.
+		inline void* Reserve(ChannelHeader* ch, uint64_t len)
+		{
+			uint64_t head = ch->head;
+			__sync_synchronize();
+
+			if(len > ch->size - (head - ch->tail))
+				return 0;
+
+			return Data(ch) + (head & (ch->size - 1));
+		}
+
+		// producer: publish 'len' bytes written into the space from Reserve().
+		// returns true if the consumer is asleep, and needs a ChannelWake(CHANNEL_DATA).
+		inline bool Commit(ChannelHeader* ch, uint64_t len)
+		{
+			__sync_synchronize();
+			ch->head = ch->head + len;
+			__sync_synchronize();
+
+			return ch->readerwaiting != 0;
+		}
+
+		// consumer: everything that's ready to read, or 0 if the ring is empty.
+		inline void* Peek(ChannelHeader* ch, uint64_t* len)
+		{
+			uint64_t tail = ch->tail;
+			*len = ch->head - tail;
+			__sync_synchronize();
+
+			return *len ? Data(ch) + (tail & (ch->size - 1)) : 0;
+		}
+
+		// consumer: hand 'len' bytes from Peek() back to the producer.
+		// returns true if the producer is asleep, and needs a ChannelWake(CHANNEL_SPACE).
+		inline bool Release(ChannelHeader* ch, uint64_t len)
+		{
+			__sync_synchronize();
+			ch->tail = ch->tail + len;
+			__sync_synchronize();
+
+			return ch->writerwaiting != 0;
+		}
+
+		#ifndef ORION_KERNEL
+
+		// the blocking half, in libc. both return false once the other side has gone (errno is EPIPE),
+		// and WaitForSpace() fails with EMSGSIZE if 'len' could never fit.
+		bool WaitForData(ChannelHeader* ch);
+		bool WaitForSpace(ChannelHeader* ch, uint64_t len);
+
+		// Commit() and Release(), plus the wakeup if the other side needs one.
+		void Publish(ChannelHeader* ch, uint64_t len);
+		void Consume(ChannelHeader* ch, uint64_t len);
+
+		#endif
+	}
+}
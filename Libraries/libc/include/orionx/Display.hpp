@@ -0,0 +1,85 @@
+// Display.hpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+
+
+#include <stdint.h>
+#include <orionx/Channel.hpp>
+#pragma once
+
+// talking to displayd.
+// a client creates a channel of DISPLAY_REQUEST_RING bytes (exactly; anything else is turned away) for its requests,
+// and says hello by sending its name (a ConnectMessage) to the server's message queue. everything after that goes through the channel, one fixed-size Request at a time.
+
+// a surface's pixels live in a channel too -- the client creates it, draws straight into Channel::Data(), and the
+// server opens it by name, so nothing gets copied. pixels are 32-bit 0xAARRGGBB, rows are 'width' pixels apart, and
+// unless the surface is opaque the colour channels are premultiplied by alpha.
+
+// the server only ever redraws what it's told has changed: send Damage once you're done drawing into a rect, and it
+// shows up on the next tick.
+
+#define DISPLAY_SERVER_QUEUE		"/displayd"
+#define DISPLAY_REQUEST_RING		0x1000
+
+// for Request::flags
+#define DISPLAY_SURFACE_OPAQUE		0x1
+
+namespace Library
+{
+	namespace Display
+	{
+		enum class RequestType : uint32_t
+		{
+			// name, x, y, width, height and flags. the surface channel needs room for width * height * 4 bytes.
+			CreateSurface,
+
+			DestroySurface,
+
+			// x, y, width and height, relative to the surface.
+			Damage,
+
+			// x and y.
+			Move,
+
+			// to the top of the stack.
+			Raise,
+
+			// every surface the client still has goes with it.
+			Disconnect,
+		};
+
+		struct ConnectMessage
+		{
+			uint64_t pid;
+			char channel[CHANNEL_NAME_MAX];
+		};
+
+		struct Request
+		{
+			RequestType type;
+
+			// chosen by the client; only has to be unique among its own surfaces.
+			uint32_t surface;
+
+			uint32_t flags;
+
+			int32_t x;
+			int32_t y;
+			uint32_t width;
+			uint32_t height;
+
+			char name[CHANNEL_NAME_MAX];
+
+			// padded to a power of two, so the ring always holds a whole number of them.
+			uint8_t _pad[36];
+		};
+
+		static_assert(sizeof(Request) == 128, "Request must stay a power of two");
+
+		inline uint64_t SurfaceSize(uint32_t width, uint32_t height)
+		{
+			return (uint64_t) width * height * 4;
+		}
+	}
+}
@@ -0,0 +1,33 @@
+// poll.h
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <sys/cdefs.h>
+#include "stdint.h"
+#pragma once
+
+__BEGIN_DECLS
+
+// the same bits as EPOLLIN etc. in sys/epoll.h
+#define POLLIN		0x001
+#define POLLPRI		0x002
+#define POLLOUT		0x004
+#define POLLERR		0x008
+#define POLLHUP		0x010
+#define POLLNVAL	0x020
+
+#define POLLRDNORM	POLLIN
+#define POLLWRNORM	POLLOUT
+
+typedef uint64_t nfds_t;
+
+struct pollfd
+{
+	int fd;
+	short events;
+	short revents;
+};
+
+int poll(struct pollfd* fds, nfds_t nfds, int timeout);
+
+__END_DECLS
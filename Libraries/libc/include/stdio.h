@@ -103,10 +103,11 @@ int vasprintf(char** result_ptr, const char* format, va_list ap);
 // in addition to bufmode being 0, 1 or 2, when ORed with 0x4 or 0x8, it means either blocking or async.
 #define __BUFMODE_BLOCK	0x4
 #define __BUFMODE_ASYNC	0x8
+#define __BUFMODE_MASK	0x3
 #define	BUFSIZ			4096	// IDGAF
+#define _IONBF			0	// No buffering.
 #define _IOFBF			1	// Fully buffered.
 #define _IOLBF			2	// Line buffered.
-#define _IONBF		4	// No buffering.
 
 
 #ifdef __cplusplus
@@ -36,6 +36,7 @@ int memcmp(const void* s1, const void* s2, size_t n);
 int strcmp(const char* s1, const char* s2);
 int strncmp(const char* s1, const char* s2, size_t n);
 void* memchr(const void* s, int c, size_t n);
+void* memrchr(const void* s, int c, size_t n);
 char* strchr(const char* s, int c);
 size_t strcspn(const char* s1, const char* s2);
 char* strpbrk(const char* s1, const char* s2);
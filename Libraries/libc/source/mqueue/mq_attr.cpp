@@ -0,0 +1,31 @@
+// mq_attr.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include "../../include/mqueue.h"
+#include "../../include/errno.h"
+#include <sys/syscall.h>
+
+extern "C" int mq_getattr(mqd_t mq, struct mq_attr* attr)
+{
+	return (int) Library::SystemCall::MessageQueueAttr((int) mq, 0, attr);
+}
+
+// only mq_flags (ie. O_NONBLOCK) can be changed, the same as everywhere else.
+extern "C" int mq_setattr(mqd_t mq, const struct mq_attr* attr, struct mq_attr* old)
+{
+	if(!attr)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	return (int) Library::SystemCall::MessageQueueAttr((int) mq, attr, old);
+}
+
+// there's no sigevent delivery to hang this off yet.
+extern "C" int mq_notify(mqd_t, const struct sigevent*)
+{
+	errno = ENOSYS;
+	return -1;
+}
@@ -5,43 +5,34 @@
 #include <stdarg.h>
 #include "../../include/mqueue.h"
 #include "../../include/fcntl.h"
-#include "../../include/stdlib.h"
-#include "../../include/stdio.h"
-#include "../../include/string.h"
 #include <sys/syscall.h>
 
 extern "C" mqd_t mq_open(const char* path, int flags, ...)
 {
-	mode_t mode = 0;
-	(void) mode;
+	// the kernel takes the name as-is; it'll deal with the leading slash.
+	const struct mq_attr* attr = 0;
 	if(flags & O_CREAT)
 	{
 		va_list ap;
 		va_start(ap, flags);
-		mode = va_arg(ap, mode_t);
-		va_end(ap);
-	}
-
-	// prepend the path with '/dev/_mq/' so the kernel knows how to handle this.
-	auto prlen = __PREFIX_LENGTH;
 
-	if(path == 0)
-		return -1;
+		// permissions aren't enforced, so the mode is ignored.
+		(void) va_arg(ap, mode_t);
+		attr = va_arg(ap, const struct mq_attr*);
 
-	if(path[0] == '/')
-		prlen--;
-
-
-	char* id = (char*) malloc(strlen(path) + prlen + 1);
+		va_end(ap);
+	}
 
-	memcpy(id, "/dev/_mq/", prlen);
-	memcpy(id + prlen, path, strlen(path));
-	*(id + prlen + strlen(path) + 1) = 0;
+	return (mqd_t) Library::SystemCall::OpenMessageQueue(path, flags, attr);
+}
 
+extern "C" int mq_close(mqd_t mq)
+{
+	Library::SystemCall::Close((uint64_t) mq);
+	return 0;
+}
 
-	// TODO: flags ignored for now
-	// this should actually fail if it doesn't exist, unless flags & O_CREAT.
-	int fd = (int) Library::SystemCall::Open(id, flags);
-	free(id);
-	return fd;
+extern "C" int mq_unlink(const char* path)
+{
+	return (int) Library::SystemCall::UnlinkMessageQueue(path);
 }
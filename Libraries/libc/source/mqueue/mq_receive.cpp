@@ -0,0 +1,16 @@
+// mq_receive.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include "../../include/mqueue.h"
+#include <sys/syscall.h>
+
+extern "C" ssize_t mq_receive(mqd_t mq, char* buf, size_t len, unsigned int* prio)
+{
+	return (ssize_t) Library::SystemCall::ReceiveMessage((int) mq, buf, len, prio, 0);
+}
+
+extern "C" ssize_t mq_timedreceive(mqd_t mq, char* buf, size_t len, unsigned int* prio, const struct timespec* abstime)
+{
+	return (ssize_t) Library::SystemCall::ReceiveMessage((int) mq, buf, len, prio, abstime);
+}
@@ -0,0 +1,16 @@
+// mq_send.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include "../../include/mqueue.h"
+#include <sys/syscall.h>
+
+extern "C" int mq_send(mqd_t mq, const char* msg, size_t len, unsigned int prio)
+{
+	return (int) Library::SystemCall::SendMessage((int) mq, msg, len, prio, 0);
+}
+
+extern "C" int mq_timedsend(mqd_t mq, const char* msg, size_t len, unsigned int prio, const struct timespec* abstime)
+{
+	return (int) Library::SystemCall::SendMessage((int) mq, msg, len, prio, abstime);
+}
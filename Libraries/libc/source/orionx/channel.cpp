@@ -0,0 +1,76 @@
+// channel.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+
+#include "../../include/orionx/Channel.hpp"
+#include <sys/syscall.h>
+#include <errno.h>
+
+// announce that we're about to sleep, then check again: either the other side sees the flag and wakes us,
+// or we see what it did. the kernel only puts us to sleep if the index still hasn't moved from what we saw.
+
+namespace Library {
+namespace Channel
+{
+	bool WaitForData(ChannelHeader* ch)
+	{
+		while(ch->head == ch->tail)
+		{
+			uint64_t head = ch->head;
+
+			ch->readerwaiting = 1;
+			__sync_synchronize();
+
+			int64_t ret = 0;
+			if(ch->head == head)
+				ret = SystemCall::ChannelWait(ch, CHANNEL_DATA, head);
+
+			ch->readerwaiting = 0;
+			if(ret < 0)
+				return false;
+		}
+
+		return true;
+	}
+
+	bool WaitForSpace(ChannelHeader* ch, uint64_t len)
+	{
+		if(len > ch->size)
+		{
+			errno = EMSGSIZE;
+			return false;
+		}
+
+		while(ch->size - Used(ch) < len)
+		{
+			uint64_t tail = ch->tail;
+
+			ch->writerwaiting = 1;
+			__sync_synchronize();
+
+			int64_t ret = 0;
+			if(ch->tail == tail)
+				ret = SystemCall::ChannelWait(ch, CHANNEL_SPACE, tail);
+
+			ch->writerwaiting = 0;
+			if(ret < 0)
+				return false;
+		}
+
+		return true;
+	}
+
+	void Publish(ChannelHeader* ch, uint64_t len)
+	{
+		if(Commit(ch, len))
+			SystemCall::ChannelWake(ch, CHANNEL_DATA);
+	}
+
+	void Consume(ChannelHeader* ch, uint64_t len)
+	{
+		if(Release(ch, len))
+			SystemCall::ChannelWake(ch, CHANNEL_SPACE);
+	}
+}
+}
@@ -0,0 +1,160 @@
+// poll.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include "../../include/poll.h"
+#include "../../include/sys/epoll.h"
+#include "../../include/errno.h"
+#include "../../include/stdlib.h"
+#include "../../include/unistd.h"
+
+// poll() borrows an event poll: watch everything, wait once, and take the watches off again.
+// anything that polls the same set of fds over and over should use epoll directly.
+
+// one event poll is kept around between calls, so the common case doesn't create and destroy one every time;
+// a thread that finds it taken (someone else is in poll()) makes its own, and closes it if it can't put it back.
+
+// the same fd can be in the array more than once. it's only watched once, for everything any of its entries
+// asked for, and each entry gets the part of the result it asked for.
+
+static volatile int SpareEventPoll = -1;
+
+static int TakeEventPoll()
+{
+	int epfd = __sync_lock_test_and_set(&SpareEventPoll, -1);
+	return epfd >= 0 ? epfd : epoll_create1(0);
+}
+
+static void GiveBackEventPoll(int epfd)
+{
+	if(!__sync_bool_compare_and_swap(&SpareEventPoll, -1, epfd))
+		close(epfd);
+}
+
+extern "C" int poll(struct pollfd* fds, nfds_t nfds, int timeout)
+{
+	int epfd = TakeEventPoll();
+	if(epfd < 0)
+		return -1;
+
+	// first[i] is the earlier entry with the same fd, if there is one; only allocated once we find a duplicate.
+	nfds_t* first = 0;
+	bool nomem = false;
+
+	int ready = 0;
+	for(nfds_t i = 0; i < nfds; i++)
+	{
+		fds[i].revents = 0;
+		if(fds[i].fd < 0)
+			continue;
+
+		struct epoll_event ev;
+		ev.events = (uint32_t) fds[i].events & (POLLIN | POLLPRI | POLLOUT);
+		ev.data.u64 = i;
+
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i].fd, &ev) == 0)
+			continue;
+
+		if(errno == EEXIST)
+		{
+			if(!first)
+			{
+				first = (nfds_t*) malloc(nfds * sizeof(nfds_t));
+				if(!first)
+				{
+					nomem = true;
+					break;
+				}
+
+				for(nfds_t k = 0; k < nfds; k++)
+					first[k] = k;
+			}
+
+			nfds_t j = 0;
+			while(fds[j].fd != fds[i].fd)
+				j++;
+
+			first[i] = j;
+
+			// the watch keeps the first entry's index, and gets everything both of them want.
+			ev.events |= (uint32_t) fds[j].events & (POLLIN | POLLPRI | POLLOUT);
+			ev.data.u64 = j;
+			epoll_ctl(epfd, EPOLL_CTL_MOD, fds[i].fd, &ev);
+			continue;
+		}
+
+		// things that can't be watched (ie. regular files) are always ready.
+		if(errno == EPERM)			fds[i].revents = fds[i].events & (POLLIN | POLLOUT);
+		else if(errno == EBADF)		fds[i].revents = POLLNVAL;
+
+		if(fds[i].revents)
+			ready++;
+	}
+
+	// no point waiting if we already have something to say.
+	if(ready > 0)
+		timeout = 0;
+
+	int ret = 0;
+	int err = ENOMEM;
+
+	struct epoll_event events[32];
+	while(!nomem)
+	{
+		int n = epoll_wait(epfd, events, 32, timeout);
+		if(n < 0)
+		{
+			err = errno;
+			ret = -1;
+			break;
+		}
+
+		int fresh = 0;
+		for(int k = 0; k < n; k++)
+		{
+			struct pollfd* p = &fds[events[k].data.u64];
+			if(!p->revents)
+				fresh++;
+
+			p->revents |= (short) events[k].events;
+		}
+
+		// there might be more; don't wait for them though. ready fds come round again (they're level-triggered),
+		// so stop once we're not seeing anything new.
+		if(n < 32 || fresh == 0)
+			break;
+
+		timeout = 0;
+	}
+
+	if(nomem)
+		ret = -1;
+
+	// what the first entry of each fd got is for all of them, so hand it out before trimming anyone's.
+	for(nfds_t i = 0; first && i < nfds; i++)
+	{
+		if(first[i] != i)
+			fds[i].revents = fds[first[i]].revents;
+	}
+
+	for(nfds_t i = 0; i < nfds; i++)
+	{
+		if(fds[i].fd < 0)
+			continue;
+
+		fds[i].revents &= (short) (fds[i].events | POLLERR | POLLHUP | POLLNVAL);
+		if(fds[i].revents)
+			ret = ret < 0 ? ret : ret + 1;
+
+		if(!first || first[i] == i)
+			epoll_ctl(epfd, EPOLL_CTL_DEL, fds[i].fd, 0);
+	}
+
+	free(first);
+	GiveBackEventPoll(epfd);
+
+	if(ret < 0)
+		errno = err;
+
+	return ret;
+}
@@ -5,24 +5,59 @@
 #include <pthread.h>
 #include <sys/syscall.h>
 #include <string.h>
+#include <stdlib.h>
+
+namespace Heap
+{
+	void ReleaseCache();
+}
+
+struct StartInfo
+{
+	void* (*routine)(void*);
+	void* arg;
+};
+
+// the thread runs this, so there's somewhere to clean up after it returns.
+static void* ThreadStart(void* p)
+{
+	StartInfo si = *((StartInfo*) p);
+	free(p);
+
+	void* ret = si.routine(si.arg);
+
+	// give the thread's malloc cache back, otherwise it's gone for good.
+	Heap::ReleaseCache();
+	return ret;
+}
 
 extern "C" int pthread_create(pthread_t* restrict thread, const pthread_attr_t* restrict oattr, void *(*start_routine)(void*), void* restrict arg)
 {
 	// thread creation should usually work, but we have to check the return value just in case.
+	StartInfo* si = (StartInfo*) malloc(sizeof(StartInfo));
+	if(!si)
+		return -1;
+
+	si->routine = start_routine;
+	si->arg = arg;
+
 	pthread_attr_t sattr;
 	memset(&sattr, 0, sizeof(pthread_attr_t));
 	if(oattr == NULL)
 	{
-		sattr.a1 = arg;
+		sattr.a1 = si;
 	}
 	else
 	{
 		memcpy(&sattr, oattr, sizeof(pthread_attr_t));
-		sattr.a1 = arg;
+		sattr.a1 = si;
 	}
 
-	uint64_t tid = Library::SystemCall::CreateThread(&sattr, (void(*)()) start_routine);
+	uint64_t tid = Library::SystemCall::CreateThread(&sattr, (void(*)()) ThreadStart);
 	*thread = tid;
 
+	if(!(tid > 0))
+		free(si);
+
 	return tid > 0 ? 0 : -1;
 }
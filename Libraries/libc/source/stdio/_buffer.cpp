@@ -0,0 +1,159 @@
+// _buffer.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include "../../include/stdio.h"
+#include "../../include/stdlib.h"
+#include "../../include/string.h"
+#include "../../include/unistd.h"
+
+// buffer layout:
+// while reading (lastop == __LASTOP_READ), [bufferread, bufferfill) is data we've read ahead but not handed out yet.
+// while writing (lastop == __LASTOP_WRITE), [0, bufferfill) is data waiting to be written out.
+// the buffer itself is only allocated on first use, so setvbuf() before any I/O costs nothing.
+
+FILE* __openfiles = 0;
+
+extern "C" void __initfile(FILE* str, uint64_t fd, uint8_t bufmode)
+{
+	memset(str, 0, sizeof(FILE));
+
+	str->__fd		= fd;
+	str->bufmode	= bufmode;
+}
+
+extern "C" void __linkfile(FILE* str)
+{
+	str->next = __openfiles;
+	__openfiles = str;
+}
+
+extern "C" void __unlinkfile(FILE* str)
+{
+	FILE** link = &__openfiles;
+	while(*link)
+	{
+		if(*link == str)
+		{
+			*link = str->next;
+			break;
+		}
+
+		link = &(*link)->next;
+	}
+
+	str->next = 0;
+}
+
+extern "C" void __setupbuf(FILE* str)
+{
+	if(str->buffer)
+		return;
+
+	if((str->bufmode & __BUFMODE_MASK) != _IONBF)
+	{
+		size_t size = str->buffersize ? str->buffersize : BUFSIZ;
+		str->buffer = (uint8_t*) malloc(size);
+
+		if(str->buffer)
+		{
+			str->buffersize = size;
+			str->ownsbuffer = 1;
+			return;
+		}
+
+		// no memory, so just degrade to unbuffered.
+		str->bufmode = (uint8_t) ((str->bufmode & ~__BUFMODE_MASK) | _IONBF);
+	}
+
+	str->buffer = str->shortbuf;
+	str->buffersize = sizeof(str->shortbuf);
+	str->ownsbuffer = 0;
+}
+
+extern "C" size_t __writeall(FILE* str, const uint8_t* buf, size_t len)
+{
+	size_t done = 0;
+	while(done < len)
+	{
+		ssize_t ret = write((int) str->__fd, buf + done, len - done);
+		if(ret <= 0)
+		{
+			str->indicatorflags |= __FILE_ERR;
+			break;
+		}
+
+		done += (size_t) ret;
+	}
+
+	return done;
+}
+
+extern "C" int __flushbuf(FILE* str)
+{
+	if(str->lastop != __LASTOP_WRITE)
+		return 0;
+
+	size_t done = __writeall(str, str->buffer, str->bufferfill);
+	if(done < str->bufferfill)
+	{
+		// keep whatever didn't make it, so a later flush can retry.
+		memmove(str->buffer, str->buffer + done, str->bufferfill - done);
+		str->bufferfill -= done;
+
+		return EOF;
+	}
+
+	str->bufferfill = 0;
+	str->bufferread = 0;
+	str->lastop = 0;
+
+	return 0;
+}
+
+extern "C" void __dropreadbuf(FILE* str)
+{
+	if(str->lastop != __LASTOP_READ)
+		return;
+
+	// step the descriptor back over the read-ahead, so it sits where the caller thinks the stream is.
+	// this fails harmlessly on things that can't seek (ttys, sockets), where the data is simply discarded.
+	uint64_t ahead = str->bufferfill - str->bufferread;
+	if(ahead > 0)
+		lseek((int) str->__fd, -((off_t) ahead), SEEK_CUR);
+
+	str->bufferfill = 0;
+	str->bufferread = 0;
+	str->lastop = 0;
+}
+
+extern "C" size_t __fillbuf(FILE* str)
+{
+	if(str->lastop == __LASTOP_WRITE && __flushbuf(str) == EOF)
+		return 0;
+
+	__setupbuf(str);
+
+	if(str->lastop == __LASTOP_READ && str->bufferread < str->bufferfill)
+		return str->bufferfill - str->bufferread;
+
+	// interactive input: make sure any prompt has actually been written out before we block.
+	if((str->bufmode & __BUFMODE_MASK) != _IOFBF && stdout && stdout != str)
+		__flushbuf(stdout);
+
+	str->bufferfill = 0;
+	str->bufferread = 0;
+	str->lastop = 0;
+
+	ssize_t ret = read((int) str->__fd, str->buffer, str->buffersize);
+	if(ret <= 0)
+	{
+		str->indicatorflags |= (ret == 0 ? __FILE_EOF : __FILE_ERR);
+		return 0;
+	}
+
+	str->bufferfill = (size_t) ret;
+	str->lastop = __LASTOP_READ;
+
+	return (size_t) ret;
+}
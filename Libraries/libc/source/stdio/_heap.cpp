@@ -8,422 +8,645 @@
 #include "../../include/assert.h"
 #include "../../include/stdio.h"
 #include "../../include/sys/mman.h"
+#include <sys/syscall.h>
+
+// small allocations are rounded up to one of a few size classes, and each class is carved out of its own spans
+// (runs of pages from mmap). every thread keeps a short list of free objects per class, so most malloc()s and
+// free()s never take a lock; only when a list runs dry or gets too long does a batch move to or from the class's
+// central list, which is locked. once every object in a span has come back, the span goes back to the kernel.
+
+// anything bigger than the largest class gets a mapping of its own, which is unmapped again on free().
+
+// a page map (like a page table, indexed by page number) says which span a pointer belongs to, so free() doesn't
+// need a header in front of every object.
 
 namespace Heap
 {
 	// plugs:
-	#define GetPage()		((uint64_t) mmap(0, 0x1000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, 0, 0))
-	#define GetPageFixed(x)	((uint64_t) mmap((void*) (x), 0x1000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | MAP_ANON, 0, 0))
+	#define GetPages(n)		((uint64_t) mmap(0, (n) * 0x1000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, 0, 0))
+	#define FreePages(x, n)	munmap((void*) (x), (n) * 0x1000)
 	#define fail()			abort()
 
-	// book keeping
-	static uint64_t ChunksInHeap;
-	static uint64_t LastFree;
+	// 16 to 128 in steps of 16, then four between each power of two up to the maximum.
+	static const uint64_t NumClasses		= 40;
+	static const uint64_t MaxSmallSize		= 32768;
+
+	// a span holds at least this much, or eight objects, whichever is more.
+	static const uint64_t MinSpanSize		= 0x10000;
+
+	// how many threads get a cache at once; past that, they go to the central lists. a thread that exits through
+	// pthread_create()'s start gives its cache back (see ReleaseCache()); any other way, the next thread that can't
+	// find a free one takes it over.
+	static const uint64_t MaxCaches			= 64;
+
+	struct Span
+	{
+		uint64_t start;
+		uint64_t pages;
 
-	static uint64_t MetadataAddr;
-	static uint64_t HeapAddress;
+		// 0 for a large allocation, which is the whole span.
+		uint64_t sizeclass;
+		uint64_t inuse;
 
-	static uint64_t SizeOfHeap;
-	static uint64_t SizeOfMeta;
+		// objects that have come back, and how far into the span we've handed out so far.
+		void* freelist;
+		uint64_t carved;
 
-	const uint64_t MetaOffset = 64;
-	const uint64_t Alignment = 64;
+		// in the class's list of spans that have something free.
+		Span* next;
+		Span* prev;
+		bool listed;
+	};
 
-	struct Chunk
+	struct FreeList
 	{
-		uint64_t offset;
-		uint64_t size;
+		void* head;
+		uint64_t count;
 	};
 
-	uint64_t addr(Chunk* c)
+	struct ThreadCache
 	{
-		return (uint64_t) c;
-	}
+		// the thread it belongs to, or 0 if it's free (thread 0 is the kernel's).
+		pthread_t owner;
+		FreeList lists[NumClasses + 1];
+	};
 
-	Chunk* chunk(uint64_t addr)
+	struct CentralList
 	{
-		return (Chunk*) addr;
+		volatile int lock;
+		Span* spans;
+		uint64_t numspans;
+	};
+
+	static uint64_t ClassSizes[NumClasses + 1];
+	static uint64_t ClassPages[NumClasses + 1];
+	static uint64_t ClassBatch[NumClasses + 1];
+
+	// by (size + 15) / 16, for the small sizes everything asks for.
+	static uint8_t SmallLookup[(1024 / 16) + 1];
+
+	static CentralList Central[NumClasses + 1];
+	static ThreadCache Caches[MaxCaches];
+
+	static Span* SpanPool;
+	static volatile int SpanPoolLock;
+
+	static void** PageMap[4096];
+	static volatile int PageMapLock;
+
+
+
+
+	static void Lock(volatile int* l)
+	{
+		while(__sync_lock_test_and_set(l, 1))
+		{
+			// whoever has it might not be running, so don't spin for long.
+			for(int i = 0; i < 64 && *l; i++)
+				asm volatile("pause");
+
+			if(*l)
+				Library::SystemCall::Yield();
+		}
 	}
 
-	Chunk* array()
+	static void Unlock(volatile int* l)
 	{
-		return (Chunk*) (MetadataAddr + MetaOffset);
+		__sync_lock_release(l);
 	}
 
-	bool isfree(Chunk* c)
+	static bool Failed(uint64_t addr)
 	{
-		return c->size & 0x1;
+		return addr == 0 || addr == (uint64_t) MAP_FAILED;
 	}
 
-	void setfree(Chunk* c)
+	static uint64_t SizeToClass(uint64_t size)
 	{
-		c->size |= 0x1;
+		if(size <= 1024)
+			return SmallLookup[(size + 15) / 16];
+
+		uint64_t c = SmallLookup[1024 / 16];
+		while(ClassSizes[c] < size)
+			c++;
+
+		return c;
 	}
 
-	void setused(Chunk* c)
+
+
+
+	// the page map: three levels of 4096 entries, which covers 48 bits of address. lookups don't lock; the tables
+	// are only ever added, and only published once they're cleared.
+	static Span** PageMapEntry(uint64_t page, bool create)
 	{
-		c->size &= ~0x1;
+		uint64_t i1 = (page >> 24) & 0xFFF;
+		uint64_t i2 = (page >> 12) & 0xFFF;
+		uint64_t i3 = page & 0xFFF;
+
+		void** mid = PageMap[i1];
+		if(!mid)
+		{
+			if(!create) return 0;
+
+			uint64_t p = GetPages(8);
+			if(Failed(p)) fail();
+
+			memset((void*) p, 0, 8 * 0x1000);
+			__sync_synchronize();
+
+			mid = (void**) p;
+			PageMap[i1] = mid;
+		}
+
+		Span** leaf = (Span**) mid[i2];
+		if(!leaf)
+		{
+			if(!create) return 0;
+
+			uint64_t p = GetPages(8);
+			if(Failed(p)) fail();
+
+			memset((void*) p, 0, 8 * 0x1000);
+			__sync_synchronize();
+
+			leaf = (Span**) p;
+			mid[i2] = (void*) leaf;
+		}
+
+		return &leaf[i3];
 	}
 
-	uint64_t size(Chunk* c)
+	static void SetPageMap(uint64_t start, uint64_t pages, Span* span)
 	{
-		return c->size & ~0x1;
+		Lock(&PageMapLock);
+
+		for(uint64_t i = 0; i < pages; i++)
+			*PageMapEntry((start / 0x1000) + i, true) = span;
+
+		Unlock(&PageMapLock);
 	}
 
-	uint64_t midpoint(uint64_t a, uint64_t b)
+	static Span* Lookup(void* ptr)
 	{
-		return a + ((b - a) / 2);
+		Span** e = PageMapEntry((uint64_t) ptr / 0x1000, false);
+		return e ? *e : 0;
 	}
 
-	static void CheckAndExpandMeta()
+
+
+
+	// span records themselves come from pages of them, and are never given back.
+	static Span* NewSpan()
 	{
-		if((ChunksInHeap + 2) * sizeof(Chunk) > SizeOfMeta * 0x1000)
+		Lock(&SpanPoolLock);
+
+		if(!SpanPool)
 		{
-			// we need to expand.
-			uint64_t fixed = GetPageFixed(MetadataAddr + (SizeOfMeta * 0x1000));
-			assert(fixed == MetadataAddr + (SizeOfMeta * 0x1000));
-			SizeOfMeta++;
+			uint64_t p = GetPages(1);
+			if(Failed(p))
+			{
+				Unlock(&SpanPoolLock);
+				return 0;
+			}
+
+			Span* spans = (Span*) p;
+			for(uint64_t i = 0; i < 0x1000 / sizeof(Span); i++)
+			{
+				spans[i].next = SpanPool;
+				SpanPool = &spans[i];
+			}
 		}
-	}
 
+		Span* ret = SpanPool;
+		SpanPool = ret->next;
 
-	Chunk* index(uint64_t i)
-	{
-		Chunk* arr = (Chunk*) (MetadataAddr + MetaOffset);
-		if(i < ChunksInHeap)
-			return &arr[i];
+		Unlock(&SpanPoolLock);
 
-		else
-			return nullptr;
+		memset(ret, 0, sizeof(Span));
+		return ret;
 	}
 
-	void pushback(uint64_t at)
+	static void DeleteSpan(Span* s)
 	{
-		// memcpy them behind.
-		// but first, check if we have enough space.
-		CheckAndExpandMeta();
-		auto behind = ChunksInHeap - at;
-
-		// memcpy.
-		memmove((void*) addr(index(at + 1)), (void*) index(at), behind * sizeof(Chunk));
-		memset((void*) index(at), 0, sizeof(Chunk));
-	}
+		Lock(&SpanPoolLock);
 
-	void pullfront(uint64_t at)
-	{
-		// essentially deletes a chunk.
-		// 'at' contains the index of the chunk to delete.
-		void* c = index(at);
-		CheckAndExpandMeta();
+		s->next = SpanPool;
+		SpanPool = s;
 
-		if(at == ChunksInHeap - 1)
-			return;
+		Unlock(&SpanPoolLock);
+	}
 
-		// calculate how many chunks to pull
-		auto ahead = (ChunksInHeap - 1) - at;
 
-		memset(c, 0, sizeof(Chunk));
-		memmove(c, index(at + 1), ahead * sizeof(Chunk));
-	}
 
 
+	// everything below is called with the class's central list locked.
+	static void Link(CentralList* cl, Span* s)
+	{
+		s->prev = 0;
+		s->next = cl->spans;
 
+		if(cl->spans)
+			cl->spans->prev = s;
 
+		cl->spans = s;
+		s->listed = true;
+	}
 
-	uint64_t round(uint64_t s)
+	static void Unlink(CentralList* cl, Span* s)
 	{
-		uint64_t remainder = s % Alignment;
+		if(s->prev)	s->prev->next = s->next;
+		else		cl->spans = s->next;
 
-		if(remainder == 0)
-			return s;
+		if(s->next)
+			s->next->prev = s->prev;
 
-		return s + Alignment - remainder;
+		s->next = 0;
+		s->prev = 0;
+		s->listed = false;
 	}
 
+	static Span* MakeSpan(uint64_t cls)
+	{
+		uint64_t pages = ClassPages[cls];
+		uint64_t start = GetPages(pages);
+		if(Failed(start))
+			return 0;
 
+		Span* s = NewSpan();
+		if(!s)
+		{
+			FreePages(start, pages);
+			return 0;
+		}
+
+		s->start = start;
+		s->pages = pages;
+		s->sizeclass = cls;
 
+		SetPageMap(start, pages, s);
+		Link(&Central[cls], s);
+		Central[cls].numspans++;
 
+		return s;
+	}
 
+	static bool Full(Span* s)
+	{
+		return !s->freelist && s->carved + ClassSizes[s->sizeclass] > s->pages * 0x1000;
+	}
 
-	uint64_t bsearch(uint64_t key, uint64_t (*getkey)(uint64_t ind))
+	// takes up to 'want' objects, linked through their first word. returns how many there were.
+	static uint64_t FetchFromCentral(uint64_t cls, uint64_t want, void** head)
 	{
-		uint64_t imin = 0;
-		uint64_t imax = ChunksInHeap - 1;
-		uint64_t remaining = ChunksInHeap;
+		CentralList* cl = &Central[cls];
+		uint64_t size = ClassSizes[cls];
 
-		while(imax >= imin && remaining > 0)
+		void* list = 0;
+		uint64_t got = 0;
+
+		Lock(&cl->lock);
+		while(got < want)
 		{
-			// calculate the midpoint for roughly equal partition
-			auto imid = midpoint(imin, imax);
+			Span* s = cl->spans;
+			if(!s && !(s = MakeSpan(cls)))
+				break;
 
-			// determine which subarray to search
-			if(getkey(imid) < key)
+			// objects that came back first, then ones that have never been used.
+			while(got < want && s->freelist)
 			{
-				if(imid < ChunksInHeap)
-					imin = imid + 1;
+				void* obj = s->freelist;
+				s->freelist = *((void**) obj);
 
-				else
-					break;
+				*((void**) obj) = list;
+				list = obj;
+				got++;
+				s->inuse++;
 			}
 
-			else if(getkey(imid) > key)
+			while(got < want && s->carved + size <= s->pages * 0x1000)
 			{
-				if(imid > 0)
-					imax = imid - 1;
+				void* obj = (void*) (s->start + s->carved);
+				s->carved += size;
 
-				else
-					break;
+				*((void**) obj) = list;
+				list = obj;
+				got++;
+				s->inuse++;
 			}
 
-			else if(getkey(imid) == key)
-				return imid;
-
-			remaining--;
+			if(Full(s))
+				Unlink(cl, s);
 		}
 
-		return imin;
+		Unlock(&cl->lock);
+
+		*head = list;
+		return got;
 	}
 
+	static void ReleaseToCentral(uint64_t cls, void* list)
+	{
+		CentralList* cl = &Central[cls];
 
+		Lock(&cl->lock);
+		while(list)
+		{
+			void* next = *((void**) list);
+			Span* s = Lookup(list);
 
+			*((void**) list) = s->freelist;
+			s->freelist = list;
+			s->inuse--;
 
+			if(!s->listed)
+				Link(cl, s);
 
+			// keep one around, so a class that's just emptied doesn't map a new span on the next malloc().
+			if(s->inuse == 0 && cl->numspans > 1)
+			{
+				Unlink(cl, s);
+				cl->numspans--;
 
+				SetPageMap(s->start, s->pages, 0);
+				FreePages(s->start, s->pages);
+				DeleteSpan(s);
+			}
 
+			list = next;
+		}
 
-	// implementation:
-	void Initialise()
+		Unlock(&cl->lock);
+	}
+
+
+
+
+	// the kernel keeps a word for us next to the tls pointer (%fs:8), zeroed for every new thread. it says which cache
+	// is the thread's, or that it couldn't get one.
+	#define NoCache		((ThreadCache*) 1)
+
+	static ThreadCache* GetSlot()
 	{
-		MetadataAddr = GetPage();
-		HeapAddress = GetPage();
-
-		SizeOfHeap = 1;
-		SizeOfMeta = 1;
-		ChunksInHeap = 1;
-		LastFree = 0;
-
-		Chunk* c = index(0);
-		c->offset = 0;
-		c->size = 0x1000;
-		setfree(c);
+		ThreadCache* tc = 0;
+		asm volatile("movq %%fs:8, %0" : "=r"(tc));
+
+		return tc;
 	}
 
-	void CreateChunk(uint64_t offset, uint64_t size)
+	static void SetSlot(ThreadCache* tc)
 	{
-		uint64_t o = bsearch(offset, [](uint64_t i) -> uint64_t { return index(i)->offset; });
-		ChunksInHeap++;
+		asm volatile("movq %0, %%fs:8" :: "r"(tc) : "memory");
+	}
+
+	static ThreadCache* GetCache()
+	{
+		ThreadCache* tc = GetSlot();
+		if(tc == NoCache)
+			return 0;
+
+		if(tc)
+			return tc;
 
-		// create chunk in offset-sorted metalist
+		pthread_t self = Library::SystemCall::GetTID();
+		for(uint64_t i = 0; i < MaxCaches; i++)
 		{
-			if(o <= ChunksInHeap)
+			if(Caches[i].owner == 0 && __sync_bool_compare_and_swap(&Caches[i].owner, (pthread_t) 0, self))
 			{
-				// check if there are more chunks behind us.
-				if(o < ChunksInHeap - 1)
-					pushback(o);
-
-				// now that's solved, make the chunk.
-				Chunk* c = index(o);
-				c->offset = offset;
-				c->size = size;
-				setfree(c);
+				SetSlot(&Caches[i]);
+				return &Caches[i];
+			}
+		}
+
+		// none free, but threads that were killed (or didn't leave through pthread_create()'s start) still hold theirs.
+		// nobody's using what's in it any more, so it's ours as it is.
+		for(uint64_t i = 0; i < MaxCaches; i++)
+		{
+			pthread_t owner = Caches[i].owner;
+			if(owner != 0 && !Library::SystemCall::ThreadAlive(owner)
+				&& __sync_bool_compare_and_swap(&Caches[i].owner, owner, self))
+			{
+				SetSlot(&Caches[i]);
+				return &Caches[i];
 			}
-			else
-				fail();
 		}
-	}
 
+		// don't go through all that on every allocation.
+		SetSlot(NoCache);
+		return 0;
+	}
 
-	void ExpandHeap()
+	static void* AllocateLarge(size_t sz)
 	{
-		// expand the heap.
-		GetPageFixed(HeapAddress + (SizeOfHeap * 0x1000));
+		uint64_t pages = (sz + 0xFFF) / 0x1000;
+		uint64_t start = GetPages(pages);
+		if(Failed(start))
+			return 0;
 
-		// always offset sorted;
-		Chunk* last = index(ChunksInHeap - 1);
-		if(last->offset + size(last) != (SizeOfHeap * 0x1000))
+		Span* s = NewSpan();
+		if(!s)
 		{
-			fprintf(stderr, "failure (1): %lx + %lx != %lx\n", last->offset, size(last), SizeOfHeap * 0x1000);
-			fail();
+			FreePages(start, pages);
+			return 0;
 		}
 
+		s->start = start;
+		s->pages = pages;
+		s->sizeclass = 0;
 
-		// either create a new chunk, or expand the last one.
-		if(isfree(last))
-		{
-			last->size += 0x1000;
-			setfree(last);
-		}
-		else
-		{
-			CreateChunk(SizeOfHeap * 0x1000, 0x1000);
-		}
-		SizeOfHeap++;
+		// free() is only ever given the start, so that's the only page it needs to find.
+		SetPageMap(start, 1, s);
+		return (void*) start;
 	}
 
 
 
-	void* Allocate(size_t sz)
+
+	// implementation:
+	void Initialise()
 	{
-		sz = round(sz);
-		// loop through each chunk, hoping to find something big enough.
+		uint64_t n = 1;
+		for(uint64_t s = 16; s <= 128; s += 16)
+			ClassSizes[n++] = s;
 
-		Chunk* c = 0;
-		for(uint64_t i = LastFree; i < ChunksInHeap; i++)
+		for(uint64_t base = 128; base < MaxSmallSize; base *= 2)
 		{
-			if(size(index(i)) >= sz && isfree(index(i)))
-			{
-				c = index(i);
-				break;
-			}
-		}
-		if(c == 0)
-		{
-			ExpandHeap();
-			return Allocate(sz);
+			for(uint64_t i = 1; i <= 4; i++)
+				ClassSizes[n++] = base + ((base / 4) * i);
 		}
 
-		uint64_t o = c->offset;
-		uint64_t oldsize = size(c);
+		assert(n == NumClasses + 1);
 
-		c->size = sz;
-		setused(c);
-
-		auto newsize = oldsize - sz;
-		if(newsize >= Alignment)
+		for(uint64_t c = 1; c <= NumClasses; c++)
 		{
-			CreateChunk(c->offset + sz, newsize - (newsize % Alignment));
+			uint64_t bytes = ClassSizes[c] * 8 > MinSpanSize ? ClassSizes[c] * 8 : MinSpanSize;
+			ClassPages[c] = (bytes + 0xFFF) / 0x1000;
+
+			// about 8k at a time between a thread and the central list, but always at least two objects.
+			uint64_t batch = 8192 / ClassSizes[c];
+			ClassBatch[c] = batch < 2 ? 2 : (batch > 32 ? 32 : batch);
 		}
-		else
+
+		uint64_t c = 1;
+		for(uint64_t i = 0; i <= 1024 / 16; i++)
 		{
-			c->size = oldsize;
-			setused(c);
-		}
+			while(ClassSizes[c] < i * 16)
+				c++;
 
-		assert(sz % Alignment == 0);
-		assert(o % Alignment == 0);
-		return (void*) (HeapAddress + o);
+			SmallLookup[i] = (uint8_t) c;
+		}
 	}
 
-	void Free(void* ptr)
+	void* Allocate(size_t sz)
 	{
-		uint64_t p = (uint64_t) ptr;
-		assert(p >= HeapAddress);
-		p -= HeapAddress;
-
-		// this is where the offset-sorted list comes in handy.
-		uint64_t o = bsearch(p, [](uint64_t i) -> uint64_t { return index(i)->offset; });
-		Chunk* self = index(o);
+		if(sz > MaxSmallSize)
+			return AllocateLarge(sz);
 
+		uint64_t cls = SizeToClass(sz);
 
-		if(self->offset != p)
+		ThreadCache* tc = GetCache();
+		if(!tc)
 		{
-			fprintf(stderr, "failure: got offset %lx, expected %lx", p, self->offset);
-			fail();
+			void* ret = 0;
+			FetchFromCentral(cls, 1, &ret);
+			return ret;
 		}
 
-		setfree(self);
-
-		// do merge here.
-		// check right first, because checking left may modify our own state.
-
-		if(o < ChunksInHeap - 1)
+		FreeList* fl = &tc->lists[cls];
+		if(!fl->head)
 		{
-			// check right neighbour
-			Chunk* right = index(o + 1);
-			assert(self->offset + size(self) == right->offset);
-			if(isfree(right))
-			{
-				self->size += size(right);
-				setfree(self);
-
-				pullfront(o + 1);
-				ChunksInHeap--;
-			}
+			fl->count = FetchFromCentral(cls, ClassBatch[cls], &fl->head);
+			if(!fl->head)
+				return 0;
 		}
-		if(o > 0)
-		{
-			// check left neighbour
-			Chunk* left = index(o - 1);
-			if(left->offset + size(left) != self->offset)
-			{
-				fprintf(stderr, "failure (2): %lx + %lx != %lx\n", left->offset, size(left), self->offset);
-				fail();
-			}
 
-			if(isfree(left))
-			{
-				// do merge
-				left->size += size(self);
-				setfree(left);
+		void* ret = fl->head;
+		fl->head = *((void**) ret);
+		fl->count--;
 
-				// delete us.
-				pullfront(o);
-				ChunksInHeap--;
-			}
-		}
+		return ret;
 	}
 
-	void* Reallocate(void* ptr, size_t newsize)
+	void Free(void* ptr)
 	{
-		// get a new chunk.
-		if(newsize == 0)
+		if(!ptr)
+			return;
+
+		Span* s = Lookup(ptr);
+		if(!s || (s->sizeclass == 0 && (uint64_t) ptr != s->start))
 		{
-			Free(ptr);
-			return NULL;
+			fprintf(stderr, "failure: free() of %p, which malloc() never returned\n", ptr);
+			fail();
 		}
-		else
-		{
-			uint64_t p = (uint64_t) ptr;
-			assert(p >= HeapAddress);
-			p -= HeapAddress;
-
-			// this is where the offset-sorted list comes in handy.
-			uint64_t o = bsearch(p, [](uint64_t i) -> uint64_t { return index(i)->offset; });
-			Chunk* self = index(o);
-
-			if(self->offset != p)
-			{
-				fprintf(stderr, "failure: got offset %lx, expected %lx", p, self->offset);
-				fail();
-			}
 
-			// 'self' is now valid.
-			// get the offset.
-			auto s = size(self);
-			void* newc = Allocate(newsize);
-			memcpy(newc, ptr, newsize > s ? s : newsize);
+		if(s->sizeclass == 0)
+		{
+			SetPageMap(s->start, 1, 0);
+			FreePages(s->start, s->pages);
+			DeleteSpan(s);
 
-			Free(ptr);
-			return newc;
+			return;
 		}
-	}
 
-	void Print()
-	{
-		for(long i = ChunksInHeap - 1; i >= 0; i--)
+		uint64_t cls = s->sizeclass;
+
+		ThreadCache* tc = GetCache();
+		if(!tc)
 		{
-			Chunk* c = index(i);
-			printf("[%d]: (%#x, %#x) - %d\n", i, c->offset, size(c), isfree(c));
+			*((void**) ptr) = 0;
+			ReleaseToCentral(cls, ptr);
+			return;
 		}
-	}
-}
 
+		FreeList* fl = &tc->lists[cls];
+		*((void**) ptr) = fl->head;
+		fl->head = ptr;
+		fl->count++;
 
+		// too many sitting here; give the central list a batch back, so other threads (and munmap) can have them.
+		if(fl->count > 2 * ClassBatch[cls])
+		{
+			void* list = fl->head;
+			void* last = list;
 
+			for(uint64_t i = 1; i < ClassBatch[cls]; i++)
+				last = *((void**) last);
 
+			fl->head = *((void**) last);
+			fl->count -= ClassBatch[cls];
 
+			*((void**) last) = 0;
+			ReleaseToCentral(cls, list);
+		}
+	}
 
+	// everything in the thread's cache goes back to the central lists, and the slot is free for someone else.
+	void ReleaseCache()
+	{
+		ThreadCache* tc = GetSlot();
+		SetSlot(0);
 
+		if(!tc || tc == NoCache)
+			return;
 
+		for(uint64_t c = 1; c <= NumClasses; c++)
+		{
+			if(tc->lists[c].head)
+				ReleaseToCentral(c, tc->lists[c].head);
+
+			tc->lists[c].head = 0;
+			tc->lists[c].count = 0;
+		}
 
+		__sync_lock_release(&tc->owner);
+	}
 
+	void* Reallocate(void* ptr, size_t newsize)
+	{
+		if(!ptr)
+			return Allocate(newsize);
 
+		if(newsize == 0)
+		{
+			Free(ptr);
+			return NULL;
+		}
 
+		Span* s = Lookup(ptr);
+		if(!s)
+		{
+			fprintf(stderr, "failure: realloc() of %p, which malloc() never returned\n", ptr);
+			fail();
+		}
 
+		uint64_t oldsize = s->sizeclass ? ClassSizes[s->sizeclass] : s->pages * 0x1000;
 
+		// it still fits, and isn't wasting most of the space.
+		if(newsize <= oldsize && newsize >= oldsize / 2)
+			return ptr;
 
+		void* newc = Allocate(newsize);
+		if(!newc)
+			return NULL;
 
+		memcpy(newc, ptr, newsize > oldsize ? oldsize : newsize);
+		Free(ptr);
 
+		return newc;
+	}
 
+	void Print()
+	{
+		for(uint64_t c = 1; c <= NumClasses; c++)
+		{
+			if(Central[c].numspans == 0)
+				continue;
 
+			uint64_t inuse = 0;
+			for(Span* s = Central[c].spans; s; s = s->next)
+				inuse += s->inuse;
 
+			printf("[%d]: %d bytes, %d span%s, %d in use in partial spans\n", c, ClassSizes[c], Central[c].numspans,
+				Central[c].numspans == 1 ? "" : "s", inuse);
+		}
+	}
+}
@@ -9,10 +9,18 @@
 
 extern "C" int fclose(FILE* file)
 {
-	if(!file || file->__fd < 4)
+	if(!file)
 		return EOF;
 
+	int ret = fflush(file);
+	if(file->__fd < 4)
+		return EOF;
+
+	__unlinkfile(file);
+	if(file->ownsbuffer)
+		free(file->buffer);
+
 	close((int) file->__fd);
 	free(file);
-	return 0;
+	return ret;
 }
@@ -7,6 +7,28 @@
 
 extern "C" int fflush(FILE* str)
 {
+	if(str == NULL)
+	{
+		int ret = 0;
+		for(FILE* f = __openfiles; f; f = f->next)
+		{
+			if(f->lastop == __LASTOP_WRITE && fflush(f) == EOF)
+				ret = EOF;
+		}
+
+		return ret;
+	}
+
+	// flushing an input stream throws away the read-ahead.
+	if(str->lastop == __LASTOP_READ)
+	{
+		__dropreadbuf(str);
+		return 0;
+	}
+
+	if(__flushbuf(str) == EOF)
+		return EOF;
+
 	Library::SystemCall::Flush(str->__fd);
 	return 0;
 }
@@ -5,13 +5,18 @@
 #include "../../include/stdio.h"
 #include "../../include/unistd.h"
 #include "../../include/assert.h"
+#include "../../include/string.h"
 
 
 extern "C" int fgetc(FILE* str)
 {
-	int f = 0;
-	fread(&f, sizeof(char), 1, str);
-	return f;
+	if(str->lastop != __LASTOP_READ || str->bufferread == str->bufferfill)
+	{
+		if(__fillbuf(str) == 0)
+			return EOF;
+	}
+
+	return str->buffer[str->bufferread++];
 }
 
 extern "C" int getc(FILE* str)
@@ -23,3 +28,38 @@ extern "C" int getchar()
 {
 	return fgetc(stdin);
 }
+
+extern "C" int ungetc(int c, FILE* str)
+{
+	if(c == EOF)
+		return EOF;
+
+	if(str->lastop == __LASTOP_WRITE && __flushbuf(str) == EOF)
+		return EOF;
+
+	__setupbuf(str);
+	if(str->lastop != __LASTOP_READ)
+	{
+		str->bufferfill = 0;
+		str->bufferread = 0;
+		str->lastop = __LASTOP_READ;
+	}
+
+	if(str->bufferread > 0)
+	{
+		str->buffer[--str->bufferread] = (uint8_t) c;
+	}
+	else if(str->bufferfill < str->buffersize)
+	{
+		memmove(str->buffer + 1, str->buffer, str->bufferfill);
+		str->buffer[0] = (uint8_t) c;
+		str->bufferfill++;
+	}
+	else
+	{
+		return EOF;
+	}
+
+	str->indicatorflags &= ~__FILE_EOF;
+	return (uint8_t) c;
+}
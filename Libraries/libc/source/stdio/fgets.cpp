@@ -4,18 +4,41 @@
 
 #include "../../include/stdio.h"
 #include "../../include/unistd.h"
-
-#define FLAG_EOF	0x80
-#define FLAG_ERR	0x40
+#include "../../include/string.h"
 
 extern "C" char* fgets(char* str, int num, FILE* stream)
 {
-	size_t read = fread(str, 1, num, stream);
-	if(read < (size_t) num)
-		stream->indicatorflags |= FLAG_EOF;
+	if(num <= 0)
+		return NULL;
+
+	size_t limit = (size_t) num - 1;
+	size_t done = 0;
+
+	while(done < limit)
+	{
+		size_t avail = (stream->lastop == __LASTOP_READ) ? stream->bufferfill - stream->bufferread : 0;
+		if(avail == 0 && (avail = __fillbuf(stream)) == 0)
+			break;
+
+		// copy up to (and including) the first newline in one go.
+		uint8_t* start = stream->buffer + stream->bufferread;
+		size_t n = (limit - done < avail) ? limit - done : avail;
+
+		uint8_t* nl = (uint8_t*) memchr(start, '\n', n);
+		if(nl)
+			n = (size_t) (nl - start) + 1;
+
+		memcpy(str + done, start, n);
+		stream->bufferread += n;
+		done += n;
+
+		if(nl)
+			break;
+	}
 
-	if(read == 0)
+	if(done == 0)
 		return NULL;
 
+	str[done] = 0;
 	return str;
 }
@@ -3,21 +3,58 @@
 // Licensed under the Apache License Version 2.0.
 
 #include "../../include/stdio.h"
-
-#define FLAG_EOF	0x80
-#define FLAG_ERR	0x40
+#include "../../include/stdlib.h"
 
 extern "C" void clearerr(FILE* str)
 {
-	str->indicatorflags &= ~FLAG_ERR;
+	str->indicatorflags &= ~(__FILE_ERR | __FILE_EOF);
 }
 
 extern "C" int ferror(FILE* str)
 {
-	return str->indicatorflags & FLAG_ERR;
+	return str->indicatorflags & __FILE_ERR;
 }
 
 extern "C" int feof(FILE* str)
 {
-	return str->indicatorflags & FLAG_EOF;
+	return str->indicatorflags & __FILE_EOF;
+}
+
+extern "C" int setvbuf(FILE* str, char* buf, int mode, size_t size)
+{
+	if(mode != _IONBF && mode != _IOFBF && mode != _IOLBF)
+		return -1;
+
+	if(fflush(str) == EOF)
+		return -1;
+
+	if(str->ownsbuffer)
+		free(str->buffer);
+
+	str->buffer = NULL;
+	str->buffersize = 0;
+	str->ownsbuffer = 0;
+	str->bufferfill = 0;
+	str->bufferread = 0;
+	str->lastop = 0;
+
+	str->bufmode = (uint8_t) ((str->bufmode & ~__BUFMODE_MASK) | mode);
+
+	// a caller-provided buffer is used as-is; otherwise one of 'size' bytes is allocated on first use.
+	if(mode != _IONBF && buf && size > 0)
+	{
+		str->buffer = (uint8_t*) buf;
+		str->buffersize = size;
+	}
+	else if(mode != _IONBF)
+	{
+		str->buffersize = size;
+	}
+
+	return 0;
+}
+
+extern "C" void setbuf(FILE* str, char* buf)
+{
+	setvbuf(str, buf, buf ? _IOFBF : _IONBF, BUFSIZ);
 }
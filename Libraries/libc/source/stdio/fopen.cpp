@@ -19,7 +19,8 @@ extern "C" FILE* fopen(const char* fname, const char* mode)
 		return NULL;
 
 	FILE* ret = (FILE*) malloc(sizeof(FILE));
-	ret->__fd = fd;
+	__initfile(ret, fd, _IOFBF);
+	__linkfile(ret);
 
 	return ret;
 }
@@ -30,9 +31,14 @@ extern "C" FILE* freopen(const char* path, const char* mode, FILE* str)
 	// TODO
 	(void) mode;
 
-
+	fflush(str);
 	close((int) str->__fd);
 
+	str->bufferfill = 0;
+	str->bufferread = 0;
+	str->lastop = 0;
+	str->indicatorflags = 0;
+
 	// TODO: handle flags
 	int fd = open(path, O_RDWR);
 
@@ -51,7 +57,8 @@ extern "C" FILE* fdopen(int fd, const char* mode)
 	(void) mode;
 
 	FILE* ret = (FILE*) malloc(sizeof(FILE));
-	ret->__fd = fd;
+	__initfile(ret, fd, _IOFBF);
+	__linkfile(ret);
 
 	return ret;
 }
@@ -7,8 +7,24 @@
 
 extern "C" int fputc(int c, FILE* str)
 {
-	fwrite(&c, sizeof(char), 1, str);
-	return c;
+	uint8_t ch = (uint8_t) c;
+	uint8_t mode = str->bufmode & __BUFMODE_MASK;
+
+	// fast path: there's already a write in progress with room left.
+	if(str->lastop == __LASTOP_WRITE && mode != _IONBF && str->bufferfill < str->buffersize)
+	{
+		str->buffer[str->bufferfill++] = ch;
+
+		if((mode == _IOLBF && ch == '\n') || str->bufferfill == str->buffersize)
+		{
+			if(__flushbuf(str) == EOF)
+				return EOF;
+		}
+
+		return ch;
+	}
+
+	return fwrite(&ch, sizeof(char), 1, str) == 1 ? ch : EOF;
 }
 
 extern "C" int putc(int c, FILE* str)
@@ -2,22 +2,54 @@
 // Copyright (c) 2014 - 2016, zhiayang@gmail.com
 // Licensed under the Apache License Version 2.0.
 
+#include "../../include/stdio.h"
 #include "../../include/unistd.h"
-#include "../../include/assert.h"
-#include "../../include/stdlib.h"
 #include "../../include/string.h"
 
 extern "C" size_t fread(void* ptr, size_t esize, size_t length, FILE* stream)
 {
-	return read((int) stream->__fd, ptr, esize * length);
+	size_t total = esize * length;
+	if(total == 0)
+		return 0;
+
+	if(stream->lastop == __LASTOP_WRITE && __flushbuf(stream) == EOF)
+		return 0;
+
+	__setupbuf(stream);
+
+	uint8_t* out = (uint8_t*) ptr;
+	size_t done = 0;
+
+	while(done < total)
+	{
+		size_t avail = (stream->lastop == __LASTOP_READ) ? stream->bufferfill - stream->bufferread : 0;
+		if(avail > 0)
+		{
+			size_t n = (total - done < avail) ? total - done : avail;
+			memcpy(out + done, stream->buffer + stream->bufferread, n);
+
+			stream->bufferread += n;
+			done += n;
+			continue;
+		}
+
+		// big reads go straight into the caller's memory, no point bouncing them through the buffer.
+		if(total - done >= stream->buffersize)
+		{
+			ssize_t ret = read((int) stream->__fd, out + done, total - done);
+			if(ret <= 0)
+			{
+				stream->indicatorflags |= (ret == 0 ? __FILE_EOF : __FILE_ERR);
+				break;
+			}
+
+			done += (size_t) ret;
+		}
+		else if(__fillbuf(stream) == 0)
+		{
+			break;
+		}
+	}
+
+	return done / esize;
 }
-
-
-
-
-
-
-
-
-
-
@@ -7,18 +7,45 @@
 
 extern "C" int fseek(FILE* str, off_t offset, int origin)
 {
+	if(str->lastop == __LASTOP_WRITE && __flushbuf(str) == EOF)
+		return -1;
+
+	// relative seeks are relative to where the caller is, not to the end of our read-ahead.
+	if(str->lastop == __LASTOP_READ)
+	{
+		if(origin == SEEK_CUR)
+			offset -= (off_t) (str->bufferfill - str->bufferread);
+
+		str->bufferfill = 0;
+		str->bufferread = 0;
+		str->lastop = 0;
+	}
+
 	off_t ret = lseek((int) str->__fd, offset, origin);
-	return ret == (off_t) -1 ? -1 : 0;
+	if(ret == (off_t) -1)
+		return -1;
+
+	str->indicatorflags &= ~__FILE_EOF;
+	return 0;
 }
 
 extern "C" off_t ftell(FILE* str)
 {
-	return tell((int) str->__fd);
+	off_t pos = tell((int) str->__fd);
+
+	if(str->lastop == __LASTOP_READ)
+		pos -= (off_t) (str->bufferfill - str->bufferread);
+
+	else if(str->lastop == __LASTOP_WRITE)
+		pos += (off_t) str->bufferfill;
+
+	return pos;
 }
 
 extern "C" void rewind(FILE* str)
 {
 	fseek(str, 0, SEEK_SET);
+	clearerr(str);
 }
 
 extern "C" int fgetpos(FILE* str, fpos_t* pos)
@@ -2,10 +2,54 @@
 // Copyright (c) 2014 - 2016, zhiayang@gmail.com
 // Licensed under the Apache License Version 2.0.
 
+#include "../../include/stdio.h"
 #include "../../include/unistd.h"
+#include "../../include/string.h"
 
 extern "C" size_t fwrite(const void* ptr, size_t size, size_t count, FILE* stream)
 {
-	// stdout buffering will be handled by the kernel.
-	return write((int) stream->__fd, ptr, count * size);
+	size_t total = size * count;
+	if(total == 0)
+		return 0;
+
+	__dropreadbuf(stream);
+	__setupbuf(stream);
+
+	const uint8_t* in = (const uint8_t*) ptr;
+	uint8_t mode = stream->bufmode & __BUFMODE_MASK;
+
+	if(mode == _IONBF)
+	{
+		if(__flushbuf(stream) == EOF)
+			return 0;
+
+		return __writeall(stream, in, total) / size;
+	}
+
+	size_t done = 0;
+	while(done < total)
+	{
+		// nothing pending and more than a buffer's worth left: skip the copy.
+		if(stream->bufferfill == 0 && total - done >= stream->buffersize)
+		{
+			done += __writeall(stream, in + done, total - done);
+			break;
+		}
+
+		size_t space = stream->buffersize - stream->bufferfill;
+		size_t n = (total - done < space) ? total - done : space;
+
+		memcpy(stream->buffer + stream->bufferfill, in + done, n);
+		stream->bufferfill += n;
+		stream->lastop = __LASTOP_WRITE;
+		done += n;
+
+		if(stream->bufferfill == stream->buffersize && __flushbuf(stream) == EOF)
+			return done / size;
+	}
+
+	if(mode == _IOLBF && memrchr(in, '\n', total))
+		__flushbuf(stream);
+
+	return done / size;
 }
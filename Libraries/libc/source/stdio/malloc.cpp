@@ -28,8 +28,12 @@ extern "C" void free(void* ptr)
 
 extern "C" void* calloc(size_t num, size_t size)
 {
+	if(size != 0 && num > SIZE_MAX / size)
+		return NULL;
+
 	void* ret = Heap::Allocate(num * size);
-	memset(ret, 0, num * size);
+	if(ret)
+		memset(ret, 0, num * size);
 
 	return ret;
 }
@@ -48,28 +48,11 @@ extern "C" int rename(const char* oldname, const char* newname)
 	return -1;
 }
 
-extern "C" void setbuf(FILE*, char*)
-{
-}
-
-extern "C" int setvbuf(FILE*, char*, int, size_t)
-{
-	return -1;
-}
-
 extern "C" FILE* tmpfile()
 {
 	return NULL;
 }
 
-extern "C" int ungetc(int c, FILE* str)
-{
-	(void) c;
-	(void) str;
-
-	return EOF;
-}
-
 
 
 
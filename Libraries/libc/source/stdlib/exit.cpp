@@ -43,7 +43,7 @@ extern "C" void exit(int ret)
 	}
 
 	// flush the shits
-	fflush(stdout);
+	fflush(NULL);
 
 	(void) ret;
 	_fini();
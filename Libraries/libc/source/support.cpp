@@ -12,8 +12,6 @@ static FILE _stdout;
 static FILE _stderr;
 static FILE _stdlog;
 
-#define BUFFER_SIZE		4096
-
 namespace Heap
 {
 	void Initialise();
@@ -22,10 +20,15 @@ namespace Heap
 extern "C" void init_libc()
 {
 	// init file descriptors
-	_stdin.__fd		= 0;
-	_stdout.__fd	= 1;
-	_stderr.__fd	= 2;
-	_stdlog.__fd	= 3;
+	__initfile(&_stdin, 0, _IOLBF | __BUFMODE_BLOCK);
+	__initfile(&_stdout, 1, _IOLBF);
+	__initfile(&_stderr, 2, _IONBF);
+	__initfile(&_stdlog, 3, _IOLBF);
+
+	__linkfile(&_stdlog);
+	__linkfile(&_stderr);
+	__linkfile(&_stdout);
+	__linkfile(&_stdin);
 
 	stdin	= &_stdin;
 	stdout	= &_stdout;
@@ -37,10 +40,7 @@ extern "C" void init_libc()
 
 	errno = 0;
 
-	// set the proper properties.
-	stdin->buffer = (uint8_t*) malloc(BUFSIZ);
-	stdin->buffersize = BUFSIZ;
-	stdin->bufmode = _IOLBF | __BUFMODE_BLOCK;
+	// buffers themselves are allocated on first use.
 }
 
 
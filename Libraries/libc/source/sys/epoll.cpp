@@ -0,0 +1,34 @@
+// epoll.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include "../../include/sys/epoll.h"
+#include "../../include/errno.h"
+#include <sys/syscall.h>
+
+extern "C" int epoll_create(int size)
+{
+	// the size is only a hint, and has been ignored everywhere for years.
+	if(size <= 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	return (int) Library::SystemCall::CreateEventPoll(0);
+}
+
+extern "C" int epoll_create1(int flags)
+{
+	return (int) Library::SystemCall::CreateEventPoll(flags);
+}
+
+extern "C" int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event)
+{
+	return (int) Library::SystemCall::ControlEventPoll(epfd, op, fd, event);
+}
+
+extern "C" int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout)
+{
+	return (int) Library::SystemCall::WaitEventPoll(epfd, events, maxevents, timeout);
+}
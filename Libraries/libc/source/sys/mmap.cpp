@@ -30,9 +30,8 @@ extern "C" void* mmap(void* addr, size_t length, int prot, int flags, int fd, of
 
 extern "C" int munmap(void* addr, size_t length)
 {
-	(void) addr;
-	(void) length;
-	return 0;
+	// only anonymous mappings exist, so that's all there is to undo.
+	return (int) Library::SystemCall::MUnmap_Anonymous((uint64_t) addr, length);
 }
 
 
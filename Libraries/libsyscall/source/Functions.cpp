@@ -14,6 +14,7 @@ namespace SystemCall
 		.quad	ExitProc			// 0000
 		.quad	InstallIRQ			// 0001
 		.quad	InstallIRQNoRegs	// 0002
+		.quad	HeapProfile			// 0003
 
 		// process related things, page 4000+
 		.quad	CreateThread		// 4000
@@ -37,6 +38,16 @@ namespace SystemCall
 		.quad	UnlockMutex			// 4018
 		.quad	TryLockMutex		// 4019
 		.quad	ForkProcess			// 4020
+		.quad	CreateChannel		// 4021
+		.quad	OpenChannel			// 4022
+		.quad	CloseChannel		// 4023
+		.quad	ChannelWait			// 4024
+		.quad	ChannelWake			// 4025
+		.quad	OpenMessageQueue	// 4026
+		.quad	UnlinkMessageQueue	// 4027
+		.quad	MessageQueueAttr	// 4028
+		.quad	ChannelSize			// 4029
+		.quad	ThreadAlive			// 4030
 
 
 		// file io things, page 8000+
@@ -56,6 +67,10 @@ namespace SystemCall
 		.quad	ConnectNetSocket	// 8013
 		.quad	BindIPCSocket		// 8014
 		.quad	ConnectIPCSocket	// 8015
+		.quad	CreateEventPoll		// 8016
+		.quad	ControlEventPoll	// 8017
+		.quad	WaitEventPoll		// 8018
+		.quad	MemoryUnmapAnonymous	// 8019
 	*/
 
 
@@ -74,6 +89,11 @@ namespace SystemCall
 		Syscall2Param(irq, handleraddr, 2);
 	}
 
+	int64_t HeapProfile(uint64_t op, uint64_t a, uint64_t b)
+	{
+		return (int64_t) Syscall3Param(op, a, b, 3);
+	}
+
 
 
 	pthread_t CreateThread(pthread_attr_t* attr, void (*thr)())
@@ -96,14 +116,14 @@ namespace SystemCall
 		Syscall2Param(tid, signum, 4003);
 	}
 
-	int SendMessage(const char* path, void* msg, size_t size, uint64_t flags)
+	int64_t SendMessage(int fd, const void* msg, size_t size, uint64_t prio, const struct timespec* abstime)
 	{
-		return (int) Syscall4Param((uintptr_t) path, (uint64_t) msg, size, flags, 4004);
+		return Syscall5Param(fd, (uintptr_t) msg, size, prio, (uintptr_t) abstime, 4004);
 	}
 
-	ssize_t ReceiveMessage(const char* path, void* msg, size_t size, uint64_t type, uint64_t flags)
+	int64_t ReceiveMessage(int fd, void* msg, size_t size, uint32_t* prio, const struct timespec* abstime)
 	{
-		return (int) Syscall5Param((uintptr_t) path, (uint64_t) msg, size, type, flags, 4005);
+		return Syscall5Param(fd, (uintptr_t) msg, size, (uintptr_t) prio, (uintptr_t) abstime, 4005);
 	}
 
 	void Sleep(uint64_t ms)
@@ -182,6 +202,56 @@ namespace SystemCall
 		return Syscall0Param(4020);
 	}
 
+	Library::ChannelHeader* CreateChannel(const char* name, uint64_t size)
+	{
+		return (Library::ChannelHeader*) Syscall2Param((uintptr_t) name, size, 4021);
+	}
+
+	Library::ChannelHeader* OpenChannel(const char* name)
+	{
+		return (Library::ChannelHeader*) Syscall1Param((uintptr_t) name, 4022);
+	}
+
+	int64_t CloseChannel(Library::ChannelHeader* ch)
+	{
+		return Syscall1Param((uintptr_t) ch, 4023);
+	}
+
+	int64_t ChannelWait(Library::ChannelHeader* ch, uint64_t which, uint64_t expected)
+	{
+		return Syscall3Param((uintptr_t) ch, which, expected, 4024);
+	}
+
+	int64_t ChannelWake(Library::ChannelHeader* ch, uint64_t which)
+	{
+		return Syscall2Param((uintptr_t) ch, which, 4025);
+	}
+
+	int64_t OpenMessageQueue(const char* name, int flags, const struct mq_attr* attr)
+	{
+		return Syscall3Param((uintptr_t) name, flags, (uintptr_t) attr, 4026);
+	}
+
+	int64_t UnlinkMessageQueue(const char* name)
+	{
+		return Syscall1Param((uintptr_t) name, 4027);
+	}
+
+	int64_t MessageQueueAttr(int fd, const struct mq_attr* newattr, struct mq_attr* oldattr)
+	{
+		return Syscall3Param(fd, (uintptr_t) newattr, (uintptr_t) oldattr, 4028);
+	}
+
+	uint64_t ChannelSize(Library::ChannelHeader* ch)
+	{
+		return Syscall1Param((uintptr_t) ch, 4029);
+	}
+
+	bool ThreadAlive(pthread_t tid)
+	{
+		return Syscall1Param(tid, 4030);
+	}
+
 
 
 
@@ -273,6 +343,26 @@ namespace SystemCall
 		return Syscall2Param(fd, (uint64_t) path, 8015);
 	}
 
+	int64_t CreateEventPoll(int flags)
+	{
+		return Syscall1Param(flags, 8016);
+	}
+
+	int64_t ControlEventPoll(int epfd, int op, int fd, struct epoll_event* event)
+	{
+		return Syscall4Param(epfd, op, fd, (uintptr_t) event, 8017);
+	}
+
+	int64_t WaitEventPoll(int epfd, struct epoll_event* events, int maxevents, int timeout)
+	{
+		return Syscall4Param(epfd, (uintptr_t) events, maxevents, timeout, 8018);
+	}
+
+	int64_t MUnmap_Anonymous(uint64_t addr, uint64_t size)
+	{
+		return Syscall2Param(addr, size, 8019);
+	}
+
 }
 }
 
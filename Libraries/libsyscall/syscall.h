@@ -10,8 +10,21 @@
 #include <signal.h>
 #include <pthread.h>
 #include <sys/stat.h>
+#include <orionx/Channel.hpp>
+#include <mqueue.h>
+#include <sys/epoll.h>
 #pragma once
 
+// operations for HeapProfile(); keep in sync with the kernel's KernelHeap.hpp.
+// only processes the kernel started itself may use it; everyone else gets EPERM.
+#define HEAPPROF_DISABLE	0
+#define HEAPPROF_ENABLE		1
+#define HEAPPROF_RESET		2
+#define HEAPPROF_SNAPSHOT	3	// returns the snapshot id
+#define HEAPPROF_PRINT		4	// a: number of call sites to show
+#define HEAPPROF_DIFF		5	// a, b: snapshot ids
+#define HEAPPROF_LEAKS		6	// a: minimum live chunks
+
 #ifdef __cplusplus
 namespace Library
 {
@@ -26,14 +39,15 @@ namespace Library
 
 
 		void ExitProc();
+		int64_t HeapProfile(uint64_t op, uint64_t a, uint64_t b);
 		void InstallIRQHandler(uint64_t irq, uint64_t handleraddr);
 		void InstallIRQHandlerWithRegs(uint64_t irq, uint64_t handleraddr);
 		pthread_t CreateThread(pthread_attr_t* attribs, void (*thr)());
 		pid_t SpawnProcess(const char* path, const char* name);
 		void SignalProcess(pid_t pid, int signum);
 		void SignalThread(pid_t tid, int signum);
-		int SendMessage(const char* path, void* msg, size_t size, uint64_t flags);
-		ssize_t ReceiveMessage(const char* path, void* msg, size_t size, uint64_t type, uint64_t flags);
+		int64_t SendMessage(int fd, const void* msg, size_t size, uint64_t prio, const struct timespec* abstime);
+		int64_t ReceiveMessage(int fd, void* msg, size_t size, uint32_t* prio, const struct timespec* abstime);
 		void Sleep(uint64_t ms);
 		void Yield();
 		void Block();
@@ -51,12 +65,25 @@ namespace Library
 		int64_t TryLockMutex(pthread_mutex_t* mtx);
 		int64_t ForkProcess();
 
+		Library::ChannelHeader* CreateChannel(const char* name, uint64_t size);
+		Library::ChannelHeader* OpenChannel(const char* name);
+		int64_t CloseChannel(Library::ChannelHeader* ch);
+		int64_t ChannelWait(Library::ChannelHeader* ch, uint64_t which, uint64_t expected);
+		int64_t ChannelWake(Library::ChannelHeader* ch, uint64_t which);
+
+		int64_t OpenMessageQueue(const char* name, int flags, const struct mq_attr* attr);
+		int64_t UnlinkMessageQueue(const char* name);
+		int64_t MessageQueueAttr(int fd, const struct mq_attr* newattr, struct mq_attr* oldattr);
+		uint64_t ChannelSize(Library::ChannelHeader* ch);
+		bool ThreadAlive(pthread_t tid);
+
 
 		uint64_t Open(const char* path, uint64_t flags);
 		void Close(uint64_t fd);
 		uint64_t Read(uint64_t sd, void* buffer, uint64_t length);
 		uint64_t Write(uint64_t sd, const void* buffer, uint64_t length);
 		uint64_t MMap_Anonymous(uint64_t addr, uint64_t size, uint64_t prot, uint64_t flags);
+		int64_t MUnmap_Anonymous(uint64_t addr, uint64_t size);
 		int Flush(uint64_t fd);
 		int Seek(uint64_t fd, off_t offset, int whence);
 		int Stat(uint64_t fd, struct stat* st, bool statlink);
@@ -67,6 +94,10 @@ namespace Library
 
 		uint64_t BindIPCSocket(uint64_t fd, const char* path);
 		uint64_t ConnectIPCSocket(uint64_t fd, const char* path);
+
+		int64_t CreateEventPoll(int flags);
+		int64_t ControlEventPoll(int epfd, int op, int fd, struct epoll_event* event);
+		int64_t WaitEventPoll(int epfd, struct epoll_event* events, int maxevents, int timeout);
 	}
 }
 #else
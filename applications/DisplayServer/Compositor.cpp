@@ -0,0 +1,235 @@
+// Compositor.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <string.h>
+#include "DisplayServer.hpp"
+
+// everything is drawn into a back buffer in normal memory, and only the damaged rects are copied out to the
+// framebuffer -- reading video memory back for blending is painfully slow.
+
+// each damaged rect is painted back to front, but a surface only gets the parts of it that no opaque surface above
+// covers. if one opaque surface covers the whole rect, nothing below it is even looked at.
+
+namespace DisplayServer
+{
+	#define BackgroundColour	0xFF202830
+
+	static int64_t min(int64_t a, int64_t b) { return a < b ? a : b; }
+	static int64_t max(int64_t a, int64_t b) { return a > b ? a : b; }
+
+	Rect Intersect(const Rect& a, const Rect& b)
+	{
+		return Rect { max(a.x1, b.x1), max(a.y1, b.y1), min(a.x2, b.x2), min(a.y2, b.y2) };
+	}
+
+	bool Contains(const Rect& outer, const Rect& inner)
+	{
+		return inner.x1 >= outer.x1 && inner.y1 >= outer.y1 && inner.x2 <= outer.x2 && inner.y2 <= outer.y2;
+	}
+
+	void Region::Add(const Rect& r)
+	{
+		if(r.Empty())
+			return;
+
+		for(size_t i = 0; i < this->count; i++)
+		{
+			if(Contains(this->rects[i], r))
+				return;
+		}
+
+		// drop anything the new one swallows.
+		for(size_t i = 0; i < this->count; )
+		{
+			if(Contains(r, this->rects[i]))	this->rects[i] = this->rects[--this->count];
+			else							i++;
+		}
+
+		if(this->count == MaxRegionRects)
+		{
+			Rect all = r;
+			for(size_t i = 0; i < this->count; i++)
+			{
+				all.x1 = min(all.x1, this->rects[i].x1);
+				all.y1 = min(all.y1, this->rects[i].y1);
+				all.x2 = max(all.x2, this->rects[i].x2);
+				all.y2 = max(all.y2, this->rects[i].y2);
+			}
+
+			this->rects[0] = all;
+			this->count = 1;
+			return;
+		}
+
+		this->rects[this->count++] = r;
+	}
+
+	void Region::Subtract(const Rect& r)
+	{
+		for(size_t i = 0; i < this->count; )
+		{
+			Rect a = this->rects[i];
+			if(Intersect(a, r).Empty())
+			{
+				i++;
+				continue;
+			}
+
+			// whatever's left of 'a': full-width bands above and below 'r', then the bits either side of it.
+			Rect pieces[4];
+			size_t n = 0;
+
+			int64_t top = max(a.y1, r.y1);
+			int64_t bottom = min(a.y2, r.y2);
+
+			if(r.y1 > a.y1)	pieces[n++] = Rect { a.x1, a.y1, a.x2, r.y1 };
+			if(r.y2 < a.y2)	pieces[n++] = Rect { a.x1, r.y2, a.x2, a.y2 };
+			if(r.x1 > a.x1)	pieces[n++] = Rect { a.x1, top, r.x1, bottom };
+			if(r.x2 < a.x2)	pieces[n++] = Rect { r.x2, top, a.x2, bottom };
+
+			if(n == 0)
+			{
+				// look at whatever gets swapped in.
+				this->rects[i] = this->rects[--this->count];
+				continue;
+			}
+
+			if(this->count - 1 + n > MaxRegionRects)
+			{
+				i++;
+				continue;
+			}
+
+			// none of the pieces touch 'r', so it doesn't matter that we'll walk over the new ones.
+			this->rects[i++] = pieces[0];
+			for(size_t k = 1; k < n; k++)
+				this->rects[this->count++] = pieces[k];
+		}
+	}
+
+	void AddDamage(Screen* scr, const Rect& r)
+	{
+		scr->damage.Add(Intersect(r, Rect { 0, 0, (int64_t) scr->width, (int64_t) scr->height }));
+	}
+
+
+
+	// premultiplied: dst = src + dst * (255 - alpha) / 255, two channels at a time.
+	static uint32_t Blend(uint32_t src, uint32_t dst)
+	{
+		uint32_t a = src >> 24;
+		if(a == 0xFF)	return src;
+		if(a == 0)		return dst;
+
+		uint32_t inv = 255 - a;
+		uint32_t rb = (dst & 0x00FF00FF) * inv;
+		uint32_t ag = ((dst >> 8) & 0x00FF00FF) * inv;
+
+		rb = ((rb + 0x00800080 + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+		ag = (ag + 0x00800080 + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+
+		return src + rb + ag;
+	}
+
+	static void Fill(Screen* scr, const Rect& r, uint32_t colour)
+	{
+		for(int64_t y = r.y1; y < r.y2; y++)
+		{
+			uint32_t* row = scr->backbuffer + (y * scr->width);
+			for(int64_t x = r.x1; x < r.x2; x++)
+				row[x] = colour;
+		}
+	}
+
+	static void Draw(Screen* scr, Surface* s, const Rect& r)
+	{
+		int64_t stride = s->bounds.x2 - s->bounds.x1;
+		size_t bytes = (size_t) (r.x2 - r.x1) * 4;
+
+		for(int64_t y = r.y1; y < r.y2; y++)
+		{
+			uint32_t* dst = scr->backbuffer + (y * scr->width) + r.x1;
+			uint32_t* src = s->pixels + ((y - s->bounds.y1) * stride) + (r.x1 - s->bounds.x1);
+
+			if(s->flags & DISPLAY_SURFACE_OPAQUE)
+			{
+				memcpy(dst, src, bytes);
+			}
+			else
+			{
+				for(int64_t x = 0; x < r.x2 - r.x1; x++)
+					dst[x] = Blend(src[x], dst[x]);
+			}
+		}
+	}
+
+	static void Flush(Screen* scr, const Rect& r)
+	{
+		size_t bytes = (size_t) (r.x2 - r.x1) * 4;
+		for(int64_t y = r.y1; y < r.y2; y++)
+		{
+			uint64_t offset = (y * scr->width) + r.x1;
+			memcpy(scr->framebuffer + offset, scr->backbuffer + offset, bytes);
+		}
+	}
+
+	static void CompositeRect(Screen* scr, const Rect& d)
+	{
+		// start from the topmost opaque surface that covers the whole thing, if there is one.
+		size_t bottom = 0;
+		bool covered = false;
+		for(size_t i = scr->numsurfaces; i > 0; i--)
+		{
+			Surface* s = scr->stack[i - 1];
+			if((s->flags & DISPLAY_SURFACE_OPAQUE) && Contains(s->bounds, d))
+			{
+				bottom = i - 1;
+				covered = true;
+				break;
+			}
+		}
+
+		Region vis;
+		if(!covered)
+		{
+			vis.Add(d);
+			for(size_t j = 0; j < scr->numsurfaces && vis.count > 0; j++)
+			{
+				if(scr->stack[j]->flags & DISPLAY_SURFACE_OPAQUE)
+					vis.Subtract(scr->stack[j]->bounds);
+			}
+
+			for(size_t k = 0; k < vis.count; k++)
+				Fill(scr, vis.rects[k], BackgroundColour);
+		}
+
+		for(size_t i = bottom; i < scr->numsurfaces; i++)
+		{
+			Surface* s = scr->stack[i];
+
+			vis.Clear();
+			vis.Add(Intersect(d, s->bounds));
+
+			for(size_t j = i + 1; j < scr->numsurfaces && vis.count > 0; j++)
+			{
+				if(scr->stack[j]->flags & DISPLAY_SURFACE_OPAQUE)
+					vis.Subtract(scr->stack[j]->bounds);
+			}
+
+			for(size_t k = 0; k < vis.count; k++)
+				Draw(scr, s, vis.rects[k]);
+		}
+	}
+
+	void Composite(Screen* scr)
+	{
+		for(size_t i = 0; i < scr->damage.count; i++)
+			CompositeRect(scr, scr->damage.rects[i]);
+
+		for(size_t i = 0; i < scr->damage.count; i++)
+			Flush(scr, scr->damage.rects[i]);
+
+		scr->damage.Clear();
+	}
+}
@@ -0,0 +1,79 @@
+// DisplayServer.hpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <orionx/Display.hpp>
+#pragma once
+
+namespace DisplayServer
+{
+	#define MaxClients			32
+	#define MaxSurfaces			64
+	#define MaxRegionRects		64
+
+	// half-open: x1 <= x < x2.
+	struct Rect
+	{
+		int64_t x1;
+		int64_t y1;
+		int64_t x2;
+		int64_t y2;
+
+		bool Empty() const { return this->x1 >= this->x2 || this->y1 >= this->y2; }
+	};
+
+	Rect Intersect(const Rect& a, const Rect& b);
+	bool Contains(const Rect& outer, const Rect& inner);
+
+	// a handful of disjoint-ish rects. running out of room never loses anything -- damage collapses into one big
+	// rect, and subtraction just stops cutting, which only costs some overdraw.
+	struct Region
+	{
+		Rect rects[MaxRegionRects];
+		size_t count = 0;
+
+		void Clear() { this->count = 0; }
+		void Add(const Rect& r);
+		void Subtract(const Rect& r);
+	};
+
+	struct Client
+	{
+		uint64_t pid;
+		Library::ChannelHeader* requests;
+
+		// ours, not the header's; the client can write those.
+		uint64_t ringsize;
+		uint64_t tail;
+	};
+
+	struct Surface
+	{
+		Client* owner;
+		uint32_t id;
+		uint32_t flags;
+
+		Rect bounds;
+		uint32_t* pixels;
+		Library::ChannelHeader* channel;
+	};
+
+	struct Screen
+	{
+		uint32_t* framebuffer;
+		uint32_t* backbuffer;
+		uint64_t width;
+		uint64_t height;
+
+		// bottom to top.
+		Surface* stack[MaxSurfaces];
+		size_t numsurfaces;
+
+		Region damage;
+	};
+
+	void AddDamage(Screen* scr, const Rect& r);
+	void Composite(Screen* scr);
+}
@@ -5,214 +5,303 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
-#include <stdlib.h>
 #include <errno.h>
-#include <signal.h>
+#include <fcntl.h>
 #include <mqueue.h>
-#include <sys/stat.h>
 #include <sys/syscall.h>
-#include <sys/un.h>
-#include <sys/socket.h>
-#include <pthread.h>
 
-static uint64_t framebuffer = 0;
-static uint64_t width = 0;
-static uint64_t height = 0;
-static uint64_t bpp = 0;
+#include "DisplayServer.hpp"
 
+// clients say hello on the message queue, and from then on we read their request channels without blocking.
+// once a tick, whatever's been damaged since the last one gets composited and copied out; if nothing was, the
+// tick costs us a few loads and nothing else.
 
+// everything in a channel header is the client's to scribble on, so sizes come from the kernel, and the read
+// index we go by is our own. a client that's closed its channel (or died) is dropped on the next tick.
 
+using namespace DisplayServer;
+using namespace Library::Display;
 
+#define TickMilliseconds	16
 
-void do_child()
-{
-	printf("in child, sleep(1000ms)\n");
-	usleep(1000000);
-	printf("awake, reading\n");
-
-
-	int s = socket(AF_UNIX, SOCK_DGRAM, 0);
-	struct sockaddr_un addr;
-
-	addr.sun_family = AF_UNIX;
+static Screen screen;
+static Client* clients[MaxClients];
 
-	strcpy(addr.sun_path, "/some/socket");
-	connect(s, (struct sockaddr*) &addr, sizeof(addr));
 
-	char* out = new char[128];
-	ssize_t res = read(s, out, 128);
+static Surface* FindSurface(Client* c, uint32_t id, size_t* index = 0)
+{
+	for(size_t i = 0; i < screen.numsurfaces; i++)
+	{
+		if(screen.stack[i]->owner == c && screen.stack[i]->id == id)
+		{
+			if(index) *index = i;
+			return screen.stack[i];
+		}
+	}
 
-	printf("read (%ld): %s\n", res, out);
+	return 0;
 }
 
-int main(int argc, char** argv)
+static void CreateSurface(Client* c, const Request& req)
 {
-	assert(argc == 5);
-	/*
-		1. framebuffer address
-		2. framebuffer width
-		3. framebuffer height
-		4. framebuffer bpp
-	*/
-
-	framebuffer	= (uint64_t) argv[1];
-	width		= (uint64_t) argv[2];
-	height		= (uint64_t) argv[3];
-	bpp			= (uint64_t) argv[4] / 8;		// kernel gives us BITS per pixel, but we really only care about BYTES per pixel.
-
-	printf("\n\nDisplay server online\n");
-	printf("Forking process...\n\n");
-
+	if(FindSurface(c, req.surface) || screen.numsurfaces == MaxSurfaces)
+		return;
 
+	if(req.width == 0 || req.height == 0 || SurfaceSize(req.width, req.height) > CHANNEL_MAX_SIZE)
+		return;
 
-	// while(true)
-	// {
-	// 	usleep(10 * 1000);
-	// 	printf(".");
-	// 	fflush(stdout);
-	// }
+	Library::ChannelHeader* ch = Library::SystemCall::OpenChannel(req.name);
+	if(!ch)
+		return;
 
-
-
-
-	// int res = fork();
-	int res = 0;
-	if(res == 0)
+	// the client picks the size, so make sure it's actually big enough before we go reading past it.
+	if(Library::SystemCall::ChannelSize(ch) < SurfaceSize(req.width, req.height))
 	{
-		printf("in child, forking again.\n");
-		fflush(stdout);
-
-		// usleep(50 * 1000);
-
-		printf("reading file.\n");
+		Library::SystemCall::CloseChannel(ch);
+		return;
+	}
 
-		FILE* orwell = fopen("/texts/1984.txt", "r");
-		struct stat s;
+	Surface* s = new Surface();
+	s->owner	= c;
+	s->id		= req.surface;
+	s->flags	= req.flags;
+	s->channel	= ch;
+	s->pixels	= (uint32_t*) Library::Channel::Data(ch);
+	s->bounds	= Rect { req.x, req.y, (int64_t) req.x + req.width, (int64_t) req.y + req.height };
 
-		fstat(orwell->__fd, &s);
-		printf("read %zu bytes.\n", s.st_size);
+	screen.stack[screen.numsurfaces++] = s;
+	AddDamage(&screen, s->bounds);
+}
 
-		uint8_t* buf = new uint8_t[s.st_size];
+static void DestroySurface(Surface* s, size_t index)
+{
+	AddDamage(&screen, s->bounds);
 
-		size_t read = fread(buf, 1, s.st_size, orwell);
-		if(read != s.st_size)
-			printf("failed to read -- got %zu bytes, expected %zu\n", read, s.st_size);
+	memmove(&screen.stack[index], &screen.stack[index + 1], (screen.numsurfaces - index - 1) * sizeof(Surface*));
+	screen.numsurfaces--;
 
-		printf("read %zu bytes.\n", read);
-		printf("%s\n", buf);
+	Library::SystemCall::CloseChannel(s->channel);
+	delete s;
+}
 
-		fclose(orwell);
+static void Disconnect(size_t slot)
+{
+	Client* c = clients[slot];
+	for(size_t i = screen.numsurfaces; i > 0; i--)
+	{
+		if(screen.stack[i - 1]->owner == c)
+			DestroySurface(screen.stack[i - 1], i - 1);
+	}
 
+	Library::SystemCall::CloseChannel(c->requests);
+	delete c;
 
-		// int r2 = fork();
-		// if(r2 == 0)
-		// {
-		// 	printf("in child of child\n");
-		// 	fflush(stdout);
-		// }
-		// else
-		// {
-		// 	printf("in parent of child's child: (pid = %d)\n", r2);
-		// 	fflush(stdout);
-		// }
+	clients[slot] = 0;
+}
 
-		// while(1);
+// returns false once the client has gone.
+static bool HandleRequest(size_t slot, const Request& req)
+{
+	Client* c = clients[slot];
+	if(req.type == RequestType::CreateSurface)
+	{
+		CreateSurface(c, req);
+		return true;
 	}
-	else
+	else if(req.type == RequestType::Disconnect)
 	{
-		// char d[10] = { 0 };
-		printf("parent: child proc (pid = %d)\n", res);
-		fflush(stdout);
-		// while(1);
+		Disconnect(slot);
+		return false;
 	}
 
+	size_t index = 0;
+	Surface* s = FindSurface(c, req.surface, &index);
+	if(!s)
+		return true;
 
+	switch(req.type)
+	{
+		case RequestType::DestroySurface:
+			DestroySurface(s, index);
+			break;
+
+		case RequestType::Damage:
+		{
+			Rect r { s->bounds.x1 + req.x, s->bounds.y1 + req.y, 0, 0 };
+			r.x2 = r.x1 + req.width;
+			r.y2 = r.y1 + req.height;
+
+			AddDamage(&screen, Intersect(r, s->bounds));
+			break;
+		}
+
+		case RequestType::Move:
+		{
+			AddDamage(&screen, s->bounds);
+
+			int64_t w = s->bounds.x2 - s->bounds.x1;
+			int64_t h = s->bounds.y2 - s->bounds.y1;
+			s->bounds = Rect { req.x, req.y, req.x + w, req.y + h };
+
+			AddDamage(&screen, s->bounds);
+			break;
+		}
+
+		case RequestType::Raise:
+		{
+			memmove(&screen.stack[index], &screen.stack[index + 1], (screen.numsurfaces - index - 1) * sizeof(Surface*));
+			screen.stack[screen.numsurfaces - 1] = s;
+
+			AddDamage(&screen, s->bounds);
+			break;
+		}
+
+		default:
+			break;
+	}
 
+	return true;
+}
 
+static void HandleRequests(size_t slot)
+{
+	Client* c = clients[slot];
+	Library::ChannelHeader* ch = c->requests;
 
+	if(ch->closed)
+	{
+		Disconnect(slot);
+		return;
+	}
 
-	// printf("opening shit\n");
-	// {
-	// 	int s = socket(AF_UNIX, SOCK_DGRAM, 0);
-	// 	struct sockaddr_un addr;
-
-	// 	addr.sun_family = AF_UNIX;
-
-	// 	strcpy(addr.sun_path, "/some/socket");
-	// 	bind(s, (struct sockaddr*) &addr, sizeof(addr));
-
-
-	// 	const char* msg = "HELLO, WORLD!\n";
-	// 	write(s, msg, strlen(msg) + 1);
-
-	// 	usleep(1500000);
-
-	// 	printf("closing\n");
-	// 	close(s);
-	// }
-
-
-
-
-
-	// {
-	// 	FILE* f = fopen("/texts/1984.txt", "r");
-	// 	struct stat s;
-
-	// 	fstat((int) f->__fd, &s);
-	// 	printf("file is %ld bytes long\n", s.st_size);
-
-	// 	uint8_t* x = (uint8_t*) malloc(s.st_size + 1);
-	// 	memset(x, 0, s.st_size + 1);
-
-	// 	fread(x, 1, s.st_size, f);
-	// 	fclose(f);
-
-	// 	printf("%p, %p\n", x, x + s.st_size);
-
-	// 	x[s.st_size] = 0;
-	// 	printf("%s\n", x);
+	// a head that's run off past a whole ring is nonsense, so don't go looking past the one ring we have.
+	uint64_t len = ch->head - c->tail;
+	if(len > c->ringsize)
+		len = c->ringsize;
 
-	// 	fflush(stdout);
-	// }
+	__sync_synchronize();
+	uint8_t* buf = Library::Channel::Data(ch) + (c->tail & (c->ringsize - 1));
 
+	size_t count = len / sizeof(Request);
+	for(size_t i = 0; i < count; i++)
+	{
+		// it's shared memory, so take our own copy before looking at it.
+		Request req;
+		memcpy(&req, buf + (i * sizeof(Request)), sizeof(Request));
+		req.name[CHANNEL_NAME_MAX - 1] = 0;
 
+		if(!HandleRequest(slot, req))
+			return;
+	}
 
+	if(count > 0)
+	{
+		c->tail += count * sizeof(Request);
 
+		__sync_synchronize();
+		ch->tail = c->tail;
+		__sync_synchronize();
 
+		if(ch->writerwaiting)
+			Library::SystemCall::ChannelWake(ch, CHANNEL_SPACE);
+	}
+}
 
+static void AcceptClients(mqd_t queue)
+{
+	ConnectMessage msg;
+	while(mq_receive(queue, (char*) &msg, sizeof(msg), 0) == sizeof(msg))
+	{
+		msg.channel[CHANNEL_NAME_MAX - 1] = 0;
+
+		size_t slot = 0;
+		while(slot < MaxClients && clients[slot])
+			slot++;
+
+		if(slot == MaxClients)
+		{
+			printf("displayd: too many clients, ignoring pid %lu\n", msg.pid);
+			continue;
+		}
+
+		Library::ChannelHeader* ch = Library::SystemCall::OpenChannel(msg.channel);
+		if(!ch)
+			continue;
+
+		if(Library::SystemCall::ChannelSize(ch) != DISPLAY_REQUEST_RING)
+		{
+			printf("displayd: pid %lu's request ring is the wrong size\n", msg.pid);
+			Library::SystemCall::CloseChannel(ch);
+			continue;
+		}
+
+		Client* c = new Client();
+		c->pid		= msg.pid;
+		c->requests	= ch;
+		c->ringsize	= DISPLAY_REQUEST_RING;
+		c->tail		= ch->tail;
+
+		clients[slot] = c;
+	}
+}
 
+int main(int argc, char** argv)
+{
+	assert(argc == 5);
+	/*
+		1. framebuffer address
+		2. framebuffer width
+		3. framebuffer height
+		4. framebuffer bpp
+	*/
 
+	uint64_t framebuffer	= (uint64_t) argv[1];
+	uint64_t width			= (uint64_t) argv[2];
+	uint64_t height			= (uint64_t) argv[3];
+	uint64_t bpp			= (uint64_t) argv[4] / 8;		// kernel gives us BITS per pixel, but we really only care about BYTES per pixel.
 
+	if(bpp != 4)
+	{
+		printf("displayd: only 32bpp framebuffers are supported (got %lu)\n", bpp * 8);
+		return 1;
+	}
 
+	screen.framebuffer	= (uint32_t*) framebuffer;
+	screen.backbuffer	= new uint32_t[width * height];
+	screen.width		= width;
+	screen.height		= height;
+	screen.numsurfaces	= 0;
 
+	struct mq_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.mq_maxmsg	= MaxClients;
+	attr.mq_msgsize	= sizeof(ConnectMessage);
 
+	mqd_t queue = mq_open(DISPLAY_SERVER_QUEUE, O_CREAT | O_RDONLY | O_NONBLOCK, 0, &attr);
+	if(queue < 0)
+	{
+		printf("displayd: failed to create %s (errno %d)\n", DISPLAY_SERVER_QUEUE, errno);
+		return 1;
+	}
 
+	printf("\n\nDisplay server online (%lux%lu)\n", width, height);
 
+	// paint the background once.
+	AddDamage(&screen, Rect { 0, 0, (int64_t) width, (int64_t) height });
 
+	while(true)
+	{
+		AcceptClients(queue);
 
+		for(size_t i = 0; i < MaxClients; i++)
+		{
+			if(clients[i])
+				HandleRequests(i);
+		}
 
+		Composite(&screen);
+		Library::SystemCall::Sleep(TickMilliseconds);
+	}
 
-	// that's really all we need to do, except watch for messages and flush the screen on occasion.
 	return 0;
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
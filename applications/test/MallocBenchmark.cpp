@@ -0,0 +1,107 @@
+// MallocBenchmark.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// a few threads, each allocating and freeing a mix of mostly small sizes (and the odd big one) in a random order,
+// writing to everything they get, and checking it's intact before it's freed.
+
+static const uint64_t NumThreads	= 4;
+static const uint64_t Iterations	= 200000;
+static const uint64_t Slots			= 1024;
+
+struct Result
+{
+	uint64_t cycles;
+	uint64_t operations;
+	uint64_t errors;
+};
+
+static Result Results[NumThreads];
+
+static uint64_t ReadTSC()
+{
+	uint32_t lo = 0;
+	uint32_t hi = 0;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+
+	return ((uint64_t) hi << 32) | lo;
+}
+
+static uint64_t Random(uint64_t* state)
+{
+	*state = (*state * 6364136223846793005ULL) + 1442695040888963407ULL;
+	return *state >> 33;
+}
+
+static void* Worker(void* arg)
+{
+	uint64_t id = (uint64_t) arg;
+	uint64_t state = (id * 7919) + 1;
+
+	uint8_t** ptrs = (uint8_t**) calloc(Slots, sizeof(uint8_t*));
+	size_t* sizes = (size_t*) calloc(Slots, sizeof(size_t));
+
+	Result* r = &Results[id];
+	uint64_t start = ReadTSC();
+
+	for(uint64_t i = 0; i < Iterations; i++)
+	{
+		uint64_t rnd = Random(&state);
+		uint64_t slot = rnd % Slots;
+
+		if(ptrs[slot])
+		{
+			if(ptrs[slot][0] != (uint8_t) slot || ptrs[slot][sizes[slot] - 1] != (uint8_t) id)
+				r->errors++;
+
+			free(ptrs[slot]);
+			ptrs[slot] = 0;
+		}
+		else
+		{
+			// one in 64 is bigger than the size classes go.
+			size_t size = (rnd & 0x3F00) == 0 ? 40000 + (rnd % 40000) : 8 + ((rnd >> 8) % 512);
+
+			ptrs[slot] = (uint8_t*) malloc(size);
+			sizes[slot] = size;
+
+			ptrs[slot][0] = (uint8_t) slot;
+			ptrs[slot][size - 1] = (uint8_t) id;
+		}
+
+		r->operations++;
+	}
+
+	for(uint64_t i = 0; i < Slots; i++)
+		free(ptrs[i]);
+
+	r->cycles = ReadTSC() - start;
+
+	free(sizes);
+	free(ptrs);
+
+	return 0;
+}
+
+void MallocBenchmark()
+{
+	printf("malloc benchmark: %d threads, %d operations each\n", NumThreads, Iterations);
+
+	pthread_t threads[NumThreads];
+	for(uint64_t i = 0; i < NumThreads; i++)
+		pthread_create(&threads[i], 0, Worker, (void*) i);
+
+	for(uint64_t i = 0; i < NumThreads; i++)
+		pthread_join(threads[i], 0);
+
+	for(uint64_t i = 0; i < NumThreads; i++)
+	{
+		printf("thread %d: %d cycles per operation, %d errors\n", i, Results[i].cycles / Results[i].operations,
+			Results[i].errors);
+	}
+}
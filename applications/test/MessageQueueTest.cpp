@@ -0,0 +1,120 @@
+// MessageQueueTest.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <mqueue.h>
+#include <pthread.h>
+
+// sends and receives (priority order, across threads), timeouts on an empty and a full queue, and a bad buffer
+// that has to leave the message where it was.
+
+#define QueueName		"/mqtest"
+#define MaxMessages		4
+#define MessageSize		64
+
+static uint64_t Errors = 0;
+
+static void Check(bool cond, const char* what)
+{
+	if(cond)
+		return;
+
+	printf("mqueue test: %s failed (errno %d)\n", what, errno);
+	Errors++;
+}
+
+static void* Sender(void* arg)
+{
+	mqd_t mq = (mqd_t) arg;
+
+	// give the main thread time to block first.
+	usleep(50000);
+	Check(mq_send(mq, "late", 5, 7) == 0, "send from another thread");
+
+	return 0;
+}
+
+void MessageQueueTest()
+{
+	struct mq_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.mq_maxmsg	= MaxMessages;
+	attr.mq_msgsize	= MessageSize;
+
+	mqd_t mq = mq_open(QueueName, O_CREAT | O_EXCL | O_RDWR, 0, &attr);
+	if(mq < 0)
+	{
+		printf("mqueue test: couldn't create %s (errno %d)\n", QueueName, errno);
+		return;
+	}
+
+	char buf[MessageSize];
+	unsigned int prio = 0;
+
+	// highest priority first, oldest first within one.
+	Check(mq_send(mq, "one", 4, 1) == 0, "send");
+	Check(mq_send(mq, "five", 5, 5) == 0, "send");
+	Check(mq_send(mq, "three", 6, 3) == 0, "send");
+	Check(mq_send(mq, "five again", 11, 5) == 0, "send");
+
+	Check(mq_receive(mq, buf, sizeof(buf), &prio) == 5 && prio == 5 && !strcmp(buf, "five"), "receive in order");
+	Check(mq_receive(mq, buf, sizeof(buf), &prio) == 11 && prio == 5 && !strcmp(buf, "five again"), "receive in order");
+	Check(mq_receive(mq, buf, sizeof(buf), &prio) == 6 && prio == 3 && !strcmp(buf, "three"), "receive in order");
+	Check(mq_receive(mq, buf, sizeof(buf), &prio) == 4 && prio == 1 && !strcmp(buf, "one"), "receive in order");
+
+	// a deadline that's already passed times out straight away, empty or full.
+	struct timespec past;
+	past.tv_sec = 0;
+	past.tv_nsec = 0;
+
+	Check(mq_timedreceive(mq, buf, sizeof(buf), 0, &past) == -1 && errno == ETIMEDOUT, "timed receive on empty queue");
+
+	for(int i = 0; i < MaxMessages; i++)
+		Check(mq_send(mq, "fill", 5, 0) == 0, "fill");
+
+	Check(mq_timedsend(mq, "extra", 6, 0, &past) == -1 && errno == ETIMEDOUT, "timed send on full queue");
+
+	for(int i = 0; i < MaxMessages; i++)
+		Check(mq_receive(mq, buf, sizeof(buf), 0) == 5, "drain");
+
+	// oversized messages and undersized buffers.
+	char big[MessageSize + 1];
+	memset(big, 'x', sizeof(big));
+
+	Check(mq_send(mq, big, sizeof(big), 0) == -1 && errno == EMSGSIZE, "oversized send");
+	Check(mq_receive(mq, buf, MessageSize - 1, 0) == -1 && errno == EMSGSIZE, "undersized receive");
+
+	// a bad buffer fails, and the message is still there for the next receive.
+	Check(mq_send(mq, "kept", 5, 2) == 0, "send");
+	Check(mq_receive(mq, (char*) 0xFFFFFFFF80000000, sizeof(buf), 0) == -1 && errno == EFAULT, "receive into a bad buffer");
+	Check(mq_receive(mq, buf, sizeof(buf), &prio) == 5 && prio == 2 && !strcmp(buf, "kept"), "message survives a bad receive");
+
+	// non-blocking, through mq_setattr.
+	struct mq_attr nb;
+	memset(&nb, 0, sizeof(nb));
+	nb.mq_flags = O_NONBLOCK;
+
+	Check(mq_setattr(mq, &nb, &attr) == 0 && attr.mq_maxmsg == MaxMessages && attr.mq_curmsgs == 0, "setattr");
+	Check(mq_receive(mq, buf, sizeof(buf), 0) == -1 && errno == EAGAIN, "non-blocking receive");
+
+	nb.mq_flags = 0;
+	Check(mq_setattr(mq, &nb, 0) == 0, "setattr");
+
+	// and a receive that actually has to sleep until another thread sends.
+	pthread_t sender;
+	pthread_create(&sender, 0, Sender, (void*) mq);
+
+	Check(mq_receive(mq, buf, sizeof(buf), &prio) == 5 && prio == 7 && !strcmp(buf, "late"), "blocking receive");
+	pthread_join(sender, 0);
+
+	mq_close(mq);
+	Check(mq_unlink(QueueName) == 0, "unlink");
+	Check(mq_open(QueueName, O_RDWR) == -1 && errno == ENOENT, "open after unlink");
+
+	printf("mqueue test: %d error%s\n", Errors, Errors == 1 ? "" : "s");
+}
@@ -5,9 +5,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+void MallocBenchmark();
+void MessageQueueTest();
+
 int main(int argc, char** argv)
 {
 	printf("Testing, testing, 1, 2, 3\n\n");
+
+	MessageQueueTest();
+	MallocBenchmark();
 	exit(1);
 
 	return 0;
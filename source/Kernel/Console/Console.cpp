@@ -44,6 +44,19 @@ namespace Console
 
 	static Mutex mtx;
 
+	// roughly once a frame, push whatever was drawn into the back buffer out to the screen.
+	// batching it like this means a burst of output costs one copy per line, not one per character.
+	static void RefreshThread()
+	{
+		while(true)
+		{
+			if(VideoOutput::LinearFramebuffer::IsDirty())
+				VideoOutput::LinearFramebuffer::RefreshBuffer();
+
+			SLEEP(16);
+		}
+	}
+
 	void Initialise()
 	{
 		HasFramebuffer = (VideoOutput::LinearFramebuffer::GetResX() > 0 && VideoOutput::LinearFramebuffer::GetResY() > 0);
@@ -63,6 +76,9 @@ namespace Console
 
 		VT_DidInit = true;
 
+		if(HasFramebuffer)
+			Multitasking::AddToQueue(Multitasking::CreateKernelThread(RefreshThread, 1));
+
 		// mtx = new Mutex();
 
 		Log("Console Initialised");
@@ -73,6 +89,12 @@ namespace Console
 		return VT_DidInit;
 	}
 
+	void Flush()
+	{
+		if(IsInitialised() && HasFramebuffer)
+			VideoOutput::LinearFramebuffer::RefreshBuffer();
+	}
+
 	void PrintChar(uint8_t c)
 	{
 		if(c == 0)
@@ -183,6 +205,56 @@ namespace Console
 		return;
 	}
 
+	// same as calling PrintChar() for each character, except that runs of plain text which fit on the
+	// current line are drawn with a single DrawString().
+	void PrintString(const char* str, uint64_t length)
+	{
+		if(!IsInitialised() || !HasFramebuffer)
+		{
+			for(uint64_t i = 0; i < length; i++)
+				PrintChar((uint8_t) str[i]);
+
+			return;
+		}
+
+		uint64_t i = 0;
+		while(i < length)
+		{
+			// columns left before PrintChar() would wrap (or scroll) instead of printing normally.
+			uint64_t maxX = ((GetResX() - 10) + (CharWidth - 1)) / CharWidth;
+			if(VT_CursorY == CharsPerColumn && maxX > CharsPerLine)
+				maxX = CharsPerLine;
+
+			uint64_t run = 0;
+			while(i + run < length && VT_CursorX + run < maxX)
+			{
+				uint8_t c = (uint8_t) str[i + run];
+				if(c == 0 || c == '\r' || c == '\b' || c == '\n' || c == '\t')
+					break;
+
+				run++;
+			}
+
+			if(run == 0)
+			{
+				PrintChar((uint8_t) str[i]);
+				i++;
+
+				continue;
+			}
+
+			if(SERIALMIRROR)
+			{
+				for(uint64_t k = 0; k < run; k++)
+					HardwareAbstraction::Devices::SerialPort::WriteChar((uint8_t) str[i + k]);
+			}
+
+			DrawString(str + i, run, (VT_CursorX * CharWidth) + OffsetLeft, (VT_CursorY * CharHeight), VT_Colour);
+			VT_CursorX += run;
+			i += run;
+		}
+	}
+
 	void ClearScreen()
 	{
 		if(!HasFramebuffer)
@@ -192,7 +264,8 @@ namespace Console
 		else
 		{
 			Memory::Set((uint64_t*) Kernel::GetFramebufferAddress(), 0x00, GetResX() * GetResY() * 4);
-			Memory::Set((uint64_t*) Kernel::GetTrueLFBAddress(), 0x00, GetResX() * GetResY() * 4);
+			MarkDirty(0, 0, GetResX(), GetResY());
+
 			VT_CursorX = 0;
 			VT_CursorY = 0;
 		}
@@ -215,6 +288,9 @@ namespace Console
 			// delete the last line.
 			Memory::Set((void*)(Kernel::GetFramebufferAddress() + ((x * y * (BitsPerPixel / 8)) - (x * CharHeight * (BitsPerPixel / 8)))),
 				0x00, x * CharHeight * (BitsPerPixel / 8));
+
+			// this all happened in the back buffer, so the whole screen needs to go out again.
+			MarkDirty(0, 0, (uint16_t) x, (uint16_t) y);
 		}
 	}
 
@@ -266,6 +342,21 @@ namespace Console
 		}
 	}
 
+	// draws straight into one cell, leaving the cursor alone -- for things like the status spinner, which would
+	// otherwise have to move the cursor out from under whoever else is printing and hope nobody noticed.
+	void PrintCharAt(uint8_t c, uint16_t x, uint16_t y)
+	{
+		if(!IsInitialised() || !HasFramebuffer)
+		{
+			if(x < 80 && y < 25)
+				*((uint16_t*) 0xB8000 + (y * 80) + x) = (uint16_t) (c | (0x0F << 8));
+		}
+		else if(x <= CharsPerLine && y <= CharsPerColumn)
+		{
+			DrawChar(c, (x * CharWidth) + OffsetLeft, (y * CharHeight), VT_Colour);
+		}
+	}
+
 	uint16_t GetCharsPerLine()
 	{
 		return CharsPerLine;
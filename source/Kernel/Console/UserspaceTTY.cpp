@@ -5,6 +5,7 @@
 #include <Kernel.hpp>
 #include <Console.hpp>
 #include <StandardIO.hpp>
+#include <HardwareAbstraction/Filesystems/Poll.hpp>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,6 +33,7 @@ namespace TTY
 		this->flush = flsh;
 		this->buffersize = BUFSIZ;
 		this->echomode = false;
+		this->poll = new HardwareAbstraction::Filesystems::PollSource();
 	}
 
 	// sometimes i like underscores.
@@ -58,20 +60,18 @@ namespace TTY
 		// flush stdout first.
 		stdout_flush(ttys->find(1)->second);
 
-		do
-		{
-			// asm volatile("pause");
-			if(tty->buffer.size() == 0)
-				continue;
-
-			Memory::Copy(buf, tty->buffer.data(), __min(tty->buffer.size(), length));
+		// sleep until stdin_write() gives us something, instead of spinning.
+		LockSpinlock(tty->poll->waiters.lock);
+		while(tty->buffer.size() == 0 && tty->BufferMode & BLOCKING_READ)
+			HardwareAbstraction::Multitasking::SleepOn(tty->poll->waiters);
 
-			tty->buffer.erase(tty->buffer.begin(), tty->buffer.begin() + __min(tty->buffer.size(), length));
-			return __min(tty->buffer.size(), length);
+		UnlockSpinlock(tty->poll->waiters.lock);
 
-		} while(tty->buffer.size() == 0 && tty->BufferMode & BLOCKING_READ);
+		uint64_t ret = __min(tty->buffer.size(), length);
+		Memory::Copy(buf, tty->buffer.data(), ret);
 
-		return 0;
+		tty->buffer.erase(tty->buffer.begin(), tty->buffer.begin() + ret);
+		return ret;
 	}
 
 	uint64_t stdin_write(TTYObject* tty, uint8_t* buf, uint64_t length)
@@ -134,6 +134,9 @@ namespace TTY
 		}
 
 
+		if(tty->buffer.size() > 0)
+			HardwareAbstraction::Filesystems::NotifyPoll(*tty->poll, EPOLLIN);
+
 		// Log("TTY has data, delta %ld", Kernel::TickCounter() - __debug_flag__);
 		// __debug_flag__ = Kernel::TickCounter();
 
@@ -227,6 +230,9 @@ namespace TTY
 			tty->buffer.push_back(d);
 
 		tty->internalbuffer.clear();
+
+		if(tty->buffer.size() > 0)
+			HardwareAbstraction::Filesystems::NotifyPoll(*tty->poll, EPOLLIN);
 	}
 
 	void noop_flush(TTYObject*)
@@ -291,6 +297,25 @@ namespace TTY
 		return 0;
 	}
 
+	uint32_t PollTTY(long ttyid)
+	{
+		assert(ttys);
+		if(ttys->find(ttyid) == ttys->end())
+			return EPOLLERR;
+
+		TTYObject* tty = ttys->find(ttyid)->second;
+		return tty->buffer.size() > 0 ? EPOLLIN : 0;
+	}
+
+	HardwareAbstraction::Filesystems::PollSource* GetTTYPollSource(long ttyid)
+	{
+		assert(ttys);
+		if(ttys->find(ttyid) == ttys->end())
+			return 0;
+
+		return ttys->find(ttyid)->second->poll;
+	}
+
 	void FlushTTY(long ttyid)
 	{
 		assert(ttys);
@@ -297,8 +297,27 @@ namespace ACPI
 				this->table = new APICTable(tableAddress, this);
 				DeviceManager::AddDevice(new Devices::APIC((APICTable*) this->table), DeviceType::AdvancedPIC);
 			}
+			else if(s0 == 'M' && s1 == 'C' && s2 == 'F' && s3 == 'G')
+			{
+				// pci express config space; PCI::Initialise() goes looking for this.
+				this->table = new MCFGTable(tableAddress, this);
+			}
+			else
+			{
+				this->table = 0;
+			}
 		}
 	}
+
+	MCFGTable::MCFGTable(uint64_t address, SystemDescriptionTable* sdtable)
+	{
+		// eight reserved bytes, then one allocation per segment group (or bus range).
+		uint64_t count = (sdtable->length - 44) / sizeof(Allocation);
+		Allocation* allocs = (Allocation*) (address + 8);
+
+		for(uint64_t i = 0; i < count; i++)
+			this->allocations.push_back(allocs[i]);
+	}
 }
 }
 }
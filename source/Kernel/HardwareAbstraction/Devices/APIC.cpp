@@ -12,7 +12,125 @@ namespace Devices
 {
 	APIC::APIC(ACPI::APICTable* table)
 	{
-		(void) table;
+		this->table = table;
+		LocalAPIC::Initialise(table->physLocalControllerAddr);
+	}
+
+	namespace LocalAPIC
+	{
+		static uint64_t BaseAddress = 0;
+		static uint64_t TicksPerMillisecond = 0;
+
+		// in ms, measured against the PIT.
+		static const uint64_t CalibrationPeriod = 50;
+
+		static uint32_t Read(uint32_t reg)
+		{
+			return *((volatile uint32_t*) (BaseAddress + reg));
+		}
+
+		static void Write(uint32_t reg, uint32_t value)
+		{
+			*((volatile uint32_t*) (BaseAddress + reg)) = value;
+		}
+
+		void Initialise(uint64_t physaddr)
+		{
+			// registers, so no caching (PCD | PWT).
+			BaseAddress = physaddr;
+			MemoryManager::Virtual::MapAddress(physaddr, physaddr, 0x1B);
+
+			EnableOnThisCPU();
+			Log("Local APIC at %x, boot processor is APIC %d", physaddr, GetID());
+		}
+
+		void EnableOnThisCPU()
+		{
+			// global enable in the APIC_BASE msr (firmware usually does this), then the software enable.
+			uint32_t lo = 0;
+			uint32_t hi = 0;
+			asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(0x1B));
+			asm volatile("wrmsr" :: "a"(lo | 0x800), "d"(hi), "c"(0x1B));
+
+			Write(LAPIC_REG_SPURIOUS, 0x100 | SpuriousInterruptNumber);
+		}
+
+		uint64_t GetBaseAddress()
+		{
+			return BaseAddress;
+		}
+
+		uint32_t GetID()
+		{
+			return Read(LAPIC_REG_ID) >> 24;
+		}
+
+		void SendEOI()
+		{
+			Write(LAPIC_REG_EOI, 0);
+		}
+
+		static void SendIPI(uint32_t apicid, uint32_t command)
+		{
+			Write(LAPIC_REG_ICR_HIGH, apicid << 24);
+			Write(LAPIC_REG_ICR_LOW, command);
+
+			// wait for the delivery status bit to clear.
+			while(Read(LAPIC_REG_ICR_LOW) & (1 << 12))
+				asm volatile("pause");
+		}
+
+		void SendInit(uint32_t apicid)
+		{
+			// INIT, level-triggered, assert.
+			SendIPI(apicid, 0x4500);
+		}
+
+		void SendStartup(uint32_t apicid, uint8_t page)
+		{
+			// STARTUP; the processor begins in real mode at page * 0x1000.
+			SendIPI(apicid, 0x4600 | page);
+		}
+
+		void SendFixedIPI(uint32_t apicid, uint8_t vector)
+		{
+			// fixed delivery, edge-triggered, assert.
+			SendIPI(apicid, 0x4000 | vector);
+		}
+
+		void CalibrateTimer()
+		{
+			// divide by 16, masked one-shot.
+			Write(LAPIC_REG_TIMER_DIV, 0x3);
+			Write(LAPIC_REG_TIMER, 0x10000);
+
+			// start on a tick boundary so we measure whole ticks.
+			uint64_t start = TickCounter();
+			while(TickCounter() == start)
+				asm volatile("pause");
+
+			start = TickCounter();
+			Write(LAPIC_REG_TIMER_INIT, 0xFFFFFFFF);
+
+			while(TickCounter() < start + CalibrationPeriod)
+				asm volatile("pause");
+
+			uint32_t left = Read(LAPIC_REG_TIMER_COUNT);
+			uint64_t elapsed = TickCounter() - start;
+			Write(LAPIC_REG_TIMER_INIT, 0);
+
+			TicksPerMillisecond = (0xFFFFFFFF - left) / elapsed;
+			Log("Local APIC timer runs at %d ticks/ms", TicksPerMillisecond);
+		}
+
+		void StartTimer(uint8_t vector, uint64_t milliseconds)
+		{
+			assert(TicksPerMillisecond > 0);
+
+			Write(LAPIC_REG_TIMER_DIV, 0x3);
+			Write(LAPIC_REG_TIMER, 0x20000 | vector);
+			Write(LAPIC_REG_TIMER_INIT, (uint32_t) (TicksPerMillisecond * milliseconds));
+		}
 	}
 }
 
@@ -47,14 +165,33 @@ namespace ACPI
 		uint64_t saddr = address + (sizeof(uint32_t) * 2);
 		Log("Parsing APIC table -- Controller Address: %x (phys), flags: %x", this->physLocalControllerAddr, this->flags);
 
-		uint64_t length = sdtable->length - sizeof(SystemDescriptionTable) - sizeof(uint64_t) - sizeof(void*);
+		// the entries run to the end of the table; 'address' already points past the standard header.
+		uint64_t header = sizeof(SystemDescriptionTable) - sizeof(SDTable*) - sizeof(uint64_t);
+		uint64_t length = sdtable->length - header - (sizeof(uint32_t) * 2);
+
 		Log("Length: %ld bytes", length);
 		for(uint64_t i = 0; i < length;)
 		{
 			using namespace APICStructs;
 			APICStruct* generic = (APICStruct*) saddr;
 
-			Log("Found APIC struct: type %s (%u), %d bytes long", readableAPICType[generic->type], generic->type, generic->length);
+			if(generic->length == 0)
+				break;
+
+			if(generic->type < sizeof(readableAPICType) / sizeof(readableAPICType[0]))
+				Log("Found APIC struct: type %s (%u), %d bytes long", readableAPICType[generic->type], generic->type, generic->length);
+
+			if(generic->type == (uint8_t) APICStructType::LocalAPIC)
+			{
+				LocalAPIC* lapic = (LocalAPIC*) generic;
+				this->localAPICs.push_back(*lapic);
+
+				Log("Processor %d: APIC id %d, %s", lapic->ACPIProcId, lapic->ACPIId, (lapic->flags & 0x1) ? "enabled" : "disabled");
+			}
+			else if(generic->type == (uint8_t) APICStructType::IOAPIC)
+			{
+				this->ioAPICs.push_back(*((IOAPIC*) generic));
+			}
 
 			saddr += generic->length;
 			i += generic->length;
@@ -0,0 +1,445 @@
+// E1000.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <Kernel.hpp>
+#include <HardwareAbstraction/Devices/NIC.hpp>
+#include <HardwareAbstraction/Network.hpp>
+#include <HardwareAbstraction/Interrupts.hpp>
+#include <StandardIO.hpp>
+
+// intel 8254x gigabit cards; qemu's e1000 is an 82540em.
+
+// both directions are rings of descriptors in memory, with the card working from the head to the tail and us moving
+// the tail. received packets are handled in a job rather than the interrupt handler, which goes through everything
+// the card's filled in and gives all of it back with one write to the tail. the card itself holds interrupts back
+// (see ITR), so a busy link doesn't mean an interrupt per packet.
+
+// each transmit descriptor has its own buffer. only every TxReportInterval-th one asks the card to say when it's
+// done, and those are what we reclaim by, a batch at a time.
+
+using namespace Library;
+using namespace Kernel::HardwareAbstraction::Devices::PCI;
+using namespace Kernel::HardwareAbstraction::MemoryManager;
+using namespace Kernel::HardwareAbstraction::Network;
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Devices {
+namespace NIC
+{
+	namespace E1000Registers
+	{
+		enum Registers
+		{
+			CTRL			= 0x0000,
+			STATUS			= 0x0008,
+			EERD			= 0x0014,
+			ICR				= 0x00C0,
+			ITR				= 0x00C4,
+			IMS				= 0x00D0,
+			IMC				= 0x00D8,
+			RCTL			= 0x0100,
+			TCTL			= 0x0400,
+			TIPG			= 0x0410,
+			RDBAL			= 0x2800,
+			RDBAH			= 0x2804,
+			RDLEN			= 0x2808,
+			RDH				= 0x2810,
+			RDT				= 0x2818,
+			RDTR			= 0x2820,
+			TDBAL			= 0x3800,
+			TDBAH			= 0x3804,
+			TDLEN			= 0x3808,
+			TDH				= 0x3810,
+			TDT				= 0x3818,
+			MTA				= 0x5200,
+			RAL0			= 0x5400,
+			RAH0			= 0x5404,
+		};
+	}
+
+	using namespace E1000Registers;
+
+	#define CTRL_ASDE			(1U << 5)
+	#define CTRL_SLU			(1U << 6)
+	#define CTRL_RST			(1U << 26)
+
+	#define STATUS_LU			(1U << 1)
+
+	#define EERD_START			(1U << 0)
+	#define EERD_DONE			(1U << 4)
+
+	#define INT_TXDW			(1U << 0)
+	#define INT_LSC				(1U << 2)
+	#define INT_RXDMT0			(1U << 4)
+	#define INT_RXO				(1U << 6)
+	#define INT_RXT0			(1U << 7)
+	#define INT_RX				(INT_RXDMT0 | INT_RXO | INT_RXT0)
+
+	#define RCTL_EN				(1U << 1)
+	#define RCTL_BAM			(1U << 15)
+	#define RCTL_SECRC			(1U << 26)
+
+	#define TCTL_EN				(1U << 1)
+	#define TCTL_PSP			(1U << 3)
+
+	#define RAH_AV				(1U << 31)
+
+	#define DESC_DD				0x01
+	#define DESC_EOP			0x02
+
+	#define TXCMD_EOP			0x01
+	#define TXCMD_IFCS			0x02
+	#define TXCMD_RS			0x08
+
+	struct RxDescriptor
+	{
+		uint64_t addr;
+		uint16_t length;
+		uint16_t checksum;
+		volatile uint8_t status;
+		uint8_t errors;
+		uint16_t special;
+
+	} __attribute__((packed));
+
+	struct TxDescriptor
+	{
+		uint64_t addr;
+		uint16_t length;
+		uint8_t cso;
+		uint8_t cmd;
+		volatile uint8_t status;
+		uint8_t css;
+		uint16_t special;
+
+	} __attribute__((packed));
+
+	// both rings fill exactly one page.
+	static const uint16_t NumDescriptors		= 256;
+	static const uint64_t BufferSize			= 0x800;
+	static const uint64_t BufferPages			= (NumDescriptors * BufferSize) / 0x1000;
+
+	// must divide NumDescriptors.
+	static const uint16_t TxReportInterval		= 32;
+
+	// in units of 256ns, so about 8000 interrupts a second at most.
+	static const uint32_t InterruptThrottle		= 488;
+
+	static uint32_t ReadReg(volatile uint8_t* base, uint32_t reg)
+	{
+		return *((volatile uint32_t*) (base + reg));
+	}
+
+	static void WriteReg(volatile uint8_t* base, uint32_t reg, uint32_t val)
+	{
+		*((volatile uint32_t*) (base + reg)) = val;
+	}
+
+	static void StaticHandleInterrupt(void* nic)
+	{
+		assert(nic);
+		((GenericNIC*) nic)->HandleInterrupt();
+	}
+
+	static void JobHandler(void* nic)
+	{
+		((E1000*) nic)->HandleReceive();
+	}
+
+	E1000::E1000(PCIDevice* _dev)
+	{
+		this->pcidev = _dev;
+
+		// enable bus mastering and memory space.
+		uint32_t f = this->pcidev->GetRegisterData(0x4, 0, 2);
+		this->pcidev->WriteRegisterData(0x4, 0, 2, (f | 0x6) & ((uint32_t) ~0x400));
+
+		assert(!this->pcidev->IsBARIOPort(0));
+		this->regs = (volatile uint8_t*) Virtual::MapIO(this->pcidev->GetBAR(0), 0x20000);
+
+		Log("Initialised Busmastering E1000 NIC with MMIO base %x", this->pcidev->GetBAR(0));
+
+		this->Reset();
+		Log("E1000 Software reset complete.");
+
+		// the mac address is the first three words of the eeprom.
+		for(uint32_t i = 0; i < 3; i++)
+		{
+			WriteReg(this->regs, EERD, EERD_START | (i << 8));
+
+			uint32_t val = 0;
+			while(!((val = ReadReg(this->regs, EERD)) & EERD_DONE))
+				asm volatile("pause");
+
+			this->MAC[i * 2] = (uint8_t) (val >> 16);
+			this->MAC[i * 2 + 1] = (uint8_t) (val >> 24);
+		}
+
+		Log("Initialised E1000 NIC with MAC address %#02x:%#02x:%#02x:%#02x:%#02x:%#02x", this->MAC[0], this->MAC[1], this->MAC[2], this->MAC[3], this->MAC[4], this->MAC[5]);
+
+		WriteReg(this->regs, RAL0, (uint32_t) (this->MAC[0] | (this->MAC[1] << 8) | (this->MAC[2] << 16) | (this->MAC[3] << 24)));
+		WriteReg(this->regs, RAH0, (uint32_t) (this->MAC[4] | (this->MAC[5] << 8)) | RAH_AV);
+
+		for(uint32_t i = 0; i < 128; i++)
+			WriteReg(this->regs, MTA + (i * 4), 0);
+
+		// receive ring: every descriptor gets a buffer, and the card gets all but one of them (head == tail means empty).
+		this->rxring = Physical::AllocateDMA(1);
+		this->rxbuffers = Physical::AllocateDMA(BufferPages);
+		this->rxnext = 0;
+		this->rxscheduled = false;
+
+		RxDescriptor* rx = (RxDescriptor*) this->rxring.virt;
+		Memory::Set(rx, 0, 0x1000);
+
+		for(uint16_t i = 0; i < NumDescriptors; i++)
+			rx[i].addr = this->rxbuffers.phys + (i * BufferSize);
+
+		WriteReg(this->regs, RDBAL, (uint32_t) this->rxring.phys);
+		WriteReg(this->regs, RDBAH, (uint32_t) (this->rxring.phys >> 32));
+		WriteReg(this->regs, RDLEN, NumDescriptors * sizeof(RxDescriptor));
+		WriteReg(this->regs, RDH, 0);
+		WriteReg(this->regs, RDT, NumDescriptors - 1);
+		WriteReg(this->regs, RDTR, 0);
+
+		// 2k buffers, broadcasts, and strip the crc.
+		WriteReg(this->regs, RCTL, RCTL_EN | RCTL_BAM | RCTL_SECRC);
+
+		// transmit ring.
+		this->txring = Physical::AllocateDMA(1);
+		this->txbuffers = Physical::AllocateDMA(BufferPages);
+		this->txtail = 0;
+		this->txclean = 0;
+		this->txsenders = 0;
+
+		TxDescriptor* tx = (TxDescriptor*) this->txring.virt;
+		Memory::Set(tx, 0, 0x1000);
+
+		for(uint16_t i = 0; i < NumDescriptors; i++)
+			tx[i].addr = this->txbuffers.phys + (i * BufferSize);
+
+		WriteReg(this->regs, TDBAL, (uint32_t) this->txring.phys);
+		WriteReg(this->regs, TDBAH, (uint32_t) (this->txring.phys >> 32));
+		WriteReg(this->regs, TDLEN, NumDescriptors * sizeof(TxDescriptor));
+		WriteReg(this->regs, TDH, 0);
+		WriteReg(this->regs, TDT, 0);
+
+		// collision threshold 15, collision distance 64 bytes, and the inter-packet gaps the manual says for copper.
+		WriteReg(this->regs, TCTL, TCTL_EN | TCTL_PSP | (0x0F << 4) | (0x40 << 12));
+		WriteReg(this->regs, TIPG, 10 | (8 << 10) | (6 << 20));
+
+		if(Interrupts::InstallDeviceHandler(this->pcidev, StaticHandleInterrupt, this))
+			Log("Using msi");
+
+		else
+			Log("Using IRQ number %d and Interrupt Pin #%c", this->pcidev->GetInterruptLine(), this->pcidev->GetInterruptPin() + 'A');
+
+		WriteReg(this->regs, ITR, InterruptThrottle);
+		WriteReg(this->regs, IMS, INT_RX | INT_LSC | INT_TXDW);
+		ReadReg(this->regs, ICR);
+
+		Log("Configured %d rx and %d tx descriptors, link is %s", NumDescriptors, NumDescriptors,
+			(ReadReg(this->regs, STATUS) & STATUS_LU) ? "up" : "down");
+	}
+
+	E1000::~E1000()
+	{
+		this->Reset();
+
+		Physical::FreeDMA(this->rxring, 1);
+		Physical::FreeDMA(this->rxbuffers, BufferPages);
+		Physical::FreeDMA(this->txring, 1);
+		Physical::FreeDMA(this->txbuffers, BufferPages);
+	}
+
+	void E1000::Reset()
+	{
+		WriteReg(this->regs, IMC, 0xFFFFFFFF);
+		WriteReg(this->regs, CTRL, ReadReg(this->regs, CTRL) | CTRL_RST);
+
+		// wait for reset.
+		while(ReadReg(this->regs, CTRL) & CTRL_RST)
+			asm volatile("pause");
+
+		WriteReg(this->regs, IMC, 0xFFFFFFFF);
+		ReadReg(this->regs, ICR);
+
+		WriteReg(this->regs, CTRL, ReadReg(this->regs, CTRL) | CTRL_SLU | CTRL_ASDE);
+	}
+
+	void E1000::HandleReceive()
+	{
+		RxDescriptor* rx = (RxDescriptor*) this->rxring.virt;
+
+		while(true)
+		{
+			uint16_t handled = 0;
+			while(rx[this->rxnext].status & DESC_DD)
+			{
+				RxDescriptor* desc = &rx[this->rxnext];
+
+				// we don't take jumbo frames, so anything without eop is an error.
+				if((desc->status & DESC_EOP) && desc->errors == 0)
+				{
+					Ethernet::HandlePacket(this, (void*) (this->rxbuffers.virt + (this->rxnext * BufferSize)), desc->length);
+				}
+				else
+				{
+					Log(1, "E1000: dropping bad packet (status %x, errors %x)", desc->status, desc->errors);
+				}
+
+				desc->status = 0;
+				this->rxnext = (uint16_t) ((this->rxnext + 1) % NumDescriptors);
+				handled++;
+			}
+
+			// give everything back at once; the tail is the last one we've finished with.
+			if(handled > 0)
+			{
+				__sync_synchronize();
+				WriteReg(this->regs, RDT, (uint16_t) ((this->rxnext + NumDescriptors - 1) % NumDescriptors));
+			}
+
+			// the interrupt handler won't queue another job while we're here, so check once more after saying we're done.
+			LockSpinlock(this->rxlock);
+			{
+				if(!(rx[this->rxnext].status & DESC_DD))
+				{
+					this->rxscheduled = false;
+					UnlockSpinlock(this->rxlock);
+					return;
+				}
+			}
+			UnlockSpinlock(this->rxlock);
+		}
+	}
+
+	// call with txwait.lock held.
+	void E1000::ReclaimTransmit()
+	{
+		TxDescriptor* tx = (TxDescriptor*) this->txring.virt;
+
+		while(this->txclean != this->txtail)
+		{
+			// the next descriptor that reports back, which has to be one we've actually sent.
+			uint16_t report = (uint16_t) ((this->txclean / TxReportInterval) * TxReportInterval + TxReportInterval - 1);
+			uint16_t inflight = (uint16_t) ((this->txtail + NumDescriptors - this->txclean) % NumDescriptors);
+
+			if((uint16_t) (report - this->txclean) >= inflight || !(tx[report].status & DESC_DD))
+				break;
+
+			// otherwise a stale dd is still there when the ring comes back round, before the slot is reused.
+			tx[report].status = 0;
+			this->txclean = (uint16_t) ((report + 1) % NumDescriptors);
+		}
+	}
+
+	void E1000::SendData(uint8_t* data, uint64_t bytes)
+	{
+		if(bytes > BufferSize)
+		{
+			Log(1, "Tried to transmit packet larger than %d bytes long, exceeds buffer size -- aborting transmit", BufferSize);
+			return;
+		}
+
+		TxDescriptor* tx = (TxDescriptor*) this->txring.virt;
+
+		LockSpinlock(this->txwait.lock);
+
+		// one descriptor always stays empty, otherwise a full ring looks like an empty one.
+		while((uint16_t) ((this->txtail + 1) % NumDescriptors) == this->txclean)
+		{
+			this->ReclaimTransmit();
+			if((uint16_t) ((this->txtail + 1) % NumDescriptors) == this->txclean)
+				Multitasking::SleepOn(this->txwait);
+		}
+
+		uint16_t slot = this->txtail;
+		this->txtail = (uint16_t) ((this->txtail + 1) % NumDescriptors);
+		this->txsenders++;
+
+		UnlockSpinlock(this->txwait.lock);
+
+		Memory::Copy((void*) (this->txbuffers.virt + (slot * BufferSize)), data, bytes);
+
+		tx[slot].length = (uint16_t) bytes;
+		tx[slot].cmd = TXCMD_EOP | TXCMD_IFCS | ((slot % TxReportInterval == TxReportInterval - 1) ? TXCMD_RS : 0);
+		tx[slot].status = 0;
+
+		LockSpinlock(this->txwait.lock);
+		{
+			this->txsenders--;
+			if(this->txsenders == 0)
+			{
+				__sync_synchronize();
+				WriteReg(this->regs, TDT, this->txtail);
+			}
+		}
+		UnlockSpinlock(this->txwait.lock);
+	}
+
+	IOResult E1000::Read(uint64_t position, uint64_t outbuf, size_t bytes)
+	{
+		(void) position;
+		(void) outbuf;
+		(void) bytes;
+
+		// does nothing -- you can't read directly from an NIC anyway
+		return IOResult();
+	}
+
+	IOResult E1000::Write(uint64_t position, uint64_t outbuf, size_t bytes)
+	{
+		(void) position;
+		this->SendData((uint8_t*) outbuf, bytes);
+
+		auto ret = IOResult();
+		ret.bytesTransferred = bytes;
+
+		return ret;
+	}
+
+	uint64_t E1000::GetHardwareType()
+	{
+		return 0x1;
+	}
+
+	uint8_t* E1000::GetMAC()
+	{
+		return this->MAC;
+	}
+
+	void E1000::HandleInterrupt()
+	{
+		// reading it clears it. the line might be shared, so nothing there means it wasn't us.
+		uint32_t icr = ReadReg(this->regs, ICR);
+		if(icr == 0)
+			return;
+
+		if(icr & INT_LSC)
+			Log("E1000: link is %s", (ReadReg(this->regs, STATUS) & STATUS_LU) ? "up" : "down");
+
+		if(icr & INT_RXO)
+			Log(1, "E1000: receive overrun");
+
+		if(icr & INT_RX)
+		{
+			LockSpinlock(this->rxlock);
+			if(!this->rxscheduled)
+			{
+				this->rxscheduled = true;
+				JobDispatch::AddJob(JobDispatch::Job(&JobHandler, this, 0));
+			}
+			UnlockSpinlock(this->rxlock);
+		}
+
+		// a sender might be waiting for descriptors.
+		if(icr & INT_TXDW)
+			Multitasking::WakeAll(this->txwait);
+	}
+}
+}
+}
+}
@@ -0,0 +1,409 @@
+// VirtioNet.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <Kernel.hpp>
+#include <HardwareAbstraction/Devices/NIC.hpp>
+#include <HardwareAbstraction/Network.hpp>
+#include <HardwareAbstraction/Interrupts.hpp>
+#include <StandardIO.hpp>
+#include <stdlib.h>
+
+// virtio network cards, the kind qemu gives you with -device virtio-net-pci.
+
+// every receive buffer we have is posted to the device up front. when the interrupt comes we switch further
+// receive interrupts off and leave the rest to a job, which takes whatever's arrived in one go, hands it up the
+// stack, and posts all the buffers back at once (with one kick). it only turns interrupts back on once the ring's
+// empty, so a steady stream of packets costs one interrupt rather than one each.
+
+// sends copy the frame into one of our own buffers, since the caller's goes away as soon as we return. nobody waits
+// for them to finish, so transmit interrupts stay off; finished buffers are picked up by the next send.
+
+using namespace Library;
+using namespace Kernel::HardwareAbstraction::Devices::PCI;
+using namespace Kernel::HardwareAbstraction::MemoryManager;
+using namespace Kernel::HardwareAbstraction::Network;
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Devices {
+namespace NIC
+{
+	#define NET_F_GUEST_CSUM		(1U << 1)
+	#define NET_F_MAC				(1U << 5)
+	#define NET_F_MRG_RXBUF			(1U << 15)
+
+	#define NET_HDR_F_NEEDS_CSUM	0x1
+	#define NET_HDR_F_DATA_VALID	0x2
+
+	#define ISR_QUEUE				0x1
+
+	struct PacketHeader
+	{
+		uint8_t flags;
+		uint8_t gsotype;
+		uint16_t hdrlen;
+		uint16_t gsosize;
+		uint16_t csumstart;
+		uint16_t csumoffset;
+
+		// only there with NET_F_MRG_RXBUF.
+		uint16_t numbuffers;
+
+	} __attribute__((packed));
+
+	// a full frame and the header fit in one, so nothing we negotiate ever needs more than one per packet.
+	static const uint64_t BufferSize		= 0x800;
+
+	static const uint16_t RxQueue			= 0;
+	static const uint16_t TxQueue			= 1;
+
+	static const uint16_t MaxRxBuffers		= 256;
+	static const uint16_t MaxTxBuffers		= 128;
+
+	static void StaticHandleInterrupt(void* nic)
+	{
+		assert(nic);
+		((GenericNIC*) nic)->HandleInterrupt();
+	}
+
+	static void JobHandler(void* nic)
+	{
+		((VirtioNet*) nic)->HandleReceive();
+	}
+
+	// where Reap() puts the buffers it finds.
+	struct Completions
+	{
+		uint16_t* bufs;
+		uint32_t* lengths;
+		uint16_t count;
+	};
+
+	// called by Reap(), with the lock held.
+	static void Completed(void* cookie, uint32_t length, void* arg)
+	{
+		Completions* c = (Completions*) arg;
+
+		c->bufs[c->count] = (uint16_t) ((uint64_t) cookie - 1);
+		if(c->lengths)
+			c->lengths[c->count] = length;
+
+		c->count++;
+	}
+
+	VirtioNet::VirtioNet(PCIDevice* _dev)
+	{
+		this->pcidev = _dev;
+		this->transport = new Virtio::Transport(_dev);
+
+		Virtio::Transport* t = this->transport;
+		t->Reset();
+		t->AddStatus(VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+		uint32_t features = t->GetFeatures() & (NET_F_GUEST_CSUM | NET_F_MAC | NET_F_MRG_RXBUF | VIRTIO_F_EVENT_IDX);
+		t->SetFeatures(features);
+
+		this->mergeable = features & NET_F_MRG_RXBUF;
+		this->hdrsize = this->mergeable ? sizeof(PacketHeader) : sizeof(PacketHeader) - sizeof(uint16_t);
+		this->checksumok = false;
+
+		if(features & NET_F_MAC)
+		{
+			for(uint8_t i = 0; i < 6; i++)
+				this->MAC[i] = t->ReadConfig8(i);
+		}
+		else
+		{
+			// locally administered, and hopefully unique enough.
+			uint8_t mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+			Memory::Copy(this->MAC, mac, 6);
+		}
+
+		this->rxqueue = new Virtio::Queue(t, RxQueue);
+		this->txqueue = new Virtio::Queue(t, TxQueue);
+
+		if(features & VIRTIO_F_EVENT_IDX)
+		{
+			this->rxqueue->UseEventIndex();
+			this->txqueue->UseEventIndex();
+		}
+
+		this->txqueue->DisableInterrupts();
+
+		// without mergeable buffers the header has to be in a descriptor of its own, so each buffer takes two.
+		uint16_t rxchain = this->mergeable ? 1 : 2;
+		this->rxcount = (uint16_t) __min(this->rxqueue->GetSize() / rxchain, MaxRxBuffers);
+		this->txcount = (uint16_t) __min(this->txqueue->GetSize() / 2, MaxTxBuffers);
+
+		this->rxbuffers = Physical::AllocateDMA((this->rxcount * BufferSize + 0xFFF) / 0x1000);
+		this->txbuffers = Physical::AllocateDMA((this->txcount * BufferSize + 0xFFF) / 0x1000);
+
+		this->rxfree = new uint16_t[this->rxcount];
+		this->rxdone = new uint16_t[this->rxcount];
+		this->rxlengths = new uint32_t[this->rxcount];
+		this->rxnumfree = 0;
+		this->rxnumdone = 0;
+		this->rxscheduled = false;
+
+		for(uint16_t i = 0; i < this->rxcount; i++)
+			this->rxfree[this->rxnumfree++] = i;
+
+		this->txfree = new uint16_t[this->txcount];
+		this->txnumfree = 0;
+		this->txsenders = 0;
+
+		for(uint16_t i = 0; i < this->txcount; i++)
+			this->txfree[this->txnumfree++] = i;
+
+		// a vector of its own with msi-x, otherwise the (probably shared) pin.
+		uint8_t vector = _dev->GetMSIXCount() ? Interrupts::AllocateVector() : 0;
+		if(vector != 0 && t->UseMSIX(vector, 2))	Interrupts::InstallVectorHandler(vector, StaticHandleInterrupt, this);
+		else										Interrupts::InstallIRQHandler(_dev->GetInterruptLine(), StaticHandleInterrupt, this);
+
+		this->Refill();
+		t->AddStatus(VIRTIO_STATUS_DRIVER_OK);
+
+		Log("Initialised virtio NIC with MAC address %#02x:%#02x:%#02x:%#02x:%#02x:%#02x", this->MAC[0], this->MAC[1], this->MAC[2],
+			this->MAC[3], this->MAC[4], this->MAC[5]);
+
+		Log("Using %s, %d rx and %d tx buffers%s%s", t->UsingMSIX() ? "msi-x" : "the pin", this->rxcount, this->txcount,
+			(features & NET_F_GUEST_CSUM) ? ", checksum offload" : "", (features & VIRTIO_F_EVENT_IDX) ? ", event indices" : "");
+	}
+
+	VirtioNet::~VirtioNet()
+	{
+		this->Reset();
+
+		Physical::FreeDMA(this->rxbuffers, (this->rxcount * BufferSize + 0xFFF) / 0x1000);
+		Physical::FreeDMA(this->txbuffers, (this->txcount * BufferSize + 0xFFF) / 0x1000);
+
+		delete[] this->rxfree;
+		delete[] this->rxdone;
+		delete[] this->rxlengths;
+		delete[] this->txfree;
+	}
+
+	void VirtioNet::Reset()
+	{
+		// the device forgets its queues, so this is only good for shutting it up.
+		this->transport->Reset();
+	}
+
+	// posts every free receive buffer back to the device, then kicks once for all of them.
+	void VirtioNet::Refill()
+	{
+		LockSpinlock(this->rxlock);
+
+		while(this->rxnumfree > 0)
+		{
+			uint16_t buf = this->rxfree[this->rxnumfree - 1];
+			uint64_t phys = this->rxbuffers.phys + (buf * BufferSize);
+
+			Virtio::Segment segs[2];
+			uint16_t count = 1;
+
+			if(this->mergeable)
+			{
+				segs[0] = { phys, (uint32_t) BufferSize, true };
+			}
+			else
+			{
+				segs[0] = { phys, (uint32_t) this->hdrsize, true };
+				segs[1] = { phys + this->hdrsize, (uint32_t) (BufferSize - this->hdrsize), true };
+				count = 2;
+			}
+
+			if(!this->rxqueue->Post(segs, count, (void*) ((uint64_t) buf + 1)))
+				break;
+
+			this->rxnumfree--;
+		}
+
+		this->rxqueue->Kick();
+		UnlockSpinlock(this->rxlock);
+	}
+
+	void VirtioNet::HandleReceive()
+	{
+		while(true)
+		{
+			LockSpinlock(this->rxlock);
+			{
+				Completions c = { this->rxdone, this->rxlengths, 0 };
+				this->rxqueue->Reap(Completed, &c);
+				this->rxnumdone = c.count;
+
+				// nothing left, so go back to waiting for interrupts -- unless something came in just now.
+				if(this->rxnumdone == 0)
+				{
+					if(this->rxqueue->EnableInterrupts())
+					{
+						this->rxscheduled = false;
+						UnlockSpinlock(this->rxlock);
+						return;
+					}
+
+					this->rxqueue->DisableInterrupts();
+				}
+			}
+			UnlockSpinlock(this->rxlock);
+
+			for(uint16_t i = 0; i < this->rxnumdone; i++)
+			{
+				uint16_t buf = this->rxdone[i];
+				uint32_t len = this->rxlengths[i];
+
+				uint8_t* data = (uint8_t*) (this->rxbuffers.virt + (buf * BufferSize));
+				PacketHeader* hdr = (PacketHeader*) data;
+
+				if(len <= this->hdrsize || (this->mergeable && hdr->numbuffers != 1))
+				{
+					Log(1, "virtio-net: dropping malformed packet (%d bytes)", len);
+				}
+				else
+				{
+					uint8_t* frame = data + this->hdrsize;
+					uint64_t framelen = len - this->hdrsize;
+
+					// the device left the checksum for us to finish; the field has the pseudo-header's sum in it already.
+					if((hdr->flags & NET_HDR_F_NEEDS_CSUM) && (uint64_t) hdr->csumstart + hdr->csumoffset + 2 <= framelen)
+					{
+						uint16_t sum = IP::CalculateIPChecksum(frame + hdr->csumstart, framelen - hdr->csumstart);
+						*((uint16_t*) (frame + hdr->csumstart + hdr->csumoffset)) = SwapEndian16(sum);
+					}
+
+					this->checksumok = hdr->flags & (NET_HDR_F_NEEDS_CSUM | NET_HDR_F_DATA_VALID);
+					Ethernet::HandlePacket(this, frame, framelen);
+					this->checksumok = false;
+				}
+
+				this->rxfree[this->rxnumfree++] = buf;
+			}
+
+			this->Refill();
+		}
+	}
+
+	bool VirtioNet::ChecksumVerified()
+	{
+		return this->checksumok;
+	}
+
+	// call with txwait.lock held.
+	void VirtioNet::ReapTransmit()
+	{
+		Completions c = { this->txfree, 0, this->txnumfree };
+		this->txqueue->Reap(Completed, &c);
+		this->txnumfree = c.count;
+	}
+
+	void VirtioNet::SendData(uint8_t* data, uint64_t bytes)
+	{
+		if(bytes > BufferSize - this->hdrsize)
+		{
+			Log(1, "Tried to transmit packet larger than %d bytes long, exceeds buffer size -- aborting transmit", BufferSize - this->hdrsize);
+			return;
+		}
+
+		LockSpinlock(this->txwait.lock);
+
+		this->ReapTransmit();
+		while(this->txnumfree == 0)
+		{
+			// everything's still out, so kick whatever's been posted and wait for the device to give one back.
+			this->txqueue->Kick();
+
+			if(this->txqueue->EnableInterrupts())
+				Multitasking::SleepOn(this->txwait);
+
+			this->txqueue->DisableInterrupts();
+			this->ReapTransmit();
+		}
+
+		uint16_t buf = this->txfree[--this->txnumfree];
+		this->txsenders++;
+		UnlockSpinlock(this->txwait.lock);
+
+		uint8_t* out = (uint8_t*) (this->txbuffers.virt + (buf * BufferSize));
+		uint64_t phys = this->txbuffers.phys + (buf * BufferSize);
+
+		Memory::Set(out, 0, this->hdrsize);
+		Memory::Copy(out + this->hdrsize, data, bytes);
+
+		Virtio::Segment segs[2] = {
+			{ phys, (uint32_t) this->hdrsize, false },
+			{ phys + this->hdrsize, (uint32_t) bytes, false },
+		};
+
+		LockSpinlock(this->txwait.lock);
+		{
+			bool ok = this->txqueue->Post(segs, 2, (void*) ((uint64_t) buf + 1));
+			assert(ok);
+
+			this->txsenders--;
+			if(this->txsenders == 0)
+				this->txqueue->Kick();
+		}
+		UnlockSpinlock(this->txwait.lock);
+	}
+
+	IOResult VirtioNet::Read(uint64_t position, uint64_t outbuf, size_t bytes)
+	{
+		(void) position;
+		(void) outbuf;
+		(void) bytes;
+
+		// does nothing -- you can't read directly from an NIC anyway
+		return IOResult();
+	}
+
+	IOResult VirtioNet::Write(uint64_t position, uint64_t outbuf, size_t bytes)
+	{
+		(void) position;
+		this->SendData((uint8_t*) outbuf, bytes);
+
+		auto ret = IOResult();
+		ret.bytesTransferred = bytes;
+
+		return ret;
+	}
+
+	uint64_t VirtioNet::GetHardwareType()
+	{
+		return 0x1;
+	}
+
+	uint8_t* VirtioNet::GetMAC()
+	{
+		return this->MAC;
+	}
+
+	void VirtioNet::HandleInterrupt()
+	{
+		// the line might be shared; reading the isr clears it.
+		if(!this->transport->UsingMSIX() && !(this->transport->ReadISR() & ISR_QUEUE))
+			return;
+
+		LockSpinlock(this->rxlock);
+		if(!this->rxscheduled && this->rxqueue->Pending())
+		{
+			this->rxscheduled = true;
+			this->rxqueue->DisableInterrupts();
+
+			JobDispatch::AddJob(JobDispatch::Job(&JobHandler, this, 0));
+		}
+		UnlockSpinlock(this->rxlock);
+
+		// a sender waiting for a buffer.
+		LockSpinlock(this->txwait.lock);
+		bool wake = this->txqueue->Pending();
+		UnlockSpinlock(this->txwait.lock);
+
+		if(wake)
+			Multitasking::WakeAll(this->txwait);
+	}
+}
+}
+}
+}
@@ -8,11 +8,13 @@
 
 #include <Kernel.hpp>
 #include <HardwareAbstraction/Devices/IOPort.hpp>
+#include <HardwareAbstraction/Devices/APIC.hpp>
 #include <Utility.hpp>
 #include <StandardIO.hpp>
 
 using namespace Kernel;
 using namespace Kernel::HardwareAbstraction::Devices;
+using namespace Kernel::HardwareAbstraction::MemoryManager;
 
 
 namespace Kernel {
@@ -33,26 +35,15 @@ namespace PCI
 	}
 
 
+	// everything below is cached when the device is found, so searching doesn't touch config space.
 	rde::list<PCIDevice*>* SearchByVendorDevice(uint16_t VendorID, uint16_t DeviceID)
 	{
 		rde::list<PCIDevice*>* ret = new rde::list<PCIDevice*>();
 
 		for(auto dev : *PCIDevice::PCIDevices)
 		{
-
-			uint16_t bus 	= 0;
-			uint16_t slot	= 0;
-			uint8_t func	= 0;
-			uint16_t vendor	= 0;
-			uint16_t device	= 0;
-
-
-			bus = dev->GetBus();
-			slot = dev->GetSlot();
-			func = dev->GetFunction();
-
-			vendor = PCI::ReadConfig16(PCI::MakeAddr(bus, slot, func), 0);
-			device = (uint16_t)(PCI::ReadConfig32(PCI::MakeAddr(bus, slot, func), 0) >> 16);
+			uint16_t vendor = dev->GetVendorID();
+			uint16_t device = dev->GetDeviceID();
 
 			if(vendor == (VendorID == 0xFFFF ? vendor : VendorID) && device == (DeviceID == 0xFFFF ? device : DeviceID))
 				ret->push_back(dev);
@@ -65,22 +56,10 @@ namespace PCI
 	{
 		rde::list<PCIDevice*>* ret = new rde::list<PCIDevice*>();
 
-
 		for(auto dev : *PCIDevice::PCIDevices)
 		{
-			uint16_t bus		= 0;
-			uint16_t slot		= 0;
-			uint8_t func		= 0;
-			uint16_t tClass		= 0;
-			uint16_t tSubclass	= 0;
-
-			bus = dev->GetBus();
-			slot = dev->GetSlot();
-			func = dev->GetFunction();
-
-
-			tClass = (uint8_t)(ReadConfig32(MakeAddr(bus, slot, func), 0x08) >> 24);
-			tSubclass = (uint8_t)(ReadConfig32(MakeAddr(bus, slot, func), 0x08) >> 16);
+			uint8_t tClass = dev->GetClass();
+			uint8_t tSubclass = dev->GetSubclass();
 
 			if(tClass == (c == 0xFF ? tClass : c) && tSubclass == (sc == 0xFF ? tSubclass : sc))
 				ret->push_back(dev);
@@ -109,24 +88,92 @@ namespace PCI
 		return (uint32_t)(((uint32_t) Bus << 16) | ((uint32_t) Slot << 11) | ((uint32_t) Function << 8) | ((uint32_t)1 << 31));
 	}
 
+
+
+	// pci express lets config space be read like memory, 4k per function, and the mcfg table says where.
+	// each bus is mapped the first time something looks at it. without it, we're back to the ports,
+	// which only reach the first 256 bytes, and only a dword at a time.
+	static uint64_t ECAMBase		= 0;
+	static uint8_t ECAMStartBus		= 0;
+	static uint8_t ECAMEndBus		= 0;
+	static uint64_t ECAMMapped[256 / 64];
+
+	static volatile uint8_t* GetECAM(uint32_t Address, uint16_t Offset)
+	{
+		uint8_t bus = (uint8_t) (Address >> 16);
+		if(ECAMBase == 0 || bus < ECAMStartBus || bus > ECAMEndBus)
+			return 0;
+
+		// the base is where bus 0 would be, even if the range starts further up.
+		uint64_t busbase = ECAMBase + ((uint64_t) bus << 20);
+		if(!(ECAMMapped[bus / 64] & (1ULL << (bus % 64))))
+		{
+			MemoryManager::Virtual::MapIO(busbase, 0x100000);
+			__sync_fetch_and_or(&ECAMMapped[bus / 64], 1ULL << (bus % 64));
+		}
+
+		// slot and function are already where they need to be, they're just 4 bits further up here.
+		return (volatile uint8_t*) MemoryManager::Virtual::PhysToDirect(busbase + ((uint64_t) (Address & 0xFF00) << 4) + Offset);
+	}
+
+	static void UseMCFG()
+	{
+		if(!Kernel::RootACPITable)
+			return;
+
+		for(auto sdt : Kernel::RootACPITable->tables)
+		{
+			if(sdt->signature[0] != 'M' || sdt->signature[1] != 'C' || sdt->signature[2] != 'F' || sdt->signature[3] != 'G')
+				continue;
+
+			// we only know about segment group 0, which is the only one that the ports can reach anyway.
+			for(auto alloc : ((ACPI::MCFGTable*) sdt->table)->allocations)
+			{
+				if(alloc.segmentGroup != 0)
+					continue;
+
+				ECAMBase = alloc.baseAddress;
+				ECAMStartBus = alloc.startBus;
+				ECAMEndBus = alloc.endBus;
+
+				Log("PCI: memory-mapped config space at %x, buses %d to %d", ECAMBase, ECAMStartBus, ECAMEndBus);
+				return;
+			}
+		}
+	}
+
+	bool HasExtendedConfig()
+	{
+		return ECAMBase != 0;
+	}
+
 	// READ REGISTERS
 
 	uint32_t ReadConfig32(uint32_t Address, uint16_t Offset)
 	{
-		IOPort::Write32(0xCF8, Address + Offset);
+		if(volatile uint8_t* ecam = GetECAM(Address, Offset & 0xFFC))
+			return *((volatile uint32_t*) ecam);
+
+		IOPort::Write32(0xCF8, Address + (Offset & 0xFC));
 		return IOPort::Read32(0xCFC);
 	}
 
 	uint16_t ReadConfig16(uint32_t Address, uint16_t Offset)
 	{
-		IOPort::Write32(0xCF8, Address + Offset);
-		return (uint16_t) IOPort::Read32(0xCFC);
+		if(volatile uint8_t* ecam = GetECAM(Address, Offset & 0xFFE))
+			return *((volatile uint16_t*) ecam);
+
+		IOPort::Write32(0xCF8, Address + (Offset & 0xFC));
+		return (uint16_t) (IOPort::Read32(0xCFC) >> ((Offset & 0x2) * 8));
 	}
 
 	uint8_t ReadConfig8(uint32_t Address, uint16_t Offset)
 	{
-		IOPort::Write32(0xCF8, Address + Offset);
-		return (uint8_t) IOPort::Read32(0xCFC);
+		if(volatile uint8_t* ecam = GetECAM(Address, Offset))
+			return *ecam;
+
+		IOPort::Write32(0xCF8, Address + (Offset & 0xFC));
+		return (uint8_t) (IOPort::Read32(0xCFC) >> ((Offset & 0x3) * 8));
 	}
 
 
@@ -139,23 +186,48 @@ namespace PCI
 	void WriteConfig32(uint32_t Address, uint16_t Offset, uint32_t Data)
 	{
 		using namespace Kernel::HardwareAbstraction::Devices::IOPort;
+		if(volatile uint8_t* ecam = GetECAM(Address, Offset & 0xFFC))
+		{
+			*((volatile uint32_t*) ecam) = Data;
+			return;
+		}
+
 		// Write the address to read.
-		Write32(0xCF8, Address + Offset);
+		Write32(0xCF8, Address + (Offset & 0xFC));
 		Write32(0xCFC, Data);
 	}
 
 	void WriteConfig16(uint32_t Address, uint16_t Offset, uint16_t Data)
 	{
 		using namespace Kernel::HardwareAbstraction::Devices::IOPort;
-		Write32(0xCF8, Address + Offset);
-		Write32(0xCFC, (uint32_t) Data);
+		if(volatile uint8_t* ecam = GetECAM(Address, Offset & 0xFFE))
+		{
+			*((volatile uint16_t*) ecam) = Data;
+			return;
+		}
+
+		// the ports only do whole dwords, so keep the other half.
+		uint8_t shift = (uint8_t) ((Offset & 0x2) * 8);
+		Write32(0xCF8, Address + (Offset & 0xFC));
+
+		uint32_t old = Read32(0xCFC) & ~(0xFFFFU << shift);
+		Write32(0xCFC, old | ((uint32_t) Data << shift));
 	}
 
 	void WriteConfig8(uint32_t Address, uint16_t Offset, uint8_t Data)
 	{
 		using namespace Kernel::HardwareAbstraction::Devices::IOPort;
-		Write32(0xCF8, Address + Offset);
-		Write32(0xCFC, (uint32_t) Data);
+		if(volatile uint8_t* ecam = GetECAM(Address, Offset))
+		{
+			*ecam = Data;
+			return;
+		}
+
+		uint8_t shift = (uint8_t) ((Offset & 0x3) * 8);
+		Write32(0xCF8, Address + (Offset & 0xFC));
+
+		uint32_t old = Read32(0xCFC) & ~(0xFFU << shift);
+		Write32(0xCFC, old | ((uint32_t) Data << shift));
 	}
 
 	uint16_t CheckDeviceExistence(uint16_t Bus, uint16_t Slot)
@@ -169,62 +241,83 @@ namespace PCI
 			return 1;
 	}
 
-	void Initialise()
-	{
-		uint16_t vendor = 0;
-		uint8_t headertype = 0;
-		// PCIDevice::PCIDevices = new Library::LinkedList<PCIDevice>();
-		PCIDevice::PCIDevices = new rde::list<PCIDevice*>();
 
-		Log("Scanning PCI bus:");
-		for(uint16_t bus = 0; bus < 256; bus++)
-		{
-			for(uint16_t slot = 0; slot < 32; slot++)
-			{
-				if(PCI::CheckDeviceExistence(bus, slot))
-				{
-					vendor = PCI::ReadConfig16(PCI::MakeAddr(bus, slot, 0), 0);
-					headertype = (uint8_t)(PCI::ReadConfig32(PCI::MakeAddr(bus, slot, 0), 0x0C) >> 16);
 
-					using PCI::PCIDevice;
-					PCIDevice* curdev = new PCI::PCIDevice(bus, slot, 0);
-					// PCIDevice::PCIDevices->push_back(curdev);
-					PCIDevice::PCIDevices->push_back(curdev);
 
+	// only buses that something actually leads to get looked at: the root bus, and whatever's behind each
+	// pci-to-pci bridge we find on the way.
+	static void ScanBus(uint16_t bus);
+
+	static void ScanFunction(uint16_t bus, uint16_t slot, uint8_t func)
+	{
+		PCIDevice* dev = new PCIDevice(bus, slot, func);
+		PCIDevice::PCIDevices->push_back(dev);
+
+		if(func == 0)
+		{
+			Log("=> /dev/pci%d > %d:%d, v:%#04x, d:%#04x, c:%#02x:%#02x h:%#02x",
+				bus * 32 + slot, bus, slot, dev->GetVendorID(), dev->GetDeviceID(), dev->GetClass(), dev->GetSubclass(),
+				dev->GetHeaderType());
+		}
+		else
+		{
+			Log("\t=> /dev/pci%df%d > %d:%d, v:%#04x, d:%#04x, c:%#02x:%#02x h:%#02x",
+				bus * 32 + slot, func, bus, slot, dev->GetVendorID(), dev->GetDeviceID(), dev->GetClass(), dev->GetSubclass(),
+				dev->GetHeaderType());
+		}
 
-					uint8_t cl = curdev->GetClass();
-					uint8_t sb = curdev->GetSubclass();
-					uint16_t devid = curdev->GetDeviceID();
+		// the secondary bus number; firmware numbers them depth-first, so anything not past us is bogus (or a loop).
+		if(dev->GetClass() == 0x06 && dev->GetSubclass() == 0x04 && dev->GetHeaderType() == 0x1)
+		{
+			uint16_t secondary = ReadConfig8(dev->GetAddress(), 0x19);
+			if(secondary > bus)
+				ScanBus(secondary);
+		}
+	}
 
-					Log("=> /dev/pci%d > %d:%d, v:%#04x, d:%#04x, c:%#02x:%#02x h:%#02x",
-						bus * 32 + slot, bus, slot, vendor, devid, cl, sb, headertype);
+	static void ScanSlot(uint16_t bus, uint16_t slot)
+	{
+		if(!CheckDeviceExistence(bus, slot))
+			return;
 
+		ScanFunction(bus, slot, 0);
 
+		if(ReadConfig8(MakeAddr(bus, slot, 0), 0x0E) & (1 << 7))
+		{
+			for(uint8_t func = 1; func < MAXFUNC; func++)
+			{
+				if(ReadConfig16(MakeAddr(bus, slot, func), 0) != 0xFFFF)
+					ScanFunction(bus, slot, func);
+			}
+		}
+	}
 
+	static void ScanBus(uint16_t bus)
+	{
+		for(uint16_t slot = 0; slot < MAXSLOT; slot++)
+			ScanSlot(bus, slot);
+	}
 
-					if((headertype) & (1 << 7))
-					{
-						for(uint8_t func = 1; func < 8; func++)
-						{
-							vendor = PCI::ReadConfig16(PCI::MakeAddr(bus, slot, func), 0);
-							if(vendor != 0xFFFF)
-							{
-								PCIDevice* devfunc = new PCI::PCIDevice(bus, slot, func);
-								// PCIDevice::PCIDevices->push_back(devfunc);
-								PCIDevice::PCIDevices->push_back(devfunc);
+	void Initialise()
+	{
+		PCIDevice::PCIDevices = new rde::list<PCIDevice*>();
+		UseMCFG();
 
-								cl = devfunc->GetClass();
-								sb = devfunc->GetSubclass();
-								devid = devfunc->GetDeviceID();
+		Log("Scanning PCI bus:");
 
-								Log("\t=> /dev/pci%df%d > %d:%d, v:%#04x, d:%#04x, c:%#02x:%#02x h:%#02x",
-									bus * 32 + slot, func, bus, slot, vendor, devid, cl, sb, headertype);
-							}
-						}
-					}
-				}
+		// a multifunction host bridge means more than one host controller, each function with its own root bus.
+		if(ReadConfig8(MakeAddr(0, 0, 0), 0x0E) & (1 << 7))
+		{
+			for(uint8_t func = 0; func < MAXFUNC; func++)
+			{
+				if(ReadConfig16(MakeAddr(0, 0, func), 0) != 0xFFFF)
+					ScanBus(func);
 			}
 		}
+		else
+		{
+			ScanBus(0);
+		}
 	}
 
 
@@ -241,13 +334,22 @@ namespace PCI
 		this->Function		= f;
 
 		this->Address		= MakeAddr(this->Bus, this->Slot, this->Function);
-		this->VendorID		= ReadConfig16(this->Address, 0x00);
-		this->DeviceID		= (uint16_t) (ReadConfig32(this->Address, 0x00) >> 16);
-		this->Class			= (uint8_t) (ReadConfig32(this->Address, 0x08) >> 24);
-		this->Subclass		= (uint8_t) (ReadConfig32(this->Address, 0x08) >> 16);
-		this->ProgIF		= (uint8_t) (ReadConfig32(this->Address, 0x08) >> 8);
-		this->InterruptLine	= (uint8_t) (ReadConfig8(this->Address, 0x3C));
-		this->InterruptPin	= (uint8_t) (ReadConfig32(this->Address, 0x3C + 0x1) >> 8);
+
+		// a dword at a time, so it's four reads whether or not config space is memory-mapped.
+		uint32_t id			= ReadConfig32(this->Address, 0x00);
+		uint32_t classcode	= ReadConfig32(this->Address, 0x08);
+		uint32_t header		= ReadConfig32(this->Address, 0x0C);
+		uint32_t interrupt	= ReadConfig32(this->Address, 0x3C);
+
+		this->VendorID		= (uint16_t) id;
+		this->DeviceID		= (uint16_t) (id >> 16);
+		this->Class			= (uint8_t) (classcode >> 24);
+		this->Subclass		= (uint8_t) (classcode >> 16);
+		this->ProgIF		= (uint8_t) (classcode >> 8);
+		this->HeaderType	= (uint8_t) (header >> 16);
+		this->InterruptLine	= (uint8_t) interrupt;
+		this->InterruptPin	= (uint8_t) (interrupt >> 8);
+		this->MSIXTable		= 0;
 	}
 
 
@@ -322,21 +424,16 @@ namespace PCI
 		return mem;
 	}
 
-	bool PCIDevice::GetIsMultifunction(){ return (uint8_t)(ReadConfig32(this->Address, 0x0C) >> 16) & (1 << 7); }
+	bool PCIDevice::GetIsMultifunction(){ return this->HeaderType & (1 << 7); }
 
 	uint8_t PCIDevice::GetHeaderType()
 	{
-		return (uint8_t)(ReadConfig32(this->Address, 0x0C) >> 16) & ~(1 << 7);
+		return this->HeaderType & ~(1 << 7);
 	}
 
 	uint32_t PCIDevice::GetRegisterData(uint16_t Offset, uint8_t FirstBit, uint8_t Length)
 	{
-		// Write the address to read.
-		IOPort::Write32(0xCF8, this->Address + Offset);
-
-		// Read the shit inside.
-
-		uint32_t Data = IOPort::Read32(0xCFC);
+		uint32_t Data = ReadConfig32(this->Address, Offset);
 
 		// Truncate accordingly
 		switch(Length)
@@ -356,9 +453,6 @@ namespace PCI
 
 	void PCIDevice::WriteRegisterData(uint16_t Offset, uint8_t FirstBit, uint8_t Length, uint32_t Value)
 	{
-		// Write the address to read.
-		IOPort::Write32(0xCF8, this->Address + Offset);
-
 		// Truncate accordingly
 		switch(Length)
 		{
@@ -372,8 +466,7 @@ namespace PCI
 		}
 
 		Value >>= FirstBit;
-
-		IOPort::Write32(0xCFC, Value);
+		WriteConfig32(this->Address, Offset, Value);
 	}
 
 
@@ -402,6 +495,165 @@ namespace PCI
 	{
 		this->InterruptLine = line;
 	}
+
+
+
+
+	// capabilities. config space only does aligned dwords, so everything here reads and writes whole ones.
+	uint8_t PCIDevice::FindCapability(uint8_t id)
+	{
+		// bit 4 of the status register says whether there's a list at all.
+		if(!((ReadConfig32(this->Address, 0x04) >> 16) & 0x10))
+			return 0;
+
+		uint8_t ptr = (uint8_t) (ReadConfig32(this->Address, 0x34) & 0xFC);
+
+		// there can't be more than this many in config space, so stop if the list goes round in circles.
+		for(int i = 0; i < 48 && ptr != 0; i++)
+		{
+			uint32_t cap = ReadConfig32(this->Address, ptr);
+			if((cap & 0xFF) == id)
+				return ptr;
+
+			ptr = (uint8_t) ((cap >> 8) & 0xFC);
+		}
+
+		return 0;
+	}
+
+	uint16_t PCIDevice::FindExtendedCapability(uint16_t id)
+	{
+		if(!HasExtendedConfig())
+			return 0;
+
+		// these start at 0x100, with a 16-bit id and the next one's offset in the top 12 bits.
+		uint16_t ptr = 0x100;
+		for(int i = 0; i < 960 && ptr >= 0x100; i++)
+		{
+			uint32_t cap = ReadConfig32(this->Address, ptr);
+			if(cap == 0 || cap == 0xFFFFFFFF)
+				return 0;
+
+			if((cap & 0xFFFF) == id)
+				return ptr;
+
+			ptr = (uint16_t) ((cap >> 20) & 0xFFC);
+		}
+
+		return 0;
+	}
+
+	// the message control word is the top half of the first dword; the bottom half is read-only.
+	static uint16_t ReadMessageControl(uint32_t addr, uint8_t cap)
+	{
+		return (uint16_t) (ReadConfig32(addr, cap) >> 16);
+	}
+
+	static void WriteMessageControl(uint32_t addr, uint8_t cap, uint16_t control)
+	{
+		WriteConfig32(addr, cap, (ReadConfig32(addr, cap) & 0xFFFF) | ((uint32_t) control << 16));
+	}
+
+	static void DisablePin(uint32_t addr)
+	{
+		// interrupt disable in the command register. the status half is write-one-to-clear, so zeroes leave it alone.
+		WriteConfig32(addr, 0x04, (ReadConfig32(addr, 0x04) & 0xFFFF) | 0x400);
+	}
+
+	static void EnablePin(uint32_t addr)
+	{
+		WriteConfig32(addr, 0x04, ReadConfig32(addr, 0x04) & 0xFBFF);
+	}
+
+	static uint32_t MessageAddress(uint32_t apicid)
+	{
+		// fixed delivery, physical destination mode.
+		return 0xFEE00000 | (apicid << 12);
+	}
+
+	bool PCIDevice::EnableMSI(uint8_t vector)
+	{
+		uint8_t cap = this->FindCapability(PCI_CAP_MSI);
+		if(cap == 0)
+			return false;
+
+		uint16_t control = ReadMessageControl(this->Address, cap);
+
+		// with a 64-bit address, the data moves down a dword.
+		uint8_t data = (uint8_t) (cap + 0x8);
+		WriteConfig32(this->Address, cap + 0x4, MessageAddress(LocalAPIC::GetID()));
+
+		if(control & 0x80)
+		{
+			WriteConfig32(this->Address, cap + 0x8, 0);
+			data = (uint8_t) (cap + 0xC);
+		}
+
+		WriteConfig32(this->Address, data, (ReadConfig32(this->Address, data) & 0xFFFF0000) | vector);
+
+		// just the one message, then switch it on.
+		WriteMessageControl(this->Address, cap, (uint16_t) ((control & ~0x70) | 0x1));
+		DisablePin(this->Address);
+
+		return true;
+	}
+
+	uint16_t PCIDevice::GetMSIXCount()
+	{
+		uint8_t cap = this->FindCapability(PCI_CAP_MSIX);
+		if(cap == 0)
+			return 0;
+
+		return (uint16_t) ((ReadMessageControl(this->Address, cap) & 0x7FF) + 1);
+	}
+
+	bool PCIDevice::EnableMSIX(uint16_t entry, uint8_t vector, uint32_t apicid)
+	{
+		uint8_t cap = this->FindCapability(PCI_CAP_MSIX);
+		uint16_t count = this->GetMSIXCount();
+
+		if(cap == 0 || entry >= count)
+			return false;
+
+		// each entry is four dwords: address (low, high), data, and a mask bit in the last one.
+		if(!this->MSIXTable)
+		{
+			// the table is somewhere in one of the memory bars.
+			uint32_t table = ReadConfig32(this->Address, cap + 0x4);
+			uint64_t phys = this->GetBAR((uint8_t) (table & 0x7)) + (table & ~0x7U);
+
+			this->MSIXTable = (volatile uint32_t*) Virtual::MapIO(phys, count * 16);
+
+			// everything starts masked, and each entry comes on as it's set up.
+			for(uint16_t i = 0; i < count; i++)
+				this->MSIXTable[(i * 4) + 3] |= 0x1;
+
+			uint16_t control = ReadMessageControl(this->Address, cap);
+			WriteMessageControl(this->Address, cap, (uint16_t) ((control | 0x8000) & ~0x4000));
+			DisablePin(this->Address);
+		}
+
+		volatile uint32_t* e = &this->MSIXTable[entry * 4];
+		e[0] = MessageAddress(apicid);
+		e[1] = 0;
+		e[2] = vector;
+		e[3] &= ~0x1U;
+
+		return true;
+	}
+
+	void PCIDevice::DisableMSIX()
+	{
+		uint8_t cap = this->FindCapability(PCI_CAP_MSIX);
+		if(cap == 0 || !this->MSIXTable)
+			return;
+
+		// the table stays in the direct map, and gets masked again if it's ever turned back on.
+		WriteMessageControl(this->Address, cap, (uint16_t) (ReadMessageControl(this->Address, cap) & ~0x8000));
+		EnablePin(this->Address);
+
+		this->MSIXTable = 0;
+	}
 };
 }
 }
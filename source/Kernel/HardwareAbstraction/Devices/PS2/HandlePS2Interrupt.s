@@ -10,6 +10,11 @@
 
 
 ASM_HandlePS2IRQ1:
+	// coming from ring 3, swap in the kernel's gs (and back out on the way out).
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	push %r15
 	push %r14
 	push %r13
@@ -47,9 +52,17 @@ ASM_HandlePS2IRQ1:
 	pop %r13
 	pop %r14
 	pop %r15
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	iretq
 
 ASM_HandlePS2IRQ12:
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	push %r15
 	push %r14
 	push %r13
@@ -89,4 +102,8 @@ ASM_HandlePS2IRQ12:
 	pop %r13
 	pop %r14
 	pop %r15
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	iretq
@@ -7,6 +7,11 @@
 
 
 RTCHandler:
+	// coming from ring 3, swap in the kernel's gs (and back out on the way out).
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	push %rax
 	push %rbx
 	push %rcx
@@ -25,4 +30,8 @@ RTCHandler:
 	pop %rcx
 	pop %rbx
 	pop %rax
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	iretq
@@ -0,0 +1,679 @@
+// AHCI.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <Kernel.hpp>
+#include <HardwareAbstraction/Devices/StorageDevice.hpp>
+#include <HardwareAbstraction/Devices/CommandQueue.hpp>
+#include <HardwareAbstraction/Interrupts.hpp>
+#include <StandardIO.hpp>
+#include <stdlib.h>
+
+// sata disks behind an ahci controller.
+
+// each port has a list of 32 command slots, and the hba works through whichever ones we've marked as issued. with
+// ncq, the disk itself takes up to 32 of them at once and finishes them in whatever order suits it. how requests
+// are split up and kept going is in CommandQueue.cpp; here, a command is one slot.
+
+// the prdt for each command points straight at the caller's pages. an hba without 64-bit addressing gets a page
+// below 4gb for each page above it, and nothing else.
+
+// when a queued command fails, the disk drops all the others it had, and won't take anything more until the ncq
+// error log (page 10h) has been read. that says which tag failed; only that one fails, and the rest are reissued.
+
+using namespace Kernel::HardwareAbstraction::MemoryManager;
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Devices {
+namespace Storage
+{
+	rde::vector<AHCIDrive*>* AHCIDrive::AHCIDrives;
+
+	namespace AHCI
+	{
+		enum Registers
+		{
+			CAP				= 0x00,
+			GHC				= 0x04,
+			IS				= 0x08,
+			PI				= 0x0C,
+			VS				= 0x10,
+		};
+
+		enum PortRegisters
+		{
+			CLB				= 0x00,
+			CLBU			= 0x04,
+			FB				= 0x08,
+			FBU				= 0x0C,
+			PIS				= 0x10,
+			PIE				= 0x14,
+			PCMD			= 0x18,
+			TFD				= 0x20,
+			SIG				= 0x24,
+			SSTS			= 0x28,
+			SERR			= 0x30,
+			SACT			= 0x34,
+			CI				= 0x38,
+		};
+
+		#define CAP_S64A			(1U << 31)
+		#define CAP_SNCQ			(1U << 30)
+		#define GHC_AE				(1U << 31)
+		#define GHC_IE				(1U << 1)
+
+		#define PCMD_ST				(1U << 0)
+		#define PCMD_FRE			(1U << 4)
+		#define PCMD_FR				(1U << 14)
+		#define PCMD_CR				(1U << 15)
+
+		#define PIS_TFES			(1U << 30)
+		#define PIS_ERRORS			(PIS_TFES | (1U << 29) | (1U << 28) | (1U << 27))
+		#define PIS_COMPLETIONS		((1U << 0) | (1U << 1) | (1U << 2) | (1U << 3) | (1U << 5))
+
+		#define TFD_BSY				0x80
+		#define TFD_DRQ				0x08
+
+		#define SIG_ATA				0x00000101
+
+		const uint8_t ATA_Identify				= 0xEC;
+		const uint8_t ATA_ReadLogExt			= 0x2F;
+		const uint8_t ATA_ReadDMAExt			= 0x25;
+		const uint8_t ATA_WriteDMAExt			= 0x35;
+		const uint8_t ATA_ReadFPDMAQueued		= 0x60;
+		const uint8_t ATA_WriteFPDMAQueued		= 0x61;
+
+		struct CommandHeader
+		{
+			uint16_t flags;
+			uint16_t prdtl;
+			volatile uint32_t prdbc;
+			uint32_t ctba;
+			uint32_t ctbau;
+			uint32_t reserved[4];
+
+		} __attribute__((packed));
+
+		struct PRDEntry
+		{
+			uint32_t dba;
+			uint32_t dbau;
+			uint32_t reserved;
+			uint32_t dbc;
+
+		} __attribute__((packed));
+
+		// one page per slot; the prdt takes up whatever's left after the fis area.
+		#define PRDsPerTable		((0x1000 - 0x80) / sizeof(PRDEntry))
+
+		struct CommandTable
+		{
+			uint8_t cfis[64];
+			uint8_t acmd[16];
+			uint8_t reserved[48];
+			PRDEntry prdt[PRDsPerTable];
+
+		} __attribute__((packed));
+
+		// a buffer that isn't physically contiguous takes an entry per page, plus one if it doesn't start on one.
+		static const uint64_t MaxCommandBytes	= (PRDsPerTable - 1) * 0x1000;
+		static const uint64_t MaxPRDBytes		= 0x400000;
+
+		// how long to poll for the error log before giving up on it (and failing everything outstanding).
+		static const uint64_t ErrorLogSpins		= 1000000;
+
+		// a page below 4gb standing in for one above it, for hbas without 64-bit addressing.
+		struct Bounce
+		{
+			uint64_t low;
+			uint64_t high;
+			uint32_t len;
+			bool copyback;
+		};
+
+		struct Controller;
+		struct Port : CommandSlots
+		{
+			Controller* hba;
+			volatile uint8_t* regs;
+			uint8_t num;
+
+			uint64_t cmdlist;
+			uint64_t tables[32];
+
+			bool ncq;
+
+			// with ncq, a slot kept out of 'mask' for reading the error log, and the page it reads into.
+			uint32_t recovery;
+			uint64_t errorlog;
+
+			// only touched by whoever holds the slot.
+			rde::vector<Bounce> bounced[32];
+
+			uint64_t sectors;
+			uint32_t sectorsize;
+
+			// under waiters.lock, which the interrupt handler takes too.
+			uint32_t issued;
+		};
+
+		struct Controller
+		{
+			PCI::PCIDevice* pci;
+			volatile uint8_t* abar;
+			bool s64a;
+
+			Port* ports[32];
+		};
+
+		static uint32_t ReadReg(volatile uint8_t* base, uint32_t reg)
+		{
+			return *((volatile uint32_t*) (base + reg));
+		}
+
+		static void WriteReg(volatile uint8_t* base, uint32_t reg, uint32_t val)
+		{
+			*((volatile uint32_t*) (base + reg)) = val;
+		}
+
+		static CommandHeader* Header(Port* port, uint32_t slot)
+		{
+			return &((CommandHeader*) Virtual::PhysToDirect(port->cmdlist))[slot];
+		}
+
+		static void StopPort(Port* port)
+		{
+			uint32_t cmd = ReadReg(port->regs, PCMD);
+			WriteReg(port->regs, PCMD, cmd & ~PCMD_ST);
+			while(ReadReg(port->regs, PCMD) & PCMD_CR)
+				asm volatile("pause");
+
+			cmd = ReadReg(port->regs, PCMD);
+			WriteReg(port->regs, PCMD, cmd & ~PCMD_FRE);
+			while(ReadReg(port->regs, PCMD) & PCMD_FR)
+				asm volatile("pause");
+		}
+
+		static void StartPort(Port* port)
+		{
+			while(ReadReg(port->regs, TFD) & (TFD_BSY | TFD_DRQ))
+				asm volatile("pause");
+
+			WriteReg(port->regs, SERR, 0xFFFFFFFF);
+			WriteReg(port->regs, PIS, 0xFFFFFFFF);
+
+			WriteReg(port->regs, PCMD, ReadReg(port->regs, PCMD) | PCMD_FRE);
+			WriteReg(port->regs, PCMD, ReadReg(port->regs, PCMD) | PCMD_ST);
+		}
+
+		// after a queued command fails, with the port restarted: which tag it was, or -1 if we can't tell. this runs in
+		// the interrupt handler, so it's polled.
+		static int ReadErrorLog(Port* port)
+		{
+			uint32_t slot = port->recovery;
+			uint32_t bit = (1U << slot);
+
+			CommandHeader* hdr = Header(port, slot);
+			CommandTable* tbl = (CommandTable*) Virtual::PhysToDirect(port->tables[slot]);
+			uint8_t* log = (uint8_t*) Virtual::PhysToDirect(port->errorlog);
+
+			tbl->prdt[0].dba = (uint32_t) port->errorlog;
+			tbl->prdt[0].dbau = (uint32_t) (port->errorlog >> 32);
+			tbl->prdt[0].reserved = 0;
+			tbl->prdt[0].dbc = 511;
+
+			// one 512-byte page of log 10h, whatever the sector size.
+			uint8_t* fis = tbl->cfis;
+			Memory::Set(fis, 0, sizeof(tbl->cfis));
+
+			fis[0] = 0x27;
+			fis[1] = 0x80;
+			fis[2] = ATA_ReadLogExt;
+			fis[4] = 0x10;
+			fis[12] = 1;
+
+			hdr->flags = 5;
+			hdr->prdtl = 1;
+			hdr->prdbc = 0;
+
+			WriteReg(port->regs, CI, bit);
+			for(uint64_t spins = 0; ReadReg(port->regs, CI) & bit; spins++)
+			{
+				if(spins == ErrorLogSpins || (ReadReg(port->regs, PIS) & PIS_TFES))
+				{
+					Log(1, "AHCI: couldn't read the ncq error log on port %d", port->num);
+
+					StopPort(port);
+					StartPort(port);
+					return -1;
+				}
+
+				asm volatile("pause");
+			}
+
+			WriteReg(port->regs, PIS, ReadReg(port->regs, PIS));
+
+			// the top bit means it wasn't a queued command after all.
+			if(log[0] & 0x80)
+				return -1;
+
+			return log[0] & 0x1F;
+		}
+
+		// call with the lock held. an error stops the port; without ncq (or if the error log doesn't say), it takes
+		// everything outstanding down with it.
+		static void Complete(Port* port, uint32_t is)
+		{
+			uint32_t active = ReadReg(port->regs, CI) | ReadReg(port->regs, SACT);
+			uint32_t finished = port->issued & ~active;
+
+			if(is & PIS_ERRORS)
+			{
+				Log(1, "AHCI: error on port %d (is: %x, tfd: %x, serr: %x)", port->num, is, ReadReg(port->regs, TFD),
+					ReadReg(port->regs, SERR));
+
+				uint32_t outstanding = port->issued & active;
+				uint32_t bad = outstanding;
+				uint32_t retry = 0;
+
+				StopPort(port);
+				StartPort(port);
+
+				if(port->ncq && outstanding)
+				{
+					int tag = ReadErrorLog(port);
+					if(tag >= 0 && (outstanding & (1U << tag)))
+					{
+						bad = (1U << tag);
+						retry = outstanding & ~bad;
+					}
+				}
+
+				port->failed |= bad;
+				finished = port->issued & ~retry;
+
+				// their command tables are still as we left them.
+				if(retry)
+				{
+					WriteReg(port->regs, SACT, retry);
+					WriteReg(port->regs, CI, retry);
+				}
+			}
+
+			port->issued &= ~finished;
+			port->done |= finished;
+		}
+
+		static void HandleInterrupt(void* arg)
+		{
+			Controller* hba = (Controller*) arg;
+
+			uint32_t pending = ReadReg(hba->abar, IS);
+			for(uint32_t i = 0; i < 32; i++)
+			{
+				Port* port = hba->ports[i];
+				if(!(pending & (1U << i)) || !port)
+					continue;
+
+				LockSpinlock(port->waiters.lock);
+				{
+					uint32_t is = ReadReg(port->regs, PIS);
+					WriteReg(port->regs, PIS, is);
+
+					Complete(port, is);
+				}
+				UnlockSpinlock(port->waiters.lock);
+
+				Multitasking::WakeAll(port->waiters);
+			}
+
+			WriteReg(hba->abar, IS, pending);
+		}
+
+		// fills in the command in 'slot' for 'len' bytes at 'buf' (in the current address space), at 'lba'. the buffer
+		// has to have been checked (and pinned, if it's userspace's) already.
+		static void Prepare(Port* port, uint32_t slot, uint8_t command, uint64_t lba, uint64_t buf, size_t len, bool write)
+		{
+			CommandHeader* hdr = Header(port, slot);
+			CommandTable* tbl = (CommandTable*) Virtual::PhysToDirect(port->tables[slot]);
+
+			uint16_t n = 0;
+			uint64_t phys = 0;
+			size_t run = 0;
+
+			// the device writes to the pages if we're reading.
+			Virtual::ScatterList sl(buf, len, 0, !write);
+			while(sl.NextPhysical(&phys, &run))
+			{
+				while(run > 0)
+				{
+					size_t l = __min(run, MaxPRDBytes);
+					uint64_t addr = phys;
+					assert(n < PRDsPerTable);
+
+					// a page at a time, at the same offset in the page so it stays word-aligned.
+					if(!port->hba->s64a && phys + l > 0x100000000ULL)
+					{
+						l = __min(run, 0x1000 - (phys & 0xFFF));
+						addr = Physical::AllocatePage(1, true) + (phys & 0xFFF);
+
+						if(write)
+							Memory::Copy(Virtual::PhysToDirect(addr), Virtual::PhysToDirect(phys), l);
+
+						port->bounced[slot].push_back({ addr, phys, (uint32_t) l, !write });
+					}
+
+					tbl->prdt[n].dba = (uint32_t) addr;
+					tbl->prdt[n].dbau = (uint32_t) (addr >> 32);
+					tbl->prdt[n].reserved = 0;
+					tbl->prdt[n].dbc = (uint32_t) (l - 1);
+
+					phys += l;
+					run -= l;
+					n++;
+				}
+			}
+
+			assert(!sl.Failed() && n > 0);
+			tbl->prdt[n - 1].dbc |= (1U << 31);
+
+			uint16_t count = (uint16_t) (len / port->sectorsize);
+			uint8_t* fis = tbl->cfis;
+			Memory::Set(fis, 0, sizeof(tbl->cfis));
+
+			fis[0] = 0x27;				// host to device register fis
+			fis[1] = 0x80;				// (this is a command)
+			fis[2] = command;
+			fis[7] = 0x40;				// lba mode
+
+			fis[4] = (uint8_t) (lba >> 0);
+			fis[5] = (uint8_t) (lba >> 8);
+			fis[6] = (uint8_t) (lba >> 16);
+			fis[8] = (uint8_t) (lba >> 24);
+			fis[9] = (uint8_t) (lba >> 32);
+			fis[10] = (uint8_t) (lba >> 40);
+
+			if(command == ATA_ReadFPDMAQueued || command == ATA_WriteFPDMAQueued)
+			{
+				// the count goes in the features, and the tag where the count would've been.
+				fis[3] = (uint8_t) (count & 0xFF);
+				fis[11] = (uint8_t) (count >> 8);
+				fis[12] = (uint8_t) (slot << 3);
+			}
+			else
+			{
+				fis[12] = (uint8_t) (count & 0xFF);
+				fis[13] = (uint8_t) (count >> 8);
+			}
+
+			hdr->flags = (uint16_t) (5 | (write ? 0x40 : 0));
+			hdr->prdtl = n;
+			hdr->prdbc = 0;
+		}
+
+		static void Issue(Port* port, uint32_t slot, bool queued)
+		{
+			LockSpinlock(port->waiters.lock);
+			{
+				port->issued |= (1U << slot);
+
+				if(queued)
+					WriteReg(port->regs, SACT, 1U << slot);
+
+				WriteReg(port->regs, CI, 1U << slot);
+			}
+			UnlockSpinlock(port->waiters.lock);
+		}
+
+		// waits for 'slot' to finish, then gives it back.
+		static bool Finish(Port* port, uint32_t slot)
+		{
+			bool ok = port->Wait(slot);
+
+			// still ours until it's released.
+			for(auto& b : port->bounced[slot])
+			{
+				if(ok && b.copyback)
+					Memory::Copy(Virtual::PhysToDirect(b.high), Virtual::PhysToDirect(b.low), b.len);
+
+				Physical::FreePage(b.low & I_AlignMask);
+			}
+
+			port->bounced[slot].clear();
+			port->Release(slot);
+
+			return ok;
+		}
+
+		class Commands : public CommandQueue
+		{
+			public:
+				// the hba wants word-aligned buffers (Prepare() deals with pages above 4gb by itself).
+				explicit Commands(Port* p) : CommandQueue(p->sectorsize, MaxCommandBytes, 2), port(p) { }
+
+				int TryStart(uint64_t lba, uint64_t buf, size_t len, bool write, uint64_t* slot) override
+				{
+					if(!this->port->TryClaim(slot))
+						return 0;
+
+					uint8_t command = this->port->ncq ? (write ? ATA_WriteFPDMAQueued : ATA_ReadFPDMAQueued)
+						: (write ? ATA_WriteDMAExt : ATA_ReadDMAExt);
+
+					Prepare(this->port, (uint32_t) *slot, command, lba, buf, len, write);
+					Issue(this->port, (uint32_t) *slot, this->port->ncq);
+					return 1;
+				}
+
+				void WaitForRoom(uint64_t, size_t, bool) override
+				{
+					this->port->WaitForFree();
+				}
+
+				bool Finish(uint64_t slot) override
+				{
+					return AHCI::Finish(this->port, (uint32_t) slot);
+				}
+
+			private:
+				Port* port;
+		};
+
+		static bool Identify(Port* port)
+		{
+			uint64_t page = Physical::AllocatePage(1, !port->hba->s64a);
+			uint16_t* id = (uint16_t*) Virtual::PhysToDirect(page);
+			Memory::Set(id, 0, 0x1000);
+
+			// not queued, and we don't know the sector size yet.
+			port->sectorsize = 512;
+
+			uint64_t slot = 0;
+			while(!port->TryClaim(&slot))
+				port->WaitForFree();
+
+			Prepare(port, (uint32_t) slot, ATA_Identify, 0, (uint64_t) id, 512, false);
+			Issue(port, (uint32_t) slot, false);
+
+			bool ok = Finish(port, (uint32_t) slot);
+			if(ok)
+			{
+				if(id[83] & (1 << 10))	port->sectors = *((uint64_t*) &id[100]);
+				else					port->sectors = *((uint32_t*) &id[60]);
+
+				// logical sectors longer than 256 words.
+				if((id[106] & 0xC000) == 0x4000 && (id[106] & (1 << 12)))
+					port->sectorsize = (uint32_t) (id[117] | ((uint32_t) id[118] << 16)) * 2;
+
+				// the hba has to support it too, and the tags can only go up to the disk's queue depth. one slot is
+				// kept back for error recovery, so there have to be at least two.
+				uint32_t depth = (id[75] & 0x1F) + 1U;
+				port->ncq = (ReadReg(port->hba->abar, CAP) & CAP_SNCQ) && (id[76] & (1 << 8))
+					&& __builtin_popcountll(port->mask) > 1;
+
+				if(port->ncq)
+				{
+					port->recovery = 63 - (uint32_t) __builtin_clzll(port->mask);
+					port->mask &= ~(1ULL << port->recovery);
+
+					if(depth < 32)
+						port->mask &= (1ULL << depth) - 1;
+				}
+
+				// the model string is byte-swapped.
+				char model[41];
+				for(int i = 0; i < 20; i++)
+				{
+					model[i * 2] = (char) (id[27 + i] >> 8);
+					model[i * 2 + 1] = (char) (id[27 + i] & 0xFF);
+				}
+
+				model[40] = 0;
+				for(int i = 39; i >= 0 && model[i] == ' '; i--)
+					model[i] = 0;
+
+				Log("AHCI: port %d: %s, %d sectors of %d bytes, %s", port->num, model, port->sectors, port->sectorsize,
+					port->ncq ? "ncq" : "no ncq");
+			}
+
+			Physical::FreePage(page);
+			return ok;
+		}
+
+		static Port* InitialisePort(Controller* hba, uint8_t num)
+		{
+			Port* port = new Port();
+
+			port->hba = hba;
+			port->num = num;
+			port->regs = hba->abar + 0x100 + (num * 0x80);
+
+			uint32_t slots = ((ReadReg(hba->abar, CAP) >> 8) & 0x1F) + 1;
+			port->mask = (slots == 32) ? 0xFFFFFFFF : ((1U << slots) - 1);
+
+			StopPort(port);
+
+			// the command list takes 1k, and the received-fis area 256 bytes after it.
+			port->cmdlist = Physical::AllocatePage(1, !hba->s64a);
+			Memory::Set(Virtual::PhysToDirect(port->cmdlist), 0, 0x1000);
+
+			port->errorlog = Physical::AllocatePage(1, !hba->s64a);
+
+			WriteReg(port->regs, CLB, (uint32_t) port->cmdlist);
+			WriteReg(port->regs, CLBU, (uint32_t) (port->cmdlist >> 32));
+			WriteReg(port->regs, FB, (uint32_t) (port->cmdlist + 0x400));
+			WriteReg(port->regs, FBU, (uint32_t) ((port->cmdlist + 0x400) >> 32));
+
+			for(uint32_t i = 0; i < slots; i++)
+			{
+				port->tables[i] = Physical::AllocatePage(1, !hba->s64a);
+				Memory::Set(Virtual::PhysToDirect(port->tables[i]), 0, 0x1000);
+
+				CommandHeader* hdr = Header(port, i);
+				hdr->ctba = (uint32_t) port->tables[i];
+				hdr->ctbau = (uint32_t) (port->tables[i] >> 32);
+			}
+
+			StartPort(port);
+			WriteReg(port->regs, PIE, PIS_ERRORS | PIS_COMPLETIONS);
+
+			// the interrupt handler needs to see it from here on.
+			hba->ports[num] = port;
+			return port;
+		}
+
+		static void InitialiseController(PCI::PCIDevice* pci)
+		{
+			// enable bus mastering and memory space.
+			uint32_t f = pci->GetRegisterData(0x4, 0, 2);
+			pci->WriteRegisterData(0x4, 0, 2, (f | 0x6) & ((uint32_t) ~0x400));
+
+			Controller* hba = new Controller();
+
+			hba->pci = pci;
+			hba->abar = (volatile uint8_t*) Virtual::MapIO(pci->GetBAR(5), 0x1100);
+
+			WriteReg(hba->abar, GHC, ReadReg(hba->abar, GHC) | GHC_AE);
+			hba->s64a = ReadReg(hba->abar, CAP) & CAP_S64A;
+
+			uint32_t vs = ReadReg(hba->abar, VS);
+			Log("AHCI %d.%d controller at %x, IRQ %d", vs >> 16, (vs >> 8) & 0xFF, pci->GetBAR(5), pci->GetInterruptLine());
+
+			Interrupts::InstallDeviceHandler(pci, HandleInterrupt, hba);
+
+			WriteReg(hba->abar, IS, 0xFFFFFFFF);
+			WriteReg(hba->abar, GHC, ReadReg(hba->abar, GHC) | GHC_IE);
+
+			uint32_t implemented = ReadReg(hba->abar, PI);
+			for(uint8_t i = 0; i < 32; i++)
+			{
+				if(!(implemented & (1U << i)))
+					continue;
+
+				// a device there, with the link up.
+				volatile uint8_t* regs = hba->abar + 0x100 + (i * 0x80);
+				if((ReadReg(regs, SSTS) & 0xF) != 3 || ReadReg(regs, SIG) != SIG_ATA)
+					continue;
+
+				Port* port = InitialisePort(hba, i);
+				if(!Identify(port))
+				{
+					Log(1, "AHCI: identify failed on port %d, ignoring", i);
+					continue;
+				}
+
+				AHCIDrive::AHCIDrives->push_back(new AHCIDrive(port));
+			}
+		}
+
+		void Initialise()
+		{
+			AHCIDrive::AHCIDrives = new rde::vector<AHCIDrive*>();
+
+			rde::list<PCI::PCIDevice*>* devlist = PCI::SearchByClassSubclass(0x1, 0x6);
+			for(auto pci : *devlist)
+				InitialiseController(pci);
+
+			for(auto d : *AHCIDrive::AHCIDrives)
+				HardwareAbstraction::Filesystems::MBR::ReadPartitions(d);
+		}
+	}
+
+
+
+	AHCIDrive::AHCIDrive(AHCI::Port* p) : StorageDevice(StorageDeviceType::AHCIHardDisk)
+	{
+		this->port = p;
+	}
+
+	uint64_t AHCIDrive::GetSectors()
+	{
+		return this->port->sectors;
+	}
+
+	uint32_t AHCIDrive::GetSectorSize()
+	{
+		return this->port->sectorsize;
+	}
+
+	IOResult AHCIDrive::Read(uint64_t LBA, uint64_t Buffer, size_t Bytes)
+	{
+		AHCI::Commands c(this->port);
+		if(!TransferBlocks(&c, LBA, Buffer, Bytes, false))
+			return IOResult();
+
+		return IOResult(Bytes, DMAAddr(), 0);
+	}
+
+	IOResult AHCIDrive::Write(uint64_t LBA, uint64_t Data, size_t Bytes)
+	{
+		AHCI::Commands c(this->port);
+		if(!TransferBlocks(&c, LBA, Data, Bytes, true))
+			return IOResult();
+
+		return IOResult(Bytes, DMAAddr(), 0);
+	}
+}
+}
+}
+}
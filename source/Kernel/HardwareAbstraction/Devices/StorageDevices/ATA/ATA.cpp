@@ -92,10 +92,11 @@ namespace Storage
 
 			rde::list<PCIDevice*>* devlist = PCI::SearchByClassSubclass(0x1, 0x1);
 
+			// machines with only ahci (ie. q35) don't have one.
 			if(devlist->size() == 0)
 			{
-				StdIO::PrintFmt("ERROR: No IDE Controller found on the PCI bus, which is impossible.");
-				UHALT();
+				Log(1, "No IDE controller found on the PCI bus");
+				return;
 			}
 
 			ATADrive::ATADrives = new rde::vector<ATADrive*>();
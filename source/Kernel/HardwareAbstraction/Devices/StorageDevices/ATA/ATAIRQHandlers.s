@@ -6,6 +6,11 @@
 .global ATA_HandleIRQ15
 
 ATA_HandleIRQ14:
+	// coming from ring 3, swap in the kernel's gs (and back out on the way out).
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	push %rax
 	push %rbx
 	push %rcx
@@ -23,10 +28,18 @@ ATA_HandleIRQ14:
 	pop %rcx
 	pop %rbx
 	pop %rax
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	iretq
 
 
 ATA_HandleIRQ15:
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	push %rax
 	push %rbx
 	push %rcx
@@ -44,4 +57,8 @@ ATA_HandleIRQ15:
 	pop %rcx
 	pop %rbx
 	pop %rax
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	iretq
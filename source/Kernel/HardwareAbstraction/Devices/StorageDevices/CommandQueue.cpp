@@ -0,0 +1,212 @@
+// CommandQueue.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <Kernel.hpp>
+#include <HardwareAbstraction/Devices/CommandQueue.hpp>
+#include <stdlib.h>
+#include <errno.h>
+
+// what ahci, virtio-blk and nvme have in common: a big request is split into commands, and a few of them are kept
+// going at once. the commands point straight at the caller's pages, which have to be there (and ours, if the device
+// is writing to them) before they're handed out, and stay there until the device is done with them. anything the
+// device can't take as it is goes through a bounce buffer instead.
+
+using namespace Kernel::HardwareAbstraction::MemoryManager;
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Devices {
+namespace Storage
+{
+	// how many commands one request keeps going at once, so one big read can't take every slot.
+	static const uint64_t MaxInFlight = 8;
+
+	bool CommandSlots::ClaimLocked(uint64_t* slot)
+	{
+		uint64_t free = this->mask & ~this->busy;
+		if(!free)
+			return false;
+
+		*slot = (uint64_t) __builtin_ctzll(free);
+		this->busy |= (1ULL << *slot);
+		return true;
+	}
+
+	bool CommandSlots::TryClaim(uint64_t* slot)
+	{
+		LockSpinlock(this->waiters.lock);
+		bool ret = this->ClaimLocked(slot);
+		UnlockSpinlock(this->waiters.lock);
+
+		return ret;
+	}
+
+	void CommandSlots::WaitForFree()
+	{
+		LockSpinlock(this->waiters.lock);
+		while((this->mask & ~this->busy) == 0)
+			Multitasking::SleepOn(this->waiters);
+
+		UnlockSpinlock(this->waiters.lock);
+	}
+
+	bool CommandSlots::Wait(uint64_t slot)
+	{
+		uint64_t bit = (1ULL << slot);
+
+		LockSpinlock(this->waiters.lock);
+
+		this->Poll();
+		while(!(this->done & bit))
+		{
+			Multitasking::SleepOn(this->waiters, this->pollinterval);
+			this->Poll();
+		}
+
+		bool ok = !(this->failed & bit);
+		this->done &= ~bit;
+		this->failed &= ~bit;
+
+		UnlockSpinlock(this->waiters.lock);
+		return ok;
+	}
+
+	void CommandSlots::Release(uint64_t slot)
+	{
+		LockSpinlock(this->waiters.lock);
+		this->busy &= ~(1ULL << slot);
+		UnlockSpinlock(this->waiters.lock);
+
+		// someone might've been waiting for a slot.
+		Multitasking::WakeAll(this->waiters);
+	}
+
+
+	static bool Submit(CommandQueue* q, uint64_t lba, uint64_t buf, size_t bytes, bool write)
+	{
+		uint64_t inflight[MaxInFlight];
+		uint64_t first = 0;
+		uint64_t count = 0;
+
+		bool ok = true;
+		size_t done = 0;
+		while(done < bytes)
+		{
+			size_t len = __min(bytes - done, q->maxbytes);
+			uint64_t sector = lba + (done / q->sectorsize);
+
+			int started = 0;
+			uint64_t slot = 0;
+			while(count == MaxInFlight || (started = q->TryStart(sector, buf + done, len, write, &slot)) == 0)
+			{
+				// whatever we've started so far goes to the device now, since we're about to wait anyway.
+				q->Flush();
+
+				// rather than sleeping on a slot while we're holding some ourselves, finish one of ours.
+				if(count > 0)
+				{
+					ok &= q->Finish(inflight[first]);
+					first = (first + 1) % MaxInFlight;
+					count--;
+				}
+				else
+				{
+					q->WaitForRoom(buf + done, len, write);
+				}
+			}
+
+			if(started < 0)
+			{
+				ok = false;
+				break;
+			}
+
+			inflight[(first + count) % MaxInFlight] = slot;
+			count++;
+
+			done += len;
+		}
+
+		q->Flush();
+		while(count > 0)
+		{
+			ok &= q->Finish(inflight[first]);
+			first = (first + 1) % MaxInFlight;
+			count--;
+		}
+
+		return ok;
+	}
+
+	bool TransferBlocks(CommandQueue* q, uint64_t lba, uint64_t buf, size_t bytes, bool write)
+	{
+		bool user = Virtual::IsUserRange((void*) buf, bytes);
+		if(!(buf & (q->alignment - 1)) && bytes % q->sectorsize == 0)
+		{
+			if(user && !Virtual::PinRange(buf, bytes))
+			{
+				Multitasking::SetThreadErrno(EFAULT);
+				return false;
+			}
+
+			bool ok = false;
+			if(!Virtual::ScatterList(buf, bytes, 0, !write).Check())
+				Multitasking::SetThreadErrno(EFAULT);
+
+			else
+				ok = Submit(q, lba, buf, bytes, write);
+
+			if(user)
+				Virtual::UnpinRange(buf, bytes);
+
+			return ok;
+		}
+
+		size_t whole = ((bytes + q->sectorsize - 1) / q->sectorsize) * q->sectorsize;
+		uint64_t pages = (whole + 0xFFF) / 0x1000;
+
+		DMAAddr bounce = Physical::AllocateDMA(pages);
+		bool ok = true;
+
+		// the bounce buffer is ours, but the caller's might not be there at all.
+		if(write)
+		{
+			// keep whatever's in the rest of the last sector.
+			if(whole != bytes)
+				ok = Submit(q, lba + (whole / q->sectorsize) - 1, bounce.virt + whole - q->sectorsize, q->sectorsize, false);
+
+			if(user && !Virtual::CopyFromUser((void*) bounce.virt, (void*) buf, bytes))
+			{
+				Multitasking::SetThreadErrno(EFAULT);
+				ok = false;
+			}
+			else if(!user)
+			{
+				Memory::Copy((void*) bounce.virt, (void*) buf, bytes);
+			}
+
+			ok = ok && Submit(q, lba, bounce.virt, whole, true);
+		}
+		else
+		{
+			ok = Submit(q, lba, bounce.virt, whole, false);
+
+			if(user && ok && !Virtual::CopyToUser((void*) buf, (void*) bounce.virt, bytes))
+			{
+				Multitasking::SetThreadErrno(EFAULT);
+				ok = false;
+			}
+			else if(!user && ok)
+			{
+				Memory::Copy((void*) buf, (void*) bounce.virt, bytes);
+			}
+		}
+
+		Physical::FreeDMA(bounce, pages);
+		return ok;
+	}
+}
+}
+}
+}
@@ -0,0 +1,725 @@
+// NVMe.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <Kernel.hpp>
+#include <HardwareAbstraction/Devices/StorageDevice.hpp>
+#include <HardwareAbstraction/Devices/CommandQueue.hpp>
+#include <HardwareAbstraction/Interrupts.hpp>
+#include <StandardIO.hpp>
+#include <stdlib.h>
+
+// nvme controllers, and the namespaces on them.
+
+// commands go into a submission queue in memory, and the controller answers in a completion queue. each entry it
+// writes flips the phase bit from what was there the last time round, so the new ones are easy to spot without the
+// controller having to tell us where it's up to. there's one admin queue pair, and then a pair of i/o queues per
+// processor (as many as the controller lets us have), so processors don't fight over the same queue.
+
+// each command (see CommandQueue.cpp) points straight at the caller's pages, through a prp list when they span
+// more than two.
+
+// with msi-x, each completion queue gets its own vector (and its own handler), aimed at the processor that uses
+// that queue, so a completion is taken where its waiter is; otherwise they all share msi or the pin, on the bsp.
+// waiters also poll their completion queue every so often, so a lost interrupt only costs time.
+
+using namespace Kernel::HardwareAbstraction::MemoryManager;
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Devices {
+namespace Storage
+{
+	rde::vector<NVMeDrive*>* NVMeDrive::NVMeDrives;
+
+	namespace NVMe
+	{
+		enum Registers
+		{
+			CAP				= 0x00,
+			VS				= 0x08,
+			INTMS			= 0x0C,
+			INTMC			= 0x10,
+			CC				= 0x14,
+			CSTS			= 0x1C,
+			AQA				= 0x24,
+			ASQ				= 0x28,
+			ACQ				= 0x30,
+			Doorbells		= 0x1000,
+		};
+
+		#define CC_EN				(1U << 0)
+		#define CC_IOSQES			(6U << 16)
+		#define CC_IOCQES			(4U << 20)
+
+		#define CSTS_RDY			(1U << 0)
+		#define CSTS_CFS			(1U << 1)
+
+		#define QUEUE_PC			(1U << 0)
+		#define QUEUE_IEN			(1U << 1)
+
+		const uint8_t Admin_CreateSQ			= 0x01;
+		const uint8_t Admin_CreateCQ			= 0x05;
+		const uint8_t Admin_Identify			= 0x06;
+		const uint8_t Admin_SetFeatures			= 0x09;
+
+		const uint8_t IO_Write					= 0x01;
+		const uint8_t IO_Read					= 0x02;
+
+		const uint32_t Feature_NumberOfQueues	= 0x07;
+
+		const uint32_t Identify_Namespace		= 0x00;
+		const uint32_t Identify_Controller		= 0x01;
+		const uint32_t Identify_ActiveList		= 0x02;
+
+		struct Command
+		{
+			uint32_t cdw0;
+			uint32_t nsid;
+			uint64_t reserved;
+			uint64_t mptr;
+			uint64_t prp1;
+			uint64_t prp2;
+			uint32_t cdw10;
+			uint32_t cdw11;
+			uint32_t cdw12;
+			uint32_t cdw13;
+			uint32_t cdw14;
+			uint32_t cdw15;
+
+		} __attribute__((packed));
+
+		struct Completion
+		{
+			uint32_t dw0;
+			uint32_t dw1;
+			uint16_t sqhead;
+			uint16_t sqid;
+			uint16_t cid;
+			volatile uint16_t status;
+
+		} __attribute__((packed));
+
+		// so the command ids in a queue fit in a mask; both rings are then a page at most.
+		static const uint16_t MaxQueueEntries	= 64;
+
+		// one pair per processor, up to this many.
+		static const uint64_t MaxIOQueues		= 8;
+
+		// per command. a prp list is one page, so this is well within what one can describe.
+		static const uint64_t MaxCommandPages	= 256;
+
+		// how long a waiter sleeps before looking at the completion queue itself.
+		static const uint64_t PollInterval		= 10;
+
+		struct Controller;
+		struct Queue : CommandSlots
+		{
+			Controller* ctl;
+			uint16_t id;
+			uint16_t size;
+
+			uint64_t sq;
+			uint64_t cq;
+
+			// under waiters.lock, which the interrupt handler takes too.
+			uint16_t sqtail;
+			uint16_t lastrung;
+			uint16_t cqhead;
+			uint16_t phase;
+
+			uint16_t status[MaxQueueEntries];
+			uint32_t result[MaxQueueEntries];
+
+			// allocated the first time a command in that slot needs one.
+			uint64_t prplists[MaxQueueEntries];
+
+			void Poll() override;
+		};
+
+		struct Controller
+		{
+			PCI::PCIDevice* pci;
+			volatile uint8_t* regs;
+			uint64_t stride;
+
+			// in bytes, whole sectors or not.
+			uint64_t maxbytes;
+
+			Queue* admin;
+			Queue* io[MaxIOQueues];
+			uint64_t numio;
+
+			// how many msi-x entries we can use; 0 when everything's on the one vector.
+			uint16_t numvectors;
+			uint8_t vectors[MaxIOQueues + 1];
+		};
+
+		struct Namespace
+		{
+			Controller* ctl;
+			uint32_t id;
+
+			uint64_t sectors;
+			uint32_t sectorsize;
+			uint64_t maxbytes;
+		};
+
+		static uint32_t ReadReg(volatile uint8_t* base, uint32_t reg)
+		{
+			return *((volatile uint32_t*) (base + reg));
+		}
+
+		static uint64_t ReadReg64(volatile uint8_t* base, uint32_t reg)
+		{
+			return ReadReg(base, reg) | ((uint64_t) ReadReg(base, reg + 4) << 32);
+		}
+
+		static void WriteReg(volatile uint8_t* base, uint32_t reg, uint32_t val)
+		{
+			*((volatile uint32_t*) (base + reg)) = val;
+		}
+
+		static void WriteReg64(volatile uint8_t* base, uint32_t reg, uint64_t val)
+		{
+			WriteReg(base, reg, (uint32_t) val);
+			WriteReg(base, reg + 4, (uint32_t) (val >> 32));
+		}
+
+		static Queue* MakeQueue(Controller* ctl, uint16_t id, uint16_t size)
+		{
+			Queue* q = new Queue();
+
+			q->ctl = ctl;
+			q->id = id;
+			q->size = size;
+
+			q->sq = Physical::AllocatePage(1);
+			q->cq = Physical::AllocatePage(1);
+			Memory::Set(Virtual::PhysToDirect(q->sq), 0, 0x1000);
+			Memory::Set(Virtual::PhysToDirect(q->cq), 0, 0x1000);
+
+			// the queue's full when the tail's one behind the head, so one entry always goes unused.
+			q->mask = (1ULL << (size - 1)) - 1;
+			q->phase = 1;
+			q->pollinterval = PollInterval;
+
+			return q;
+		}
+
+		// call with the lock held. returns how many commands finished.
+		static uint64_t Reap(Queue* q)
+		{
+			Completion* cq = (Completion*) Virtual::PhysToDirect(q->cq);
+			uint64_t ret = 0;
+
+			while((cq[q->cqhead].status & 1) == q->phase)
+			{
+				Completion* c = &cq[q->cqhead];
+
+				q->status[c->cid] = (uint16_t) (c->status >> 1);
+				q->result[c->cid] = c->dw0;
+				q->done |= (1ULL << c->cid);
+				if(q->status[c->cid] != 0)
+					q->failed |= (1ULL << c->cid);
+
+				q->cqhead++;
+				if(q->cqhead == q->size)
+				{
+					q->cqhead = 0;
+					q->phase ^= 1;
+				}
+
+				ret++;
+			}
+
+			// tells the controller it can reuse them (and takes the interrupt back down).
+			if(ret > 0)
+				WriteReg(q->ctl->regs, (uint32_t) (Doorbells + ((2 * q->id + 1) * q->ctl->stride)), q->cqhead);
+
+			return ret;
+		}
+
+		// waiters look for themselves every so often, in case an interrupt went missing.
+		void Queue::Poll()
+		{
+			Reap(this);
+		}
+
+		static void HandleQueueInterrupt(void* arg)
+		{
+			Queue* q = (Queue*) arg;
+
+			LockSpinlock(q->waiters.lock);
+			uint64_t n = Reap(q);
+			UnlockSpinlock(q->waiters.lock);
+
+			if(n > 0)
+				Multitasking::WakeAll(q->waiters);
+		}
+
+		static void HandleInterrupt(void* arg)
+		{
+			Controller* ctl = (Controller*) arg;
+
+			for(uint64_t i = 0; i <= ctl->numio; i++)
+				HandleQueueInterrupt((i == 0) ? ctl->admin : ctl->io[i - 1]);
+		}
+
+		// returns the msi-x entry the queue's completions should go to, or -1 if there's no vector even for the
+		// admin queue. past the number of entries we have (or vectors we could get), queues double up, and the vector
+		// just has more than one handler (and goes wherever the first queue's does).
+		static int AttachQueue(Controller* ctl, Queue* q)
+		{
+			if(ctl->numvectors == 0)
+				return 0;
+
+			if(q->id < ctl->numvectors)
+			{
+				uint8_t vector = Interrupts::AllocateVector();
+				if(vector == 0)
+				{
+					if(q->id == 0)
+						return -1;
+
+					Log(1, "NVMe: out of vectors after %d, the rest of the queues share them", q->id);
+					ctl->numvectors = q->id;
+				}
+				else
+				{
+					// i/o queue n is picked by processor n - 1 (see PickQueue()), so that's where its messages go;
+					// the admin queue, and anything without a processor, stays with us. the aps are up by now.
+					SMP::CPU* cpu = (q->id > 0) ? SMP::GetCPU(q->id - 1U) : 0;
+					if(!cpu || !cpu->online)
+						cpu = SMP::GetCurrentCPU();
+
+					ctl->vectors[q->id] = vector;
+					ctl->pci->EnableMSIX(q->id, vector, cpu->apicid);
+				}
+			}
+
+			uint16_t entry = (uint16_t) (q->id % ctl->numvectors);
+
+			Interrupts::InstallVectorHandler(ctl->vectors[entry], HandleQueueInterrupt, q);
+			return entry;
+		}
+
+		// points the command at 'len' bytes at 'buf' (in the current address space). the first entry can start
+		// anywhere; the rest are whole pages, so they go in the slot's list once there are more than two.
+		// false if part of the buffer isn't there.
+		static bool MakePRPs(Queue* q, uint16_t cid, Command* cmd, uint64_t buf, size_t len, bool write)
+		{
+			uint64_t n = 0;
+			uint64_t phys = 0;
+			uint64_t second = 0;
+			uint64_t* list = 0;
+			size_t run = 0;
+
+			// the controller writes to the pages if we're reading.
+			Virtual::ScatterList sl(buf, len, 0, !write);
+			while(sl.NextPhysical(&phys, &run))
+			{
+				while(run > 0)
+				{
+					size_t l = __min(run, 0x1000 - (phys & 0xFFF));
+
+					if(n == 0)
+					{
+						cmd->prp1 = phys;
+					}
+					else if(n == 1)
+					{
+						second = phys;
+					}
+					else
+					{
+						if(!list)
+						{
+							if(q->prplists[cid] == 0)
+								q->prplists[cid] = Physical::AllocatePage(1);
+
+							list = (uint64_t*) Virtual::PhysToDirect(q->prplists[cid]);
+							list[0] = second;
+						}
+
+						assert(n - 1 < 0x1000 / sizeof(uint64_t));
+						list[n - 1] = phys;
+					}
+
+					phys += l;
+					run -= l;
+					n++;
+				}
+			}
+
+			if(sl.Failed())
+				return false;
+
+			if(n == 2)		cmd->prp2 = second;
+			else if(n > 2)	cmd->prp2 = q->prplists[cid];
+
+			return true;
+		}
+
+		// puts the command in the queue, but doesn't ring the doorbell.
+		static void Issue(Queue* q, uint16_t cid, Command* cmd)
+		{
+			LockSpinlock(q->waiters.lock);
+			{
+				Command* sq = (Command*) Virtual::PhysToDirect(q->sq);
+
+				cmd->cdw0 = (cmd->cdw0 & 0xFFFF) | ((uint32_t) cid << 16);
+				sq[q->sqtail] = *cmd;
+
+				q->sqtail = (uint16_t) ((q->sqtail + 1) % q->size);
+			}
+			UnlockSpinlock(q->waiters.lock);
+		}
+
+		// tells the controller about everything issued since the last time.
+		static void Ring(Queue* q)
+		{
+			LockSpinlock(q->waiters.lock);
+			if(q->sqtail != q->lastrung)
+			{
+				__sync_synchronize();
+				WriteReg(q->ctl->regs, (uint32_t) (Doorbells + ((2 * q->id) * q->ctl->stride)), q->sqtail);
+
+				q->lastrung = q->sqtail;
+			}
+			UnlockSpinlock(q->waiters.lock);
+		}
+
+		// waits for 'cid' to finish, then gives it back.
+		static bool Finish(Queue* q, uint16_t cid, uint32_t* result = 0)
+		{
+			bool ok = q->Wait(cid);
+
+			uint16_t status = q->status[cid];
+			if(result)
+				*result = q->result[cid];
+
+			q->Release(cid);
+
+			if(!ok)
+				Log(1, "NVMe: command failed on queue %d (status %x)", q->id, status);
+
+			return ok;
+		}
+
+		static bool AdminCommand(Controller* ctl, Command* cmd, uint32_t* result = 0)
+		{
+			uint64_t cid = 0;
+			while(!ctl->admin->TryClaim(&cid))
+				ctl->admin->WaitForFree();
+
+			Issue(ctl->admin, (uint16_t) cid, cmd);
+			Ring(ctl->admin);
+
+			return Finish(ctl->admin, (uint16_t) cid, result);
+		}
+
+		static bool Identify(Controller* ctl, uint32_t cns, uint32_t nsid, uint64_t page)
+		{
+			Command cmd;
+			Memory::Set(&cmd, 0, sizeof(Command));
+
+			cmd.cdw0 = Admin_Identify;
+			cmd.nsid = nsid;
+			cmd.prp1 = page;
+			cmd.cdw10 = cns;
+
+			return AdminCommand(ctl, &cmd);
+		}
+
+		// the one for this processor, more or less.
+		static Queue* PickQueue(Controller* ctl)
+		{
+			return ctl->io[SMP::GetCurrentCPU()->id % ctl->numio];
+		}
+
+		class Commands : public CommandQueue
+		{
+			public:
+				// the controller wants dword-aligned buffers.
+				Commands(Namespace* n, Queue* q) : CommandQueue(n->sectorsize, n->maxbytes, 4), ns(n), queue(q) { }
+
+				int TryStart(uint64_t lba, uint64_t buf, size_t len, bool write, uint64_t* slot) override
+				{
+					if(!this->queue->TryClaim(slot))
+						return 0;
+
+					uint16_t cid = (uint16_t) *slot;
+
+					Command cmd;
+					Memory::Set(&cmd, 0, sizeof(Command));
+
+					cmd.cdw0 = write ? IO_Write : IO_Read;
+					cmd.nsid = this->ns->id;
+					cmd.cdw10 = (uint32_t) lba;
+					cmd.cdw11 = (uint32_t) (lba >> 32);
+					cmd.cdw12 = (uint32_t) ((len / this->ns->sectorsize) - 1);
+
+					if(!MakePRPs(this->queue, cid, &cmd, buf, len, write))
+					{
+						this->queue->Release(cid);
+						return -1;
+					}
+
+					Issue(this->queue, cid, &cmd);
+					return 1;
+				}
+
+				void WaitForRoom(uint64_t, size_t, bool) override
+				{
+					this->queue->WaitForFree();
+				}
+
+				void Flush() override
+				{
+					Ring(this->queue);
+				}
+
+				bool Finish(uint64_t slot) override
+				{
+					return NVMe::Finish(this->queue, (uint16_t) slot);
+				}
+
+			private:
+				Namespace* ns;
+				Queue* queue;
+		};
+
+		static bool CreateQueues(Controller* ctl, uint16_t size)
+		{
+			// ask for one pair per processor we might have; the answer is how many we got, minus one.
+			uint64_t want = __min((uint64_t) MaxCPUs, MaxIOQueues);
+
+			Command cmd;
+			Memory::Set(&cmd, 0, sizeof(Command));
+
+			cmd.cdw0 = Admin_SetFeatures;
+			cmd.cdw10 = Feature_NumberOfQueues;
+			cmd.cdw11 = (uint32_t) ((want - 1) | ((want - 1) << 16));
+
+			uint32_t result = 0;
+			if(!AdminCommand(ctl, &cmd, &result))
+				return false;
+
+			uint64_t got = __min((result & 0xFFFF), (result >> 16)) + 1ULL;
+			uint64_t num = __min(want, got);
+
+			for(uint16_t i = 1; i <= num; i++)
+			{
+				Queue* q = MakeQueue(ctl, i, size);
+				// only the admin queue can come back without one.
+				uint16_t entry = (uint16_t) AttachQueue(ctl, q);
+
+				Memory::Set(&cmd, 0, sizeof(Command));
+				cmd.cdw0 = Admin_CreateCQ;
+				cmd.prp1 = q->cq;
+				cmd.cdw10 = (uint32_t) (((size - 1) << 16) | i);
+				cmd.cdw11 = QUEUE_PC | QUEUE_IEN | ((uint32_t) entry << 16);
+
+				if(!AdminCommand(ctl, &cmd))
+					return false;
+
+				Memory::Set(&cmd, 0, sizeof(Command));
+				cmd.cdw0 = Admin_CreateSQ;
+				cmd.prp1 = q->sq;
+				cmd.cdw10 = (uint32_t) (((size - 1) << 16) | i);
+				cmd.cdw11 = QUEUE_PC | ((uint32_t) i << 16);
+
+				if(!AdminCommand(ctl, &cmd))
+					return false;
+
+				// the interrupt handler needs to see it from here on.
+				ctl->io[i - 1] = q;
+				ctl->numio = i;
+			}
+
+			return true;
+		}
+
+		static void AddNamespace(Controller* ctl, uint32_t nsid, uint64_t page)
+		{
+			if(!Identify(ctl, Identify_Namespace, nsid, page))
+				return;
+
+			uint8_t* id = (uint8_t*) Virtual::PhysToDirect(page);
+
+			uint64_t sectors = *((uint64_t*) &id[0]);
+			uint8_t format = id[26] & 0xF;
+			uint32_t lbads = (*((uint32_t*) &id[128 + (format * 4)]) >> 16) & 0xFF;
+
+			if(sectors == 0 || lbads < 9)
+				return;
+
+			Namespace* ns = new Namespace();
+			ns->ctl = ctl;
+			ns->id = nsid;
+			ns->sectors = sectors;
+			ns->sectorsize = 1U << lbads;
+			ns->maxbytes = ctl->maxbytes & ~((uint64_t) ns->sectorsize - 1);
+
+			Log("NVMe: namespace %d: %d sectors of %d bytes", nsid, ns->sectors, ns->sectorsize);
+			NVMeDrive::NVMeDrives->push_back(new NVMeDrive(ns));
+		}
+
+		static void InitialiseController(PCI::PCIDevice* pci)
+		{
+			// enable bus mastering and memory space.
+			uint32_t f = pci->GetRegisterData(0x4, 0, 2);
+			pci->WriteRegisterData(0x4, 0, 2, (f | 0x6) & ((uint32_t) ~0x400));
+
+			Controller* ctl = new Controller();
+			ctl->pci = pci;
+			ctl->regs = (volatile uint8_t*) Virtual::MapIO(pci->GetBAR(0), 0x1000);
+
+			uint64_t cap = ReadReg64(ctl->regs, CAP);
+			ctl->stride = 4ULL << ((cap >> 32) & 0xF);
+
+			// the doorbells, for the admin queue and however many i/o queues we end up with.
+			ctl->regs = (volatile uint8_t*) Virtual::MapIO(pci->GetBAR(0), Doorbells + (2 * (MaxIOQueues + 1) * ctl->stride));
+
+			if(((cap >> 48) & 0xF) != 0)
+			{
+				Log(1, "NVMe: controller doesn't do 4k pages, ignoring");
+				return;
+			}
+
+			uint32_t vs = ReadReg(ctl->regs, VS);
+			Log("NVMe %d.%d controller at %x, IRQ %d", vs >> 16, (vs >> 8) & 0xFF, pci->GetBAR(0), pci->GetInterruptLine());
+
+			// stop it, if the firmware didn't.
+			WriteReg(ctl->regs, CC, ReadReg(ctl->regs, CC) & ~CC_EN);
+			while(ReadReg(ctl->regs, CSTS) & CSTS_RDY)
+				asm volatile("pause");
+
+			uint16_t size = (uint16_t) __min((cap & 0xFFFF) + 1, (uint64_t) MaxQueueEntries);
+
+			ctl->admin = MakeQueue(ctl, 0, size);
+			WriteReg(ctl->regs, AQA, (uint32_t) ((size - 1) | ((size - 1) << 16)));
+			WriteReg64(ctl->regs, ASQ, ctl->admin->sq);
+			WriteReg64(ctl->regs, ACQ, ctl->admin->cq);
+
+			// msi-x if there's more than one entry to spread the queues over, then plain msi, then the pin.
+			ctl->numvectors = (uint16_t) __min((uint64_t) pci->GetMSIXCount(), MaxIOQueues + 1);
+			if(ctl->numvectors <= 1 || AttachQueue(ctl, ctl->admin) < 0)
+			{
+				ctl->numvectors = 0;
+				Interrupts::InstallDeviceHandler(pci, HandleInterrupt, ctl);
+			}
+
+			WriteReg(ctl->regs, CC, CC_EN | CC_IOSQES | CC_IOCQES);
+			while(!(ReadReg(ctl->regs, CSTS) & (CSTS_RDY | CSTS_CFS)))
+				asm volatile("pause");
+
+			if(ReadReg(ctl->regs, CSTS) & CSTS_CFS)
+			{
+				Log(1, "NVMe: controller failed to start, ignoring");
+				return;
+			}
+
+			// the mask registers are off limits with msi-x, which masks per entry instead.
+			if(ctl->numvectors == 0)
+				WriteReg(ctl->regs, INTMC, 0x1);
+
+			uint64_t page = Physical::AllocatePage(1);
+			uint8_t* id = (uint8_t*) Virtual::PhysToDirect(page);
+
+			if(!Identify(ctl, Identify_Controller, 0, page))
+			{
+				Log(1, "NVMe: identify failed, ignoring");
+				Physical::FreePage(page);
+				return;
+			}
+
+			// the maximum transfer is a power of two of the minimum page size; 0 means no limit.
+			uint8_t mdts = id[77];
+			uint32_t numns = *((uint32_t*) &id[516]);
+
+			ctl->maxbytes = MaxCommandPages * 0x1000;
+			if(mdts != 0)
+				ctl->maxbytes = __min(ctl->maxbytes, (1ULL << mdts) * 0x1000);
+
+			if(!CreateQueues(ctl, size) || ctl->numio == 0)
+			{
+				Log(1, "NVMe: couldn't create i/o queues, ignoring");
+				Physical::FreePage(page);
+				return;
+			}
+
+			Log("NVMe: %d i/o queue%s of %d entries, %d namespace%s", ctl->numio, ctl->numio == 1 ? "" : "s", size, numns,
+				numns == 1 ? "" : "s");
+
+			// the list of active namespaces is newer than 1.0, so count up ourselves if it's not there.
+			uint64_t listpage = Physical::AllocatePage(1);
+			uint32_t* list = (uint32_t*) Virtual::PhysToDirect(listpage);
+
+			if(Identify(ctl, Identify_ActiveList, 0, listpage))
+			{
+				for(uint32_t i = 0; i < 1024 && list[i] != 0; i++)
+					AddNamespace(ctl, list[i], page);
+			}
+			else
+			{
+				for(uint32_t i = 1; i <= __min(numns, 1024U); i++)
+					AddNamespace(ctl, i, page);
+			}
+
+			Physical::FreePage(listpage);
+			Physical::FreePage(page);
+		}
+
+		void Initialise()
+		{
+			NVMeDrive::NVMeDrives = new rde::vector<NVMeDrive*>();
+
+			rde::list<PCI::PCIDevice*>* devlist = PCI::SearchByClassSubclass(0x1, 0x8);
+			for(auto pci : *devlist)
+				InitialiseController(pci);
+
+			for(auto d : *NVMeDrive::NVMeDrives)
+				HardwareAbstraction::Filesystems::MBR::ReadPartitions(d);
+		}
+	}
+
+
+
+	NVMeDrive::NVMeDrive(NVMe::Namespace* n) : StorageDevice(StorageDeviceType::NVMeDisk)
+	{
+		this->ns = n;
+	}
+
+	uint64_t NVMeDrive::GetSectors()
+	{
+		return this->ns->sectors;
+	}
+
+	uint32_t NVMeDrive::GetSectorSize()
+	{
+		return this->ns->sectorsize;
+	}
+
+	IOResult NVMeDrive::Read(uint64_t LBA, uint64_t Buffer, size_t Bytes)
+	{
+		NVMe::Commands c(this->ns, NVMe::PickQueue(this->ns->ctl));
+		if(!TransferBlocks(&c, LBA, Buffer, Bytes, false))
+			return IOResult();
+
+		return IOResult(Bytes, DMAAddr(), 0);
+	}
+
+	IOResult NVMeDrive::Write(uint64_t LBA, uint64_t Data, size_t Bytes)
+	{
+		NVMe::Commands c(this->ns, NVMe::PickQueue(this->ns->ctl));
+		if(!TransferBlocks(&c, LBA, Data, Bytes, true))
+			return IOResult();
+
+		return IOResult(Bytes, DMAAddr(), 0);
+	}
+}
+}
+}
+}
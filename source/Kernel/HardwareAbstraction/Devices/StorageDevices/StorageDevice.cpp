@@ -45,6 +45,14 @@ namespace Devices
 			dev->diskid = storageDevices->size();
 			storageDevices->push_back(dev);
 		}
+
+		StorageDevice* GetStorageDevice(uid_t diskid)
+		{
+			if(!storageDevices || diskid >= storageDevices->size())
+				return 0;
+
+			return (*storageDevices)[diskid];
+		}
 	}
 }
 }
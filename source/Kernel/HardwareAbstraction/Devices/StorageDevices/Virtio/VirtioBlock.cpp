@@ -0,0 +1,337 @@
+// VirtioBlock.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <Kernel.hpp>
+#include <HardwareAbstraction/Devices/StorageDevice.hpp>
+#include <HardwareAbstraction/Devices/Virtio.hpp>
+#include <HardwareAbstraction/Devices/CommandQueue.hpp>
+#include <HardwareAbstraction/Interrupts.hpp>
+#include <StandardIO.hpp>
+#include <stdlib.h>
+
+// virtio block devices, the kind qemu gives you with -drive if=virtio.
+
+// a request is a chain of three parts: a header saying what to do and where, the data itself (straight from the
+// caller's pages), and a byte the device writes the status into. a chain is one command to CommandQueue.cpp, and
+// we only tell the device about new chains once we've posted as many as we're going to for now.
+
+using namespace Kernel::HardwareAbstraction::MemoryManager;
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Devices {
+namespace Storage
+{
+	rde::vector<VirtioBlockDrive*>* VirtioBlockDrive::VirtioBlockDrives;
+
+	namespace VirtioBlock
+	{
+		#define BLK_F_SIZE_MAX		(1U << 1)
+		#define BLK_F_SEG_MAX		(1U << 2)
+		#define BLK_F_RO			(1U << 5)
+
+		#define BLK_T_IN			0
+		#define BLK_T_OUT			1
+
+		#define BLK_S_OK			0
+
+		#define ISR_QUEUE			0x1
+
+		enum Config
+		{
+			Capacity		= 0x00,
+			SizeMax			= 0x08,
+			SegMax			= 0x0C,
+		};
+
+		// the device always counts in 512-byte sectors, whatever its real block size is.
+		static const uint32_t SectorSize		= 512;
+
+		// the header and status byte for one request. the device reads the first 16 bytes and writes the status.
+		struct Request
+		{
+			uint32_t type;
+			uint32_t reserved;
+			uint64_t sector;
+
+			volatile uint8_t status;
+			uint8_t padding[15];
+
+		} __attribute__((packed));
+
+		// all of them fit in one page, and in the slot masks.
+		static const uint64_t MaxRequests		= 64;
+
+		// data segments per chain, at most. one per page, so this caps a chain at (n - 1) pages.
+		static const uint64_t MaxDataSegments	= 64;
+
+		struct Device : CommandSlots
+		{
+			Virtio::Transport* transport;
+			Virtio::Queue* queue;
+
+			uint64_t sectors;
+			bool readonly;
+
+			uint32_t segments;
+			uint32_t segmentbytes;
+			uint64_t maxbytes;
+
+			// the headers and status bytes, one per slot. descriptors free up (under waiters.lock) along with them.
+			uint64_t requests;
+		};
+
+		static Request* GetRequest(Device* dev, uint64_t slot)
+		{
+			return &((Request*) Virtual::PhysToDirect(dev->requests))[slot];
+		}
+
+		// called by Reap(), with the lock held.
+		static void Completed(void* cookie, uint32_t length, void* arg)
+		{
+			(void) length;
+
+			Device* dev = (Device*) arg;
+			dev->done |= (1ULL << ((uint64_t) cookie - 1));
+		}
+
+		static void HandleInterrupt(void* arg)
+		{
+			Device* dev = (Device*) arg;
+
+			// the line might be shared; reading the isr clears it.
+			if(!dev->transport->UsingMSIX() && !(dev->transport->ReadISR() & ISR_QUEUE))
+				return;
+
+			LockSpinlock(dev->waiters.lock);
+			dev->queue->Reap(Completed, dev);
+			UnlockSpinlock(dev->waiters.lock);
+
+			Multitasking::WakeAll(dev->waiters);
+		}
+
+		// takes a request slot and posts the chain in 'segs' (leaving the first and last for the header and status),
+		// but doesn't kick. false if there's no slot, or not enough descriptors for the chain.
+		static bool TryPost(Device* dev, Virtio::Segment* segs, uint16_t count, uint64_t sector, bool write, uint64_t* slot)
+		{
+			bool ret = false;
+			LockSpinlock(dev->waiters.lock);
+
+			if(dev->queue->GetFree() >= count && dev->ClaimLocked(slot))
+			{
+				Request* req = GetRequest(dev, *slot);
+				req->type = write ? BLK_T_OUT : BLK_T_IN;
+				req->reserved = 0;
+				req->sector = sector;
+				req->status = 0xFF;
+
+				uint64_t phys = dev->requests + (*slot * sizeof(Request));
+				segs[0] = { phys, 16, false };
+				segs[count - 1] = { phys + 16, 1, true };
+
+				ret = dev->queue->Post(segs, count, (void*) (*slot + 1));
+				assert(ret);
+			}
+
+			UnlockSpinlock(dev->waiters.lock);
+			return ret;
+		}
+
+		static void Kick(Device* dev)
+		{
+			LockSpinlock(dev->waiters.lock);
+			dev->queue->Kick();
+			UnlockSpinlock(dev->waiters.lock);
+		}
+
+		static void WaitForFree(Device* dev, uint16_t count)
+		{
+			LockSpinlock(dev->waiters.lock);
+			while((dev->mask & ~dev->busy) == 0 || dev->queue->GetFree() < count)
+				Multitasking::SleepOn(dev->waiters);
+
+			UnlockSpinlock(dev->waiters.lock);
+		}
+
+		// waits for 'slot' to finish, then gives it back.
+		static bool Finish(Device* dev, uint64_t slot)
+		{
+			bool ok = dev->Wait(slot) && GetRequest(dev, slot)->status == BLK_S_OK;
+			dev->Release(slot);
+
+			return ok;
+		}
+
+		// fills in the data segments for 'len' bytes at 'buf' (in the current address space), starting at segs[1].
+		// returns the length of the whole chain, or 0 if part of the buffer isn't there.
+		static uint16_t MakeChain(Device* dev, Virtio::Segment* segs, uint64_t buf, size_t len, bool write)
+		{
+			uint16_t n = 1;
+			uint64_t phys = 0;
+			size_t run = 0;
+
+			// the device writes to the pages if we're reading.
+			Virtual::ScatterList sl(buf, len, 0, !write);
+			while(sl.NextPhysical(&phys, &run))
+			{
+				while(run > 0)
+				{
+					size_t l = __min(run, (size_t) dev->segmentbytes);
+					assert(n <= dev->segments);
+
+					segs[n] = { phys, (uint32_t) l, !write };
+
+					phys += l;
+					run -= l;
+					n++;
+				}
+			}
+
+			if(sl.Failed())
+				return 0;
+
+			return (uint16_t) (n + 1);
+		}
+
+		class Commands : public CommandQueue
+		{
+			public:
+				explicit Commands(Device* d) : CommandQueue(SectorSize, d->maxbytes, 1), dev(d) { }
+
+				int TryStart(uint64_t lba, uint64_t buf, size_t len, bool write, uint64_t* slot) override
+				{
+					uint16_t chain = MakeChain(this->dev, this->segs, buf, len, write);
+					if(chain == 0)
+						return -1;
+
+					return TryPost(this->dev, this->segs, chain, lba, write, slot) ? 1 : 0;
+				}
+
+				void WaitForRoom(uint64_t buf, size_t len, bool write) override
+				{
+					uint16_t chain = MakeChain(this->dev, this->segs, buf, len, write);
+					if(chain > 0)
+						WaitForFree(this->dev, chain);
+				}
+
+				void Flush() override
+				{
+					Kick(this->dev);
+				}
+
+				bool Finish(uint64_t slot) override
+				{
+					return VirtioBlock::Finish(this->dev, slot);
+				}
+
+			private:
+				Device* dev;
+				Virtio::Segment segs[MaxDataSegments + 2];
+		};
+
+		static Device* InitialiseDevice(PCI::PCIDevice* pci)
+		{
+			Device* dev = new Device();
+			dev->transport = new Virtio::Transport(pci);
+
+			Virtio::Transport* t = dev->transport;
+			t->Reset();
+			t->AddStatus(VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+			uint32_t features = t->GetFeatures() & (BLK_F_SIZE_MAX | BLK_F_SEG_MAX | BLK_F_RO);
+			t->SetFeatures(features);
+
+			dev->queue = new Virtio::Queue(t, 0);
+			dev->sectors = t->ReadConfig64(Capacity);
+			dev->readonly = features & BLK_F_RO;
+
+			// one segment per page unless the device says otherwise, and we need two descriptors for ourselves.
+			uint64_t segs = __min((uint64_t) dev->queue->GetSize() - 2, MaxDataSegments);
+			if(features & BLK_F_SEG_MAX)
+				segs = __min(segs, (uint64_t) t->ReadConfig32(SegMax));
+
+			dev->segments = (uint32_t) segs;
+			dev->segmentbytes = 0x1000;
+			if(features & BLK_F_SIZE_MAX)
+				dev->segmentbytes = __min(dev->segmentbytes, t->ReadConfig32(SizeMax));
+
+			// a buffer that isn't page aligned takes one more segment than its length says.
+			dev->maxbytes = ((dev->segments - 1) * dev->segmentbytes) & ~((uint64_t) SectorSize - 1);
+			assert(dev->segmentbytes >= SectorSize && dev->maxbytes > 0);
+
+			// each chain takes at least three descriptors.
+			uint64_t nreqs = __min(MaxRequests, (uint64_t) dev->queue->GetSize() / 3);
+			dev->mask = (nreqs == 64) ? ~0ULL : ((1ULL << nreqs) - 1);
+
+			dev->requests = Physical::AllocatePage(1);
+			Memory::Set(Virtual::PhysToDirect(dev->requests), 0, 0x1000);
+
+			// a vector of its own with msi-x, otherwise the (probably shared) pin.
+			uint8_t vector = pci->GetMSIXCount() ? Interrupts::AllocateVector() : 0;
+			if(vector != 0 && t->UseMSIX(vector, 1))	Interrupts::InstallVectorHandler(vector, HandleInterrupt, dev);
+			else										Interrupts::InstallIRQHandler(pci->GetInterruptLine(), HandleInterrupt, dev);
+
+			t->AddStatus(VIRTIO_STATUS_DRIVER_OK);
+
+			Log("Virtio block device, %s: %d sectors, %d-entry queue, %d bytes per request%s", t->UsingMSIX() ? "msi-x" : "pin",
+				dev->sectors, dev->queue->GetSize(), dev->maxbytes, dev->readonly ? ", read-only" : "");
+
+			return dev;
+		}
+
+		void Initialise()
+		{
+			VirtioBlockDrive::VirtioBlockDrives = new rde::vector<VirtioBlockDrive*>();
+
+			// only transitional devices, since we only speak the legacy interface.
+			rde::list<PCI::PCIDevice*>* devlist = PCI::SearchByVendorDevice(0x1AF4, 0x1001);
+			for(auto pci : *devlist)
+				VirtioBlockDrive::VirtioBlockDrives->push_back(new VirtioBlockDrive(InitialiseDevice(pci)));
+
+			for(auto d : *VirtioBlockDrive::VirtioBlockDrives)
+				HardwareAbstraction::Filesystems::MBR::ReadPartitions(d);
+		}
+	}
+
+
+
+	VirtioBlockDrive::VirtioBlockDrive(VirtioBlock::Device* d) : StorageDevice(StorageDeviceType::VirtioDisk)
+	{
+		this->dev = d;
+	}
+
+	uint64_t VirtioBlockDrive::GetSectors()
+	{
+		return this->dev->sectors;
+	}
+
+	uint32_t VirtioBlockDrive::GetSectorSize()
+	{
+		return VirtioBlock::SectorSize;
+	}
+
+	IOResult VirtioBlockDrive::Read(uint64_t LBA, uint64_t Buffer, size_t Bytes)
+	{
+		VirtioBlock::Commands c(this->dev);
+		if(!TransferBlocks(&c, LBA, Buffer, Bytes, false))
+			return IOResult();
+
+		return IOResult(Bytes, DMAAddr(), 0);
+	}
+
+	IOResult VirtioBlockDrive::Write(uint64_t LBA, uint64_t Data, size_t Bytes)
+	{
+		if(this->dev->readonly)
+			return IOResult();
+
+		VirtioBlock::Commands c(this->dev);
+		if(!TransferBlocks(&c, LBA, Data, Bytes, true))
+			return IOResult();
+
+		return IOResult(Bytes, DMAAddr(), 0);
+	}
+}
+}
+}
+}
@@ -0,0 +1,396 @@
+// Virtio.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <Kernel.hpp>
+#include <HardwareAbstraction/Devices/Virtio.hpp>
+#include <HardwareAbstraction/Devices/IOPort.hpp>
+#include <HardwareAbstraction/Devices/APIC.hpp>
+
+// the parts every virtio device shares: the (legacy) pci transport, and split virtqueues.
+
+// a virtqueue is a table of descriptors, a ring of the chains we've made available, and a ring of the ones the
+// device has used. all three live in one physically contiguous allocation, laid out the way the legacy interface
+// wants it, and we get at them through the direct map.
+
+// with event indices, each side says how far the other has to get before it wants hearing about it (the word after
+// each ring), rather than just switching notifications on and off. a device that's still busy with the last batch
+// then isn't kicked again for the next one, and we only get interrupted when we've asked to be.
+
+using namespace Kernel::HardwareAbstraction::MemoryManager;
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Devices {
+namespace Virtio
+{
+	enum Registers
+	{
+		HostFeatures	= 0x00,
+		GuestFeatures	= 0x04,
+		QueueAddress	= 0x08,
+		QueueSize		= 0x0C,
+		QueueSelect		= 0x0E,
+		QueueNotify		= 0x10,
+		DeviceStatus	= 0x12,
+		ISRStatus		= 0x13,
+		DeviceConfig	= 0x14,
+
+		// only with msi-x on, and the device config moves down past them.
+		ConfigVector	= 0x14,
+		QueueVector		= 0x16,
+	};
+
+	#define NO_VECTOR			0xFFFF
+
+	#define DESC_F_NEXT			0x1
+	#define DESC_F_WRITE		0x2
+	#define USED_F_NO_NOTIFY	0x1
+	#define AVAIL_F_NO_INTERRUPT	0x1
+
+	struct Descriptor
+	{
+		uint64_t addr;
+		uint32_t len;
+		uint16_t flags;
+		uint16_t next;
+
+	} __attribute__((packed));
+
+	struct AvailableRing
+	{
+		uint16_t flags;
+		volatile uint16_t idx;
+		uint16_t ring[];
+
+	} __attribute__((packed));
+
+	struct UsedElement
+	{
+		uint32_t id;
+		uint32_t len;
+
+	} __attribute__((packed));
+
+	struct UsedRing
+	{
+		volatile uint16_t flags;
+		volatile uint16_t idx;
+		UsedElement ring[];
+
+	} __attribute__((packed));
+
+
+
+	Transport::Transport(PCI::PCIDevice* p)
+	{
+		this->pci = p;
+
+		// enable bus mastering and io space.
+		uint32_t f = p->GetRegisterData(0x4, 0, 2);
+		p->WriteRegisterData(0x4, 0, 2, (f | 0x5) & ((uint32_t) ~0x400));
+
+		assert(p->IsBARIOPort(0));
+		this->ioaddr = (uint16_t) p->GetBAR(0);
+		this->configbase = DeviceConfig;
+		this->msix = false;
+	}
+
+	uint32_t Transport::GetFeatures()
+	{
+		return IOPort::Read32(this->ioaddr + HostFeatures);
+	}
+
+	void Transport::SetFeatures(uint32_t features)
+	{
+		IOPort::Write32(this->ioaddr + GuestFeatures, features);
+	}
+
+	void Transport::AddStatus(uint8_t status)
+	{
+		uint8_t old = IOPort::ReadByte(this->ioaddr + DeviceStatus);
+		IOPort::WriteByte(this->ioaddr + DeviceStatus, old | status);
+	}
+
+	void Transport::Reset()
+	{
+		IOPort::WriteByte(this->ioaddr + DeviceStatus, 0);
+	}
+
+	uint8_t Transport::ReadISR()
+	{
+		return IOPort::ReadByte(this->ioaddr + ISRStatus);
+	}
+
+	bool Transport::UseMSIX(uint8_t vector, uint16_t queues)
+	{
+		if(this->pci->GetMSIXCount() == 0 || !this->pci->EnableMSIX(0, vector, LocalAPIC::GetID()))
+			return false;
+
+		IOPort::Write16(this->ioaddr + ConfigVector, NO_VECTOR);
+
+		// a device that can't do it reads back NO_VECTOR.
+		bool ok = true;
+		for(uint16_t i = 0; i < queues; i++)
+		{
+			this->SelectQueue(i);
+			IOPort::Write16(this->ioaddr + QueueVector, 0);
+			ok = ok && IOPort::Read16(this->ioaddr + QueueVector) == 0;
+		}
+
+		if(!ok)
+		{
+			this->pci->DisableMSIX();
+			return false;
+		}
+
+		this->configbase = DeviceConfig + 4;
+		this->msix = true;
+		return true;
+	}
+
+	bool Transport::UsingMSIX()
+	{
+		return this->msix;
+	}
+
+	uint8_t Transport::ReadConfig8(uint16_t offset)
+	{
+		return IOPort::ReadByte(this->ioaddr + this->configbase + offset);
+	}
+
+	uint16_t Transport::ReadConfig16(uint16_t offset)
+	{
+		return IOPort::Read16(this->ioaddr + this->configbase + offset);
+	}
+
+	uint32_t Transport::ReadConfig32(uint16_t offset)
+	{
+		return IOPort::Read32(this->ioaddr + this->configbase + offset);
+	}
+
+	uint64_t Transport::ReadConfig64(uint16_t offset)
+	{
+		return this->ReadConfig32(offset) | ((uint64_t) this->ReadConfig32(offset + 4) << 32);
+	}
+
+	uint16_t Transport::SelectQueue(uint16_t index)
+	{
+		IOPort::Write16(this->ioaddr + QueueSelect, index);
+		return IOPort::Read16(this->ioaddr + QueueSize);
+	}
+
+	void Transport::SetQueueAddress(uint64_t phys)
+	{
+		IOPort::Write32(this->ioaddr + QueueAddress, (uint32_t) (phys / 0x1000));
+	}
+
+	void Transport::Notify(uint16_t index)
+	{
+		IOPort::Write16(this->ioaddr + QueueNotify, index);
+	}
+
+
+
+
+	Queue::Queue(Transport* t, uint16_t idx)
+	{
+		this->transport = t;
+		this->index = idx;
+		this->size = t->SelectQueue(idx);
+		assert(this->size > 0);
+
+		// the used ring starts on the next page after everything else.
+		uint64_t first = (sizeof(Descriptor) * this->size) + sizeof(AvailableRing) + (sizeof(uint16_t) * (this->size + 1));
+		uint64_t second = sizeof(UsedRing) + (sizeof(UsedElement) * this->size) + sizeof(uint16_t);
+
+		uint64_t usedoffset = (first + 0xFFF) & I_AlignMask;
+		uint64_t pages = (usedoffset + second + 0xFFF) / 0x1000;
+
+		uint64_t phys = Physical::AllocatePage(pages);
+		uint8_t* base = (uint8_t*) Virtual::PhysToDirect(phys);
+		Memory::Set(base, 0, pages * 0x1000);
+
+		this->desc = (Descriptor*) base;
+		this->avail = (AvailableRing*) (base + (sizeof(Descriptor) * this->size));
+		this->used = (UsedRing*) (base + usedoffset);
+		this->cookies = new void*[this->size];
+
+		// every descriptor starts out on the free list, which is threaded through 'next'.
+		for(uint16_t i = 0; i < this->size; i++)
+		{
+			this->desc[i].next = (uint16_t) (i + 1);
+			this->cookies[i] = 0;
+		}
+
+		this->freehead = 0;
+		this->numfree = this->size;
+		this->lastused = 0;
+		this->lastkick = 0;
+
+		this->eventidx = false;
+		this->interrupts = true;
+
+		t->SetQueueAddress(phys);
+	}
+
+	uint16_t Queue::GetSize()
+	{
+		return this->size;
+	}
+
+	uint16_t Queue::GetFree()
+	{
+		return this->numfree;
+	}
+
+	bool Queue::Post(const Segment* segs, uint16_t count, void* cookie)
+	{
+		if(count == 0 || count > this->numfree)
+			return false;
+
+		// the free list is already linked through 'next', so the chain just takes the first 'count' of it.
+		uint16_t head = this->freehead;
+		uint16_t d = head;
+		for(uint16_t i = 0; i < count; i++)
+		{
+			this->desc[d].addr = segs[i].phys;
+			this->desc[d].len = segs[i].length;
+			this->desc[d].flags = (uint16_t) ((segs[i].writable ? DESC_F_WRITE : 0) | (i + 1 < count ? DESC_F_NEXT : 0));
+
+			if(i + 1 < count)
+				d = this->desc[d].next;
+		}
+
+		this->freehead = this->desc[d].next;
+		this->numfree = (uint16_t) (this->numfree - count);
+		this->cookies[head] = cookie;
+
+		// the device can't see the entry until idx moves past it.
+		this->avail->ring[this->avail->idx % this->size] = head;
+		__sync_synchronize();
+		this->avail->idx = (uint16_t) (this->avail->idx + 1);
+
+		return true;
+	}
+
+	// the words after the rings: where we want interrupting, and where the device wants kicking.
+	static volatile uint16_t* UsedEvent(AvailableRing* avail, uint16_t size)
+	{
+		return (volatile uint16_t*) &avail->ring[size];
+	}
+
+	static volatile uint16_t* AvailEvent(UsedRing* used, uint16_t size)
+	{
+		return (volatile uint16_t*) &used->ring[size];
+	}
+
+	// whether moving from 'old' to 'now' went past 'event'.
+	static bool NeedEvent(uint16_t event, uint16_t now, uint16_t old)
+	{
+		return (uint16_t) (now - event - 1) < (uint16_t) (now - old);
+	}
+
+	void Queue::Kick()
+	{
+		uint16_t old = this->lastkick;
+		uint16_t now = this->avail->idx;
+
+		if(old == now)
+			return;
+
+		this->lastkick = now;
+
+		// pairs with the device publishing where it's up to and then checking idx one last time.
+		__sync_synchronize();
+
+		bool notify = false;
+		if(this->eventidx)	notify = NeedEvent(*AvailEvent(this->used, this->size), now, old);
+		else				notify = !(this->used->flags & USED_F_NO_NOTIFY);
+
+		if(notify)
+			this->transport->Notify(this->index);
+	}
+
+	bool Queue::Pending()
+	{
+		return this->lastused != this->used->idx;
+	}
+
+	void Queue::UseEventIndex()
+	{
+		this->eventidx = true;
+		*UsedEvent(this->avail, this->size) = this->lastused;
+	}
+
+	void Queue::DisableInterrupts()
+	{
+		this->interrupts = false;
+
+		// with event indices the device never looks at the flag, but leaving the index where it is means it won't
+		// interrupt again until it's gone all the way around.
+		if(!this->eventidx)
+			this->avail->flags = AVAIL_F_NO_INTERRUPT;
+	}
+
+	bool Queue::EnableInterrupts()
+	{
+		this->interrupts = true;
+
+		if(this->eventidx)	*UsedEvent(this->avail, this->size) = this->lastused;
+		else				this->avail->flags = 0;
+
+		__sync_synchronize();
+		return !this->Pending();
+	}
+
+	uint64_t Queue::Reap(void (*done)(void* cookie, uint32_t length, void* arg), void* arg)
+	{
+		uint64_t ret = 0;
+
+		again:
+		while(this->lastused != this->used->idx)
+		{
+			// don't read the element before we've seen idx.
+			__sync_synchronize();
+
+			UsedElement e = this->used->ring[this->lastused % this->size];
+			this->lastused++;
+
+			uint16_t head = (uint16_t) e.id;
+			void* cookie = this->cookies[head];
+			this->cookies[head] = 0;
+
+			// put the whole chain back on the free list.
+			uint16_t d = head;
+			uint16_t n = 1;
+			while(this->desc[d].flags & DESC_F_NEXT)
+			{
+				d = this->desc[d].next;
+				n++;
+			}
+
+			this->desc[d].next = this->freehead;
+			this->freehead = head;
+			this->numfree = (uint16_t) (this->numfree + n);
+
+			done(cookie, e.len, arg);
+			ret++;
+		}
+
+		// ask for an interrupt on the next one, and make sure it didn't slip in before we did.
+		if(this->eventidx && this->interrupts)
+		{
+			*UsedEvent(this->avail, this->size) = this->lastused;
+			__sync_synchronize();
+
+			if(this->Pending())
+				goto again;
+		}
+
+		return ret;
+	}
+}
+}
+}
+}
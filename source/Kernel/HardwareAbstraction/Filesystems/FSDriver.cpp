@@ -4,6 +4,7 @@
 
 #include <Kernel.hpp>
 #include <HardwareAbstraction/Devices/StorageDevice.hpp>
+#include <sys/epoll.h>
 
 using namespace Kernel::HardwareAbstraction::Devices::Storage;
 
@@ -56,6 +57,16 @@ namespace Filesystems
 	{
 		return rde::vector<VFS::vnode*>();
 	}
+
+	uint32_t FSDriver::Poll(VFS::vnode*)
+	{
+		return EPOLLIN | EPOLLOUT;
+	}
+
+	PollSource* FSDriver::GetPollSource(VFS::vnode*)
+	{
+		return 0;
+	}
 }
 }
 }
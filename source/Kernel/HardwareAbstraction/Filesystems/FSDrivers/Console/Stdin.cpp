@@ -5,6 +5,7 @@
 #include <Kernel.hpp>
 #include <Console.hpp>
 #include <HardwareAbstraction/Filesystems.hpp>
+#include <HardwareAbstraction/Filesystems/Poll.hpp>
 
 namespace Kernel {
 namespace HardwareAbstraction {
@@ -64,6 +65,16 @@ namespace Filesystems
 	{
 		return rde::vector<VFS::vnode*>();
 	}
+
+	uint32_t FSDriverStdin::Poll(VFS::vnode*)
+	{
+		return TTY::PollTTY(0);
+	}
+
+	PollSource* FSDriverStdin::GetPollSource(VFS::vnode*)
+	{
+		return TTY::GetTTYPollSource(0);
+	}
 }
 }
 }
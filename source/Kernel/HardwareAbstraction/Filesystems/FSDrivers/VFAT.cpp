@@ -20,6 +20,7 @@
 
 #include <String.hpp>
 #include <sys/stat.h>
+#include <errno.h>
 
 #include <rdestl/vector.h>
 
@@ -576,7 +577,12 @@ namespace Filesystems
 				uint64_t toread = ((cluslen - have) > pair.second) ? (pair.second) : (cluslen - have);
 
 				// Log("reading %d sectors at %d", toread * spc, this->ClusterToLBA((uint32_t) pair.first));
-				IO::Read(this->partition->GetStorageDevice(), this->ClusterToLBA((uint32_t) pair.first), rbuf, toread * spc * 512);
+				if(!IO::Read(this->partition->GetStorageDevice(), this->ClusterToLBA((uint32_t) pair.first), rbuf, toread * spc * 512))
+				{
+					MemoryManager::Virtual::FreePage(obuf, bufferPageSize);
+					Multitasking::SetThreadErrno(EIO);
+					return (size_t) -1;
+				}
 
 				rbuf += (toread * spc * 512);
 				have += toread;
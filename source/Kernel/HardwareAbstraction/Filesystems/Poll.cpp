@@ -0,0 +1,552 @@
+// Poll.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <Kernel.hpp>
+#include <HardwareAbstraction/Filesystems/Poll.hpp>
+#include <rdestl/rdestl.h>
+#include <errno.h>
+
+// event polls: one object that watches many fds, so a single thread can wait on all of them (epoll, more or less).
+
+// each watched fd has a PollWatch hanging off its driver's PollSource. when the source says something changed, the
+// watch goes onto its event poll's ready list, and whoever's waiting there is woken. waiting asks the driver what's
+// actually ready, so a notification only has to mean "might be ready"; waits cost the number of ready fds, not watched ones.
+
+// level-triggered watches are put back on the ready list after being reported, and dropped the next time round if they
+// turn out not to be ready any more. EPOLLET ones aren't.
+
+// lock order is the source's lock, then the event poll's. pollLock covers everything else -- the watch lists,
+// and the watches themselves while they're being looked at -- and is never held by notifications.
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Filesystems
+{
+	// events are gathered into a buffer on the stack, then copied out to userspace with no locks held.
+	#define MaxEventsPerWait	64
+
+	struct EventPoll;
+
+	struct PollWatch
+	{
+		EventPoll* ep;
+		VFS::vnode* node;
+		PollSource* source;
+
+		fd_t fd;
+		uint32_t events;
+		uint64_t data;
+
+		PollWatch* next;		// on the source, under its lock
+		PollWatch* readynext;	// on the ready list, under ep->waiters.lock
+		bool queued;
+	};
+
+	struct EventPoll
+	{
+		// these are under waiters.lock
+		PollWatch* ready = 0;
+		PollWatch* readytail = 0;
+		uint64_t nready = 0;
+		bool closed = false;
+
+		Multitasking::WaitQueue waiters;
+
+		// and these under pollLock; refs are the fd, plus threads in the middle of waiting.
+		rde::vector<PollWatch*> watches;
+		uint64_t refs = 1;
+	};
+
+	static Mutex pollLock;
+
+	static void Queue(PollWatch* w, bool wake)
+	{
+		EventPoll* ep = w->ep;
+
+		LockSpinlock(ep->waiters.lock);
+		if(!w->queued)
+		{
+			w->queued = true;
+			w->readynext = 0;
+
+			if(ep->readytail)	ep->readytail->readynext = w;
+			else				ep->ready = w;
+
+			ep->readytail = w;
+			ep->nready++;
+		}
+
+		if(wake)
+			Multitasking::WakeAll(ep->waiters);
+
+		UnlockSpinlock(ep->waiters.lock);
+	}
+
+	static PollWatch* Dequeue(EventPoll* ep)
+	{
+		LockSpinlock(ep->waiters.lock);
+
+		PollWatch* w = ep->ready;
+		if(w)
+		{
+			ep->ready = w->readynext;
+			if(!ep->ready)
+				ep->readytail = 0;
+
+			w->queued = false;
+			w->readynext = 0;
+			ep->nready--;
+		}
+
+		UnlockSpinlock(ep->waiters.lock);
+		return w;
+	}
+
+	static void Unqueue(PollWatch* w)
+	{
+		EventPoll* ep = w->ep;
+		LockSpinlock(ep->waiters.lock);
+
+		if(w->queued)
+		{
+			PollWatch* prev = 0;
+			for(PollWatch* c = ep->ready; c; prev = c, c = c->readynext)
+			{
+				if(c != w)
+					continue;
+
+				if(prev)	prev->readynext = c->readynext;
+				else		ep->ready = c->readynext;
+
+				if(ep->readytail == c)
+					ep->readytail = prev;
+
+				break;
+			}
+
+			w->queued = false;
+			ep->nready--;
+		}
+
+		UnlockSpinlock(ep->waiters.lock);
+	}
+
+	// everything below is called with pollLock held.
+
+	static void Detach(PollWatch* w)
+	{
+		PollSource* src = w->source;
+
+		LockSpinlock(src->waiters.lock);
+		{
+			PollWatch* prev = 0;
+			for(PollWatch* c = src->watches; c; prev = c, c = c->next)
+			{
+				if(c != w)
+					continue;
+
+				if(prev)	prev->next = c->next;
+				else		src->watches = c->next;
+
+				break;
+			}
+		}
+		UnlockSpinlock(src->waiters.lock);
+
+		Unqueue(w);
+		VFS::Dereference(w->node);
+
+		delete w;
+	}
+
+	static void Remove(PollWatch* w)
+	{
+		EventPoll* ep = w->ep;
+		ep->watches.remove(w);
+
+		Detach(w);
+	}
+
+	static void Put(EventPoll* ep)
+	{
+		assert(ep->refs > 0);
+		if(--ep->refs == 0)
+			delete ep;
+	}
+
+	static EventPoll* GetEventPoll(fd_t fd)
+	{
+		VFS::fileentry* fe = VFS::FileEntryFromFD(&Multitasking::GetCurrentProcess()->iocontext, fd);
+		if(!fe || fe->node->info->driver->GetType() != FSDriverType::EventPoll || !fe->node->info->data)
+		{
+			Multitasking::SetThreadErrno(EBADF);
+			return 0;
+		}
+
+		return (EventPoll*) fe->node->info->data;
+	}
+
+	static PollWatch* FindWatch(EventPoll* ep, fd_t fd)
+	{
+		for(PollWatch* w : ep->watches)
+		{
+			if(w->fd == fd)
+				return w;
+		}
+
+		return 0;
+	}
+
+	// reports at most 'max' of the watches that were ready when we started; level-triggered ones go to the back.
+	static int64_t Harvest(EventPoll* ep, struct epoll_event* out, int64_t max)
+	{
+		LockSpinlock(ep->waiters.lock);
+		uint64_t pending = ep->nready;
+		UnlockSpinlock(ep->waiters.lock);
+
+		int64_t n = 0;
+		for(uint64_t i = 0; i < pending && n < max; i++)
+		{
+			PollWatch* w = Dequeue(ep);
+			if(!w)
+				break;
+
+			uint32_t ev = w->node->info->driver->Poll(w->node) & (w->events | EPOLLERR | EPOLLHUP);
+			if(!ev)
+				continue;
+
+			out[n].events = ev;
+			out[n].data.u64 = w->data;
+			n++;
+
+			if(!(w->events & EPOLLET))
+				Queue(w, false);
+		}
+
+		return n;
+	}
+
+
+
+
+	void NotifyPoll(PollSource& src, uint32_t events)
+	{
+		LockSpinlock(src.waiters.lock);
+
+		for(PollWatch* w = src.watches; w; w = w->next)
+		{
+			if((w->events | EPOLLERR | EPOLLHUP) & events)
+				Queue(w, true);
+		}
+
+		Multitasking::WakeAll(src.waiters);
+		UnlockSpinlock(src.waiters.lock);
+	}
+
+	void ForgetPolls(VFS::vnode* node)
+	{
+		PollSource* src = node->info->driver->GetPollSource(node);
+		if(!src)
+			return;
+
+		AutoMutex lk(pollLock);
+		while(true)
+		{
+			PollWatch* w = 0;
+
+			LockSpinlock(src->waiters.lock);
+			for(w = src->watches; w; w = w->next)
+			{
+				if(w->node == node)
+					break;
+			}
+			UnlockSpinlock(src->waiters.lock);
+
+			if(!w)
+				break;
+
+			Remove(w);
+		}
+	}
+
+
+
+
+	extern "C" fd_t Syscall_CreateEventPoll(int64_t flags)
+	{
+		(void) flags;
+
+		VFS::Filesystem* fs = VFS::GetFilesystemAtPath(VFS::FS_EPOLL_MOUNTPOINT);
+		assert(fs);
+		assert(fs->driver);
+
+		VFS::vnode* node = VFS::CreateNode(fs->driver);
+		node->type = VFS::VNodeType::File;
+		node->info->data = (void*) new EventPoll();
+
+		VFS::fileentry* fe = VFS::Open(&Multitasking::GetCurrentProcess()->iocontext, node, 0);
+		assert(fe);
+
+		return fe->fd;
+	}
+
+	extern "C" int64_t Syscall_ControlEventPoll(fd_t epfd, int64_t op, fd_t fd, struct epoll_event* _event)
+	{
+		// copy it in before taking the lock; faulting on it with the lock held would stall every other poll.
+		struct epoll_event kev;
+		struct epoll_event* event = 0;
+		if(_event)
+		{
+			if(!MemoryManager::Virtual::CopyFromUser(&kev, _event, sizeof(kev)))
+			{
+				Multitasking::SetThreadErrno(EFAULT);
+				return -1;
+			}
+
+			event = &kev;
+		}
+
+		AutoMutex lk(pollLock);
+
+		EventPoll* ep = GetEventPoll(epfd);
+		if(!ep)
+			return -1;
+
+		VFS::fileentry* fe = VFS::FileEntryFromFD(&Multitasking::GetCurrentProcess()->iocontext, fd);
+		if(!fe)
+		{
+			Multitasking::SetThreadErrno(EBADF);
+			return -1;
+		}
+
+		if(op != EPOLL_CTL_DEL && !event)
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return -1;
+		}
+
+		PollWatch* w = FindWatch(ep, fd);
+		if(op == EPOLL_CTL_ADD)
+		{
+			if(w)
+			{
+				Multitasking::SetThreadErrno(EEXIST);
+				return -1;
+			}
+
+			VFS::vnode* node = fe->node;
+			FSDriver* driver = node->info->driver;
+
+			// regular files are always ready, so there's nothing to watch.
+			// event polls can't watch each other.
+			PollSource* src = driver->GetType() == FSDriverType::EventPoll ? 0 : driver->GetPollSource(node);
+			if(!src)
+			{
+				Multitasking::SetThreadErrno(EPERM);
+				return -1;
+			}
+
+			w = new PollWatch();
+			w->ep		= ep;
+			w->node		= VFS::Reference(node);
+			w->source	= src;
+			w->fd		= fd;
+			w->events	= event->events;
+			w->data		= event->data.u64;
+			w->next		= 0;
+			w->readynext	= 0;
+			w->queued	= false;
+
+			ep->watches.push_back(w);
+
+			LockSpinlock(src->waiters.lock);
+			w->next = src->watches;
+			src->watches = w;
+			UnlockSpinlock(src->waiters.lock);
+
+			// it might be ready already; the next wait will find out.
+			Queue(w, true);
+			return 0;
+		}
+
+		if(!w)
+		{
+			Multitasking::SetThreadErrno(ENOENT);
+			return -1;
+		}
+
+		if(op == EPOLL_CTL_DEL)
+		{
+			Remove(w);
+			return 0;
+		}
+		else if(op == EPOLL_CTL_MOD)
+		{
+			LockSpinlock(w->source->waiters.lock);
+			w->events	= event->events;
+			w->data		= event->data.u64;
+			UnlockSpinlock(w->source->waiters.lock);
+
+			Queue(w, true);
+			return 0;
+		}
+
+		Multitasking::SetThreadErrno(EINVAL);
+		return -1;
+	}
+
+	// timeout is in milliseconds; -1 waits forever, and 0 doesn't wait at all.
+	extern "C" int64_t Syscall_WaitEventPoll(fd_t epfd, struct epoll_event* out, int64_t max, int64_t timeout)
+	{
+		if(!out || max <= 0)
+		{
+			Multitasking::SetThreadErrno(EINVAL);
+			return -1;
+		}
+
+		// fewer than asked for is always allowed, and the rest stay queued for next time.
+		if(max > MaxEventsPerWait)
+			max = MaxEventsPerWait;
+
+		if(!MemoryManager::Virtual::IsUserRange(out, (size_t) max * sizeof(struct epoll_event)))
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return -1;
+		}
+
+		struct epoll_event events[MaxEventsPerWait];
+
+		EventPoll* ep = 0;
+		{
+			AutoMutex lk(pollLock);
+			if(!(ep = GetEventPoll(epfd)))
+				return -1;
+
+			ep->refs++;
+		}
+
+		uint64_t deadline = timeout > 0 ? Kernel::TickCounter() + (uint64_t) timeout : 0;
+		int64_t ret = 0;
+
+		while(true)
+		{
+			{
+				AutoMutex lk(pollLock);
+				if(ep->closed)
+				{
+					Multitasking::SetThreadErrno(EBADF);
+					ret = -1;
+					break;
+				}
+
+				ret = Harvest(ep, events, max);
+			}
+
+			if(ret > 0 || timeout == 0)
+				break;
+
+			uint64_t remaining = 0;
+			if(timeout > 0)
+			{
+				uint64_t now = Kernel::TickCounter();
+				if(now >= deadline)
+					break;
+
+				remaining = deadline - now;
+			}
+
+			LockSpinlock(ep->waiters.lock);
+			if(!ep->ready && !ep->closed)
+				Multitasking::SleepOn(ep->waiters, remaining);
+
+			UnlockSpinlock(ep->waiters.lock);
+		}
+
+		{
+			AutoMutex lk(pollLock);
+			Put(ep);
+		}
+
+		if(ret > 0 && !MemoryManager::Virtual::CopyToUser(out, events, (size_t) ret * sizeof(struct epoll_event)))
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return -1;
+		}
+
+		return ret;
+	}
+
+
+
+
+	EventPollFS::EventPollFS() : FSDriver(nullptr, FSDriverType::EventPoll)
+	{
+		this->_seekable = false;
+	}
+
+	EventPollFS::~EventPollFS()
+	{
+	}
+
+	bool EventPollFS::Create(VFS::vnode*, const char*, uint64_t, uint64_t)
+	{
+		return false;
+	}
+
+	bool EventPollFS::Delete(VFS::vnode*, const char*)
+	{
+		return false;
+	}
+
+	bool EventPollFS::Traverse(VFS::vnode*, const char*, char**)
+	{
+		return false;
+	}
+
+	size_t EventPollFS::Read(VFS::vnode*, void*, off_t, size_t)
+	{
+		return 0;
+	}
+
+	size_t EventPollFS::Write(VFS::vnode*, const void*, off_t, size_t)
+	{
+		return 0;
+	}
+
+	void EventPollFS::Flush(VFS::vnode*)
+	{
+	}
+
+	void EventPollFS::Stat(VFS::vnode*, struct stat*, bool)
+	{
+	}
+
+	void EventPollFS::Close(VFS::vnode* node)
+	{
+		EventPoll* ep = (EventPoll*) node->info->data;
+		if(!ep)
+			return;
+
+		AutoMutex lk(pollLock);
+		node->info->data = 0;
+
+		while(ep->watches.size() > 0)
+			Remove(ep->watches.back());
+
+		// anyone still waiting finds out when they wake up.
+		LockSpinlock(ep->waiters.lock);
+		ep->closed = true;
+		Multitasking::WakeAll(ep->waiters);
+		UnlockSpinlock(ep->waiters.lock);
+
+		Put(ep);
+	}
+
+	rde::vector<VFS::vnode*> EventPollFS::ReadDir(VFS::vnode*)
+	{
+		return rde::vector<VFS::vnode*>();
+	}
+}
+}
+}
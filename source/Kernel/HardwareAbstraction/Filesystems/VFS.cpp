@@ -11,6 +11,7 @@
 #include <String.hpp>
 
 #include <HardwareAbstraction/Network.hpp>
+#include <HardwareAbstraction/Filesystems/Poll.hpp>
 
 using namespace Kernel::HardwareAbstraction::Devices::Storage;
 namespace Kernel {
@@ -24,6 +25,8 @@ namespace Filesystems
 		const char* FS_STDOUT_MOUNTPOINT = "/dev/stdout";
 		const char* FS_STDERR_MOUNTPOINT = "/dev/stderr";
 		const char* FS_SOCKET_MOUNTPOINT = "/dev/socketfs";
+		const char* FS_MQUEUE_MOUNTPOINT = "/dev/_mq";
+		const char* FS_EPOLL_MOUNTPOINT = "/dev/_epoll";
 
 		static id_t curid = 0;
 		static id_t curfeid = 0;
@@ -37,6 +40,8 @@ namespace Filesystems
 		static FSDriver* driver_stdout = 0;
 		static FSDriver* driver_stderr = 0;
 		static FSDriver* driver_socketfs = 0;
+		static FSDriver* driver_mqueue = 0;
+		static FSDriver* driver_epoll = 0;
 
 		static Mutex mtx;
 
@@ -83,12 +88,16 @@ namespace Filesystems
 			driver_stdout = new FSDriverStdout();
 			driver_stderr = new FSDriverStdlog();
 			driver_socketfs = new Network::SocketVFS();
+			driver_mqueue = new IPC::MessageQueueFS();
+			driver_epoll = new EventPollFS();
 
 			Mount(nullptr, driver_console, FS_CONSOLE_MOUNTPOINT);
 			Mount(nullptr, driver_stdin, FS_STDIN_MOUNTPOINT);
 			Mount(nullptr, driver_stdout, FS_STDOUT_MOUNTPOINT);
 			Mount(nullptr, driver_stdout, FS_STDERR_MOUNTPOINT);
 			Mount(nullptr, driver_socketfs, FS_SOCKET_MOUNTPOINT);
+			Mount(nullptr, driver_mqueue, FS_MQUEUE_MOUNTPOINT);
+			Mount(nullptr, driver_epoll, FS_EPOLL_MOUNTPOINT);
 
 			auto ctx = getctx();
 			OpenFile(ctx, FS_STDIN_MOUNTPOINT, 0);
@@ -228,6 +237,7 @@ namespace Filesystems
 			assert(fe->node->info);
 			assert(fe->node->info->driver);
 
+			ForgetPolls(fe->node);
 			fe->node->info->driver->Close(fe->node);
 
 			ioctx->fdarray.fds.remove(fe);
@@ -426,7 +436,8 @@ namespace Filesystems
 		assert(fe->node);
 		auto read = VFS::Read(ctx, fe->node, buf, fe->offset, len);
 
-		if(read > 0)
+		// (size_t) -1 is an error, with errno set.
+		if(read > 0 && read != (size_t) -1)
 			fe->offset += read;
 
 		return read;
@@ -445,7 +456,8 @@ namespace Filesystems
 		assert(fe->node);
 		auto written = VFS::Write(ctx, fe->node, buf, fe->offset, len);
 
-		fe->offset += written;
+		if(written != (size_t) -1)
+			fe->offset += written;
 		return written;
 	}
 
@@ -30,6 +30,9 @@ namespace IO
 		bool completed		= 0;
 
 		Multitasking::Thread* owningthread = 0;
+
+		// on the owning thread's stack; it's blocked until we're done.
+		bool* ok = 0;
 	};
 
 	static rde::vector<IOTransfer>* Transfers;
@@ -67,36 +70,65 @@ namespace IO
 				if(req.writeop)
 				{
 					uint64_t outbuf = req.out;
+					uint64_t bounce = 0;
+					bool ok = false;
 					if(req.owningthread->Parent != Multitasking::GetProcess(0))
 					{
-						// if we're writing from userspace, we need to copy the buffer to kernel space *before* the write.
-						outbuf = Virtual::AllocatePage((req.count + 0xFFF) / 0x1000);
-						Virtual::CopyToKernel(req.out, outbuf, req.count, &req.owningthread->Parent->VAS);
+						// we're not in the writer's address space. most buffers are in the kernel's part of it, or
+						// physically contiguous, so the device can take them as they are; the rest get copied over first.
+						Virtual::ScatterList sl(req.out, req.count, &req.owningthread->Parent->VAS);
+						outbuf = (uint64_t) sl.Contiguous();
+
+						if(!outbuf)
+						{
+							bounce = outbuf = Virtual::AllocatePage((req.count + 0xFFF) / 0x1000);
+							if(!Virtual::CopyToKernel(req.out, outbuf, req.count, &req.owningthread->Parent->VAS))
+							{
+								Log(1, "IO: write buffer %x of thread %d isn't mapped", req.out, req.owningthread->ThreadID);
+								outbuf = 0;
+							}
+						}
 					}
 
-					IOResult iores = req.device->Write(req.pos, outbuf, req.count);
-					(void) iores;
+					if(outbuf)
+					{
+						IOResult iores = req.device->Write(req.pos, outbuf, req.count);
+						ok = (iores.bytesTransferred == req.count);
+					}
 
-					if(outbuf != req.out)
+					if(bounce)
 					{
-						Virtual::FreePage(outbuf, (req.count + 0xFFF) / 0x1000);
+						Virtual::FreePage(bounce, (req.count + 0xFFF) / 0x1000);
 					}
+
+					if(req.ok)
+						*req.ok = ok;
 				}
 				else
 				{
 					IOResult iores = req.device->Read(req.pos, req.out, req.count);
+					bool ok = (iores.bytesTransferred == req.count);
 
-					// if this is a read from kernel space, just do shit.
-					if(req.owningthread->Parent == Multitasking::GetProcess(0))
+					// nothing to copy from if it failed.
+					if(!ok)
 					{
+						Log(1, "IO: read of %d bytes at %x failed", req.count, req.pos);
+					}
+					else if(req.owningthread->Parent == Multitasking::GetProcess(0))
+					{
+						// if this is a read from kernel space, just do shit.
 						// Log("copying over: %x to %x, %d bytes (%x)", iores.allocatedBuffer.virt, req.out, req.count, req.ownerRet);
 						Memory::CopyOverlap((void*) req.out, (void*) iores.allocatedBuffer.virt, req.count);
 					}
-					else
+					else if(!Virtual::CopyFromKernel(iores.allocatedBuffer.virt, req.out, req.count, &req.owningthread->Parent->VAS))
 					{
-						Virtual::CopyFromKernel(iores.allocatedBuffer.virt, req.out, req.count, &req.owningthread->Parent->VAS);
+						Log(1, "IO: read buffer %x of thread %d isn't mapped", req.out, req.owningthread->ThreadID);
+						ok = false;
 					}
 
+					if(req.ok)
+						*req.ok = ok;
+
 					// if the bufferSizeInPages is zero, then we don't free anything
 					// these buffers may be device specific, like NIC Rx/Tx buffers.
 					if(iores.bufferSizeInPages > 0)
@@ -136,17 +168,22 @@ namespace IO
 		Multitasking::AddToQueue(Multitasking::CreateKernelThread(Scheduler, 2));
 	}
 
-	void Read(IODevice* dev, uint64_t pos, uint64_t buf, uint64_t bytes)
+	bool Read(IODevice* dev, uint64_t pos, uint64_t buf, uint64_t bytes)
 	{
 		// only returns when the data is read, therefore is blocking.
 		assert(dev);
 		if(bytes == 0 || buf == 0)
 		{
 			HALT("");
-			return;
+			return false;
 		}
 
+		if(dev->QueuesInternally())
+			return dev->Read(pos, buf, bytes).bytesTransferred == bytes;
+
+		bool ok = false;
 		IOTransfer req;
+		req.ok				= &ok;
 
 		req.device			= dev;
 		req.pos				= pos;
@@ -164,16 +201,22 @@ namespace IO
 		UNLOCK(listmtx);
 
 		BLOCK();
+		return ok;
 	}
 
-	void Write(IODevice* dev, uint64_t pos, uint64_t buf, uint64_t bytes)
+	bool Write(IODevice* dev, uint64_t pos, uint64_t buf, uint64_t bytes)
 	{
 		// only returns when the data is read, therefore is blocking.
 		assert(dev);
 		if(bytes == 0 || buf == 0)
-			return;
+			return true;
+
+		if(dev->QueuesInternally())
+			return dev->Write(pos, buf, bytes).bytesTransferred == bytes;
 
+		bool ok = false;
 		IOTransfer req;
+		req.ok				= &ok;
 		if(pos == 0x1D6A)
 		{
 			// MemoryManager::KernelHeap::Print();
@@ -194,6 +237,7 @@ namespace IO
 		UNLOCK(listmtx);
 
 		BLOCK();
+		return ok;
 	}
 
 
@@ -249,6 +249,12 @@ Fault31:
 
 GlobalHandler:
 	xchg %bx, %bx
+
+	// int_no and err_code are on top, so cs is at 24.
+	testb $3, 24(%rsp)
+	jz 1f
+	swapgs
+1:
 	pushq %r15
 	pushq %r14
 	pushq %r13
@@ -279,7 +285,6 @@ GlobalHandler:
 	movq %rsp, %rdi
 
 	call ExceptionHandler_C
-	hlt
 
 	addq $8, %rsp	// remove cr2
 	addq $8, %rsp	// Don't pop %rsp, may not be defined.
@@ -303,6 +308,10 @@ GlobalHandler:
 	// Remove int_no and err_code
 	addq $16, %rsp
 
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	// Return to where we came from.
 	iretq
 
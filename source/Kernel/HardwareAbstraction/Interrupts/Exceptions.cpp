@@ -10,6 +10,7 @@
 #include <HardwareAbstraction/Devices/IOPort.hpp>
 #include <Memory.hpp>
 #include <StandardIO.hpp>
+#include <Console.hpp>
 
 using namespace Kernel;
 using namespace Library;
@@ -142,7 +143,6 @@ namespace Interrupts
 
 	static IDTEntry idt[256];
 	static IDTPointer idtp;
-	extern rde::vector<IRQHandlerPlugList*>* IRQHandlerList;
 
 
 	void SetGate(uint8_t num, uint64_t base, uint16_t sel, uint8_t flags)
@@ -183,8 +183,12 @@ namespace Interrupts
 
 		// Points the processor's internal register to the new IDT
 		HAL_AsmLoadIDT((uint64_t) &idtp);
+	}
 
-		IRQHandlerList = new rde::vector<IRQHandlerPlugList*>();
+	// the other processors share the boot processor's idt.
+	void LoadIDT()
+	{
+		HAL_AsmLoadIDT((uint64_t) &idtp);
 	}
 
 	void InstallDefaultHandlers()
@@ -199,6 +203,9 @@ namespace Interrupts
 		SetGate(7, (uint64_t) Fault7, 0x08, 0x8E);
 
 		SetGate(8, (uint64_t) Fault8, 0x08, 0x8E);
+
+		// double faults (eg. running off the end of a kernel stack) get a stack of their own, from ist1 in the tss.
+		idt[8].always0_ist = 1;
 		SetGate(9, (uint64_t) Fault9, 0x08, 0x8E);
 		SetGate(10, (uint64_t) Fault10, 0x08, 0x8E);
 		SetGate(11, (uint64_t) Fault11, 0x08, 0x8E);
@@ -340,14 +347,23 @@ namespace Interrupts
 		asm volatile("mov %%cr3, %0" : "=r" (cr3));
 
 
-		Log(1, "%s Exception: RIP: %p, Error Code: %x, CR3: %p, CR2: %p, TID: %d", ExceptionMessages[r->InterruptID], r->rip, r->ErrorCode, cr3, r->cr2, Multitasking::GetCurrentThread()->ThreadID);
-
 		// check if this page fault can be handled gracefully, ie. swapping from disk, doing a cow, etc.
 		if(r->InterruptID == 14 && MemoryManager::Virtual::HandlePageFault(cr2, cr3, r->ErrorCode))
 			return;
 
+		// the kernel touching a bad user pointer, somewhere that's prepared for it.
+		if((r->InterruptID == 14 || r->InterruptID == 13) && !(r->cs & 3) && MemoryManager::Virtual::FixupException(&r->rip))
+			return;
+
+		// demand paging and cow go through here all the time, so only the ones nobody could deal with get logged.
+		Log(1, "%s Exception: RIP: %p, Error Code: %x, CR3: %p, CR2: %p, TID: %d", ExceptionMessages[r->InterruptID], r->rip, r->ErrorCode, cr3, r->cr2, Multitasking::GetCurrentThread()->ThreadID);
+
 
-		if(Multitasking::GetCurrentThread()->State & STATE_NORMAL)
+		// the stack we came from is unusable, so there's no killing just the thread.
+		if(r->InterruptID == 8 && cr2 >= KernelStackAddress && cr2 < KernelStackAddress + KernelStackWindow)
+			Log(1, "Kernel stack overflow in thread %d (guard page at %x)", Multitasking::GetCurrentThread()->ThreadID, cr2 & I_AlignMask);
+
+		if(r->InterruptID != 8 && Multitasking::GetCurrentThread()->State & STATE_NORMAL)
 		{
 			Log(1, "Terminated thread %d belonging to parent %s, for exception: %s", Multitasking::GetCurrentThread()->ThreadID,
 				Multitasking::GetCurrentThread()->Parent->Name, ExceptionMessages[r->InterruptID]);
@@ -382,21 +398,19 @@ namespace Interrupts
 			// Utilities::GenerateStackTrace(r->rsp, 3);
 
 
-			// this is quite fucking bad...
-			// basically, create opcodes in memory to do a syscall that does Syscall_TerminateCrashedThread
-			// did i mention we're executing code in the heap?????
-			uint8_t syscallOpcodes[] = { 0x49, 0xC7, 0xC2, 0x01, 0x00, 0x00, 0x00, 0xCD, 0xF8 };
-			uint8_t* dest = new uint8_t[16];
-
-			memcpy(dest, syscallOpcodes, 9);
+			// take it out through the scheduler, like Syscall_TerminateCrashedThread would -- we're on its kernel
+			// stack already. if whatever faulted could take interrupts, so can the rest of this; tearing down the
+			// process (when it's the last thread) might need to sleep. this doesn't come back.
+			if(r->rflags & 0x200)
+				asm volatile("sti" ::: "memory");
 
-			r->rip = (uint64_t) dest;
-
-
-			return;
+			Multitasking::TerminateCurrentThread(0);
 		}
 
 
+		// make sure everything queued before the crash actually makes it out.
+		FlushLog();
+
 		StdIO::PrintFmt("\n\n\nCPU Exception: %s; Error Code: %x", ExceptionMessages[r->InterruptID], r->ErrorCode);
 		StdIO::PrintFmt("\n[mx] has met an unresolvable error, and will now halt.\n");
 
@@ -435,6 +449,7 @@ namespace Interrupts
 
 
 		StdIO::PrintFmt("\n");
+		Console::Flush();
 		UHALT();
 	}
 }
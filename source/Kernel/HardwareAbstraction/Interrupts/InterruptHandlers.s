@@ -106,8 +106,78 @@ Interrupt15:
 
 
 
+// one stub per vector from FirstDeviceVector (0x30) to LastDeviceVector (0xEF), 16 bytes apart, for
+// Interrupts::AllocateVector() to point the idt at.
+.global VectorStubs
+.type VectorStubs, @function
+.align 16
+VectorStubs:
+.set vec, 0x30
+.rept 0xC0
+	.align 16
+	pushq $vec	// int_no
+	jmp GlobalHandler
+	.set vec, vec + 1
+.endr
+
+
+
+
+// the local apic sends this when an interrupt goes away before it's delivered; it doesn't want an EOI.
+.global SpuriousInterrupt
+.type SpuriousInterrupt, @function
+SpuriousInterrupt:
+	iretq
+
+
+
+// another processor changed an address space we're running; see TLB.cpp.
+// only the caller-saved registers need saving, since we never switch from here.
+.global TLBShootdownInterrupt
+.type TLBShootdownInterrupt, @function
+TLBShootdownInterrupt:
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
+	push %r11
+	push %r10
+	push %r9
+	push %r8
+	push %rdx
+	push %rcx
+	push %rax
+	push %rsi
+	push %rdi
+
+	cld
+	call TLBShootdown_C
+
+	pop %rdi
+	pop %rsi
+	pop %rax
+	pop %rcx
+	pop %rdx
+	pop %r8
+	pop %r9
+	pop %r10
+	pop %r11
+
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
+	iretq
+
+
+
 
 GlobalHandler:
+	// from ring 3, swap in the kernel's gs (the int_no we pushed puts cs at 16).
+	testb $3, 16(%rsp)
+	jz 1f
+	swapgs
+1:
 	push %r15
 	push %r14
 	push %r13
@@ -145,8 +215,12 @@ GlobalHandler:
 	pop %r15
 
 	addq $8, %rsp
-	// Return to where we came from.
 
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
+	// Return to where we came from.
 	iretq
 
 
@@ -8,6 +8,8 @@
 #include <Kernel.hpp>
 #include <HardwareAbstraction/Interrupts.hpp>
 #include <HardwareAbstraction/Devices/IOPort.hpp>
+#include <HardwareAbstraction/Devices/APIC.hpp>
+#include <HardwareAbstraction/Devices/PCI.hpp>
 #include <Memory.hpp>
 #include <StandardIO.hpp>
 
@@ -22,36 +24,82 @@ namespace Interrupts
 {
 	extern "C" void ThreadExceptionTerminate();
 
-	rde::vector<IRQHandlerPlugList*>* IRQHandlerList;
+	extern "C" void VectorStubs();
 
+	// indexed by vector, so dispatch doesn't go looking; empty until something's installed there.
+	static IRQHandlerPlugList* VectorTable[256];
 
-	static IRQHandlerPlugList* GetPlugList(uint64_t irq)
+	static Spinlock VectorLock;
+	static uint8_t NextVector = FirstDeviceVector;
+
+
+	static IRQHandlerPlugList* GetPlugList(uint8_t vector)
 	{
-		// see if we need to create a new plug list.
-		IRQHandlerPlugList* pluglist = 0;
-		for(uint64_t i = 0; i < IRQHandlerList->size(); i++)
-		{
-			if(irq == (*IRQHandlerList)[i]->IRQNum)
-			{
-				pluglist = (*IRQHandlerList)[i];
-				break;
-			}
-		}
+		LockSpinlock(VectorLock);
 
+		IRQHandlerPlugList* pluglist = VectorTable[vector];
 		if(!pluglist)
 		{
-			pluglist = new IRQHandlerPlugList(irq);
-			IRQHandlerList->push_back(pluglist);
-			Log("Creating new PlugList for IRQ %d", irq);
+			pluglist = new IRQHandlerPlugList(vector);
+			VectorTable[vector] = pluglist;
 		}
 
+		UnlockSpinlock(VectorLock);
 		return pluglist;
 	}
 
 	void InstallIRQHandler(uint64_t irq, void(*Handler)(void*), void* arg)
 	{
-		// add it to the list.
-		GetPlugList(irq)->HandlerList.push_back(new IRQHandlerPlug(Handler, arg));
+		// the pic's lines start at 32.
+		InstallVectorHandler((uint8_t) (irq + 32), Handler, arg);
+	}
+
+	void InstallVectorHandler(uint8_t vector, void(*Handler)(void*), void* arg)
+	{
+		IRQHandlerPlugList* pl = GetPlugList(vector);
+		IRQHandlerPlug* plug = new IRQHandlerPlug(Handler, arg);
+
+		LockSpinlock(pl->lock);
+		assert(pl->HandlerList.size() < MaxHandlersPerVector);
+		pl->HandlerList.push_back(plug);
+		UnlockSpinlock(pl->lock);
+	}
+
+	bool InstallDeviceHandler(PCI::PCIDevice* dev, void(*Handler)(void*), void* arg)
+	{
+		uint8_t vector = dev->FindCapability(PCI_CAP_MSI) ? AllocateVector() : 0;
+		if(vector != 0 && dev->EnableMSI(vector))
+		{
+			InstallVectorHandler(vector, Handler, arg);
+			return true;
+		}
+
+		InstallIRQHandler(dev->GetInterruptLine(), Handler, arg);
+		return false;
+	}
+
+	uint8_t AllocateVector()
+	{
+		LockSpinlock(VectorLock);
+
+		uint8_t ret = 0;
+		if(NextVector <= LastDeviceVector)
+		{
+			ret = NextVector;
+			NextVector++;
+		}
+
+		UnlockSpinlock(VectorLock);
+
+		if(ret == 0)
+		{
+			Log(1, "Out of interrupt vectors");
+			return 0;
+		}
+
+		// each stub is 16 bytes, starting from the first vector.
+		SetGate(ret, (uint64_t) VectorStubs + ((ret - FirstDeviceVector) * 16), 0x08, 0x8E);
+		return ret;
 	}
 
 	void UninstallIRQHandler(uint64_t irq)
@@ -74,20 +122,30 @@ namespace Interrupts
 
 	extern "C" void InterruptHandler_C(uint64_t iid)
 	{
-		// get the proper IRQHandlerPlugList.
-		for(uint64_t i = 0; i < IRQHandlerList->size(); i++)
+		IRQHandlerPlugList* pl = VectorTable[iid & 0xFF];
+		if(pl)
+		{
+			// plugs are never freed, so a copy of the list stays good after we let go -- and the handlers take locks
+			// of their own, which mustn't nest inside this one.
+			IRQHandlerPlug* handlers[MaxHandlersPerVector];
+			uint64_t count = 0;
+
+			LockSpinlock(pl->lock);
+			count = pl->HandlerList.size();
+			for(uint64_t k = 0; k < count; k++)
+				handlers[k] = pl->HandlerList[k];
+
+			UnlockSpinlock(pl->lock);
+
+			for(uint64_t k = 0; k < count; k++)
+				handlers[k]->handle(handlers[k]->arg);
+		}
+
+		// messages go straight to the local apic, so that's who wants to hear about it.
+		if(iid >= FirstDeviceVector)
 		{
-			// operate with zero-based index, not absolute IDT offset.
-			if((*IRQHandlerList)[i]->IRQNum == iid - 32)
-			{
-				IRQHandlerPlugList* pl = (*IRQHandlerList)[i];
-
-				for(uint64_t k = 0; k < pl->HandlerList.size(); k++)
-				{
-					IRQHandlerPlug* handler = pl->HandlerList[k];
-					handler->handle(handler->arg);
-				}
-			}
+			LocalAPIC::SendEOI();
+			return;
 		}
 
 		// This IRQ is >7, send an EOI to the slave controller too.
@@ -75,11 +75,9 @@ namespace LoadBinary
 		assert(FileHeader->ElfIdentification[EI_DATA] == ElfDataLittleEndian);
 		assert(FileHeader->ElfType == ElfTypeExecutable);
 
-		rde::hash_map<uint64_t, bool>* allocatedpgs = new rde::hash_map<uint64_t, bool>();
+		// virtual page -> physical page, in the new process.
+		rde::hash_map<uint64_t, uint64_t>* allocatedpgs = new rde::hash_map<uint64_t, uint64_t>();
 
-
-
-		// temporarily map the process's pml4.
 		for(uint64_t k = 0; k < FileHeader->ElfProgramHeaderEntries; k++)
 		{
 			ELF64ProgramHeader_type* ProgramHeader = (ELF64ProgramHeader_type*) (this->buffer + FileHeader->ElfProgramHeaderOffset + (k * FileHeader->ElfProgramHeaderEntrySize));
@@ -97,38 +95,35 @@ namespace LoadBinary
 				if(allocatedpgs->size() > 0 && allocatedpgs->find(actualvirt) != allocatedpgs->end())
 					continue;	// we've already mapped this address to a page, continue.
 
-				(*allocatedpgs)[actualvirt] = true;
-
 				uint64_t t = Physical::AllocatePage();
+				(*allocatedpgs)[actualvirt] = t;
 
 				assert(Virtual::AllocateVirtual(1, actualvirt, &proc->VAS, t) == actualvirt);
 				Virtual::MapAddress(actualvirt, t, 0x07, proc->VAS.PML4);
-
-				// map it to this address space for a bit.
-				Virtual::MapAddress(TemporaryVirtualMapping + actualvirt, t, 0x07);
-				// Log("mapped %x to phys %x, in target vas (%x)", actualvirt, t, proc->VAS.PML4);
-				// Log("temp %x to phys %x", TemporaryVirtualMapping + actualvirt, t);
 			}
 
-			if(ProgramHeader->ProgramMemorySize > ProgramHeader->ProgramFileSize)
+			// fill it in through the direct map, a page at a time: the file's bytes, then zeroes up to the memory size.
+			uint64_t filesize = ProgramHeader->ProgramFileSize;
+			uint64_t memsize = ProgramHeader->ProgramMemorySize;
+
+			for(uint64_t off = 0; off < memsize; )
 			{
-				Memory::Set((void*) (TemporaryVirtualMapping + ProgramHeader->ProgramVirtualAddress + ProgramHeader->ProgramFileSize),
-					0, ProgramHeader->ProgramMemorySize - ProgramHeader->ProgramFileSize);
+				uint64_t va = ProgramHeader->ProgramVirtualAddress + off;
+				uint64_t len = 0x1000 - (va & 0xFFF);
+				if(len > memsize - off)
+					len = memsize - off;
 
-				// Log("memset %x to 0, %d bytes", TemporaryVirtualMapping + ProgramHeader->ProgramVirtualAddress
-					// + ProgramHeader->ProgramFileSize, ProgramHeader->ProgramMemorySize - ProgramHeader->ProgramFileSize);
-			}
+				uint8_t* dest = (uint8_t*) Virtual::PhysToDirect((*allocatedpgs)[va & ((uint64_t) ~0xFFF)] + (va & 0xFFF));
+				uint64_t fromfile = (off >= filesize) ? 0 : ((filesize - off < len) ? filesize - off : len);
 
-			Memory::Copy((void*) (TemporaryVirtualMapping + ProgramHeader->ProgramVirtualAddress),
-				(void*) (this->buffer + ProgramHeader->ProgramOffset), ProgramHeader->ProgramFileSize);
+				if(fromfile > 0)
+					Memory::Copy(dest, this->buffer + ProgramHeader->ProgramOffset + off, fromfile);
 
-			// Log("memcpy to %x, %d bytes", TemporaryVirtualMapping + ProgramHeader->ProgramVirtualAddress, ProgramHeader->ProgramFileSize);
-			// Utilities::DumpBytes(TemporaryVirtualMapping + ProgramHeader->ProgramVirtualAddress, ProgramHeader->ProgramFileSize);
-		}
+				if(fromfile < len)
+					Memory::Set(dest + fromfile, 0, len - fromfile);
 
-		for(auto pair : *allocatedpgs)
-		{
-			Virtual::UnmapAddress(TemporaryVirtualMapping + pair.first);
+				off += len;
+			}
 		}
 
 		delete allocatedpgs;
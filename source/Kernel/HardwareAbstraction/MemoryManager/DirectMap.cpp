@@ -0,0 +1,65 @@
+// DirectMap.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <Kernel.hpp>
+#include <HardwareAbstraction/MemoryManager/Virtual.hpp>
+
+// every page of ram, permanently mapped at I_DirectMapBase + phys, so the kernel can get at any physical page
+// (ie. one that belongs to another address space) without mapping it anywhere first.
+
+// it lives in pml4 slot 511, which CreateVAS() shares with every address space, so it's there no matter
+// whose cr3 is loaded. ram is mapped with 1gb and 2mb pages wherever it can be; device registers only get 2mb ones.
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace MemoryManager {
+namespace Virtual
+{
+	// after the memory map and cpuid, before the first CreateVAS().
+	void InitialiseDirectMap()
+	{
+		PageMapStructure* pml4 = (PageMapStructure*) GetKernelCR3();
+		uint64_t total = 0;
+
+		for(uint64_t i = 0; i < K_MemoryMap->NumberOfEntries; i++)
+		{
+			auto& entry = K_MemoryMap->Entries[i];
+			if(entry.MemoryType != G_MemoryTypeAvailable && entry.MemoryType != G_MemoryACPI)
+				continue;
+
+			uint64_t base = entry.BaseAddress & I_AlignMask;
+			uint64_t end = (entry.BaseAddress + entry.Length + 0xFFF) & I_AlignMask;
+
+			if(end > I_DirectMapLength)
+			{
+				Log(1, "Only the first %d GB of physical memory is directly mapped", I_DirectMapLength / I_HugePageSize);
+				end = I_DirectMapLength;
+			}
+
+			if(base >= end)
+				continue;
+
+			MapRegion(I_DirectMapBase + base, base, (end - base) / 0x1000, I_Present | I_ReadWrite, pml4, true);
+			total += end - base;
+		}
+
+		Log("Direct-mapped %d MB of physical memory at %x", total / (1024 * 1024), I_DirectMapBase);
+	}
+
+	// device registers go in the same window (there's no ram behind them, so nothing else is there), uncached.
+	void* MapIO(uint64_t phys, uint64_t bytes)
+	{
+		uint64_t base = phys & I_AlignMask;
+		uint64_t end = (phys + bytes + 0xFFF) & I_AlignMask;
+		assert(end <= I_DirectMapLength);
+
+		MapRegion(I_DirectMapBase + base, base, (end - base) / 0x1000, I_Present | I_ReadWrite | I_CacheDisable,
+			(PageMapStructure*) GetKernelCR3());
+
+		return PhysToDirect(phys);
+	}
+}
+}
+}
+}
@@ -5,6 +5,8 @@
 // Heap things.
 
 #include <Kernel.hpp>
+#include <stdlib.h>
+#include <errno.h>
 
 using namespace Kernel;
 using namespace Kernel::HardwareAbstraction::MemoryManager;
@@ -22,6 +24,7 @@ using namespace Library;
 
 #define HEADER_FREE					0xFFFFFFFFEE014EAA
 #define HEADER_USED					0xFFFFFFFFEEDEAD00
+#define HEADER_TRACKED				0xFFFFFFFFEEDEAD01		// used, and charged to a call site by the profiler
 #define FOOTER_MAGIC				0x00000000EEF055AA
 
 
@@ -67,6 +70,10 @@ namespace KernelHeap
 
 	static uint64_t FirstHeapPhysPage;
 
+	static bool Profiling = false;
+	static void ProfileAllocation(Header* h);
+	static void ProfileFree(Header* h);
+
 
 
 
@@ -75,7 +82,7 @@ namespace KernelHeap
 	{
 		assert(header);
 
-		_assert(header, header->magic == HEADER_FREE || header->magic == HEADER_USED);
+		_assert(header, header->magic == HEADER_FREE || header->magic == HEADER_USED || header->magic == HEADER_TRACKED);
 		_assert(header, header->size > 0);
 
 		// check footer too.
@@ -210,9 +217,25 @@ namespace KernelHeap
 
 	void ExpandHeap(uint64_t numPages)
 	{
-		uint64_t phys = Physical::AllocatePage(numPages);
+		uint64_t end = KernelHeapAddress + (SizeOfHeapInPages * 0x1000);
+
+		if(numPages >= I_LargePageSize / 0x1000)
+		{
+			// big expansions get 4k pages up to the next 2mb boundary, then whole large pages from there.
+			uint64_t head = ((I_LargePageSize - (end & (I_LargePageSize - 1))) & (I_LargePageSize - 1)) / 0x1000;
+			uint64_t body = (numPages - head + 511) & ~((uint64_t) 511);
 
-		Virtual::MapRegion(KernelHeapAddress + (SizeOfHeapInPages * 0x1000), phys, numPages, MapFlags);
+			if(head > 0)
+				Virtual::MapRegion(end, Physical::AllocatePage(head), head, MapFlags);
+
+			Virtual::MapRegion(end + (head * 0x1000), Physical::AllocatePage(body), body, MapFlags);
+			numPages = head + body;
+		}
+		else
+		{
+			uint64_t phys = Physical::AllocatePage(numPages);
+			Virtual::MapRegion(end, phys, numPages, MapFlags);
+		}
 
 
 		Footer* _last = sane((Footer*) ((KernelHeapAddress + (SizeOfHeapInPages * 0x1000)) - sizeof(Footer)));
@@ -256,7 +279,9 @@ namespace KernelHeap
 
 
 
-	void* AllocateChunk(uint64_t size)
+	// owner and owner1 are passed down, so that the recursive calls after expanding the heap
+	// (and allocations made on behalf of realloc) still get charged to the real caller.
+	static void* AllocateInternal(uint64_t size, uint64_t owner, uint64_t owner1)
 	{
 		if(size == 0) return 0;
 
@@ -275,7 +300,7 @@ namespace KernelHeap
 				ExpandHeap((size + 0xFFF) / 0x1000);
 
 				// Log("Expanded heap by %d bytes", ((size + 0xFFF) / 0x1000) * 0x1000);
-				return AllocateChunk(size);
+				return AllocateInternal(size, owner, owner1);
 			}
 		}
 
@@ -297,7 +322,7 @@ namespace KernelHeap
 				> KernelHeapAddress + (SizeOfHeapInPages * 0x1000))
 			{
 				ExpandHeap(((newSize + sizeof(Header) + sizeof(Footer)) + 0xFFF) / 0x1000);
-				return AllocateChunk(size);
+				return AllocateInternal(size, owner, owner1);
 			}
 
 
@@ -324,13 +349,21 @@ namespace KernelHeap
 
 
 		h->magic = HEADER_USED;
-		h->owner = returnAddr(0) & 0xFFFFFFFF;
-		h->owner1 = returnAddr(1)  & 0xFFFFFFFF;
+		h->owner = owner & 0xFFFFFFFF;
+		h->owner1 = owner1 & 0xFFFFFFFF;
+
+		if(Profiling)
+			ProfileAllocation(h);
 
 		// Log("chunk %x goes to owner %x", h, h->owner);
 		return (void*) (h + 1);
 	}
 
+	void* AllocateChunk(uint64_t size)
+	{
+		return AllocateInternal(size, returnAddr(0), returnAddr(1));
+	}
+
 
 
 	void TryMergeLeft(Header* hdr)
@@ -420,6 +453,10 @@ namespace KernelHeap
 
 		// _assert(hdr, !isFree(hdr));
 
+		// tracked chunks are always uncharged, even if profiling was turned off since.
+		if(hdr->magic == HEADER_TRACKED)
+			ProfileFree(hdr);
+
 		// set it to free.
 		hdr->magic = HEADER_FREE;
 
@@ -435,7 +472,7 @@ namespace KernelHeap
 		if(ptr == 0)
 		{
 			Log(1, "called realloc() with ptr == 0, possible bug: return %p / %p", returnAddr(0), returnAddr(1));
-			return AllocateChunk(size);
+			return AllocateInternal(size, returnAddr(0), returnAddr(1));
 		}
 
 		if(size == 0)
@@ -465,7 +502,7 @@ namespace KernelHeap
 		else
 		{
 			// we need to allocate a new one, then free it.
-			void* newplace = AllocateChunk(size);
+			void* newplace = AllocateInternal(size, returnAddr(0), returnAddr(1));
 			memmove(newplace, ptr, hdr->size);
 
 			FreeChunk(ptr);
@@ -490,6 +527,331 @@ namespace KernelHeap
 	{
 		return FirstHeapPhysPage;
 	}
+
+
+
+
+
+	// heap profiling.
+	// while enabled, every allocation is charged to its call site: the (owner, owner1) pair of return
+	// addresses already kept in the header. owner alone is usually just operator new or malloc, so the
+	// pair is what actually tells callers apart. charged chunks are marked HEADER_TRACKED, so frees are
+	// only ever credited against allocations that were counted in the first place.
+	//
+	// sites are never removed from the table once inserted, so snapshots can simply be indexed by slot.
+
+	#define ProfileSites			1024		// must be a power of two
+	#define ProfileSnapshots		4
+	#define ProfileLeakSamples		4
+
+	struct CallSite
+	{
+		uint32_t owner;
+		uint32_t owner1;
+
+		uint64_t liveBytes;
+		uint64_t liveCount;
+		uint64_t peakBytes;
+		uint64_t allocs;
+		uint64_t frees;
+	};
+
+	struct SnapshotEntry
+	{
+		uint64_t liveBytes;
+		uint64_t liveCount;
+	};
+
+	struct Snapshot
+	{
+		uint64_t id;
+		SnapshotEntry* entries;
+	};
+
+	static CallSite Sites[ProfileSites];
+	static uint64_t NumSites = 0;
+	static uint64_t UntrackedAllocations = 0;
+
+	static Snapshot Snapshots[ProfileSnapshots];
+	static uint64_t NextSnapshotID = 1;
+
+	// scratch space for the reports, so they don't need big stack frames. protected by mtx.
+	static uint16_t ReportOrder[ProfileSites];
+	static int64_t ReportKey[ProfileSites];
+
+	static uint64_t SiteIndex(uint32_t owner, uint32_t owner1)
+	{
+		uint64_t key = ((uint64_t) owner << 32) | owner1;
+		key ^= key >> 33;
+		key *= 0xFF51AFD7ED558CCD;
+		key ^= key >> 33;
+
+		return key & (ProfileSites - 1);
+	}
+
+	static CallSite* FindSite(uint32_t owner, uint32_t owner1, bool create)
+	{
+		uint64_t idx = SiteIndex(owner, owner1);
+		for(uint64_t probe = 0; probe < ProfileSites; probe++)
+		{
+			CallSite* site = &Sites[(idx + probe) & (ProfileSites - 1)];
+			if(site->allocs > 0 && site->owner == owner && site->owner1 == owner1)
+				return site;
+
+			if(site->allocs == 0)
+			{
+				// leave some room, so probe chains stay short.
+				if(!create || NumSites >= (ProfileSites * 3) / 4)
+					return 0;
+
+				site->owner = owner;
+				site->owner1 = owner1;
+				NumSites++;
+
+				return site;
+			}
+		}
+
+		return 0;
+	}
+
+	static void ProfileAllocation(Header* h)
+	{
+		CallSite* site = FindSite(h->owner, h->owner1, true);
+		if(!site)
+		{
+			UntrackedAllocations++;
+			return;
+		}
+
+		site->allocs++;
+		site->liveCount++;
+		site->liveBytes += h->size;
+
+		if(site->liveBytes > site->peakBytes)
+			site->peakBytes = site->liveBytes;
+
+		h->magic = HEADER_TRACKED;
+	}
+
+	static void ProfileFree(Header* h)
+	{
+		CallSite* site = FindSite(h->owner, h->owner1, false);
+		if(!site || site->liveCount == 0)
+			return;
+
+		site->frees++;
+		site->liveCount--;
+		site->liveBytes -= __min(site->liveBytes, h->size);
+	}
+
+	static Snapshot* GetSnapshot(uint64_t id)
+	{
+		Snapshot* snap = &Snapshots[id % ProfileSnapshots];
+		if(id == 0 || snap->id != id || !snap->entries)
+			return 0;
+
+		return snap;
+	}
+
+	// orders the first 'count' sites in ReportOrder by descending ReportKey, and returns how many have a
+	// positive key. this is a plain selection of the top few, since we only ever print a handful.
+	static uint64_t SelectTop(uint64_t top)
+	{
+		uint64_t found = 0;
+		for(uint64_t i = 0; i < ProfileSites; i++)
+			ReportOrder[i] = (uint16_t) i;
+
+		while(found < top)
+		{
+			uint64_t best = found;
+			for(uint64_t i = found + 1; i < ProfileSites; i++)
+			{
+				if(ReportKey[ReportOrder[i]] > ReportKey[ReportOrder[best]])
+					best = i;
+			}
+
+			if(ReportKey[ReportOrder[best]] <= 0)
+				break;
+
+			uint16_t tmp = ReportOrder[found];
+			ReportOrder[found] = ReportOrder[best];
+			ReportOrder[best] = tmp;
+
+			found++;
+		}
+
+		return found;
+	}
+
+	void SetProfiling(bool enabled)
+	{
+		AutoMutex mutex(*mtx);
+		Profiling = enabled;
+
+		Log("Heap profiling %s", enabled ? "enabled" : "disabled");
+	}
+
+	bool IsProfiling()
+	{
+		return Profiling;
+	}
+
+	void ResetProfile()
+	{
+		AutoMutex mutex(*mtx);
+
+		// tracked chunks still out there just won't find their site when freed, which is harmless.
+		memset(Sites, 0, sizeof(Sites));
+		NumSites = 0;
+		UntrackedAllocations = 0;
+
+		for(uint64_t i = 0; i < ProfileSnapshots; i++)
+			Snapshots[i].id = 0;
+	}
+
+	uint64_t TakeProfileSnapshot()
+	{
+		AutoMutex mutex(*mtx);
+
+		uint64_t id = NextSnapshotID++;
+		Snapshot* snap = &Snapshots[id % ProfileSnapshots];
+
+		if(!snap->entries)
+			snap->entries = (SnapshotEntry*) AllocateInternal(sizeof(SnapshotEntry) * ProfileSites, returnAddr(0), returnAddr(1));
+
+		if(!snap->entries)
+			return 0;
+
+		for(uint64_t i = 0; i < ProfileSites; i++)
+		{
+			snap->entries[i].liveBytes = Sites[i].liveBytes;
+			snap->entries[i].liveCount = Sites[i].liveCount;
+		}
+
+		snap->id = id;
+		return id;
+	}
+
+	void PrintProfile(uint64_t top)
+	{
+		AutoMutex mutex(*mtx);
+
+		uint64_t totalBytes = 0;
+		uint64_t totalCount = 0;
+		for(uint64_t i = 0; i < ProfileSites; i++)
+		{
+			ReportKey[i] = (int64_t) Sites[i].liveBytes;
+			totalBytes += Sites[i].liveBytes;
+			totalCount += Sites[i].liveCount;
+		}
+
+		Log("Heap profile: %d bytes live in %d chunks, %d call sites (%d allocations not tracked)",
+			totalBytes, totalCount, NumSites, UntrackedAllocations);
+
+		uint64_t n = SelectTop(__min(top, (uint64_t) ProfileSites));
+		for(uint64_t i = 0; i < n; i++)
+		{
+			CallSite* site = &Sites[ReportOrder[i]];
+			Log("    %p / %p: %d bytes in %d chunks, peak %d; %d allocs, %d frees",
+				0xFFFFFFFF00000000 | site->owner, 0xFFFFFFFF00000000 | site->owner1, site->liveBytes, site->liveCount,
+				site->peakBytes, site->allocs, site->frees);
+		}
+	}
+
+	void DiffProfileSnapshots(uint64_t older, uint64_t newer)
+	{
+		AutoMutex mutex(*mtx);
+
+		Snapshot* a = GetSnapshot(older);
+		Snapshot* b = GetSnapshot(newer);
+		if(!a || !b)
+		{
+			Log(1, "Heap profile snapshot %d or %d no longer exists", older, newer);
+			return;
+		}
+
+		int64_t totalBytes = 0;
+		int64_t totalCount = 0;
+		for(uint64_t i = 0; i < ProfileSites; i++)
+		{
+			ReportKey[i] = (int64_t) b->entries[i].liveBytes - (int64_t) a->entries[i].liveBytes;
+			totalBytes += ReportKey[i];
+			totalCount += (int64_t) b->entries[i].liveCount - (int64_t) a->entries[i].liveCount;
+		}
+
+		Log("Heap growth from snapshot %d to %d: %d bytes, %d chunks", older, newer, totalBytes, totalCount);
+
+		uint64_t n = SelectTop(16);
+		for(uint64_t i = 0; i < n; i++)
+		{
+			uint64_t idx = ReportOrder[i];
+			Log("    %p / %p: +%d bytes, +%d chunks", 0xFFFFFFFF00000000 | Sites[idx].owner, 0xFFFFFFFF00000000 | Sites[idx].owner1,
+				ReportKey[idx], (int64_t) b->entries[idx].liveCount - (int64_t) a->entries[idx].liveCount);
+		}
+	}
+
+	void ReportLeaks(uint64_t minCount)
+	{
+		AutoMutex mutex(*mtx);
+
+		// a site that keeps allocating and has never freed anything is almost certainly leaking
+		// (or is a long-lived cache, which is worth knowing about anyway).
+		for(uint64_t i = 0; i < ProfileSites; i++)
+		{
+			CallSite* site = &Sites[i];
+			ReportKey[i] = (site->allocs > 0 && site->frees == 0 && site->liveCount >= __max(minCount, (uint64_t) 1))
+				? (int64_t) site->liveBytes : 0;
+		}
+
+		uint64_t n = SelectTop(16);
+		Log("Heap leak report: %d call sites with at least %d live chunks and no frees", n, minCount);
+
+		for(uint64_t i = 0; i < n; i++)
+		{
+			CallSite* site = &Sites[ReportOrder[i]];
+			Log("    %p / %p: %d bytes in %d chunks", 0xFFFFFFFF00000000 | site->owner, 0xFFFFFFFF00000000 | site->owner1,
+				site->liveBytes, site->liveCount);
+
+			// show where a few of them live, so they can be inspected.
+			uint64_t samples = 0;
+			Header* hdr = sane((Header*) KernelHeapAddress);
+			do
+			{
+				if(hdr->magic == HEADER_TRACKED && hdr->owner == site->owner && hdr->owner1 == site->owner1)
+				{
+					Log("        chunk at %p, %d bytes", (uintptr_t) (hdr + 1), hdr->size);
+					samples++;
+				}
+
+			} while(samples < ProfileLeakSamples && (hdr = next(hdr)) != 0);
+		}
+	}
+
+	// the reports are full of kernel addresses, so only the kernel and what it started at boot get to ask.
+	extern "C" int64_t Syscall_HeapProfile(uint64_t op, uint64_t a, uint64_t b)
+	{
+		Multitasking::Process* proc = Multitasking::GetCurrentProcess();
+		if(proc != Kernel::KernelProcess && proc->Parent != Kernel::KernelProcess)
+		{
+			Multitasking::SetThreadErrno(EPERM);
+			return -1;
+		}
+
+		switch(op)
+		{
+			case HEAPPROF_DISABLE:	SetProfiling(false);			return 0;
+			case HEAPPROF_ENABLE:	SetProfiling(true);				return 0;
+			case HEAPPROF_RESET:	ResetProfile();					return 0;
+			case HEAPPROF_SNAPSHOT:	return (int64_t) TakeProfileSnapshot();
+			case HEAPPROF_PRINT:	PrintProfile(a ? a : 16);		return 0;
+			case HEAPPROF_DIFF:		DiffProfileSnapshots(a, b);		return 0;
+			case HEAPPROF_LEAKS:	ReportLeaks(a);					return 0;
+		}
+
+		Multitasking::SetThreadErrno(EINVAL);
+		return -1;
+	}
 }
 }
 }
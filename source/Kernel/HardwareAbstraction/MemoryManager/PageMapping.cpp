@@ -4,6 +4,7 @@
 
 #include <Kernel.hpp>
 #include <HardwareAbstraction/MemoryManager/Virtual.hpp>
+#include <HardwareAbstraction/SMP.hpp>
 
 
 namespace Kernel {
@@ -11,18 +12,18 @@ namespace HardwareAbstraction {
 namespace MemoryManager {
 namespace Virtual
 {
-	static PageMapStructure* CurrentPML4T;
-
 	// this stuff deals with the non-allocator part of the vmm
 	// simply the page mapping bits.
 
+	// which pml4 is loaded is a per-processor thing, so it lives in the gs block (see SMP.hpp).
+
 
 	void Initialise()
 	{
 		PageMapStructure* OriginalPml4 = (PageMapStructure*) GetKernelCR3();
 
 		OriginalPml4->Entry[I_RECURSIVE_SLOT] = (uint64_t) OriginalPml4 | I_Present | I_ReadWrite;
-		CurrentPML4T = OriginalPml4;
+		SMP::GetCurrentCPU()->CurrentPML4T = OriginalPml4;
 	}
 
 	void ChangeRawCR3(uint64_t newval)
@@ -40,12 +41,12 @@ namespace Virtual
 
 	void SwitchPML4T(PageMapStructure* PML4T)
 	{
-		CurrentPML4T = PML4T;
+		SMP::GetCurrentCPU()->CurrentPML4T = PML4T;
 	}
 
 	PageMapStructure* GetCurrentPML4T()
 	{
-		return CurrentPML4T;
+		return SMP::GetCurrentCPU()->CurrentPML4T;
 	}
 
 	void invlpg(PageMapStructure* p)
@@ -96,6 +97,34 @@ namespace Virtual
 
 
 
+	// replaces a large page at 'VirtAddr' (of 'size') with a table of the next size down, mapping the same memory,
+	// so that part of it can be changed. 'entry' is its pdpt or pd entry.
+	static void SplitLargePage(uint64_t* entry, uint64_t size, uint64_t VirtAddr, PageMapStructure* PML)
+	{
+		uint64_t e = *entry;
+		PageMapStructure* table = (PageMapStructure*) Physical::AllocateFromReserved();
+
+		if(size == I_HugePageSize)
+		{
+			// 2mb pages have the same layout, pat bit and all.
+			uint64_t base = e & 0x000FFFFFC0000000;
+			for(uint64_t i = 0; i < 512; i++)
+				table->Entry[i] = (base + (i * I_LargePageSize)) | (e & 0x1FFF);
+		}
+		else
+		{
+			// the pat bit moves from bit 12 to bit 7, where the size bit was.
+			uint64_t base = e & 0x000FFFFFFFE00000;
+			uint64_t flags = (e & 0xFFF & ~((uint64_t) I_LargePage)) | ((e & 0x1000) ? 0x80 : 0);
+
+			for(uint64_t i = 0; i < 512; i++)
+				table->Entry[i] = (base + (i * 0x1000)) | flags;
+		}
+
+		*entry = (uint64_t) table | (e & (I_Present | I_ReadWrite | I_UserAccess));
+		InvalidateRange(VirtAddr & ~(size - 1), size / 0x1000, PML);
+	}
+
 	void MapAddress(uint64_t VirtAddr, uint64_t PhysAddr, uint64_t Flags, PageMapStructure* PML4, bool DoNotUnmap)
 	{
 		uint64_t PageTableIndex					= I_PT_INDEX(VirtAddr);
@@ -142,6 +171,10 @@ namespace Virtual
 			invlpg(PML);
 			invlpg(PDPT);
 		}
+		else if(PDPT->Entry[PageDirectoryPointerTableIndex] & I_LargePage)
+		{
+			SplitLargePage(&PDPT->Entry[PageDirectoryPointerTableIndex], I_HugePageSize, VirtAddr, PML);
+		}
 		PageMapStructure* PageDirectory = (PageMapStructure*) (PDPT->Entry[PageDirectoryPointerTableIndex] & I_AlignMask);
 		if(other)
 			Virtual::MapAddress((uint64_t) PageDirectory, (uint64_t) PageDirectory, 0x7);
@@ -154,6 +187,10 @@ namespace Virtual
 			invlpg(PDPT);
 			invlpg(PageDirectory);
 		}
+		else if(PageDirectory->Entry[PageDirectoryIndex] & I_LargePage)
+		{
+			SplitLargePage(&PageDirectory->Entry[PageDirectoryIndex], I_LargePageSize, VirtAddr, PML);
+		}
 
 		PageMapStructure* PageTable = (PageMapStructure*) (PageDirectory->Entry[PageDirectoryIndex] & I_AlignMask);
 		if(other)
@@ -175,7 +212,59 @@ namespace Virtual
 
 
 
-	void UnmapAddress(uint64_t VirtAddr, PageMapStructure* PML4, bool DoNotUnmap)
+	// just clears the entry (or a whole large page, if we're unmapping all of it) without touching the tlb,
+	// and returns how many pages that was.
+	static uint64_t ClearEntry(uint64_t VirtAddr, uint64_t LengthInPages, PageMapStructure* PML)
+	{
+		uint64_t PageTableIndex					= I_PT_INDEX(VirtAddr);
+		uint64_t PageDirectoryIndex				= I_PD_INDEX(VirtAddr);
+		uint64_t PageDirectoryPointerTableIndex	= I_PDPT_INDEX(VirtAddr);
+		uint64_t PML4TIndex						= I_PML4_INDEX(VirtAddr);
+
+		PageMapStructure* PDPT = (PageMapStructure*)(PML->Entry[PML4TIndex] & I_AlignMask);
+
+		if(PDPT)
+		{
+			uint64_t* pdpte = &PDPT->Entry[PageDirectoryPointerTableIndex];
+			if(*pdpte & I_LargePage)
+			{
+				if(!(VirtAddr & (I_HugePageSize - 1)) && LengthInPages >= I_HugePageSize / 0x1000)
+				{
+					*pdpte = 0;
+					return I_HugePageSize / 0x1000;
+				}
+
+				SplitLargePage(pdpte, I_HugePageSize, VirtAddr, PML);
+			}
+
+			PageMapStructure* PageDirectory = (PageMapStructure*)(*pdpte & I_AlignMask);
+
+			if(PageDirectory)
+			{
+				uint64_t* pde = &PageDirectory->Entry[PageDirectoryIndex];
+				if(*pde & I_LargePage)
+				{
+					if(!(VirtAddr & (I_LargePageSize - 1)) && LengthInPages >= I_LargePageSize / 0x1000)
+					{
+						*pde = 0;
+						return I_LargePageSize / 0x1000;
+					}
+
+					SplitLargePage(pde, I_LargePageSize, VirtAddr, PML);
+				}
+
+				PageMapStructure* PageTable = (PageMapStructure*)(*pde & I_AlignMask);
+
+				if(PageTable)
+					PageTable->Entry[PageTableIndex] = 0;
+			}
+		}
+
+		return 1;
+	}
+
+	// everything is cleared first, then invalidated in one go; see TLB.cpp.
+	static void Unmap(uint64_t VirtAddr, uint64_t LengthInPages, PageMapStructure* PML4, bool DoNotUnmap)
 	{
 		bool DidMapPML4 = false;
 
@@ -189,29 +278,12 @@ namespace Virtual
 			MapAddress((uint64_t) PML4, (uint64_t) PML4, 0x03);
 		}
 
-		uint64_t PageTableIndex					= I_PT_INDEX(VirtAddr);
-		uint64_t PageDirectoryIndex				= I_PD_INDEX(VirtAddr);
-		uint64_t PageDirectoryPointerTableIndex	= I_PDPT_INDEX(VirtAddr);
-		uint64_t PML4TIndex						= I_PML4_INDEX(VirtAddr);
-
-		PageMapStructure* PML = PML4;
-
-		if(PML)
+		if(PML4)
 		{
-			PageMapStructure* PDPT = (PageMapStructure*)(PML->Entry[PML4TIndex] & I_AlignMask);
-
-			if(PDPT)
-			{
-				PageMapStructure* PageDirectory = (PageMapStructure*)(PDPT->Entry[PageDirectoryPointerTableIndex] & I_AlignMask);
-
-				if(PageDirectory)
-				{
-					PageMapStructure* PageTable = (PageMapStructure*)(PageDirectory->Entry[PageDirectoryIndex] & I_AlignMask);
-					PageTable->Entry[PageTableIndex] = 0;
+			for(uint64_t i = 0; i < LengthInPages; )
+				i += ClearEntry(VirtAddr + (i * 0x1000), LengthInPages - i, PML4);
 
-					invlpg((PageMapStructure*) VirtAddr);
-				}
-			}
+			InvalidateRange(VirtAddr, LengthInPages, PML4);
 		}
 
 
@@ -222,18 +294,83 @@ namespace Virtual
 		}
 	}
 
+	void UnmapAddress(uint64_t VirtAddr, PageMapStructure* PML4, bool DoNotUnmap)
+	{
+		Unmap(VirtAddr, 1, PML4, DoNotUnmap);
+	}
+
 
 
-	void MapRegion(uint64_t VirtAddr, uint64_t PhysAddr, uint64_t LengthInPages, uint64_t Flags, PageMapStructure* PML4)
+	// maps 'size' (2mb or 1gb) at once, if both addresses line up and nothing's there yet; returns false otherwise.
+	// page tables come from below 16mb, which every address space identity maps, so we can use them directly.
+	static bool MapLargePage(uint64_t VirtAddr, uint64_t PhysAddr, uint64_t Flags, PageMapStructure* PML, uint64_t size)
 	{
-		for(uint64_t i = 0; i < LengthInPages; i++)
-			MapAddress(VirtAddr + (i * 0x1000), PhysAddr + (i * 0x1000), Flags, PML4);
+		if((VirtAddr & (size - 1)) || (PhysAddr & (size - 1)) || I_PML4_INDEX(VirtAddr) == I_RECURSIVE_SLOT)
+			return false;
+
+		uint64_t tableflags = (Flags & (I_ReadWrite | I_UserAccess)) | I_Present;
+
+		uint64_t* pml4e = &PML->Entry[I_PML4_INDEX(VirtAddr)];
+		if(!(*pml4e & I_Present))
+			*pml4e = Physical::AllocateFromReserved() | tableflags;
+
+		uint64_t* pdpte = &((PageMapStructure*) (*pml4e & I_AlignMask))->Entry[I_PDPT_INDEX(VirtAddr)];
+		if(size == I_HugePageSize)
+		{
+			if(*pdpte & I_Present)
+				return false;
+
+			*pdpte = PhysAddr | Flags | I_LargePage;
+			return true;
+		}
+
+		if(!(*pdpte & I_Present))
+			*pdpte = Physical::AllocateFromReserved() | tableflags;
+
+		else if(*pdpte & I_LargePage)
+			return false;
+
+		uint64_t* pde = &((PageMapStructure*) (*pdpte & I_AlignMask))->Entry[I_PD_INDEX(VirtAddr)];
+		if(*pde & I_Present)
+			return false;
+
+		*pde = PhysAddr | Flags | I_LargePage;
+		return true;
+	}
+
+	// uses large pages wherever it can, which is wherever both addresses are aligned and there's enough left.
+	// 1gb pages only when asked -- a whole gigabyte with one memory type and one set of permissions is only
+	// ever right for the direct map, never for device registers or anything userspace owns.
+	void MapRegion(uint64_t VirtAddr, uint64_t PhysAddr, uint64_t LengthInPages, uint64_t Flags, PageMapStructure* PML4, bool Huge)
+	{
+		PageMapStructure* PML = (PML4 == 0 ? GetCurrentPML4T() : PML4);
+		bool huge = Huge && KernelCPUID && KernelCPUID->GigabytePageSize();
+
+		for(uint64_t i = 0; i < LengthInPages; )
+		{
+			uint64_t virt = VirtAddr + (i * 0x1000);
+			uint64_t phys = PhysAddr + (i * 0x1000);
+			uint64_t left = LengthInPages - i;
+
+			if(huge && left >= I_HugePageSize / 0x1000 && MapLargePage(virt, phys, Flags, PML, I_HugePageSize))
+			{
+				i += I_HugePageSize / 0x1000;
+			}
+			else if(left >= I_LargePageSize / 0x1000 && MapLargePage(virt, phys, Flags, PML, I_LargePageSize))
+			{
+				i += I_LargePageSize / 0x1000;
+			}
+			else
+			{
+				MapAddress(virt, phys, Flags, PML4);
+				i++;
+			}
+		}
 	}
 
 	void UnmapRegion(uint64_t VirtAddr, uint64_t LengthInPages, PageMapStructure* PML4)
 	{
-		for(uint64_t i = 0; i < LengthInPages; i++)
-			UnmapAddress(VirtAddr + (i * 0x1000), PML4);
+		Unmap(VirtAddr, LengthInPages, PML4, false);
 	}
 
 
@@ -265,6 +402,9 @@ namespace Virtual
 				if(other)
 					Virtual::MapAddress((uint64_t) PDPT, (uint64_t) PDPT, 0x7);
 
+				if(PDPT->Entry[PageDirectoryPointerTableIndex] & I_LargePage)
+					SplitLargePage(&PDPT->Entry[PageDirectoryPointerTableIndex], I_HugePageSize, va, PML);
+
 				PageMapStructure* PageDirectory = (PageMapStructure*) (PDPT->Entry[PageDirectoryPointerTableIndex] & I_AlignMask);
 
 				assert(PageDirectory);
@@ -272,6 +412,9 @@ namespace Virtual
 					if(other)
 						Virtual::MapAddress((uint64_t) PageDirectory, (uint64_t) PageDirectory, 0x7);
 
+					if(PageDirectory->Entry[PageDirectoryIndex] & I_LargePage)
+						SplitLargePage(&PageDirectory->Entry[PageDirectoryIndex], I_LargePageSize, va, PML);
+
 					PageMapStructure* PageTable = (PageMapStructure*) (PageDirectory->Entry[PageDirectoryIndex] & I_AlignMask);
 
 					assert(PageTable);
@@ -311,6 +454,60 @@ namespace Virtual
 	}
 
 
+	// page tables all come from below 16 MB, which every address space identity maps,
+	// so we can walk another address space's tables directly. returns 0 if any level is missing.
+	// inside a large page, returns what the entry for that 4k page would be.
+	uint64_t LookupMapping(uint64_t virt, PageMapStructure* pml4)
+	{
+		uint64_t pml4e = pml4->Entry[I_PML4_INDEX(virt)];
+		if(!(pml4e & I_Present))
+			return 0;
+
+		uint64_t pdpte = ((PageMapStructure*) (pml4e & I_AlignMask))->Entry[I_PDPT_INDEX(virt)];
+		if(!(pdpte & I_Present))
+			return 0;
+
+		if(pdpte & I_LargePage)
+			return ((pdpte & 0x000FFFFFC0000000) + (virt & (I_HugePageSize - 0x1000))) | (pdpte & 0xFFF & ~((uint64_t) I_LargePage));
+
+		uint64_t pde = ((PageMapStructure*) (pdpte & I_AlignMask))->Entry[I_PD_INDEX(virt)];
+		if(!(pde & I_Present))
+			return 0;
+
+		if(pde & I_LargePage)
+			return ((pde & 0x000FFFFFFFE00000) + (virt & (I_LargePageSize - 0x1000))) | (pde & 0xFFF & ~((uint64_t) I_LargePage));
+
+		return ((PageMapStructure*) (pde & I_AlignMask))->Entry[I_PT_INDEX(virt)];
+	}
+
+	uint64_t LookupMapping(uint64_t virt, PageMapStructure* pml4, PageWalkCache* cache)
+	{
+		uint64_t base = virt & ~((uint64_t) I_LargePageSize - 1);
+		if(cache->pt && cache->pml4 == pml4 && cache->base == base)
+			return cache->pt->Entry[I_PT_INDEX(virt)];
+
+		cache->pt = 0;
+
+		uint64_t pml4e = pml4->Entry[I_PML4_INDEX(virt)];
+		if(!(pml4e & I_Present))
+			return 0;
+
+		uint64_t pdpte = ((PageMapStructure*) (pml4e & I_AlignMask))->Entry[I_PDPT_INDEX(virt)];
+		if(!(pdpte & I_Present) || (pdpte & I_LargePage))
+			return LookupMapping(virt, pml4);
+
+		uint64_t pde = ((PageMapStructure*) (pdpte & I_AlignMask))->Entry[I_PD_INDEX(virt)];
+		if(!(pde & I_Present) || (pde & I_LargePage))
+			return LookupMapping(virt, pml4);
+
+		cache->pml4 = pml4;
+		cache->pt = (PageMapStructure*) (pde & I_AlignMask);
+		cache->base = base;
+
+		return cache->pt->Entry[I_PT_INDEX(virt)];
+	}
+
+
 	static void ChangeCOWFlag(uint64_t virt, PageMapStructure* pml, bool cow)
 	{
 		PageMapStructure* pdpt = 0;
@@ -79,6 +79,52 @@ namespace Physical
 	}
 
 
+	// carves a 2mb-aligned block out of whichever pair has one, so it can be mapped with large pages.
+	// returns 0 if none of them do. call with the mutex held.
+	static uint64_t AllocateAligned(uint64_t size, bool Below4Gb)
+	{
+		for(size_t i = 0; i < PageList->size(); i++)
+		{
+			Pair* p = (*PageList)[i];
+
+			uint64_t end = p->BaseAddr + (p->LengthInPages * 0x1000);
+			uint64_t base = (p->BaseAddr + I_LargePageSize - 1) & ~((uint64_t) I_LargePageSize - 1);
+
+			if(base + (size * 0x1000) > end || (Below4Gb && base + (size * 0x1000) > 0xFFFFFFFF))
+				continue;
+
+			uint64_t head = (base - p->BaseAddr) / 0x1000;
+			uint64_t tail = (end - (base + (size * 0x1000))) / 0x1000;
+
+			if(head == 0 && tail == 0)
+			{
+				PageList->erase(PageList->begin() + i);
+				delete p;
+			}
+			else if(head == 0)
+			{
+				p->BaseAddr += (size * 0x1000);
+				p->LengthInPages = tail;
+			}
+			else
+			{
+				p->LengthInPages = head;
+				if(tail > 0)
+				{
+					Pair* np = new Pair();
+					np->BaseAddr = base + (size * 0x1000);
+					np->LengthInPages = tail;
+
+					PageList->push_back(np);
+				}
+			}
+
+			return base;
+		}
+
+		return 0;
+	}
+
 	uint64_t AllocatePage(uint64_t size, bool Below4Gb)
 	{
 		if(!DidInit)
@@ -89,6 +135,12 @@ namespace Physical
 		size_t trycount = 0;
 		auto len = PageList->size();
 
+		if(size >= I_LargePageSize / 0x1000)
+		{
+			if(uint64_t ret = AllocateAligned(size, Below4Gb))
+				return ret;
+		}
+
 		begin:
 
 		if(PageList->size() == 0)
@@ -191,8 +243,15 @@ namespace Physical
 		// if not, we'll end up with a super-screwed mapping.
 		// possibly some overlap as well.
 
-		uint64_t ret = ReservedRegionForVMM + ReservedRegionIndex;
-		ReservedRegionIndex += (0x1000 * size);
+		// every processor builds page tables, so claim the range atomically.
+		uint64_t ofs = __sync_fetch_and_add(&ReservedRegionIndex, 0x1000 * size);
+		if(ofs + (0x1000 * size) > LengthOfReservedRegion)
+		{
+			__sync_fetch_and_sub(&ReservedRegionIndex, 0x1000 * size);
+			HALT("Reserved region for page tables exhausted");
+		}
+
+		uint64_t ret = ReservedRegionForVMM + ofs;
 		Memory::Set((void*) ret, 0x00, (size * 0x1000));
 		return ret;
 	}
@@ -0,0 +1,287 @@
+// TLB.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <Kernel.hpp>
+#include <HardwareAbstraction/MemoryManager/Virtual.hpp>
+#include <HardwareAbstraction/Devices/APIC.hpp>
+
+// keeping the tlb in sync with the page tables, without throwing all of it away on every address space switch.
+
+// with process-context ids, each processor hands out its ids to the address spaces it runs, round-robin, and
+// loads cr3 without flushing when it goes back to one that still has its id. unmapping something from an address
+// space takes its ids away everywhere (so the next load flushes), and interrupts whoever's running it right now.
+
+// the bottom 1gb and the top two pml4 slots are the same tables in every address space (see CreateVAS()), so
+// stale entries there could be under any id, or global. changing those bumps 'kernelgen' and interrupts every
+// processor; each one flushes everything when it sees the generation move (and again at its next switch, for the
+// ids it isn't using right now).
+
+// whoever sends a shootdown waits for it to be done, even with interrupts off. a processor that can't take the
+// interrupt (it's waiting for us, or for a lock we hold) does the flush itself from its spin loop instead; see
+// ServiceTLBShootdowns().
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace MemoryManager {
+namespace Virtual
+{
+	using SMP::CPU;
+
+	#define CR3_NOFLUSH		(1ULL << 63)
+	#define CR4_PGE			(1 << 7)
+	#define CR4_PCIDE		(1 << 17)
+
+	// past this many pages, reloading cr3 is cheaper than invlpg-ing each one.
+	static const uint64_t FullFlushThreshold = 32;
+
+	static bool usePCID = false;
+	static bool useINVPCID = false;
+	static volatile uint64_t kernelgen = 0;
+
+	static uint64_t ReadCR4()
+	{
+		uint64_t ret = 0;
+		asm volatile("mov %%cr4, %[r]" : [r]"=r"(ret) :: "memory");
+		return ret;
+	}
+
+	static void WriteCR4(uint64_t val)
+	{
+		asm volatile("mov %[v], %%cr4" :: [v]"r"(val) : "memory");
+	}
+
+	static uint64_t DisableInterrupts()
+	{
+		uint64_t flags = 0;
+		asm volatile("pushfq; pop %[fl]; cli" : [fl]"=r"(flags) :: "memory");
+		return flags;
+	}
+
+	static void RestoreInterrupts(uint64_t flags)
+	{
+		if(flags & 0x200)
+			asm volatile("sti" ::: "memory");
+	}
+
+	static bool IsShared(uint64_t virt, uint64_t pages)
+	{
+		uint64_t last = virt + ((pages - 1) * 0x1000);
+		return virt < 0x40000000 || I_PML4_INDEX(virt) >= 510 || I_PML4_INDEX(last) >= 510;
+	}
+
+	// the current id only (without pcids, everything that isn't global).
+	static void FlushCurrent()
+	{
+		// bit 63 always reads as 0, so this flushes.
+		ChangeRawCR3(GetRawCR3());
+	}
+
+	// every id, globals included.
+	static void FlushEverything()
+	{
+		if(useINVPCID)
+		{
+			uint64_t desc[2] = { 0, 0 };
+			asm volatile("invpcid %[d], %[t]" :: [d]"m"(desc), [t]"r"((uint64_t) 2) : "memory");
+		}
+		else if(usePCID || (ReadCR4() & CR4_PGE))
+		{
+			// changing cr4.pge does it too.
+			uint64_t cr4 = ReadCR4();
+			WriteCR4(cr4 ^ CR4_PGE);
+			WriteCR4(cr4);
+		}
+		else
+		{
+			FlushCurrent();
+		}
+	}
+
+	// takes away every id belonging to 'addr', except 'skip's.
+	static void Forget(uint64_t addr, CPU* skip)
+	{
+		for(uint64_t c = 0; c < MaxCPUs; c++)
+		{
+			CPU* cpu = SMP::GetCPU(c);
+			if(!cpu || cpu == skip)
+				continue;
+
+			for(uint64_t i = 0; i < NumPCIDs; i++)
+				__sync_bool_compare_and_swap(&cpu->pcids[i], addr, 0);
+		}
+	}
+
+	// catches up with every shootdown sent to 'cpu' so far. interrupts have to be off.
+	static void Service(CPU* cpu)
+	{
+		uint64_t req = cpu->TLBRequests;
+		if(cpu->TLBShootdowns == req)
+			return;
+
+		uint64_t gen = kernelgen;
+		if(cpu->kernelgen != gen)
+		{
+			cpu->kernelgen = gen;
+			FlushEverything();
+		}
+		else
+		{
+			FlushCurrent();
+		}
+
+		__sync_synchronize();
+		cpu->TLBShootdowns = req;
+	}
+
+	void ServiceTLBShootdowns()
+	{
+		Service(SMP::GetCurrentCPU());
+	}
+
+	// interrupts the other processors running 'addr' (or all of them, for the shared range), then waits for them to
+	// flush. we keep servicing our own while we wait, in case one of them is waiting for us to do the same.
+	static void Shootdown(uint64_t addr, bool all)
+	{
+		if(SMP::GetNumberOfCPUs() < 2)
+			return;
+
+		uint64_t seen[MaxCPUs];
+		uint64_t flags = DisableInterrupts();
+		CPU* self = SMP::GetCurrentCPU();
+
+		for(uint64_t c = 0; c < MaxCPUs; c++)
+		{
+			CPU* cpu = SMP::GetCPU(c);
+			seen[c] = 0;
+
+			if(!cpu || cpu == self || !cpu->online)
+				continue;
+
+			if(!all && *((volatile uint64_t*) &cpu->CurrentCR3) != addr)
+				continue;
+
+			seen[c] = __sync_add_and_fetch(&cpu->TLBRequests, 1);
+			Devices::LocalAPIC::SendFixedIPI(cpu->apicid, TLBShootdownNumber);
+		}
+
+		for(uint64_t c = 0; c < MaxCPUs; c++)
+		{
+			if(seen[c] == 0)
+				continue;
+
+			CPU* cpu = SMP::GetCPU(c);
+			while(cpu->TLBShootdowns < seen[c])
+			{
+				Service(self);
+				asm volatile("pause");
+			}
+		}
+
+		RestoreInterrupts(flags);
+	}
+
+	// on each processor, while it's still on the kernel's cr3 (which is id 0; we never hand that one out).
+	void InitialiseTLB()
+	{
+		CPU* cpu = SMP::GetCurrentCPU();
+		if(cpu->id == 0)
+		{
+			usePCID = KernelCPUID->ProcessContextID();
+			useINVPCID = usePCID && KernelCPUID->InvalidatePCID();
+
+			if(usePCID)
+				Log("Using process-context ids%s", useINVPCID ? ", with invpcid" : "");
+		}
+
+		if(usePCID)
+			WriteCR4(ReadCR4() | CR4_PCIDE);
+
+		cpu->kernelgen = kernelgen;
+	}
+
+	// the value for cr3 when switching to 'pml4'. the scheduler calls this with interrupts off.
+	uint64_t SwitchContext(CPU* cpu, PageMapStructure* pml4)
+	{
+		uint64_t addr = (uint64_t) pml4;
+		cpu->CurrentCR3 = addr;
+
+		if(!usePCID)
+			return addr;
+
+		// pairs with InvalidateRange(): either it sees our CurrentCR3 and interrupts us, or we see our id gone.
+		__sync_synchronize();
+
+		uint64_t gen = kernelgen;
+		if(cpu->kernelgen != gen)
+		{
+			cpu->kernelgen = gen;
+			FlushEverything();
+		}
+
+		for(uint64_t i = 0; i < NumPCIDs; i++)
+		{
+			if(cpu->pcids[i] == addr)
+				return addr | (i + 1) | CR3_NOFLUSH;
+		}
+
+		// recycle the next id; whatever it had cached isn't ours, so this load flushes.
+		uint64_t i = cpu->nextpcid;
+		cpu->nextpcid = (i + 1) % NumPCIDs;
+		cpu->pcids[i] = addr;
+
+		return addr | (i + 1);
+	}
+
+	// call after clearing or changing entries in 'pml4', before reusing what they pointed to.
+	void InvalidateRange(uint64_t virt, uint64_t pages, PageMapStructure* pml4)
+	{
+		if(pages == 0)
+			return;
+
+		uint64_t flags = DisableInterrupts();
+		CPU* cpu = SMP::GetCurrentCPU();
+
+		uint64_t addr = (uint64_t) pml4;
+		bool current = (addr == (GetRawCR3() & I_AlignMask));
+		bool shared = IsShared(virt, pages);
+
+		if(current || shared)
+		{
+			if(pages > FullFlushThreshold)
+			{
+				FlushCurrent();
+			}
+			else
+			{
+				for(uint64_t i = 0; i < pages; i++)
+					invlpg((PageMapStructure*) (virt + (i * 0x1000)));
+			}
+		}
+
+		if(shared)			__sync_fetch_and_add(&kernelgen, 1);
+		else if(usePCID)	Forget(addr, current ? cpu : 0);
+
+		__sync_synchronize();
+		RestoreInterrupts(flags);
+
+		Shootdown(addr, shared);
+	}
+
+	// for address spaces going away, so their pml4 can be reused without inheriting anything.
+	void ForgetContext(PageMapStructure* pml4)
+	{
+		if(usePCID)
+			Forget((uint64_t) pml4, 0);
+	}
+
+	// another processor changed an address space we're running.
+	extern "C" void TLBShootdown_C()
+	{
+		Service(SMP::GetCurrentCPU());
+		Devices::LocalAPIC::SendEOI();
+	}
+}
+}
+}
+}
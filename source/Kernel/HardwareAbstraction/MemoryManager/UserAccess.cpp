@@ -0,0 +1,117 @@
+// UserAccess.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <Kernel.hpp>
+#include <errno.h>
+#include <HardwareAbstraction/MemoryManager/Virtual.hpp>
+
+// touching userspace from the kernel, when the address came from userspace and can't be trusted.
+
+// the range gets checked up front; past that, the copy just goes ahead, and if it faults on something that
+// HandlePageFault() can't sort out (ie. it isn't a demand-paged or cow page), the exception handler finds the
+// faulting instruction in the exception table and resumes at its fixup instead of killing us.
+
+extern "C" uint64_t UserCopy_Raw(void* dst, const void* src, size_t bytes);
+
+struct ExceptionTableEntry
+{
+	uint64_t rip;
+	uint64_t fixup;
+};
+
+// kernel.ld
+extern "C" ExceptionTableEntry ExceptionTableStart[];
+extern "C" ExceptionTableEntry ExceptionTableEnd[];
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace MemoryManager {
+namespace Virtual
+{
+	bool IsUserRange(const void* addr, size_t bytes)
+	{
+		uint64_t a = (uint64_t) addr;
+		return a >= I_UserSpaceBase && a <= I_UserSpaceEnd && bytes <= I_UserSpaceEnd - a;
+	}
+
+	bool CopyToUser(void* user, const void* src, size_t bytes)
+	{
+		if(!IsUserRange(user, bytes))
+			return false;
+
+		return UserCopy_Raw(user, src, bytes) == 0;
+	}
+
+	bool CopyFromUser(void* dst, const void* user, size_t bytes)
+	{
+		if(!IsUserRange(user, bytes))
+			return false;
+
+		return UserCopy_Raw(dst, user, bytes) == 0;
+	}
+
+	// a nul-terminated string, a page at a time so that one ending just before an unmapped page still works.
+	// returns its length, or -1 if it faulted; a length of 'max' means there was no nul in the first 'max' bytes.
+	int64_t CopyStringFromUser(char* dst, const char* user, size_t max)
+	{
+		size_t done = 0;
+		while(done < max)
+		{
+			uint64_t addr = (uint64_t) user + done;
+			size_t chunk = 0x1000 - (addr & 0xFFF);
+			if(chunk > max - done)
+				chunk = max - done;
+
+			if(!CopyFromUser(dst + done, (const void*) addr, chunk))
+				return -1;
+
+			for(size_t i = 0; i < chunk; i++)
+			{
+				if(dst[done + i] == 0)
+					return (int64_t) (done + i);
+			}
+
+			done += chunk;
+		}
+
+		return (int64_t) max;
+	}
+
+	// for paths and names handed to syscalls: false (with errno set) if it faulted, or doesn't fit in 'max' bytes.
+	bool CopyPathFromUser(char* dst, const char* user, size_t max)
+	{
+		int64_t len = CopyStringFromUser(dst, user, max);
+		if(len < 0)
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return false;
+		}
+
+		if((size_t) len == max)
+		{
+			Multitasking::SetThreadErrno(ENAMETOOLONG);
+			return false;
+		}
+
+		return true;
+	}
+
+	// called for faults in kernel mode; if 'rip' is somewhere that expects to fault, moves it to the fixup.
+	bool FixupException(uint64_t* rip)
+	{
+		for(ExceptionTableEntry* e = ExceptionTableStart; e < ExceptionTableEnd; e++)
+		{
+			if(e->rip == *rip)
+			{
+				*rip = e->fixup;
+				return true;
+			}
+		}
+
+		return false;
+	}
+}
+}
+}
+}
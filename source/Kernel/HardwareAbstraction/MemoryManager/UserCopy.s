@@ -0,0 +1,28 @@
+// UserCopy.s
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+.global UserCopy_Raw
+.type UserCopy_Raw, @function
+
+.section .text
+
+// copies %rdx bytes from %rsi to %rdi, either of which might fault. returns how many bytes weren't copied.
+// a fault in the rep movsb lands in the fixup (see the exception table), with %rcx saying how far it got.
+UserCopy_Raw:
+	mov %rdx, %rcx
+
+1:
+	rep movsb
+
+	xor %eax, %eax
+	ret
+
+2:
+	mov %rcx, %rax
+	ret
+
+
+// (faulting rip, where to go instead) pairs.
+.section .extable, "a"
+	.quad 1b, 2b
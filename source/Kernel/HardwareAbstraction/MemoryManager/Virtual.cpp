@@ -5,6 +5,7 @@
 
 #include <Kernel.hpp>
 #include <StandardIO.hpp>
+#include <HardwareAbstraction/Devices/APIC.hpp>
 #include <stddef.h>
 
 #include <rdestl/rdestl.h>
@@ -14,6 +15,39 @@ namespace HardwareAbstraction {
 namespace MemoryManager {
 namespace Virtual
 {
+	static MemRegion* FindRegion(VirtualAddressSpace* vas, uint64_t addr)
+	{
+		for(MemRegion* region : vas->regions)
+		{
+			if(addr >= region->start && addr < region->start + (region->length * 0x1000))
+				return region;
+		}
+
+		return 0;
+	}
+
+	static bool IsDemandRegion(MemRegion* region)
+	{
+		return region && region->used && (region->phys & I_DemandPaged);
+	}
+
+	// a device might be reading or writing it right now; anything unmapping it has to wait until it's done.
+	// returns with the vas locked, so nothing can pin it again (or free it first) before the caller is done.
+	static void LockUnpinned(VirtualAddressSpace* vas, uint64_t addr)
+	{
+		while(true)
+		{
+			LockMutex(*vas->mtx);
+
+			MemRegion* region = FindRegion(vas, addr);
+			if(!region || region->pins == 0)
+				return;
+
+			UnlockMutex(*vas->mtx);
+			YieldCPU();
+		}
+	}
+
 	static uint64_t FinaliseRegion(MemRegion* region, uint64_t phys, void* pml4)
 	{
 		region->used = 1;
@@ -26,7 +60,8 @@ namespace Virtual
 
 
 
-	uint64_t AllocateVirtual(uint64_t size, uint64_t addr, VirtualAddressSpace* _v, uint64_t phys)
+	// with 'align' (and no address), prefers somewhere aligned to it, but settles for anywhere.
+	uint64_t AllocateVirtual(uint64_t size, uint64_t addr, VirtualAddressSpace* _v, uint64_t phys, uint64_t align)
 	{
 		VirtualAddressSpace* vas = (_v ? _v : &Multitasking::GetCurrentProcess()->VAS);
 
@@ -36,6 +71,19 @@ namespace Virtual
 
 		AutoMutex mtx(*vas->mtx);
 
+		if(addr == 0 && align > 0x1000)
+		{
+			for(MemRegion* region : vas->regions)
+			{
+				uint64_t aligned = (region->start + align - 1) & ~(align - 1);
+				if(region->used == 0 && aligned + (size * 0x1000) <= region->start + (region->length * 0x1000))
+				{
+					addr = aligned;
+					break;
+				}
+			}
+		}
+
 		for(MemRegion* region : vas->regions)
 		{
 			assert(region->length > 0);
@@ -175,8 +223,11 @@ namespace Virtual
 	{
 		uint64_t phys = Physical::AllocatePage(size);
 
+		// if we got a 2mb-aligned block, put it somewhere 2mb-aligned too, so MapRegion() can use large pages.
+		uint64_t align = (size >= I_LargePageSize / 0x1000 && !(phys & (I_LargePageSize - 1))) ? I_LargePageSize : 0;
+
 		// store the 'flags' we used in the 'phys' field.
-		uint64_t virt = AllocateVirtual(size, addr, 0, phys | flags);
+		uint64_t virt = AllocateVirtual(size, addr, 0, phys | flags, align);
 
 		MapRegion(virt, phys & ((uint64_t) ~0xFFF), size, flags);
 
@@ -270,6 +321,31 @@ namespace Virtual
 		if(region->used) delete region;
 	}
 
+	// munmap(), so the address comes from userspace: it has to be exactly something AllocatePage() gave this
+	// process, not a stack or a channel that only looks like one.
+	bool FreeAnonymousPage(uint64_t addr, uint64_t size)
+	{
+		VirtualAddressSpace* vas = &Multitasking::GetCurrentProcess()->VAS;
+		bool found = false;
+
+		LockUnpinned(vas, addr);
+		for(MemRegion* region : vas->regions)
+		{
+			if(region->start == addr && region->length == size && region->used)
+			{
+				found = !(region->phys & (I_DemandPaged | I_SharedPages)) && (region->phys & I_AlignMask) != 0;
+				break;
+			}
+		}
+
+		// still under the same lock, so two threads unmapping it at once can't both free it.
+		if(found)
+			FreePage(addr, size);
+
+		UnlockMutex(*vas->mtx);
+		return found;
+	}
+
 
 	VirtualAddressSpace* SetupVAS(VirtualAddressSpace* vas)
 	{
@@ -301,9 +377,9 @@ namespace Virtual
 
 	void DestroyVAS(VirtualAddressSpace* vas)
 	{
-		// todo
-
-		(void) vas;
+		// todo: free the tables (and whatever's mapped that's ours).
+		// for now, just make sure nothing cached survives into whatever gets this pml4 next.
+		ForgetContext(vas->PML4);
 	}
 
 
@@ -324,6 +400,14 @@ namespace Virtual
 			if(virt >= region->start && virt < end)
 			{
 				assert(region->phys > 0);
+
+				// demand-paged and shared regions aren't physically contiguous, so ask the page tables.
+				if(region->phys & (I_DemandPaged | I_SharedPages))
+				{
+					uint64_t pte = LookupMapping(virt, vas->PML4);
+					return (pte & I_Present) ? (pte & I_AlignMask) + (virt & 0xFFF) : 0;
+				}
+
 				return region->phys + (virt - region->start);
 			}
 		}
@@ -331,122 +415,328 @@ namespace Virtual
 		return 0;
 	}
 
-	void ForceInsertALPTuple(uint64_t addr, size_t sizeInPages, uint64_t phys, VirtualAddressSpace* vas)
+
+
+	// demand-paged regions, for stacks: only the page tables are set up front, and pages are allocated the first
+	// time they're touched. the lowest page of the region is a guard, and is never populated.
+	uint64_t ReserveRegion(uint64_t size, uint64_t flags, VirtualAddressSpace* _v)
 	{
-		// todo???
-		(void) addr;
-		(void) sizeInPages;
-		(void) phys;
-		(void) vas;
-	}
+		VirtualAddressSpace* vas = (_v ? _v : &Multitasking::GetCurrentProcess()->VAS);
+		assert(size > 1);
 
+		flags &= 0xFFF & ~((uint64_t) I_DemandPaged);
+		uint64_t virt = AllocateVirtual(size, 0, vas, flags | I_DemandPaged);
 
+		// one not-present entry per page table makes sure the tables exist, so the fault handler never has to build them.
+		for(uint64_t va = virt; va < virt + (size * 0x1000); va = (va & ~((uint64_t) 0x1FFFFF)) + 0x200000)
+			MapAddress(va, 0, flags & ~((uint64_t) I_Present), vas->PML4);
 
+		return virt;
+	}
 
+	void ReleaseRegion(uint64_t addr, uint64_t size, VirtualAddressSpace* _v)
+	{
+		VirtualAddressSpace* vas = (_v ? _v : &Multitasking::GetCurrentProcess()->VAS);
+		LockUnpinned(vas, addr);
 
+		for(uint64_t i = 1; i < size; i++)
+		{
+			uint64_t va = addr + (i * 0x1000);
+			uint64_t pte = LookupMapping(va, vas->PML4);
 
+			if(pte & I_Present)
+			{
+				UnmapAddress(va, vas->PML4);
+				Physical::FreePage(pte & I_AlignMask);
+			}
+		}
 
+		FreeVirtual(addr, size, vas);
+		UnlockMutex(*vas->mtx);
+	}
 
+	// returns the physical page behind 'virt', allocating it first if it's an untouched page in a demand-paged region.
+	// returns 0 for anything else, including the guard page.
+	uint64_t PopulatePage(uint64_t virt, VirtualAddressSpace* _v)
+	{
+		VirtualAddressSpace* vas = (_v ? _v : &Multitasking::GetCurrentProcess()->VAS);
+		uint64_t page = virt & I_AlignMask;
 
+		// two threads can fault on the same page at once.
+		AutoMutex mtx(*vas->mtx);
 
+		MemRegion* region = FindRegion(vas, page);
+		if(!IsDemandRegion(region) || page == region->start)
+			return 0;
 
+		uint64_t pte = LookupMapping(page, vas->PML4);
+		if(pte & I_Present)
+			return pte & I_AlignMask;
 
+		uint64_t phys = Physical::AllocatePage();
+		uint64_t flags = region->phys & 0xFFF & ~((uint64_t) I_DemandPaged);
 
+		// nobody gets to see the page until it's been cleared.
+		Memory::Set(PhysToDirect(phys), 0, 0x1000);
 
+		MapAddress(page, phys, flags, vas->PML4);
+		invlpg((PageMapStructure*) page);
 
+		return phys;
+	}
 
-	void CopyFromKernel(uint64_t fromAddr, uint64_t toAddr, size_t bytes, VirtualAddressSpace* to)
+	// for dma straight to or from userspace: keeps every region under the range from being unmapped (and its pages
+	// freed) until UnpinRange(). false, with nothing pinned, if any of it isn't allocated.
+	bool PinRange(uint64_t virt, size_t bytes, VirtualAddressSpace* _v)
 	{
-		// this can only be done in the kernel
-		assert(Multitasking::GetProcess(0) == Multitasking::GetCurrentProcess());
+		VirtualAddressSpace* vas = (_v ? _v : &Multitasking::GetCurrentProcess()->VAS);
+		AutoMutex mtx(*vas->mtx);
 
-		VirtualAddressSpace* from = &Multitasking::GetProcess(0)->VAS;
+		for(uint64_t a = virt; a < virt + bytes; )
+		{
+			MemRegion* region = FindRegion(vas, a);
+			if(!region || !region->used)
+				return false;
 
-		size_t numPages			= (bytes + 0xFFF) / 0x1000;
-		uint64_t toAligned		= toAddr & I_AlignMask;
-		uint64_t beginOffset	= toAddr - toAligned;
-		uint64_t toPhys			= GetVirtualPhysical(toAligned, to);
+			a = region->start + (region->length * 0x1000);
+		}
 
-		if(toPhys == 0)
+		for(uint64_t a = virt; a < virt + bytes; )
 		{
-			Log(1, "Could not fetch physical address for %x in vas %x", toAligned, to->PML4);
-			toPhys = GetMapping(toAligned, to->PML4) & I_AlignMask;
+			MemRegion* region = FindRegion(vas, a);
+			region->pins++;
+
+			a = region->start + (region->length * 0x1000);
 		}
 
-		assert(toPhys > 0);
+		return true;
+	}
 
-		// allocate some temporary virt pages in the local address space
-		// then map the physical pages behind toAddr to our local space
-		uint64_t toVirtTemp = AllocateVirtual(numPages, 0, from, toPhys);
-		assert(toVirtTemp != 0);
+	void UnpinRange(uint64_t virt, size_t bytes, VirtualAddressSpace* _v)
+	{
+		VirtualAddressSpace* vas = (_v ? _v : &Multitasking::GetCurrentProcess()->VAS);
+		AutoMutex mtx(*vas->mtx);
 
-		Virtual::MapRegion(toVirtTemp, toPhys, numPages, 0x3);
+		for(uint64_t a = virt; a < virt + bytes; )
+		{
+			MemRegion* region = FindRegion(vas, a);
+			assert(region && region->pins > 0);
+			region->pins--;
 
-		// then copy it.
-		Log("Copying %d bytes from %p to %p (%x, %x, %x)", bytes, fromAddr, toAddr, beginOffset, toPhys, to->PML4);
-		Memory::CopyOverlap((void*) (toVirtTemp + beginOffset), (void*) fromAddr, bytes);
+			a = region->start + (region->length * 0x1000);
+		}
+	}
 
-		FreeVirtual(toVirtTemp, numPages);
-		Virtual::UnmapRegion(toVirtTemp, numPages);
+	void ForceInsertALPTuple(uint64_t addr, size_t sizeInPages, uint64_t phys, VirtualAddressSpace* vas)
+	{
+		// todo???
+		(void) addr;
+		(void) sizeInPages;
+		(void) phys;
+		(void) vas;
 	}
 
-	void CopyToKernel(uint64_t fromAddr, uint64_t toAddr, size_t bytes, VirtualAddressSpace* from)
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+	// without going through the direct map: when 'vas' is what we're running on, or the range is in the kernel's
+	// part of every address space.
+	static bool DirectlyAccessible(uint64_t virt, size_t bytes, VirtualAddressSpace* vas)
 	{
-		// this can only be done in the kernel
-		assert(Multitasking::GetProcess(0) == Multitasking::GetCurrentProcess());
+		if(!vas || (uint64_t) vas->PML4 == (GetRawCR3() & I_AlignMask))
+			return true;
 
-		VirtualAddressSpace* to = &Multitasking::GetProcess(0)->VAS;
-		size_t numPages			= (bytes + 0xFFF) / 0x1000;
+		return virt + bytes <= I_UserSpaceBase || virt >= I_UserSpaceEnd;
+	}
 
-		uint64_t fromAligned	= fromAddr & I_AlignMask;
-		uint64_t beginOffset	= fromAddr - fromAligned;
-		uint64_t fromPhys		= GetVirtualPhysical(fromAligned, from);
+	ScatterList::ScatterList(uint64_t v, size_t b, VirtualAddressSpace* as, bool w)
+	{
+		this->virt = v;
+		this->bytes = b;
+		this->writable = w;
+		this->failed = false;
+		this->direct = DirectlyAccessible(v, b, as);
+
+		this->vas = as ? as : &Multitasking::GetCurrentProcess()->VAS;
+		this->pml4 = as ? as->PML4 : (PageMapStructure*) (GetRawCR3() & I_AlignMask);
+	}
 
-		// special exception for kernel heap
-		if(fromPhys == 0 && fromAddr >= KernelHeapAddress)
-			fromPhys = GetVirtualPhysical(fromAligned, to);
+	// the page tables know about things the region list doesn't (the kernel heap, touched pages in demand-paged
+	// regions), so ask them first.
+	uint64_t ScatterList::Resolve(uint64_t v)
+	{
+		uint64_t pte = LookupMapping(v, this->pml4, &this->walk);
 
-		if(fromPhys == 0) Log(1, "Could not fetch physical address for %x in vas %x", fromAligned, from->PML4);
-		assert(fromPhys > 0);
+		// whatever writes to it needs its own copy first.
+		if(this->writable && (pte & I_Present) && (pte & I_CopyOnWrite) && !(pte & I_ReadWrite))
+		{
+			SplitCOW(v, this->vas);
+			pte = LookupMapping(v, this->pml4, &this->walk);
+		}
 
-		// allocate some temporary virt pages in the local address space
-		// then map the physical pages behind toAddr to our local space
-		uint64_t fromPhysMapped = AllocateVirtual(numPages, 0, to, fromPhys);
-		Virtual::MapRegion(fromPhysMapped, fromPhys, numPages, 0x3);
+		if(pte & I_Present)
+			return (pte & I_AlignMask) + (v & 0xFFF);
 
-		// then copy it.
-		Memory::Copy((void*) toAddr, (void*) (fromPhysMapped + beginOffset), bytes);
+		uint64_t ret = PopulatePage(v, this->vas);
+		if(ret) return ret + (v & 0xFFF);
 
-		FreeVirtual(fromPhysMapped, numPages);
-		Virtual::UnmapRegion(fromPhysMapped, numPages);
+		// nothing there (ie. a bad pointer from userspace); the caller gets EFAULT.
+		ret = GetVirtualPhysical(v, this->vas);
+		if(ret == 0) Log(1, "Could not fetch physical address for %x in vas %x", v, this->pml4);
+
+		return ret;
 	}
 
+	// how far things go on from 'phys' at 'virt' before the next page isn't physically next.
+	size_t ScatterList::Run(uint64_t phys)
+	{
+		size_t run = 0x1000 - (this->virt & 0xFFF);
+		while(run < this->bytes && this->Resolve(this->virt + run) == phys + run)
+			run += 0x1000;
 
+		if(run > this->bytes)
+			run = this->bytes;
 
+		this->virt += run;
+		this->bytes -= run;
+		return run;
+	}
 
+	bool ScatterList::Next(uint8_t** ptr, size_t* len)
+	{
+		if(this->bytes == 0)
+			return false;
 
+		if(this->direct)
+		{
+			*ptr = (uint8_t*) this->virt;
+			*len = this->bytes;
 
+			this->virt += this->bytes;
+			this->bytes = 0;
+			return true;
+		}
 
+		uint64_t phys = this->Resolve(this->virt);
+		if(phys == 0)
+		{
+			this->failed = true;
+			return false;
+		}
 
+		*ptr = (uint8_t*) PhysToDirect(phys);
+		*len = this->Run(phys);
+		return true;
+	}
 
+	bool ScatterList::NextPhysical(uint64_t* phys, size_t* len)
+	{
+		if(this->bytes == 0)
+			return false;
 
+		*phys = this->Resolve(this->virt);
+		if(*phys == 0)
+		{
+			this->failed = true;
+			return false;
+		}
 
+		*len = this->Run(*phys);
+		return true;
+	}
 
+	bool ScatterList::Failed()
+	{
+		return this->failed;
+	}
 
+	bool ScatterList::Check()
+	{
+		uint64_t phys = 0;
+		size_t len = 0;
+		while(this->NextPhysical(&phys, &len))
+			;
 
+		return !this->failed;
+	}
 
+	uint8_t* ScatterList::Contiguous()
+	{
+		size_t total = this->bytes;
 
+		uint8_t* ptr = 0;
+		size_t len = 0;
+		if(!this->Next(&ptr, &len) || len != total)
+			return 0;
 
+		return ptr;
+	}
 
+	// 'from' or 'to' being 0 means that side is directly accessible (ie. kernel memory).
+	static bool Copy(uint64_t fromAddr, uint64_t toAddr, size_t bytes, VirtualAddressSpace* from, VirtualAddressSpace* to)
+	{
+		ScatterList src(fromAddr, bytes, from);
+		ScatterList dst(toAddr, bytes, to, true);
 
+		uint8_t* s = 0;
+		uint8_t* d = 0;
+		size_t slen = 0;
+		size_t dlen = 0;
 
+		while(true)
+		{
+			if(slen == 0 && !src.Next(&s, &slen))
+				break;
 
+			if(dlen == 0 && !dst.Next(&d, &dlen))
+				break;
 
+			size_t len = slen < dlen ? slen : dlen;
 
+			// a directly accessible run can still be a bad user pointer, so those go through the fault-safe copies.
+			bool ok = true;
+			if(IsUserRange(d, len))			ok = CopyToUser(d, s, len);
+			else if(IsUserRange(s, len))	ok = CopyFromUser(d, s, len);
+			else							Memory::Copy(d, s, len);
 
+			if(!ok)
+				return false;
 
+			s += len;
+			d += len;
+			slen -= len;
+			dlen -= len;
+		}
 
+		return !src.Failed() && !dst.Failed();
+	}
 
+	bool CopyFromKernel(uint64_t fromAddr, uint64_t toAddr, size_t bytes, VirtualAddressSpace* to)
+	{
+		return Copy(fromAddr, toAddr, bytes, 0, to);
+	}
+
+	bool CopyToKernel(uint64_t fromAddr, uint64_t toAddr, size_t bytes, VirtualAddressSpace* from)
+	{
+		return Copy(fromAddr, toAddr, bytes, from, 0);
+	}
+
+	bool CopyBetweenAddressSpaces(uint64_t fromAddr, uint64_t toAddr, size_t bytes, VirtualAddressSpace* from, VirtualAddressSpace* to)
+	{
+		return Copy(fromAddr, toAddr, bytes, from, to);
+	}
 
 
 
@@ -486,19 +776,40 @@ namespace Virtual
 			reg->start	= pair->start;
 			reg->used	= pair->used;
 
-			if(pair->used)
+			if(pair->used && (pair->phys & I_SharedPages))
+			{
+				// not ours to copy, and the child isn't attached to whatever owns them; leave a hole.
+				reg->used = 0;
+				reg->phys = 0;
+			}
+			else if(pair->used && (pair->phys & I_DemandPaged))
+			{
+				// only copy the pages that have actually been touched; the rest stay lazy in the child too.
+				uint64_t flags = pair->phys & 0xFFF & ~((uint64_t) I_DemandPaged);
+				for(uint64_t va = pair->start; va < pair->start + (pair->length * 0x1000); va = (va & ~((uint64_t) 0x1FFFFF)) + 0x200000)
+					Virtual::MapAddress(va, 0, flags & ~((uint64_t) I_Present), dest->PML4);
+
+				for(uint64_t i = 1; i < pair->length; i++)
+				{
+					uint64_t va = pair->start + (i * 0x1000);
+					if(!(LookupMapping(va, src->PML4) & I_Present))
+						continue;
+
+					uint64_t p = Physical::AllocatePage();
+					Memory::Copy(PhysToDirect(p), (void*) va, 0x1000);
+
+					Virtual::MapAddress(va, p, flags, dest->PML4);
+				}
+			}
+			else if(pair->used)
 			{
 				uint64_t p = Physical::AllocatePage(pair->length);
 
 				// todo: use Copy-on-write (COW) for this instead of allocating a new page
 				Virtual::MapRegion(pair->start, p, pair->length, (pair->phys & 0xFFF) | 0x7, dest->PML4);
 
-				Virtual::MapRegion(TemporaryVirtualMapping, p, pair->length, 0x07);
-
 				// copy contents.
-				Memory::CopyOverlap((void*) TemporaryVirtualMapping, (void*) pair->start, pair->length * 0x1000);
-
-				Virtual::UnmapRegion(TemporaryVirtualMapping, pair->length);
+				Memory::Copy(PhysToDirect(p), (void*) pair->start, pair->length * 0x1000);
 				reg->phys = p | (pair->phys & 0xFFF);
 			}
 
@@ -510,6 +821,36 @@ namespace Virtual
 		return dest;
 	}
 
+	// gives the page at 'virt' in 'vas' its own copy, if it's sharing one copy-on-write. false if it isn't.
+	bool SplitCOW(uint64_t virt, VirtualAddressSpace* vas)
+	{
+		PageMapStructure* pdpt = 0;
+		PageMapStructure* pd = 0;
+		PageMapStructure* pt = 0;
+
+		// conditions for cow:
+		// bit 11 (0x800) for COW set, bit 1 (0x2, R/W bit) not set.
+		uint64_t* value = GetPageTableEntry(virt, vas->PML4, &pdpt, &pd, &pt);
+		if(!value || !(*value & I_CopyOnWrite) || (*value & I_ReadWrite))
+			return false;
+
+		// allocate a page, copy existing data, then return.
+		uint64_t np = Physical::AllocatePage();
+		uint64_t old = *value & I_AlignMask;
+		uint64_t oldflags = *value & ~I_AlignMask;
+
+		// copy the old bytes over before anyone can see the new page.
+		Log(3, "Copying 0x1000 bytes from phys %x to %x", old, virt & I_AlignMask);
+		Memory::Copy(PhysToDirect(np), PhysToDirect(old), 0x1000);
+
+		// written straight into 'vas's tables, since it might not be the one we're running.
+		*value = np | (oldflags | I_ReadWrite | I_CopyOnWrite);
+		InvalidateRange(virt & I_AlignMask, 1, vas->PML4);
+
+		Log("Successfully allocated new physical page at %x for COW purposes mapped to virtual page %x", np, virt & I_AlignMask);
+		return true;
+	}
+
 	bool HandlePageFault(uint64_t cr2, uint64_t cr3, uint64_t errorcode)
 	{
 		(void) cr3;
@@ -521,33 +862,25 @@ namespace Virtual
 
 		// HALT("PF");
 
-		// check if cow.
-		uint64_t* value = GetPageTableEntry(cr2, Multitasking::GetCurrentProcess()->VAS.PML4, &pdpt, &pd, &pt);
-
-		// conditions for cow:
-		// bit 11 (0x800) for COW set, bit 1 (0x2, R/W bit) not set.
-		if(value && (*value & I_CopyOnWrite) && !(*value & I_ReadWrite))
+		// first touch of a page in a demand-paged region (ie. a stack).
+		if(!(errorcode & 0x1))
 		{
-			// allocate a page, copy existing data, then return.
-			uint64_t np = Physical::AllocatePage();
-			uint64_t old = *value & I_AlignMask;
-			uint64_t oldflags = *value & ~I_AlignMask;
-
-			*value = np | (oldflags | I_ReadWrite | I_CopyOnWrite);
+			if(PopulatePage(cr2) != 0)
+				return true;
 
-			// we need to copy the old bytes to the new page.
-			// _old_ should contain the virtual address of the parent
-			Virtual::MapAddress(cr2 & I_AlignMask, np, 0x07);
-			Virtual::MapAddress(TemporaryVirtualMapping, old, 0x07);
-
-			Log(3, "Copying 0x1000 bytes from phys %x to %x (error: %x)", old, cr2 & I_AlignMask, errorcode);
-			Memory::CopyOverlap((void*) (cr2 & I_AlignMask) , (void*) TemporaryVirtualMapping, 0x1000);
-			Virtual::UnmapAddress(TemporaryVirtualMapping);
+			MemRegion* region = FindRegion(&Multitasking::GetCurrentProcess()->VAS, cr2);
+			if(IsDemandRegion(region) && (cr2 & I_AlignMask) == region->start)
+			{
+				Log(1, "Thread %d overflowed its stack (guard page at %x)", Multitasking::GetCurrentThread()->ThreadID, region->start);
+				return false;
+			}
+		}
 
-			Log("Successfully allocated new physical page at %x for COW purposes mapped to virtual page %x", np, cr2 & I_AlignMask);
+		// check if cow.
+		if(SplitCOW(cr2, &Multitasking::GetCurrentProcess()->VAS))
 			return true;
-		}
 
+		uint64_t* value = GetPageTableEntry(cr2, Multitasking::GetCurrentProcess()->VAS.PML4, &pdpt, &pd, &pt);
 		Log("Invalid access (%x:%x)", value, value ? *value : 0);
 		return false;
 	}
@@ -564,15 +897,10 @@ namespace Virtual
 			top 1024gb is also kernel owned.
 		*/
 
-		PageMapStructure* _kernelpml4 = (PageMapStructure*) Kernel::GetKernelCR3();
-		Virtual::MapAddress(TemporaryVirtualMapping, (uint64_t) _kernelpml4, 0x07);
-		PageMapStructure* kernelpml4 = (PageMapStructure*) TemporaryVirtualMapping;
-
-		PageMapStructure* _pdpt = (PageMapStructure*) kernelpml4->Entry[0];
+		PageMapStructure* kernelpml4 = (PageMapStructure*) PhysToDirect(Kernel::GetKernelCR3());
 
 		// bottom 1gb
-		Virtual::MapAddress(TemporaryVirtualMapping + 0x1000, (uint64_t) _pdpt, 0x07);
-		PageMapStructure* pdpt = (PageMapStructure*) (TemporaryVirtualMapping + 0x1000);
+		PageMapStructure* pdpt = (PageMapStructure*) PhysToDirect(kernelpml4->Entry[0] & I_AlignMask);
 		PageMapStructure* pt = (PageMapStructure*) pdpt->Entry[0];
 
 		// we need to throw this address (aka pointer) into the created things.
@@ -614,12 +942,12 @@ namespace Virtual
 		}
 
 		// Map the LFB.
-		for(uint64_t i = 0; i < Kernel::GetLFBLengthInPages(); i++)
-			Virtual::MapAddress(Kernel::GetFramebufferAddress() + (i * 0x1000), Kernel::GetFramebufferAddress() + (i * 0x1000), 0x07, PML4);
+		Virtual::MapRegion(Kernel::GetTrueLFBAddress(), Kernel::GetTrueLFBAddress(), Kernel::GetLFBLengthInPages(), 0x07, PML4);
 
+		// and the local apic, which interrupt handlers (timer EOIs) touch in whatever address space is current.
+		if(Devices::LocalAPIC::GetBaseAddress())
+			Virtual::MapAddress(Devices::LocalAPIC::GetBaseAddress(), Devices::LocalAPIC::GetBaseAddress(), 0x1B, PML4);
 
-		Virtual::UnmapAddress(TemporaryVirtualMapping);
-		Virtual::UnmapAddress(TemporaryVirtualMapping + 0x1000);
 		return (uint64_t) PML4;
 	}
 
@@ -0,0 +1,279 @@
+// Registry.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+
+#include <Kernel.hpp>
+
+using namespace Library;
+
+// tid -> Thread* and pid -> Process*, for every thread and process that exists, whatever state it's in.
+// a dead thread stays until it's joined (or straight away, if it was detached), so join can still find it.
+// open addressing with linear probing; ids are handed out sequentially, so the id itself is a perfectly good hash.
+
+// readers take no locks at all: a slot's key is written once (after its value) and never changes,
+// so a reader either sees the key with its value, or doesn't see the key yet.
+// removal only clears the value, leaving the key behind as a tombstone.
+
+// writers serialise on the table's own spinlock -- never the run queue or sleep list locks.
+// growing builds a new table and swaps the pointer; the old one is freed once no reader can still be looking at it.
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Multitasking
+{
+	#define EmptyKey			((int64_t) -1)
+	#define MinTableSize		64
+
+	template <typename T>
+	struct IDTable
+	{
+		struct Entry
+		{
+			volatile int64_t key;
+			T* volatile value;
+		};
+
+		struct Table
+		{
+			uint64_t capacity;
+			uint64_t used;			// slots with a key, including tombstones
+			Entry* entries;
+
+			Table* next;			// on the retired list
+		};
+
+		Table* volatile current = 0;
+		Table* retired = 0;
+
+		volatile uint64_t readers = 0;
+		uint64_t live = 0;
+
+		Spinlock lock;
+
+
+		static Table* Allocate(uint64_t capacity)
+		{
+			Table* t = new Table;
+			t->capacity = capacity;
+			t->used = 0;
+			t->next = 0;
+			t->entries = new Entry[capacity];
+
+			for(uint64_t i = 0; i < capacity; i++)
+			{
+				t->entries[i].key = EmptyKey;
+				t->entries[i].value = 0;
+			}
+
+			return t;
+		}
+
+		static void Free(Table* t)
+		{
+			delete[] t->entries;
+			delete t;
+		}
+
+		// keep at least one in four slots empty, so probes always terminate.
+		static bool NeedsGrow(Table* t)
+		{
+			return !t || (t->used + 1) * 4 > t->capacity * 3;
+		}
+
+		static Entry* Find(Table* t, int64_t key)
+		{
+			uint64_t mask = t->capacity - 1;
+			for(uint64_t i = (uint64_t) key & mask; ; i = (i + 1) & mask)
+			{
+				Entry* e = &t->entries[i];
+				if(e->key == key || e->key == EmptyKey)
+					return e;
+			}
+		}
+
+		T* Lookup(int64_t key)
+		{
+			if(key < 0)
+				return 0;
+
+			// announce ourselves before looking at the table, so a writer that swapped it knows to wait.
+			__sync_fetch_and_add(&this->readers, 1);
+
+			T* ret = 0;
+			Table* t = this->current;
+			if(t)
+			{
+				Entry* e = Find(t, key);
+				if(e->key == key)
+					ret = e->value;
+			}
+
+			__sync_fetch_and_sub(&this->readers, 1);
+			return ret;
+		}
+
+		// only ever called with the lock held.
+		void Publish(Table* nt)
+		{
+			Table* old = this->current;
+
+			__sync_synchronize();
+			this->current = nt;
+			__sync_synchronize();
+
+			if(old)
+			{
+				old->next = this->retired;
+				this->retired = old;
+			}
+		}
+
+		// anyone who reads 'readers' as zero after the swap will only ever see the new table.
+		Table* TakeRetired()
+		{
+			if(!this->retired || this->readers != 0)
+				return 0;
+
+			Table* ret = this->retired;
+			this->retired = 0;
+			return ret;
+		}
+
+		void Insert(int64_t key, T* value)
+		{
+			Table* fresh = 0;
+			Table* dead = 0;
+
+			while(true)
+			{
+				LockSpinlock(this->lock);
+				if(!NeedsGrow(this->current))
+					break;
+
+				// tombstones count towards 'used', so sometimes this is just a rehash at the same size.
+				uint64_t want = MinTableSize;
+				while(want < (this->live + 1) * 4)
+					want *= 2;
+
+				if(fresh && fresh->capacity >= want)
+				{
+					Table* cur = this->current;
+					for(uint64_t i = 0; cur && i < cur->capacity; i++)
+					{
+						Entry* from = &cur->entries[i];
+						if(from->value == 0)
+							continue;
+
+						Entry* to = Find(fresh, from->key);
+						to->value = from->value;
+						to->key = from->key;
+						fresh->used++;
+					}
+
+					this->Publish(fresh);
+					fresh = 0;
+					break;
+				}
+
+				// don't allocate with the lock held -- the heap might sleep, and we have interrupts off.
+				UnlockSpinlock(this->lock);
+
+				if(fresh)
+					Free(fresh);
+
+				fresh = Allocate(want);
+			}
+
+			Entry* e = Find(this->current, key);
+			if(e->key == EmptyKey)
+			{
+				e->value = value;
+				__sync_synchronize();
+				e->key = key;
+
+				this->current->used++;
+				this->live++;
+			}
+			else
+			{
+				if(e->value == 0)
+					this->live++;
+
+				e->value = value;
+			}
+
+			dead = this->TakeRetired();
+			UnlockSpinlock(this->lock);
+
+			if(fresh)
+				Free(fresh);
+
+			while(dead)
+			{
+				Table* next = dead->next;
+				Free(dead);
+				dead = next;
+			}
+		}
+
+		// safe from interrupt context: never allocates or frees.
+		void Remove(int64_t key, T* value)
+		{
+			LockSpinlock(this->lock);
+
+			Table* t = this->current;
+			if(t)
+			{
+				Entry* e = Find(t, key);
+				if(e->key == key && e->value == value)
+				{
+					e->value = 0;
+					this->live--;
+				}
+			}
+
+			UnlockSpinlock(this->lock);
+		}
+	};
+
+	static IDTable<Thread> ThreadTable;
+	static IDTable<Process> ProcessTable;
+
+
+	void RegisterThread(Thread* t)
+	{
+		assert(t);
+		ThreadTable.Insert(t->ThreadID, t);
+	}
+
+	void UnregisterThread(Thread* t)
+	{
+		assert(t);
+		ThreadTable.Remove(t->ThreadID, t);
+	}
+
+	void RegisterProcess(Process* p)
+	{
+		assert(p);
+		ProcessTable.Insert(p->ProcessID, p);
+	}
+
+	void UnregisterProcess(Process* p)
+	{
+		assert(p);
+		ProcessTable.Remove(p->ProcessID, p);
+	}
+
+	Thread* GetThread(pid_t tid)
+	{
+		return ThreadTable.Lookup(tid);
+	}
+
+	Process* GetProcess(pid_t pid)
+	{
+		return ProcessTable.Lookup(pid);
+	}
+}
+}
+}
@@ -18,50 +18,117 @@ namespace Kernel {
 namespace HardwareAbstraction {
 namespace Multitasking
 {
-	static bool IsFirst = true;
-	static rde::vector<Thread*> PendingSleepList;
-
-	static RunQueue mainRunQueue;
-	static Thread* CurrentThread = 0;
-
-	static uint64_t CurrentCR3 = 0;
-	static uint64_t ScheduleCount = 0;
+	using SMP::CPU;
+	using SMP::GetCurrentCPU;
 
 	rde::vector<Thread*> SleepList;
 	rde::vector<Process*> ProcessList;
-
-	bool SchedulerEnabled = true;
+	Spinlock SleepListLock;
 
 	void Initialise()
 	{
-		CurrentCR3 = GetKernelCR3();
+		CPU* cpu = GetCurrentCPU();
+
+		cpu->CurrentCR3 = GetKernelCR3();
+		cpu->runqueue = new RunQueue();
+		cpu->Errno = 0;
+	}
 
-		mainRunQueue = RunQueue();
-		// mainRunQueue.queue = new rde::vector<Thread*>[NUM_PRIO];
 
-		*((int64_t*) 0x2610) = 0;
+	Process* GetCurrentProcess()
+	{
+		Thread* t = GetCurrentThread();
+		return t ? t->Parent : Kernel::KernelProcess;
 	}
 
+	Thread* GetCurrentThread()
+	{
+		// interrupts off, so we can't migrate between reading the cpu and reading its thread.
+		uint64_t flags = 0;
+		asm volatile("pushfq; pop %[fl]; cli" : [fl]"=r"(flags) :: "memory");
+
+		Thread* ret = GetCurrentCPU()->CurrentThread;
 
-	Process* GetCurrentProcess()	{ return CurrentThread ? CurrentThread->Parent : Kernel::KernelProcess; }
-	Thread* GetCurrentThread()		{ return CurrentThread; }
-	pid_t GetCurrentThreadID()		{ return CurrentThread->ThreadID; }
-	pid_t GetCurrentProcessID()		{ return CurrentThread->Parent->ProcessID; }
-	RunQueue& GetRunQueue()			{ return mainRunQueue; }
+		if(flags & 0x200)
+			asm volatile("sti" ::: "memory");
+
+		return ret;
+	}
+
+	pid_t GetCurrentThreadID()		{ return GetCurrentThread()->ThreadID; }
+	pid_t GetCurrentProcessID()		{ return GetCurrentThread()->Parent->ProcessID; }
+	RunQueue& GetRunQueue()			{ return *GetCurrentCPU()->runqueue; }
+
+	RunQueue& LockRunQueue(Thread* t)
+	{
+		// the thread can get stolen between us reading its processor and taking the lock,
+		// so check that it's still where we think it is.
+		while(true)
+		{
+			CPU* cpu = t->Processor ? t->Processor : GetCurrentCPU();
+			RunQueue* rq = cpu->runqueue;
+
+			rq->lock();
+			if(t->Processor == 0 || t->Processor == cpu)
+				return *rq;
+
+			rq->unlock();
+		}
+	}
 
 	// if, after N number of switches, processes in the low/norm queue don't get to run, run them all to completion.
 	// todo: fix scheduler. starvation still happens (unable to prevent cross-starvation)
 	static size_t StarvationThresholds[NUM_PRIO] = { 64, 16, 1, 1 };
 
+	// called with our own queue locked, when we've got nothing but the idle thread to run.
+	// try the other processors' queues (without waiting on them), and take something that isn't pinned or running.
+	static Thread* StealThread(CPU* cpu)
+	{
+		for(uint64_t n = 1; n < SMP::GetNumberOfCPUs(); n++)
+		{
+			CPU* victim = SMP::GetCPU((cpu->id + n) % SMP::GetNumberOfCPUs());
+			if(!victim || !victim->online || !victim->runqueue || !victim->runqueue->trylock())
+				continue;
+
+			Thread* found = 0;
+			for(int i = NUM_PRIO - 1; i >= 0 && !found; i--)
+			{
+				for(auto t : victim->runqueue->queue[i])
+				{
+					if(!(t->flags & FLAG_PINNED) && !t->OnCPU && t != victim->CurrentThread)
+					{
+						found = t;
+						break;
+					}
+				}
+			}
+
+			if(found)
+			{
+				victim->runqueue->queue[found->Priority].remove(found);
+				found->Processor = cpu;
+				cpu->runqueue->queue[found->Priority].push_back(found);
+			}
+
+			victim->runqueue->unlock();
+
+			if(found)
+				return found;
+		}
+
+		return 0;
+	}
+
 	Thread* GetNextThread()
 	{
-		auto& theQueue = GetRunQueue();
-		Thread* r = CurrentThread;
+		CPU* cpu = GetCurrentCPU();
+		auto& theQueue = *cpu->runqueue;
+		Thread* r = 0;
 		theQueue.lock();
 
 		for(int i = 0; i < NUM_PRIO; i++)
 		{
-			if(!theQueue.queue[i].empty() && (ScheduleCount % StarvationThresholds[i]) == 0)
+			if(!theQueue.queue[i].empty() && (cpu->ScheduleCount % StarvationThresholds[i]) == 0)
 			{
 				r = theQueue.queue[i].front();
 				theQueue.queue[i].erase(theQueue.queue[i].begin());
@@ -70,120 +137,127 @@ namespace Multitasking
 			}
 		}
 
+		// nothing was due this round; take the highest priority thing we have.
+		for(int i = NUM_PRIO - 1; i >= 0 && r == nullptr; i--)
+		{
+			if(!theQueue.queue[i].empty())
+			{
+				r = theQueue.queue[i].front();
+				theQueue.queue[i].erase(theQueue.queue[i].begin());
+				theQueue.queue[i].push_back(r);
+			}
+		}
+
+		if(r == nullptr || r == cpu->IdleThread)
+		{
+			Thread* stolen = StealThread(cpu);
+			if(stolen)
+				r = stolen;
+		}
+
 		if(r == nullptr)
 		{
 			Log(3, "FATAL: Thread was null!");
-			// error recovery: switch to the kernel thread
-			CurrentThread = KernelProcess->Threads.front();
-			r = CurrentThread;
+			// error recovery: switch to the idle thread
+			r = cpu->IdleThread ? cpu->IdleThread : KernelProcess->Threads.front();
 			assert(r);
 		}
 
+		r->Processor = cpu;
+		r->OnCPU = 1;
+		cpu->CurrentThread = r;
+
 		theQueue.unlock();
 
-		ScheduleCount++;
+		cpu->ScheduleCount++;
 		return r;
 	}
 
 	extern "C" uint64_t SwitchProcess(uint64_t context)
 	{
-		if(BOpt_Likely(!IsFirst))
+		CPU* cpu = GetCurrentCPU();
+		Thread* prev = cpu->CurrentThread;
+
+		if(BOpt_Likely(!cpu->IsFirst && prev))
 		{
-			if(PendingSleepList.size() > 0)
+			if(cpu->PendingSleep)
 			{
-				assert(PendingSleepList.size() == 1 && "no, it can't be!");
-				for(uint64_t i = 0, s = PendingSleepList.size(); i < s; i++)
-				{
-					auto front = PendingSleepList.front();
-					PendingSleepList.erase_unordered(PendingSleepList.begin());
-					SleepList.push_back(front);
+				Thread* p = cpu->PendingSleep;
+				cpu->PendingSleep = 0;
 
-					SleepList.back()->StackPointer = context;
-				}
+				p->StackPointer = context;
+
+				LockSpinlock(SleepListLock);
+				SleepList.push_back(p);
+				UnlockSpinlock(SleepListLock);
 			}
 			else
 			{
-				CurrentThread->StackPointer = context;
+				prev->StackPointer = context;
 			}
+
+			// %gs:24 stores the thread's current errno.
+			// we therefore need to save it before switching threads.
+			prev->currenterrno = cpu->Errno;
 		}
 		else
 		{
-			IsFirst = false;
+			// whatever we were running on (the boot stack) isn't a thread, so there's nothing to save.
+			cpu->IsFirst = false;
+			prev = 0;
 		}
 
+		// the old thread's OnCPU is only cleared once we're off its stack; see FinishSwitch().
+		cpu->PreviousThread = prev;
 
+		Thread* next = GetNextThread();
+		cpu->Errno = next->currenterrno;
 
-		if(BOpt_Likely(!IsFirst))
-		{
-			uint64_t StackBottom = CurrentThread->TopOfStack - DefaultRing3StackSize;
-
-			// check if we're about to overflow.
-			if(context - StackBottom <= 0x100)
-			{
-				Log(1, "Warning: Thread(%d) of Process(%s, %d) has only 0x100 bytes of stack space left", CurrentThread->ThreadID, CurrentThread->Parent->Name, CurrentThread->Parent->ProcessID);
-			}
-			else if(context - StackBottom <= 0x10)
-			{
-				Log(1, "Warning: Thread(%d) of Process(%s, %d) has only 16 bytes of stack space left, taking action...", CurrentThread->ThreadID, CurrentThread->Parent->Name, CurrentThread->Parent->ProcessID);
-				UHALT();
-			}
-		}
-
-
-
-
-
-
-		// 0x2610 stores the thread's current errno.
-		// we therefore need to save it before switching threads.
-		CurrentThread->currenterrno = *((int64_t*) 0x2610);
-		CurrentThread = GetNextThread();
-
-		// if(CurrentThread->Parent->ProcessID == 2)
-		// 	Log("have pid 2???");
-
-
-		if(CurrentThread->Parent->Flags & 0x1)
-		{
-			// this tells switch.s (on return) that we need to return to user-mode.
-			*((uint64_t*) 0x2608) = 0xFADE;
-		}
 
+		// this tells switch.s (on return) whether we need to return to user-mode.
+		cpu->ReturnToUser = (next->Parent->Flags & 0x1) ? 0xFADE : 0;
 
 		// set tss
-		*((uint64_t*) 0x2504) = CurrentThread->TopOfStack;
+		cpu->tss->rsp0 = next->TopOfStack;
 
 		// update fs
-		uint64_t tlsptr = (uintptr_t) &CurrentThread->tlsptr;
+		uint64_t tlsptr = (uintptr_t) &next->tlsptr;
 		SetTLS(tlsptr);
 
 
-		if((uint64_t) CurrentThread->Parent->VAS.PML4 != CurrentCR3)
+		if((uint64_t) next->Parent->VAS.PML4 != cpu->CurrentCR3)
 		{
 			using namespace MemoryManager;
 
 			// Only change the value in cr3 if we need to, to avoid trashing the TLB.
-			*((uint64_t*) 0x2600) = (uint64_t) CurrentThread->Parent->VAS.PML4;
-			CurrentCR3 = (uint64_t) CurrentThread->Parent->VAS.PML4;
-			Virtual::SwitchPML4T((Virtual::PageMapStructure*) CurrentCR3);
+			// with pcids, this usually doesn't trash it either.
+			cpu->NewCR3 = Virtual::SwitchContext(cpu, next->Parent->VAS.PML4);
+			Virtual::SwitchPML4T(next->Parent->VAS.PML4);
 		}
 		else
 		{
-			*((uint64_t*) 0x2600) = 0;
+			cpu->NewCR3 = 0;
 		}
 
 
 
-		return CurrentThread->StackPointer;
+		return next->StackPointer;
 	}
 
-	extern "C" void VerifySchedule()
+	// called by the task switcher once it's on the new thread's stack (and address space).
+	// only now can another processor safely pick up the thread we just left.
+	extern "C" void FinishSwitch()
 	{
-		// if(CurrentThread->Parent->ProcessID == 2)
-		// 	HardwareAbstraction::Devices::SerialPort::WriteString("[2]");
+		CPU* cpu = GetCurrentCPU();
+		Thread* prev = cpu->PreviousThread;
 
-		// if(CurrentThread->Parent->ProcessID == 1)
-		// 	HardwareAbstraction::Devices::SerialPort::WriteString("[1]");
+		if(prev && prev != cpu->CurrentThread)
+		{
+			__sync_synchronize();
+			prev->OnCPU = 0;
+		}
+
+		cpu->PreviousThread = 0;
 	}
 
 	extern "C" void YieldCPU()
@@ -193,47 +267,55 @@ namespace Multitasking
 
 	void Sleep(int64_t t)
 	{
-		if(CurrentThread->Sleep != 0)
+		// keep interrupts off until we've yielded: if the timer switched us out after we left the run queue,
+		// but before we were marked as pending sleep, nothing would ever put us back.
+		uint64_t flags = 0;
+		asm volatile("pushfq; pop %[fl]; cli" : [fl]"=r"(flags) :: "memory");
+
+		CPU* cpu = GetCurrentCPU();
+		if(cpu->CurrentThread->Sleep != 0)
 		{
 			Log("SLEEP (%d, %d, %x)", GetCurrentThread()->ThreadID, GetCurrentThread()->State, __builtin_return_address(0));
 		}
 
-		Thread* p = FetchAndRemoveThread(CurrentThread);
+		Thread* p = FetchAndRemoveThread(cpu->CurrentThread);
 
 		p->Sleep = (uint32_t) __abs(t);
-		PendingSleepList.push_back(p);
+		cpu->PendingSleep = p;
 
 		// todo: what does this comment mean?
 		// if time is negative, we called from userspace, so don't nest interrupts.
 		YieldCPU();
+
+		if(flags & 0x200)
+			asm volatile("sti" ::: "memory");
 	}
 
 	uint64_t GetCurrentCR3()
 	{
-		if(IsFirst)
+		CPU* cpu = GetCurrentCPU();
+		if(cpu->IsFirst || !cpu->CurrentThread)
 		{
 			return Kernel::GetKernelCR3();
 		}
 		else
 		{
-			return (uint64_t) CurrentThread->Parent->VAS.PML4;
+			return (uint64_t) cpu->CurrentThread->Parent->VAS.PML4;
 		}
 	}
 
-	static int counter = 0;
+	// per-thread, so that a thread which yields with the scheduler disabled doesn't leave it disabled for everyone else.
 	void DisableScheduler()
 	{
-		counter++;
-		SchedulerEnabled = false;
+		Thread* t = GetCurrentThread();
+		if(t) t->PreemptCount++;
 	}
 
 	void EnableScheduler()
 	{
-		if(counter > 0)
-			counter--;
-
-		if(counter == 0)
-			SchedulerEnabled = true;
+		Thread* t = GetCurrentThread();
+		if(t && t->PreemptCount > 0)
+			t->PreemptCount--;
 	}
 }
 }
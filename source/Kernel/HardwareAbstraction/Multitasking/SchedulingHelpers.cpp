@@ -16,6 +16,19 @@ namespace Kernel {
 namespace HardwareAbstraction {
 namespace Multitasking
 {
+	static Spinlock ProcessListLock;
+
+	// dead, detached threads, pushed by the timer (so without locks) and freed by whoever makes the next thread.
+	static Thread* volatile ReapList = 0;
+
+	// either the thread or a detacher can get here first, so only one of them frees it.
+	static void ReleaseUserStack(Thread* t)
+	{
+		uint64_t u = __sync_lock_test_and_set(&t->UserStack, 0);
+		if(u)
+			FreeUserStack(t->Parent, u, t->UserStackSize);
+	}
+
 	extern "C" void ExitThread()
 	{
 		Log("Thread %d exited.", GetCurrentThread()->ThreadID);
@@ -34,33 +47,68 @@ namespace Multitasking
 
 	extern "C" void* Syscall_JoinThread(pthread_t tid)
 	{
-		// todo: better blocking
 		Thread* t = GetThread(tid);
 		if(t == 0)
 		{
 			SetThreadErrno(EINVAL);
+			return 0;
+		}
+
+		if(t == GetCurrentThread())
+		{
+			SetThreadErrno(EDEADLK);
+			return 0;
 		}
 
-		void* retval = 0;
+		// only one thread gets to join (and free) it, and not at all if it's detached.
+		if(__sync_fetch_and_or(&t->flags, FLAG_JOINED) & (FLAG_JOINED | FLAG_DETACHED))
+		{
+			SetThreadErrno(EINVAL);
+			return 0;
+		}
 
-		WatchThread(tid);
-		BLOCK();
+		// it stays on the sleep list until the timer marks it dead, so don't free it before then.
+		LockSpinlock(t->Exited.lock);
+		while(t->State != STATE_DEAD)
+			SleepOn(t->Exited);
 
-		retval = t->returnval;
+		UnlockSpinlock(t->Exited.lock);
 
-		delete t;
-		return (void*) retval;
+		void* retval = t->returnval;
+		Cleanup(t);
+
+		return retval;
 	}
 
 	extern "C" void Syscall_DetachThread(pthread_t tid)
 	{
-		volatile Thread* volatile t = GetThread(tid);
+		Thread* t = GetThread(tid);
 		if(t == 0)
 		{
 			SetThreadErrno(EINVAL);
+			return;
+		}
+
+		// if the timer already saw it die, it left it registered for a join that's now never coming.
+		// the two can race, but unregistering twice is harmless.
+		if(__sync_fetch_and_or(&t->flags, FLAG_DETACHED) & FLAG_JOINED)
+		{
+			SetThreadErrno(EINVAL);
+			return;
+		}
+
+		// a thread that's on its way out isn't using its user stack any more.
+		if(t->State == STATE_AWAITDEATH || t->State == STATE_DEAD)
+		{
+			if(t->Parent == GetCurrentProcess())
+				ReleaseUserStack(t);
 		}
 
-		t->flags |= FLAG_DETACHED;
+		if(t->State == STATE_DEAD)
+		{
+			UnregisterThread(t);
+			QueueReap(t);
+		}
 	}
 
 	extern "C" pthread_t Syscall_GetTID()
@@ -68,6 +116,16 @@ namespace Multitasking
 		return (pthread_t) GetCurrentThreadID();
 	}
 
+	// whether 'tid' is one of our threads, and hasn't exited (joined or not).
+	extern "C" uint64_t Syscall_ThreadAlive(pthread_t tid)
+	{
+		Thread* t = GetThread(tid);
+		if(t == 0 || t->Parent != GetCurrentProcess())
+			return 0;
+
+		return t->State != STATE_AWAITDEATH && t->State != STATE_DEAD;
+	}
+
 	void WatchThread(pthread_t tid)
 	{
 		Thread* target = GetThread(tid);
@@ -99,12 +157,19 @@ namespace Multitasking
 
 	void SetThreadErrno(int errno)
 	{
+		// both writes have to land on the same processor.
+		uint64_t flags = 0;
+		asm volatile("pushfq; pop %[fl]; cli" : [fl]"=r"(flags) :: "memory");
+
 		// set here in case we get switched
 		// the 'ol bait 'n' switch
 		GetCurrentThread()->currenterrno = errno;
 
 		// set here for return asm to find.
-		*((int64_t*) 0x2610) = errno;
+		SMP::GetCurrentCPU()->Errno = errno;
+
+		if(flags & 0x200)
+			asm volatile("sti" ::: "memory");
 	}
 
 
@@ -136,19 +201,21 @@ namespace Multitasking
 
 
 
+	// the queue of whichever processor the thread belongs to; lock it with LockRunQueue() first.
 	rde::vector<Thread*>& GetThreadList(Thread* t)
 	{
-		return GetRunQueue().queue[t->Priority];
+		RunQueue* rq = t->Processor ? t->Processor->runqueue : &GetRunQueue();
+		return rq->queue[t->Priority];
 	}
 
 	Thread* FetchAndRemoveThread(Thread* thread)
 	{
 		assert(thread);
-		GetRunQueue().lock();
+		auto& rq = LockRunQueue(thread);
 
 		GetThreadList(thread).remove(thread);
 
-		GetRunQueue().unlock();
+		rq.unlock();
 		return thread;
 	}
 
@@ -162,9 +229,9 @@ namespace Multitasking
 	void WakeForMessage(Thread* thread)
 	{
 		assert(thread);
-		GetRunQueue().lock();
+		auto& rq = LockRunQueue(thread);
 
-		auto list = GetThreadList(thread);
+		auto& list = GetThreadList(thread);
 		if(thread->State != STATE_BLOCKING && thread->State != STATE_SUSPEND)
 		{
 			assert(list.contains(thread));
@@ -172,22 +239,25 @@ namespace Multitasking
 		}
 		else
 		{
+			LockSpinlock(SleepListLock);
 			assert(SleepList.contains(thread));
 
 			// thread is blocking, shoo it out of the blocking queue.
 			SleepList.remove(thread);
+			UnlockSpinlock(SleepListLock);
+
 			thread->State = STATE_NORMAL;
-			GetThreadList(thread).push_back(thread);
+			list.push_back(thread);
 		}
 
-		GetRunQueue().unlock();
+		rq.unlock();
 		YieldCPU();
 	}
 
 
 	void Block(uint8_t purpose)
 	{
-		GetRunQueue().lock();
+		auto& rq = LockRunQueue(GetCurrentThread());
 		if(GetCurrentThread()->State == STATE_BLOCKING)
 		{
 			Log("BLOCK (%d, %d, %x)", GetCurrentThread()->ThreadID, GetCurrentThread()->State, __builtin_return_address(0));
@@ -197,10 +267,13 @@ namespace Multitasking
 		Thread* thread = FetchAndRemoveThread(GetCurrentThread());
 
 		thread->State = STATE_BLOCKING;
+
+		LockSpinlock(SleepListLock);
 		SleepList.push_back(thread);
+		UnlockSpinlock(SleepListLock);
 
 		(void) purpose;
-		GetRunQueue().unlock();
+		rq.unlock();
 		YieldCPU();
 	}
 
@@ -216,16 +289,25 @@ namespace Multitasking
 
 	void AddToQueue(Process* Proc)
 	{
+		LockSpinlock(ProcessListLock);
 		ProcessList.push_back(Proc);
+		UnlockSpinlock(ProcessListLock);
+
+		RegisterProcess(Proc);
+
 		for(auto t : Proc->Threads)
 			AddToQueue(t);
 	}
 
 	void AddToQueue(Thread* t)
 	{
-		GetRunQueue().lock();
-		GetRunQueue().queue[t->Priority].push_back(t);
-		GetRunQueue().unlock();
+		// new threads start on whoever created them (unless told otherwise), and get stolen by idle processors.
+		if(!t->Processor)
+			t->Processor = SMP::GetCurrentCPU();
+
+		auto& rq = LockRunQueue(t);
+		GetThreadList(t).push_back(t);
+		rq.unlock();
 	}
 
 	extern "C" void Syscall_TerminateCrashedThread()
@@ -274,9 +356,49 @@ namespace Multitasking
 
 		if(t->CrashState)		delete t->CrashState;
 
+		UnregisterThread(t);
+		RemoveFromWaitQueue(t);
+
+		// some processor might still be on its way off the kernel stack.
+		while(t->OnCPU)
+			asm volatile("pause");
+
+		FreeKernelStack(t->TopOfStack, t->StackSize);
+		if(t->UserStack)
+			FreeUserStack(t->Parent, t->UserStack, t->UserStackSize);
+
 		delete t;
 	}
 
+	void QueueReap(Thread* t)
+	{
+		if(__sync_fetch_and_or(&t->flags, FLAG_REAPING) & FLAG_REAPING)
+			return;
+
+		Thread* head;
+		do
+		{
+			head = ReapList;
+			t->ReapNext = head;
+
+		} while(!__sync_bool_compare_and_swap(&ReapList, head, t));
+	}
+
+	void ReapDetachedThreads()
+	{
+		Thread* t = __sync_lock_test_and_set(&ReapList, (Thread*) 0);
+		while(t)
+		{
+			Thread* next = t->ReapNext;
+
+			// the process might be gone by now; whatever user stack is left went with it (or leaks until it does).
+			t->UserStack = 0;
+			Cleanup(t);
+
+			t = next;
+		}
+	}
+
 	void Cleanup(Process* p)
 	{
 		// todo: close all file handles
@@ -285,8 +407,11 @@ namespace Multitasking
 		assert(p);
 		assert(p->Threads.size() == 0);
 
+		UnregisterProcess(p);
+
 		// close all files
 		Filesystems::CloseAll(p);
+		IPC::CloseChannels(p);
 
 
 		// destroy its address space
@@ -302,58 +427,73 @@ namespace Multitasking
 	// direct
 	void Suspend(Thread* p)
 	{
-		GetRunQueue().lock();
-		if(p && p->State == STATE_NORMAL)
+		assert(p);
+		auto& rq = LockRunQueue(p);
+		if(p->State == STATE_NORMAL)
 		{
 			Log("Suspended thread %d, name: %s", p->ThreadID, p->Parent->Name);
 
 			// GetThreadList(p)->RemoveAt((uint64_t) GetThreadList(p)->IndexOf(p));
 
-			assert(p);
 			GetThreadList(p).remove(p);
+
+			LockSpinlock(SleepListLock);
 			SleepList.push_back(p);
+			UnlockSpinlock(SleepListLock);
+
 			p->State = STATE_SUSPEND;
 		}
 
-		GetRunQueue().unlock();
+		rq.unlock();
 	}
 
 	void Resume(Thread* p)
 	{
-		GetRunQueue().lock();
-		if(p && p->State == STATE_SUSPEND)
+		assert(p);
+		auto& rq = LockRunQueue(p);
+		if(p->State == STATE_SUSPEND)
 		{
 			Log("Resumed thread %d, name: %s", p->ThreadID, p->Parent->Name);
 
 			p->Sleep = 0;
 			p->State = STATE_NORMAL;
 		}
-		GetRunQueue().unlock();
+		rq.unlock();
 	}
 
 	void Kill(Thread* p)
 	{
 		if(p && p->State == STATE_NORMAL)
 		{
-			GetRunQueue().lock();
+			auto& rq = LockRunQueue(p);
 			p->State = STATE_AWAITDEATH;
 
 			// remove the thread from its parent process's list.
 			Process* par = p->Parent;
+			LockSpinlock(par->ThreadsLock);
 			par->Threads.remove(p);
+			bool last = par->Threads.empty();
+			UnlockSpinlock(par->ThreadsLock);
 
 			GetThreadList(p).remove(p);
+
+			LockSpinlock(SleepListLock);
 			SleepList.push_back(p);
+			UnlockSpinlock(SleepListLock);
+
+			rq.unlock();
 
+			// a detached thread that's exiting won't touch its user stack again, and nobody's going to join it.
+			if(!last && p == GetCurrentThread() && (p->flags & FLAG_DETACHED))
+				ReleaseUserStack(p);
 
-			if(!(par->Flags & FLAG_DYING) && par->Threads.empty())
+			// not under the queue lock -- tearing down the address space can take a while, and might sleep.
+			if(!(par->Flags & FLAG_DYING) && last)
 			{
 				Log("Killed all threads of process %s, cleaning up", par->Name);
 				Cleanup(par);
 			}
 
-			GetRunQueue().unlock();
-
 
 			// wake up the watching threads.
 			for(size_t i = 0, s = p->watchers.size(); i < s; i++)
@@ -367,10 +507,15 @@ namespace Multitasking
 		}
 		else if(p && (p->State == STATE_BLOCKING || p->State == STATE_SUSPEND))
 		{
+			LockSpinlock(SleepListLock);
 			assert(SleepList.contains(p));
 			p->State = STATE_AWAITDEATH;
+			UnlockSpinlock(SleepListLock);
+
 			Process* par = p->Parent;
+			LockSpinlock(par->ThreadsLock);
 			par->Threads.remove(p);
+			UnlockSpinlock(par->ThreadsLock);
 		}
 		else
 		{
@@ -385,16 +530,27 @@ namespace Multitasking
 
 
 
-	// by process
+	// by process.
+	// these work on a copy of the thread list: the per-thread calls take run queue locks, which nest outside
+	// ThreadsLock, and killing a thread takes it off the list we'd be walking.
+	static rde::vector<Thread*> CopyThreads(Process* p)
+	{
+		LockSpinlock(p->ThreadsLock);
+		rde::vector<Thread*> ret = p->Threads;
+		UnlockSpinlock(p->ThreadsLock);
+
+		return ret;
+	}
+
 	void Suspend(Process* p)
 	{
-		for(auto t : p->Threads)
+		for(auto t : CopyThreads(p))
 			Suspend(t);
 	}
 
 	void Resume(Process* p)
 	{
-		for(auto t : p->Threads)
+		for(auto t : CopyThreads(p))
 			Resume(t);
 	}
 
@@ -408,7 +564,7 @@ namespace Multitasking
 		// p->Flags |= FLAG_DYING;
 
 		// the flag stops Kill(thread) from calling Cleanup() on the parent process.
-		for(auto t : p->Threads)
+		for(auto t : CopyThreads(p))
 			Kill(t);
 
 		// Cleanup(p);
@@ -422,43 +578,6 @@ namespace Multitasking
 
 		return false;
 	}
-
-	Process* GetProcess(pid_t pid)
-	{
-		for(auto p : ProcessList)
-		{
-			if(p->ProcessID == pid)
-				return p;
-		}
-
-		return 0;
-	}
-
-	Thread* GetThread(pid_t tid)
-	{
-		auto& runqueue = GetRunQueue();
-		runqueue.lock();
-
-		Thread* ret = 0;
-
-		for(int i = 0; i < NUM_PRIO; i++)
-		{
-			for(auto t : runqueue.queue[i])
-			{
-				if(t->ThreadID == tid)
-					ret = t;
-			}
-		}
-
-		for(auto t : SleepList)
-		{
-			if(t->ThreadID == tid)
-				ret = t;
-		}
-
-		runqueue.unlock();
-		return ret;
-	}
 }
 }
 }
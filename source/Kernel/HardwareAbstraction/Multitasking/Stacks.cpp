@@ -0,0 +1,133 @@
+// Stacks.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+
+#include <Kernel.hpp>
+#include <HardwareAbstraction/MemoryManager.hpp>
+
+using namespace Kernel::HardwareAbstraction::MemoryManager;
+
+// kernel stacks live in their own window in the shared top half, so they're valid in every address space
+// (and fork doesn't have to copy them). they're mapped up front -- we can't take a page fault on the stack the
+// fault would be pushed onto -- but each one sits on an unmapped guard page, so overflowing it is a double fault
+// instead of silent corruption. since every page is real, they're kept small: 16k for a user thread's syscalls,
+// 64k for kernel threads.
+
+// freed kernel stacks keep their pages, and go on a free list for their size; making a thread is usually just a pop.
+// the free list is threaded through the stacks themselves.
+
+// user stacks are demand-paged regions in the process' address space, with a guard page at the bottom.
+// only the top page (which holds the return address into ExitThread_Userspace) exists to begin with.
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Multitasking
+{
+	#define MaxCachedStacks			64
+
+	struct StackCache
+	{
+		uint64_t size;
+		uint64_t free;		// base of the first cached stack, which holds the base of the next.
+		uint64_t count;
+	};
+
+	static StackCache Caches[] = { { KernelStackSize, 0, 0 }, { KernelThreadStackSize, 0, 0 } };
+	static uint64_t NextStackSlot = KernelStackAddress;
+	static Spinlock StackLock;
+
+	static StackCache* GetCache(uint64_t size)
+	{
+		for(auto& c : Caches)
+		{
+			if(c.size == size)
+				return &c;
+		}
+
+		HALT("No stack cache for that size");
+		return 0;
+	}
+
+	uint64_t AllocateKernelStack(uint64_t size)
+	{
+		StackCache* cache = GetCache(size);
+		uint64_t base = 0;
+		bool fresh = false;
+
+		LockSpinlock(StackLock);
+		if(cache->free)
+		{
+			base = cache->free;
+			cache->free = *((uint64_t*) base);
+			cache->count--;
+		}
+		else
+		{
+			// guard page, then the stack. slots are never handed back, but the window is big enough not to care.
+			base = NextStackSlot + 0x1000;
+			NextStackSlot += size + 0x1000;
+			fresh = true;
+		}
+		UnlockSpinlock(StackLock);
+
+		if(fresh)
+		{
+			assert(base + size <= KernelStackAddress + KernelStackWindow);
+
+			// one page at a time; there's no need for them to be contiguous.
+			for(uint64_t i = 0; i < size / 0x1000; i++)
+				Virtual::MapAddress(base + (i * 0x1000), Physical::AllocatePage(), 0x03);
+		}
+
+		return base + size;
+	}
+
+	void FreeKernelStack(uint64_t top, uint64_t size)
+	{
+		StackCache* cache = GetCache(size);
+		uint64_t base = top - size;
+
+		LockSpinlock(StackLock);
+		if(cache->count < MaxCachedStacks)
+		{
+			*((uint64_t*) base) = cache->free;
+			cache->free = base;
+			cache->count++;
+
+			UnlockSpinlock(StackLock);
+			return;
+		}
+		UnlockSpinlock(StackLock);
+
+		// cache is full, so give the pages back.
+		for(uint64_t i = 0; i < size / 0x1000; i++)
+		{
+			uint64_t va = base + (i * 0x1000);
+			uint64_t pte = Virtual::LookupMapping(va, (Virtual::PageMapStructure*) GetKernelCR3());
+
+			Virtual::UnmapAddress(va);
+			Physical::FreePage(pte & I_AlignMask);
+		}
+	}
+
+	uint64_t AllocateUserStack(Process* p, uint64_t size)
+	{
+		assert(p);
+		assert(size > 0 && !(size & 0xFFF));
+
+		uint64_t guard = Virtual::ReserveRegion((size / 0x1000) + 1, 0x07, &p->VAS);
+		uint64_t base = guard + 0x1000;
+
+		Virtual::PopulatePage(base + size - 0x1000, &p->VAS);
+		return base;
+	}
+
+	void FreeUserStack(Process* p, uint64_t base, uint64_t size)
+	{
+		assert(p);
+		Virtual::ReleaseRegion(base - 0x1000, (size / 0x1000) + 1, &p->VAS);
+	}
+}
+}
+}
@@ -21,6 +21,9 @@ namespace Multitasking
 	uint64_t NumThreads = 0;
 	uint64_t NumProcesses = 0;
 
+	// NumThreads goes down when threads die, so ids come from here and are never reused.
+	static uint64_t NextThreadID = 0;
+
 	static uint64_t* SetupThreadRegs(Thread* thread, uint64_t* stack, Thread_attr* attr)
 	{
 		(void) thread;
@@ -46,17 +49,17 @@ namespace Multitasking
 		return stack;
 	}
 
-	static void SetupStackThread_Kern(Thread* thread, uint64_t u, uint64_t f, Thread_attr* attr)
+	static void SetupStackThread_Kern(Thread* thread, uint64_t f, Thread_attr* attr)
 	{
-		uint64_t* stack = (uint64_t*) thread->StackPointer;
-
-		// need to insert a return statement here that will call the killthread function.
-		uint64_t* usp = (uint64_t*) (u + DefaultRing3StackSize - 8);
+		// kernel threads never leave ring 0, so they run on the kernel stack itself.
+		// the return address into ExitThread goes at the very top, and the iret frame below it.
+		uint64_t* usp = (uint64_t*) (thread->TopOfStack - 8);
 		*usp = (uint64_t) Multitasking::ExitThread;
 
-		// kernel thread
+		uint64_t* stack = usp;
+
 		*--stack = 0x10;															// SS (-8)
-		*--stack = u + DefaultRing3StackSize - 8;									// User stack pointer (-16)
+		*--stack = (uint64_t) usp;													// Stack pointer (-16)
 		*--stack = 0x202;															// RFLAGS (-24)
 		*--stack = 0x08;															// CS (-32)
 		*--stack = (uint64_t) f;													// RIP (-40)
@@ -64,57 +67,32 @@ namespace Multitasking
 		thread->StackPointer = (uint64_t) SetupThreadRegs(thread, stack, attr);
 	}
 
-	static void SetupStackThread_Proc(Thread* thread, uint64_t u, uint64_t physu, uint64_t physks, uint64_t stacksize, uint64_t f, Thread_attr* attr)
+	static void SetupStackThread_Proc(Thread* thread, uint64_t u, uint64_t stacksize, uint64_t f, Thread_attr* attr)
 	{
-		uint64_t* stack = (uint64_t*) thread->StackPointer;
-
-		if(stacksize == 0)
-			stacksize = DefaultRing3StackSize;
-
 		// need to insert a return statement here that will call the killthread function.
 		// it's kinda dangerous, because we're jumping directly to kernel code
-		uint64_t* usp = (uint64_t*) (u + stacksize - 8);
-
-		// probably not in the same address space anyway
-		uint64_t oldstack = (uint64_t) stack;
-		physks += (stacksize - 0x1000);
+		uint64_t usp = u + stacksize - 8;
 
 		{
-			Virtual::MapAddress(TemporaryVirtualMapping, (physu + stacksize - 8) & I_AlignMask, 0x07);
+			// the top page of the user stack is the only one that exists so far, and it's in the other address space.
+			uint64_t physu = Virtual::GetVirtualPhysical(usp, &thread->Parent->VAS);
+			assert(physu);
 
-			uint64_t uspv = (uint64_t) usp;
-			uint64_t* tmpusp = (uint64_t*) (TemporaryVirtualMapping + (uspv - (uspv & I_AlignMask)));
-
-			*tmpusp = (uint64_t) Multitasking::ExitThread_Userspace;
-			Virtual::UnmapAddress(TemporaryVirtualMapping);
-
-
-			Virtual::MapAddress(TemporaryVirtualMapping + oldstack - 0x1000, physks, 0x07);
-			stack = (uint64_t*) (TemporaryVirtualMapping + (uint64_t) oldstack);
+			*((uint64_t*) Virtual::PhysToDirect(physu)) = (uint64_t) Multitasking::ExitThread_Userspace;
 		}
 
 		{
+			// the kernel stack is in the shared half, so we can write it directly.
+			uint64_t* stack = (uint64_t*) thread->StackPointer;
+
 			// user thread (always)
 			*--stack = 0x23;															// SS
-			*--stack = u + stacksize - 8;												// User stack pointer
+			*--stack = usp;																// User stack pointer
 			*--stack = 0x202;															// RFLAGS
 			*--stack = 0x1B;															// CS
 			*--stack = (uint64_t) f;													// RIP (-40)
 
-			thread->StackPointer = (uint64_t) SetupThreadRegs(thread, stack, attr) - TemporaryVirtualMapping;
-			Virtual::UnmapAddress(TemporaryVirtualMapping + oldstack - 0x1000);
-		}
-	}
-
-	static void SetupStackThread(Thread* thread, uint64_t u, uint64_t physu, uint64_t physks, uint64_t stacksz, uint64_t f, Thread_attr* attr)
-	{
-		if(thread->Parent == Kernel::KernelProcess)
-		{
-			SetupStackThread_Kern(thread, u, f, attr);
-		}
-		else
-		{
-			SetupStackThread_Proc(thread, u, physu, physks, stacksz, f, attr);
+			thread->StackPointer = (uint64_t) SetupThreadRegs(thread, stack, attr);
 		}
 	}
 
@@ -138,30 +116,13 @@ namespace Multitasking
 
 	Thread* CreateThread(Process* Parent, void (*Function)(), Thread_attr* oattr)
 	{
-		DisableScheduler();
+		// dead detached threads give their kernel stacks back to the cache first, so we can take one.
+		ReapDetachedThreads();
+
 		Thread* thread = new Thread();
 		Thread_attr* attr = 0;
 
-		// allocate kernel stack.
-		uint64_t k = 0;
-		uint64_t physks = 0;
-		if((uint64_t) Parent->VAS.PML4 != GetKernelCR3())
-		{
-			auto pk = Physical::AllocatePage(DefaultRing3StackSize / 0x1000);
-			k = Virtual::AllocateVirtual(DefaultRing3StackSize / 0x1000, 0, &Parent->VAS, pk);
-
-			Virtual::MapRegion(k, pk, DefaultRing3StackSize / 0x1000, 0x07, Parent->VAS.PML4);
-			physks = pk;
-
-		}
-		else
-		{
-			k = Virtual::AllocatePage(DefaultRing3StackSize / 0x1000);
-			physks = Virtual::GetVirtualPhysical(k);
-
-			Log("kernel stack for tid %d is at %x, %x bytes", NumThreads, physks, DefaultRing3StackSize);
-		}
-
+		bool kernthread = (Parent == Kernel::KernelProcess);
 
 		// check.
 		if(oattr == nullptr)
@@ -174,31 +135,35 @@ namespace Multitasking
 			attr = oattr;
 		}
 
-		// allocate user stack.
+		// kernel stacks come from the cache, user stacks are reserved and filled in as they're touched.
+		uint64_t kstacksz = kernthread ? KernelThreadStackSize : KernelStackSize;
+		uint64_t k = AllocateKernelStack(kstacksz);
+
 		uint64_t u = 0;
 		uint64_t ustacksz = 0;
-		uint64_t physu = 0;
-		if(attr->stackptr == 0 || attr->stacksize == 0)
+		if(!kernthread)
 		{
-			physu = Physical::AllocatePage(DefaultRing3StackSize / 0x1000);
-			u = Virtual::AllocateVirtual(DefaultRing3StackSize / 0x1000, 0, &Parent->VAS, physu);
-			ustacksz = DefaultRing3StackSize;
-
-			Virtual::MapRegion(u, physu, DefaultRing3StackSize / 0x1000, 0x07, Parent->VAS.PML4);
-		}
-		else
-		{
-			u = attr->stackptr;
-			ustacksz = attr->stacksize;
-			HALT("Unsupported");
+			if(attr->stackptr == 0 || attr->stacksize == 0)
+			{
+				ustacksz = DefaultRing3StackSize;
+				u = AllocateUserStack(Parent, ustacksz);
+			}
+			else
+			{
+				u = attr->stackptr;
+				ustacksz = attr->stacksize;
+				HALT("Unsupported");
+			}
 		}
 
-		thread->StackSize			= DefaultRing3StackSize;
-		thread->TopOfStack			= k + ustacksz;
+		thread->StackSize			= kstacksz;
+		thread->TopOfStack			= k;
 		thread->StackPointer		= thread->TopOfStack;
+		thread->UserStack			= u;
+		thread->UserStackSize		= ustacksz;
 		thread->funcpointer			= Function;
 		thread->State				= STATE_NORMAL;
-		thread->ThreadID			= (pid_t) NumThreads, NumThreads++;
+		thread->ThreadID			= (pid_t) __sync_fetch_and_add(&NextThreadID, 1);
 		thread->Parent				= Parent;
 		thread->Priority			= attr->priority;
 		thread->ExecutionTime		= 0;
@@ -207,20 +172,26 @@ namespace Multitasking
 		thread->flags				= Parent->Flags;
 		thread->currenterrno		= 0;
 
-		SetupStackThread(thread, u, physu, physks, ustacksz, (uint64_t) Function, attr);
+		if(kernthread)	SetupStackThread_Kern(thread, (uint64_t) Function, attr);
+		else			SetupStackThread_Proc(thread, u, ustacksz, (uint64_t) Function, attr);
+
+		LockSpinlock(Parent->ThreadsLock);
 		Parent->Threads.push_back(thread);
+		UnlockSpinlock(Parent->ThreadsLock);
+
+		__sync_fetch_and_add(&NumThreads, 1);
+		RegisterThread(thread);
 
 		if(FirstProc)
 		{
 			// set tss
-			asm volatile("movq %[stacktop], 0x2504" :: [stacktop]"r"(thread->TopOfStack));
+			SMP::GetCurrentCPU()->tss->rsp0 = thread->TopOfStack;
 		}
 
 		Log("Created Thread: Parent: %s, TID: %d", Parent->Name, thread->ThreadID);
 		if(oattr == nullptr)
 			delete attr;
 
-		EnableScheduler();
 		return thread;
 	}
 
@@ -242,7 +213,6 @@ namespace Multitasking
 	Process* CreateProcess(const char name[64], uint8_t Flags, uint64_t tlssize, void (*Function)(), uint8_t Priority, void* a1, void* a2, void* a3, void* a4, void* a5, void* a6)
 	{
 		using namespace Kernel::HardwareAbstraction::MemoryManager::Virtual;
-		DisableScheduler();
 
 		PageMapStructure* PML4 = FirstProc ? (PageMapStructure*) (GetKernelCR3()) : (PageMapStructure*) Virtual::CreateVAS();
 		Process* process = new Process(PML4);
@@ -253,7 +223,7 @@ namespace Multitasking
 			tlssize = 8;
 
 		process->Flags					= Flags;
-		process->ProcessID				= (pid_t) NumProcesses;
+		process->ProcessID				= (pid_t) __sync_fetch_and_add(&NumProcesses, 1);
 		process->VAS					= Virtual::VirtualAddressSpace(PML4);
 		process->SignalHandlers			= new sighandler_t[__SIGCOUNT];
 		process->tlssize				= tlssize;
@@ -274,7 +244,6 @@ namespace Multitasking
 
 		String::Copy(process->Name, name);
 
-		NumProcesses++;
 		auto k = CreateThread(process, Function, Priority, a1, a2, a3, a4, a5, a6);
 		(void) k;
 
@@ -292,7 +261,6 @@ namespace Multitasking
 		}
 
 		Log("Creating new process in VAS (%s): CR3(phys): %x, PID %d", name, (uint64_t) PML4, process->ProcessID);
-		EnableScheduler();
 		return process;
 	}
 
@@ -300,14 +268,21 @@ namespace Multitasking
 	Thread* CloneThread(Thread* orig)
 	{
 		Thread* ret			= new Thread();
-		ret->ThreadID		= (pid_t) NumThreads, NumThreads++;
-		ret->StackPointer	= orig->StackPointer;
-		ret->TopOfStack		= orig->TopOfStack;
+		ret->ThreadID		= (pid_t) __sync_fetch_and_add(&NextThreadID, 1);
+
+		// kernel stacks aren't part of the address space, so the clone needs its own.
+		// the caller fills in the register frame that sits at the top of it.
 		ret->StackSize		= orig->StackSize;
+		ret->TopOfStack		= AllocateKernelStack(orig->StackSize);
+		ret->StackPointer	= ret->TopOfStack - 160;
+
+		// the user stack is at the same place in the copied address space.
+		ret->UserStack		= orig->UserStack;
+		ret->UserStackSize	= orig->UserStackSize;
 		ret->State			= orig->State;
 		ret->Sleep			= orig->Sleep;
 		ret->Priority		= orig->Priority;
-		ret->flags			= orig->flags;
+		ret->flags			= orig->flags & ~FLAG_JOINED;
 		ret->ExecutionTime	= orig->ExecutionTime;
 		ret->Parent			= orig->Parent;
 		ret->currenterrno	= orig->currenterrno;
@@ -318,6 +293,11 @@ namespace Multitasking
 
 		Memory::Copy(ret->tlsptr, orig->tlsptr, orig->Parent->tlssize);
 
+		// whatever libcslot pointed at belongs to the original thread, not this one.
+		ret->libcslot		= 0;
+
+		__sync_fetch_and_add(&NumThreads, 1);
+		RegisterThread(ret);
 		return ret;
 	}
 
@@ -332,7 +312,6 @@ namespace Multitasking
 	{
 		(void) attr;
 
-		DisableScheduler();
 		using namespace Kernel::HardwareAbstraction::MemoryManager::Virtual;
 
 		Thread* curthr = GetCurrentThread();
@@ -341,7 +320,7 @@ namespace Multitasking
 
 		proc->Parent				= Multitasking::GetCurrentProcess();
 		proc->Flags					= proc->Parent->Flags;
-		proc->ProcessID				= (pid_t) NumProcesses;
+		proc->ProcessID				= (pid_t) __sync_fetch_and_add(&NumProcesses, 1);
 		proc->VAS					= Virtual::VirtualAddressSpace(PML4);
 		proc->SignalHandlers		= new sighandler_t[__SIGCOUNT];
 		proc->tlssize				= proc->Parent->tlssize;
@@ -357,7 +336,6 @@ namespace Multitasking
 		Virtual::CopyVAS(&proc->Parent->VAS, &proc->VAS);
 		String::Copy(proc->Name, name);
 
-		NumProcesses++;
 
 		// copy the thread.
 		Thread* newt = CloneThread(curthr);
@@ -378,53 +356,16 @@ namespace Multitasking
 		OpenFile(&proc->iocontext, "/dev/stderr", 0);
 
 		Log("Forking process from PID %d, new PID %d, CR3 %x", proc->Parent->ProcessID, proc->ProcessID, proc->VAS.PML4);
-
-		EnableScheduler();
 		return proc;
 	}
 
 
 
-	// todo: zero reentrancy-safe.
-	static uint64_t saved_rip = 0;
-	static uint64_t saved_ss = 0;
-	static uint64_t saved_cs = 0;
-	static uint64_t saved_rfl = 0;
-	static uint64_t saved_usp = 0;
-
-	static ThreadRegisterState_type saved_registers;
+	// the syscall stub hands us its register frame, which stays put on the thread's kernel stack until the syscall returns.
+	// remember where it is, so fork can copy it (whichever processor it happens to be on by then).
 	extern "C" void __syscall_internal_save_registers(uint64_t rsp)
 	{
-		uint64_t* stack = (uint64_t*) rsp;
-
-		saved_registers.rdi	= *stack++;
-		saved_registers.rsi	= *stack++;
-		saved_registers.rbp	= *stack++;
-
-		saved_registers.rax	= *stack++;
-		saved_registers.rbx	= *stack++;
-		saved_registers.rcx	= *stack++;
-		saved_registers.rdx	= *stack++;
-
-		saved_registers.r8	= *stack++;
-		saved_registers.r9	= *stack++;
-		saved_registers.r10	= *stack++;
-		saved_registers.r11	= *stack++;
-		saved_registers.r12	= *stack++;
-		saved_registers.r13	= *stack++;
-		saved_registers.r14	= *stack++;
-		saved_registers.r15	= *stack++;
-
-		// skip rbp pushed.
-		stack++;
-
-		saved_rip			= *stack++;
-		saved_cs			= *stack++;
-		saved_rfl			= *stack++;
-		saved_usp			= *stack++;
-		saved_ss			= *stack++;
-
-		// Log("%p / %p / %p / %p / %p", saved_rip, saved_cs, saved_rfl, saved_usp, saved_ss);
+		GetCurrentThread()->SyscallFrame = rsp;
 	}
 
 	extern "C" int64_t Syscall_ForkProcess()
@@ -432,52 +373,39 @@ namespace Multitasking
 		Process* cur = GetCurrentProcess();
 		Process* proc = ForkProcess(cur->Name, 0);
 
+		// rdi, rsi, rbp, rax, rbx, rcx, rdx, r8 - r15, then the pushed rbp, then the interrupt frame.
+		uint64_t* saved = (uint64_t*) GetCurrentThread()->SyscallFrame;
+		uint64_t* frame = saved + 16;
+
 		// we access the saved registers here.
 		// proc has the things set up, but we need to retroactively screw with the registers on stack.
 		{
-			// get a temporary mapping.
-			uint64_t begin = proc->Threads.front()->StackPointer & ~((uint64_t) 0xFFF);
-			uint64_t sz = 1;
-
-			if(proc->Threads.front()->StackPointer + 160 > begin + 0x1000)
-				sz = 2;
-
-			// map... hopefully.
-			uint64_t phys = Virtual::GetVirtualPhysical(begin, &proc->VAS);
-			uint64_t virt = Virtual::AllocateVirtual(sz);
-
-			Virtual::MapRegion(virt, phys, sz, 0x07);
-
-			uint64_t stackptr = virt + (proc->Threads.front()->StackPointer - begin);
-
-			uint64_t* stack = (uint64_t*) (stackptr + 160);
-
-			*--stack = saved_ss;
-			*--stack = saved_usp;
-			*--stack = saved_rfl;
-			*--stack = saved_cs;
-			*--stack = saved_rip;
-
-			*--stack = saved_registers.r15;		// R15 (-48)
-			*--stack = saved_registers.r14;		// R14 (-56)
-			*--stack = saved_registers.r13;		// R13 (-64)
-			*--stack = saved_registers.r12;		// R12 (-72)
-			*--stack = saved_registers.r11;		// R11 (-80)
-			*--stack = saved_registers.r10;		// R10 (-88)
-			*--stack = saved_registers.r9;		// R9 (-96)
-			*--stack = saved_registers.r8;		// R8 (-104)
-
-			*--stack = saved_registers.rdx;		// RDX (-112)
-			*--stack = saved_registers.rcx;		// RCX (-120)
-			*--stack = saved_registers.rbx;		// RBX (-128)
-			*--stack = 0;						// RAX (-136)
-
-			*--stack = saved_registers.rbp;		// RBP (-144)
-			*--stack = saved_registers.rsi;		// RSI (-152)
-			*--stack = saved_registers.rdi;		// RDI (-160)
-
-			Virtual::UnmapRegion(virt, sz);
-			Virtual::FreeVirtual(virt, sz);
+			// the child's kernel stack is in the shared half, so no need for a temporary mapping.
+			uint64_t* stack = (uint64_t*) (proc->Threads.front()->StackPointer + 160);
+
+			*--stack = frame[4];		// SS
+			*--stack = frame[3];		// User stack pointer
+			*--stack = frame[2];		// RFLAGS
+			*--stack = frame[1];		// CS
+			*--stack = frame[0];		// RIP
+
+			*--stack = saved[14];		// R15 (-48)
+			*--stack = saved[13];		// R14 (-56)
+			*--stack = saved[12];		// R13 (-64)
+			*--stack = saved[11];		// R12 (-72)
+			*--stack = saved[10];		// R11 (-80)
+			*--stack = saved[9];		// R10 (-88)
+			*--stack = saved[8];		// R9 (-96)
+			*--stack = saved[7];		// R8 (-104)
+
+			*--stack = saved[6];		// RDX (-112)
+			*--stack = saved[5];		// RCX (-120)
+			*--stack = saved[4];		// RBX (-128)
+			*--stack = 0;				// RAX (-136)
+
+			*--stack = saved[2];		// RBP (-144)
+			*--stack = saved[1];		// RSI (-152)
+			*--stack = saved[0];		// RDI (-160)
 		}
 		// done.
 
@@ -8,6 +8,9 @@
 .global TaskSwitcherCoOp
 .type TaskSwitcherCoOp, @function
 
+.global LocalTimerInterrupt
+.type LocalTimerInterrupt, @function
+
 .section .text
 .code64
 
@@ -36,17 +39,15 @@
 		iretq
 
 
+	each entry point has its own path in, since a global 'which one was it' flag doesn't work with
+	more than one processor. per-processor state (%gs) is only valid after the swapgs, if we came from ring 3.
 */
 
 TaskSwitcherCoOp:
-	movq $1, IsYieldMode
-	jmp StageOne
-
-ProcessTimerInterrupt:
-	movq $0, IsYieldMode
-	jmp StageOne
-
-StageOne:
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	push %r15
 	push %r14
 	push %r13
@@ -63,11 +64,6 @@ StageOne:
 	push %rsi
 	push %rdi
 
-	// this is where we diverge.
-	cmpq $0, IsYieldMode
-	je CallTimer
-
-
 	// Load the kernel data segment
 	mov $0x10, %ax
 	mov %ax, %ds
@@ -77,30 +73,107 @@ StageOne:
 
 	call SwitchProcess
 	movq %rax, %rsp
+	jmp StageTwo
+
+
+ProcessTimerInterrupt:
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
+	push %r15
+	push %r14
+	push %r13
+	push %r12
+	push %r11
+	push %r10
+	push %r9
+	push %r8
+	push %rdx
+	push %rcx
+	push %rbx
+	push %rax
+	push %rbp
+	push %rsi
+	push %rdi
 
+	mov %rsp, %rdi
+	call ProcessTimerInterrupt_C
 
+	// check if we need to switch
+	push %rax
+
+	mov $0x20, %al
+	outb %al, $0x20
+
+	pop %rax
+	jmp CheckSwitch
+
+
+LocalTimerInterrupt:
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
+	push %r15
+	push %r14
+	push %r13
+	push %r12
+	push %r11
+	push %r10
+	push %r9
+	push %r8
+	push %rdx
+	push %rcx
+	push %rbx
+	push %rax
+	push %rbp
+	push %rsi
+	push %rdi
+
+	// this one sends its own (local apic) EOI.
+	mov %rsp, %rdi
+	call ProcessLocalTimerInterrupt_C
+	jmp CheckSwitch
+
+
+CheckSwitch:
+	cmpq $0, %rax
+
+	// if we don't, pop and iret.
+	je PopReg
+
+
+	mov %rax, %rsp
+	// else, we need to.
+	jmp StageTwo
 
 
 
 StageTwo:
-	cmpq $0xFADE, 0x2608
+	// %gs:16 is CPU::ReturnToUser
+	cmpq $0xFADE, %gs:16
 	je DoRing3
 
 
 
 ChangeCR3:
-	cmpq $0x0, 0x2600
-	je PopReg
+	// %gs:8 is CPU::NewCR3
+	cmpq $0x0, %gs:8
+	je FinishReg
 
 
 	// if not zero, do a CR3 switch.
-	movq 0x2600, %rax
+	movq %gs:8, %rax
 	mov %rax, %cr3
-	jmp PopReg
+	jmp FinishReg
+
 
+FinishReg:
+	// we're off the old thread's stack now, so other processors may run it.
+	call FinishSwitch
 
 PopReg:
-	call VerifySchedule
 	pop %rdi
 	pop %rsi
 	pop %rbp
@@ -116,6 +189,11 @@ PopReg:
 	pop %r13
 	pop %r14
 	pop %r15
+
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	iretq
 
 
@@ -126,39 +204,3 @@ DoRing3:
 	mov %rbp, %es
 
 	jmp ChangeCR3
-
-
-CallTimer:
-	mov %rsp, %rdi
-	call ProcessTimerInterrupt_C
-
-	// check if we need to switch
-	push %rax
-
-	mov $0x20, %al
-	outb %al, $0x20
-
-	pop %rax
-
-
-	cmpq $0, %rax
-
-	// if we don't, pop and iret.
-	je PopReg
-
-
-	mov %rax, %rsp
-	// else, we need to.
-	jmp StageTwo
-
-
-
-
-
-
-.section .data
-IsYieldMode:
-	.quad		0
-
-
-
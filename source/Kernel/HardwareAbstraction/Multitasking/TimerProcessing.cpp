@@ -6,6 +6,7 @@
 #include <Kernel.hpp>
 #include <HardwareAbstraction/Devices/RTC.hpp>
 #include <HardwareAbstraction/Devices/SerialPort.hpp>
+#include <HardwareAbstraction/Devices/APIC.hpp>
 #include <String.hpp>
 #include <math.h>
 
@@ -23,26 +24,50 @@ namespace Kernel
 		static const uint64_t SchedulerTickRate = 10;
 		static const uint64_t ElapsedTicksPerCall = GlobalMilliseconds / GlobalTickRate;
 
-		extern "C" uint64_t ProcessTimerInterrupt_C(uint64_t context)
+		// threads we can't put back right now (their queue was busy) wait here for the next tick.
+		#define MaxWakesPerTick		32
+
+		static void ProcessSleepList()
 		{
-			TimerCounter += (GlobalMilliseconds / GlobalTickRate);
-			ThreadTime += (GlobalMilliseconds / GlobalTickRate);
+			Thread* woken[MaxWakesPerTick];
+			uint64_t numWoken = 0;
+
+			Thread* reaped[MaxWakesPerTick];
+			uint64_t numReaped = 0;
+
+			// we're in an interrupt, so never wait on the lock -- whoever has it might be the thread we interrupted.
+			if(!TryLockSpinlock(SleepListLock))
+				return;
 
 			for(uint64_t l = SleepList.size(), g = 0; g < l; g++)
 			{
 				Thread* m = SleepList.front();
 				SleepList.erase(SleepList.begin());
 
-				if(m->State == STATE_SUSPEND || m->State == STATE_BLOCKING)
+				if(m->State == STATE_BLOCKING && m->WakeDeadline && TimerCounter >= m->WakeDeadline && numWoken < MaxWakesPerTick)
+				{
+					// a timed wait ran out; SleepOn() takes it off the wait queue.
+					m->State = STATE_NORMAL;
+					m->WakeDeadline = 0;
+					m->Sleep = 0;
+
+					woken[numWoken++] = m;
+					continue;
+				}
+				else if(m->State == STATE_SUSPEND || m->State == STATE_BLOCKING)
 				{
 					SleepList.push_back(m);
 					continue;
 				}
+				else if(m->State == STATE_AWAITDEATH && numReaped < MaxWakesPerTick)
+				{
+					// off the list now, marked dead below.
+					reaped[numReaped++] = m;
+					continue;
+				}
 				else if(m->State == STATE_AWAITDEATH)
 				{
-					// don't delete.
-					m->State = STATE_DEAD;
-					NumThreads--;
+					SleepList.push_back(m);
 					continue;
 				}
 
@@ -56,16 +81,81 @@ namespace Kernel
 
 
 
-				if(m->Sleep == 0)
+				if(m->Sleep == 0 && numWoken < MaxWakesPerTick)
+				{
+					woken[numWoken++] = m;
+				}
+				else
+				{
+					SleepList.push_back(m);
+				}
+			}
+
+			UnlockSpinlock(SleepListLock);
+
+			// second half: the run queues are locked before the sleep list everywhere else, so do this without it.
+			for(uint64_t i = 0; i < numReaped; i++)
+			{
+				Thread* m = reaped[i];
+
+				// a joiner checks the state with this held, so it can't see it dead (and free it) until we let go.
+				if(!TryLockSpinlock(m->Exited.lock))
+				{
+					LockSpinlock(SleepListLock);
+					SleepList.push_back(m);
+					UnlockSpinlock(SleepListLock);
+					continue;
+				}
+
+				// don't delete; and unless nobody is ever going to join it, keep it findable until someone does.
+				m->State = STATE_DEAD;
+				__sync_fetch_and_sub(&NumThreads, 1);
+
+				__sync_synchronize();
+				if(m->flags & FLAG_DETACHED)
+				{
+					UnregisterThread(m);
+					QueueReap(m);
+				}
+
+				WakeAll(m->Exited);
+				UnlockSpinlock(m->Exited.lock);
+			}
+
+			for(uint64_t i = 0; i < numWoken; i++)
+			{
+				Thread* m = woken[i];
+				RunQueue* rq = m->Processor ? m->Processor->runqueue : &GetRunQueue();
+
+				if(rq->trylock())
 				{
 					// GetThreadList(m)->insert(GetThreadList(m)->begin(), m);
-					GetThreadList(m).push_back(m);
+					rq->queue[m->Priority].push_back(m);
+					rq->unlock();
 				}
 				else
 				{
+					// sleep is already 0, so it goes straight back next time.
+					LockSpinlock(SleepListLock);
 					SleepList.push_back(m);
+					UnlockSpinlock(SleepListLock);
 				}
 			}
+		}
+
+		static bool CanPreempt()
+		{
+			Thread* t = GetCurrentThread();
+			return !t || t->PreemptCount == 0;
+		}
+
+		// the PIT only interrupts the boot processor, so it alone keeps time and wakes sleepers.
+		extern "C" uint64_t ProcessTimerInterrupt_C(uint64_t context)
+		{
+			TimerCounter += (GlobalMilliseconds / GlobalTickRate);
+			ThreadTime += (GlobalMilliseconds / GlobalTickRate);
+
+			ProcessSleepList();
 
 			// do the thing with the rtc thing
 			if(Devices::RTC::DidInitialise())
@@ -74,7 +164,7 @@ namespace Kernel
 			// increment the spent time in the current thread
 
 			// HardwareAbstraction::Devices::SerialPort::WriteString("x");
-			if(SchedulerEnabled && TimerCounter % SchedulerTickRate)
+			if(CanPreempt() && TimerCounter % SchedulerTickRate)
 			{
 				if(GetCurrentThread() != 0)
 					GetCurrentThread()->ExecutionTime = ThreadTime;
@@ -85,6 +175,17 @@ namespace Kernel
 
 			return 0;
 		}
+
+		// the application processors are driven by their local apic timers instead; all they do is reschedule.
+		extern "C" uint64_t ProcessLocalTimerInterrupt_C(uint64_t context)
+		{
+			Devices::LocalAPIC::SendEOI();
+
+			if(CanPreempt())
+				return SwitchProcess(context);
+
+			return 0;
+		}
 	}
 	}
 
@@ -0,0 +1,153 @@
+// WaitQueue.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+
+#include <Kernel.hpp>
+
+// a list of threads waiting for something, threaded through the threads themselves so that waiting never allocates.
+
+// the waiter checks its condition with the queue's lock held, and calls SleepOn() if it still has to wait.
+// a wakeup can't get lost in between: we're marked as blocked before the lock is dropped, and the waker
+// needs that same lock to find us.
+
+// lock order is the queue, then the run queue, then the sleep list.
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Multitasking
+{
+	static void Append(WaitQueue& wq, Thread* t)
+	{
+		t->WaitNext = 0;
+		t->WaitingOn = &wq;
+
+		if(wq.tail)	wq.tail->WaitNext = t;
+		else		wq.head = t;
+
+		wq.tail = t;
+	}
+
+	static void Unlink(WaitQueue& wq, Thread* t)
+	{
+		Thread* prev = 0;
+		for(Thread* c = wq.head; c; prev = c, c = c->WaitNext)
+		{
+			if(c != t)
+				continue;
+
+			if(prev)	prev->WaitNext = c->WaitNext;
+			else		wq.head = c->WaitNext;
+
+			if(wq.tail == c)
+				wq.tail = prev;
+
+			break;
+		}
+
+		t->WaitNext = 0;
+		t->WaitingOn = 0;
+	}
+
+	// like WakeForMessage(), but only for blocked threads, and without yielding.
+	static void Wake(Thread* t)
+	{
+		auto& rq = LockRunQueue(t);
+
+		// the timer changes the state of timed-out waiters under the sleep list lock, not ours.
+		LockSpinlock(SleepListLock);
+		bool blocked = (t->State == STATE_BLOCKING);
+		if(blocked)
+		{
+			SleepList.remove(t);
+			t->State = STATE_NORMAL;
+			t->WakeDeadline = 0;
+		}
+		UnlockSpinlock(SleepListLock);
+
+		if(blocked)
+			GetThreadList(t).push_back(t);
+
+		rq.unlock();
+	}
+
+	// call with wq.lock held (once); returns with it held again, after we've been woken.
+	// with a timeout (in milliseconds), returns false if that ran out first.
+	// wakeups can be spurious, so check the condition again either way.
+	bool SleepOn(WaitQueue& wq, uint64_t timeout)
+	{
+		Thread* self = GetCurrentThread();
+		assert(wq.lock.recursion == 1);
+
+		Append(wq, self);
+
+		// the same as Block(), except that the queue's lock is dropped between leaving the run queue and yielding.
+		auto& rq = LockRunQueue(self);
+		GetThreadList(self).remove(self);
+		self->State = STATE_BLOCKING;
+
+		LockSpinlock(SleepListLock);
+		self->WakeDeadline = timeout ? TickCounter() + timeout : 0;
+		SleepList.push_back(self);
+		UnlockSpinlock(SleepListLock);
+
+		rq.unlock();
+		UnlockSpinlock(wq.lock);
+
+		YieldCPU();
+
+		// if the queue didn't wake us, we're still on it.
+		LockSpinlock(wq.lock);
+		self->WakeDeadline = 0;
+
+		if(self->WaitingOn != &wq)
+			return true;
+
+		Unlink(wq, self);
+		return false;
+	}
+
+	bool WakeOne(WaitQueue& wq)
+	{
+		LockSpinlock(wq.lock);
+
+		Thread* t = wq.head;
+		if(t)
+		{
+			Unlink(wq, t);
+			Wake(t);
+		}
+
+		UnlockSpinlock(wq.lock);
+		return t != 0;
+	}
+
+	void WakeAll(WaitQueue& wq)
+	{
+		LockSpinlock(wq.lock);
+
+		while(Thread* t = wq.head)
+		{
+			Unlink(wq, t);
+			Wake(t);
+		}
+
+		UnlockSpinlock(wq.lock);
+	}
+
+	// for threads that die while waiting.
+	void RemoveFromWaitQueue(Thread* t)
+	{
+		WaitQueue* wq = t->WaitingOn;
+		if(!wq)
+			return;
+
+		LockSpinlock(wq->lock);
+		if(t->WaitingOn == wq)
+			Unlink(*wq, t);
+
+		UnlockSpinlock(wq->lock);
+	}
+}
+}
+}
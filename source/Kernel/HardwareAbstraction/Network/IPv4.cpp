@@ -181,6 +181,7 @@ namespace IP
 		{
 			// send into socket buffer.
 			skt->recvbuffer.Write((uint8_t*) packet, length);
+			Filesystems::NotifyPoll(skt->poll, EPOLLIN);
 			return;
 		}
 
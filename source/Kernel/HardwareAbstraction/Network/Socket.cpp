@@ -62,15 +62,6 @@ namespace Network
 		return (Socket*) node->info->data;
 	}
 
-	static void addProcToBlockingList(Socket* skt)
-	{
-		assert(skt);
-		pid_t pid = Multitasking::GetCurrentProcess()->ProcessID;
-		if(!skt->blockingProcs.contains(pid))
-			skt->blockingProcs.push_back(pid);
-	}
-
-
 	// file descriptor stuff.
 	fd_t OpenSocket(SocketProtocol prot, uint64_t flags)
 	{
@@ -445,13 +436,12 @@ namespace Network
 			return (size_t) -1;
 		}
 
-		// only block if we have to
-		if(skt->recvbuffer.ByteCount() == 0)
-		{
-			Log(3, "blocking");
-			addProcToBlockingList(skt);
-			BLOCK();
-		}
+		// only block if we have to; the data's written before the notification, so checking under the lock is enough.
+		LockSpinlock(skt->poll.waiters.lock);
+		while(skt->recvbuffer.ByteCount() == 0)
+			Multitasking::SleepOn(skt->poll.waiters);
+
+		UnlockSpinlock(skt->poll.waiters.lock);
 
 		// now we have data.
 		return this->Read(node, buf, 0, bytes);
@@ -489,14 +479,7 @@ namespace Network
 		else if(skt->protocol == SocketProtocol::IPC)
 		{
 			skt->recvbuffer.Write((uint8_t*) buf, length);
-
-			// TODO: do we want to wake all processes? if there's more than one, there's a fair chance
-			// that it may have already read everything in the buffer, leaving the others with nothing
-			for(pid_t pid : skt->blockingProcs)
-			{
-				Log(3, "waking pid %d", pid);
-				Multitasking::WakeForMessage(Multitasking::GetProcess(pid));
-			}
+			NotifyPoll(skt->poll, EPOLLIN);
 		}
 
 		return length;
@@ -526,6 +509,22 @@ namespace Network
 	{
 		return rde::vector<VFS::vnode*>();
 	}
+
+	// sends don't block, so we're always writable.
+	uint32_t SocketVFS::Poll(VFS::vnode* node)
+	{
+		Socket* skt = (Socket*) node->info->data;
+		if(!skt)
+			return EPOLLHUP;
+
+		return EPOLLOUT | (skt->recvbuffer.ByteCount() > 0 ? EPOLLIN : 0);
+	}
+
+	PollSource* SocketVFS::GetPollSource(VFS::vnode* node)
+	{
+		Socket* skt = (Socket*) node->info->data;
+		return skt ? &skt->poll : 0;
+	}
 }
 }
 }
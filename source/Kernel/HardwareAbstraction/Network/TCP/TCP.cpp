@@ -69,37 +69,38 @@ namespace TCP
 	{
 		TCPPacket* tcp = (TCPPacket*) packet;
 
-		// validate checksum
-		// setup a fake IPv4 header.
-		IP::PseudoIPv4Header* pseudo = new IP::PseudoIPv4Header;
-		pseudo->source = source;
-		pseudo->dest = destip;
+		// validate checksum, unless the card already did.
+		if(!interface || !interface->ChecksumVerified())
+		{
+			// setup a fake IPv4 header.
+			IP::PseudoIPv4Header* pseudo = new IP::PseudoIPv4Header;
+			pseudo->source = source;
+			pseudo->dest = destip;
 
-		pseudo->zeroes = 0;
-		pseudo->protocol = (uint8_t) IP::ProtocolType::TCP;
-		pseudo->length = SwapEndian16((uint16_t) length);
+			pseudo->zeroes = 0;
+			pseudo->protocol = (uint8_t) IP::ProtocolType::TCP;
+			pseudo->length = SwapEndian16((uint16_t) length);
 
-		// calculate the pseudo header's checksum separately.
-		uint16_t checks[2];
-		checks[0] = SwapEndian16(IP::CalculateIPChecksum(pseudo, sizeof(IP::PseudoIPv4Header)));
+			// calculate the pseudo header's checksum separately.
+			uint16_t checks[2];
+			checks[0] = SwapEndian16(IP::CalculateIPChecksum(pseudo, sizeof(IP::PseudoIPv4Header)));
 
-		uint16_t tcpcheck = tcp->Checksum;
-		tcp->Checksum = 0xFFFF;
+			uint16_t tcpcheck = tcp->Checksum;
+			tcp->Checksum = 0xFFFF;
 
-		// checksum the tcp packet.
-		checks[1] = SwapEndian16(IP::CalculateIPChecksum(packet, length));
+			// checksum the tcp packet.
+			checks[1] = SwapEndian16(IP::CalculateIPChecksum(packet, length));
 
-		uint16_t checksum = ~IP::CalculateIPChecksum(checks, sizeof(checks));
+			uint16_t checksum = ~IP::CalculateIPChecksum(checks, sizeof(checks));
 
-		if(checksum != SwapEndian16(tcpcheck))
-		{
-			Log(1, "Bad checksum on TCP packet from %d.%d.%d.%d, discarding (got %0.4x, expected %0.4x)", source.b1, source.b2, source.b3, source.b4,
-				SwapEndian16(tcpcheck), checksum);
-			return;
+			if(checksum != SwapEndian16(tcpcheck))
+			{
+				Log(1, "Bad checksum on TCP packet from %d.%d.%d.%d, discarding (got %0.4x, expected %0.4x)", source.b1, source.b2, source.b3, source.b4,
+					SwapEndian16(tcpcheck), checksum);
+				return;
+			}
 		}
 
-
-
 		uint16_t sourceport = SwapEndian16(tcp->clientport);
 		uint16_t destport = SwapEndian16(tcp->serverport);
 
@@ -207,6 +207,9 @@ namespace TCP
 
 			delete[] buf;
 		}
+
+		if(datalength > 0)
+			Filesystems::NotifyPoll(this->socket->poll, EPOLLIN);
 	}
 
 
@@ -160,6 +160,7 @@ namespace UDP
 		{
 			// send into socket buffer.
 			skt->recvbuffer.Write((uint8_t*) packet + sizeof(UDPPacket), actuallength);
+			Filesystems::NotifyPoll(skt->poll, EPOLLIN);
 			Log("wrote received data (%d bytes) (from %d.%d.%d.%d) into socket", actuallength, source.b1, source.b2, source.b3, source.b4);
 
 			return;
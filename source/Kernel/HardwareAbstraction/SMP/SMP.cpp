@@ -0,0 +1,291 @@
+// SMP.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+
+#include <Kernel.hpp>
+#include <HardwareAbstraction/SMP.hpp>
+#include <HardwareAbstraction/Interrupts.hpp>
+#include <HardwareAbstraction/DeviceManager.hpp>
+#include <HardwareAbstraction/Devices/APIC.hpp>
+
+using namespace Library;
+
+// Trampoline.s
+extern "C" uint8_t SMPTrampolineStart[];
+extern "C" uint8_t SMPTrampolineEnd[];
+extern "C" uint8_t SMPTrampolineCR3[];
+extern "C" uint8_t SMPTrampolineStack[];
+extern "C" uint8_t SMPTrampolineEntry[];
+extern "C" uint8_t SMPTrampolineCPU[];
+
+// SecondStage.s
+extern "C" uint8_t GDT64Pointer[];
+
+// TaskSwitcher.s, InterruptHandlers.s
+extern "C" void LocalTimerInterrupt();
+extern "C" void SpuriousInterrupt();
+extern "C" void TLBShootdownInterrupt();
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace SMP
+{
+	using namespace Multitasking;
+
+	struct GDTPointer
+	{
+		uint16_t limit;
+		uint64_t base;
+
+	} __attribute__ ((packed));
+
+	static CPU BootProcessor;
+	static uint8_t BootDoubleFaultStack[DoubleFaultStackSize] __attribute__ ((aligned (16)));
+	static CPU* CPUs[MaxCPUs];
+	static uint64_t NumCPUs = 0;
+
+	// the stack an application processor runs on until its first switch.
+	static const uint64_t APBootStackSize = 0x4000;
+
+	// same timeslice as the PIT gives the boot processor.
+	static const uint64_t APTimerPeriod = GlobalMilliseconds / GlobalTickRate;
+
+	static void SetGSBase(CPU* cpu)
+	{
+		uint64_t addr = (uint64_t) cpu;
+		asm volatile("wrmsr" :: "a"((uint32_t) addr), "d"((uint32_t) (addr >> 32)), "c"(MSR_GS_BASE));
+
+		// the user half of swapgs. nothing in userspace uses gs, so it starts out as 0.
+		asm volatile("wrmsr" :: "a"(0), "d"(0), "c"(MSR_KERNEL_GS_BASE));
+	}
+
+	void Initialise()
+	{
+		// this runs before anything else in the kernel, so GetCurrentCPU() works from the start.
+		CPU* cpu = &BootProcessor;
+
+		cpu->self		= cpu;
+		cpu->id			= 0;
+		cpu->online		= 1;
+		cpu->IsFirst	= true;
+
+		// the boot processor keeps the gdt and tss that SecondStage.s set up.
+		cpu->tss		= (TaskStateSegment*) 0x2500;
+		cpu->tss->ist[0] = (uint64_t) BootDoubleFaultStack + DoubleFaultStackSize;
+
+		CPUs[0] = cpu;
+		NumCPUs = 1;
+
+		SetGSBase(cpu);
+	}
+
+	uint64_t GetNumberOfCPUs()
+	{
+		return NumCPUs;
+	}
+
+	CPU* GetCPU(uint64_t id)
+	{
+		return id < MaxCPUs ? CPUs[id] : 0;
+	}
+
+	static void SetupGDT(CPU* cpu)
+	{
+		// copy everything up to the tss descriptor from the boot gdt, then point our own descriptor at our own tss.
+		GDTPointer* boot = (GDTPointer*) GDT64Pointer;
+		Memory::Copy(cpu->gdt, (void*) boot->base, 6 * sizeof(uint64_t));
+
+		uint64_t base = (uint64_t) cpu->tss;
+		uint64_t limit = sizeof(TaskStateSegment) - 1;
+
+		cpu->gdt[6] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) | ((uint64_t) 0x89 << 40)
+						| (((limit >> 16) & 0xF) << 48) | (((base >> 24) & 0xFF) << 56);
+
+		cpu->gdt[7] = base >> 32;
+	}
+
+	static void APIdle()
+	{
+		// the local timer reschedules us (and steals work for us), so just wait for it.
+		while(true)
+			asm volatile("sti; hlt");
+	}
+
+	extern "C" void SMP_APEntry(CPU* cpu)
+	{
+		SetGSBase(cpu);
+
+		// our own gdt, then reload cs (0x18 is user code in there) and the data segments.
+		GDTPointer gdtp;
+		gdtp.limit = sizeof(cpu->gdt) - 1;
+		gdtp.base = (uint64_t) cpu->gdt;
+
+		asm volatile("lgdt %[p]" :: [p]"m"(gdtp));
+		asm volatile(
+			"pushq $0x08				\n\t"
+			"leaq 1f(%%rip), %%rax		\n\t"
+			"pushq %%rax				\n\t"
+			"lretq						\n\t"
+			"1:							\n\t"
+			"mov $0x10, %%ax			\n\t"
+			"mov %%ax, %%ds				\n\t"
+			"mov %%ax, %%es				\n\t"
+			"mov %%ax, %%ss				\n\t"
+			::: "rax", "memory");
+
+		asm volatile("ltr %%ax" :: "a"(0x30));
+		asm volatile("fninit");
+
+		Interrupts::LoadIDT();
+		MemoryManager::Virtual::InitialiseTLB();
+
+		Devices::LocalAPIC::EnableOnThisCPU();
+		Devices::LocalAPIC::StartTimer(LocalTimerNumber, APTimerPeriod);
+
+		__sync_synchronize();
+		cpu->online = 1;
+
+		// first switch: IsFirst is set, so this stack gets thrown away and we never come back here.
+		asm volatile("sti");
+		YieldCPU();
+
+		while(true)
+			asm volatile("hlt");
+	}
+
+	static void WaitMilliseconds(uint64_t ms)
+	{
+		uint64_t start = TickCounter();
+		while(TickCounter() < start + ms)
+			asm volatile("pause");
+	}
+
+	static bool StartAP(uint32_t apicid)
+	{
+		using namespace Devices;
+
+		CPU* cpu = new CPU;
+		Memory::Set(cpu, 0, sizeof(CPU));
+
+		cpu->self			= cpu;
+		cpu->id				= (uint32_t) NumCPUs;
+		cpu->apicid			= apicid;
+		cpu->IsFirst		= true;
+		cpu->CurrentCR3		= GetKernelCR3();
+		cpu->CurrentPML4T	= (MemoryManager::Virtual::PageMapStructure*) GetKernelCR3();
+		cpu->runqueue		= new RunQueue();
+		cpu->logring		= CreateLogRing();
+
+		cpu->tss = new TaskStateSegment;
+		Memory::Set(cpu->tss, 0, sizeof(TaskStateSegment));
+		cpu->tss->iomapbase = sizeof(TaskStateSegment);
+		cpu->tss->ist[0] = (uint64_t) new uint8_t[DoubleFaultStackSize] + DoubleFaultStackSize;
+
+		SetupGDT(cpu);
+
+		// every processor needs something it can always run.
+		Thread* idle = CreateKernelThread(APIdle, 0);
+		idle->flags |= FLAG_PINNED;
+		idle->Processor = cpu;
+		cpu->IdleThread = idle;
+
+		CPUs[cpu->id] = cpu;
+		AddToQueue(idle);
+
+
+		// the copy of the trampoline is shared, so processors come up one at a time.
+		uint64_t stack = (uint64_t) new uint8_t[APBootStackSize];
+		uint64_t tramp = SMPTrampolineAddress;
+
+		*((uint64_t*) (tramp + (SMPTrampolineCR3 - SMPTrampolineStart)))	= GetKernelCR3();
+		*((uint64_t*) (tramp + (SMPTrampolineStack - SMPTrampolineStart)))	= (stack + APBootStackSize) & ~((uint64_t) 0xF);
+		*((uint64_t*) (tramp + (SMPTrampolineEntry - SMPTrampolineStart)))	= (uint64_t) SMP_APEntry;
+		*((uint64_t*) (tramp + (SMPTrampolineCPU - SMPTrampolineStart)))	= (uint64_t) cpu;
+
+		// INIT, wait, then STARTUP (twice, if the first one didn't take).
+		LocalAPIC::SendInit(apicid);
+		WaitMilliseconds(10);
+
+		LocalAPIC::SendStartup(apicid, (uint8_t) (tramp >> 12));
+		WaitMilliseconds(2);
+
+		if(!cpu->online)
+			LocalAPIC::SendStartup(apicid, (uint8_t) (tramp >> 12));
+
+		for(uint64_t waited = 0; !cpu->online && waited < 1000; waited += 10)
+			WaitMilliseconds(10);
+
+		if(!cpu->online)
+		{
+			Log(1, "Processor with APIC id %d did not start", apicid);
+
+			// put it back to waiting for a STARTUP, so that it can't wander onto anything we're about to free.
+			LocalAPIC::SendInit(apicid);
+			WaitMilliseconds(10);
+
+			CPUs[cpu->id] = 0;
+
+			// it never ran, so it's still on the queue we're about to delete.
+			Kill(idle);
+			idle->Processor = 0;
+
+			DestroyLogRing(cpu->logring);
+			delete[] (uint8_t*) stack;
+			delete[] (uint8_t*) (cpu->tss->ist[0] - DoubleFaultStackSize);
+			delete cpu->tss;
+			delete cpu->runqueue;
+			delete cpu;
+
+			return false;
+		}
+
+		NumCPUs++;
+		Log("Processor %d (APIC id %d) online", cpu->id, apicid);
+		return true;
+	}
+
+	void StartAPs()
+	{
+		using namespace Devices;
+
+		APIC* apic = (APIC*) DeviceManager::GetDevice(DeviceType::AdvancedPIC);
+		if(!apic || !LocalAPIC::GetBaseAddress())
+		{
+			Log(1, "No MADT found, running on the boot processor only");
+			return;
+		}
+
+		// the trampoline loads cr3 in protected mode.
+		assert(GetKernelCR3() < 0x100000000);
+
+		BootProcessor.apicid = LocalAPIC::GetID();
+
+		// the boot processor stays on the PIT; the others get their local timer, calibrated against it.
+		// none of these gates are for userspace (dpl 0), or an 'int' would get it an eoi and a reschedule.
+		LocalAPIC::CalibrateTimer();
+		Interrupts::SetGate(LocalTimerNumber, (uint64_t) LocalTimerInterrupt, 0x08, 0x8E);
+		Interrupts::SetGate(SpuriousInterruptNumber, (uint64_t) SpuriousInterrupt, 0x08, 0x8E);
+		Interrupts::SetGate(TLBShootdownNumber, (uint64_t) TLBShootdownInterrupt, 0x08, 0x8E);
+
+		Memory::Copy((void*) SMPTrampolineAddress, SMPTrampolineStart, (uint64_t) (SMPTrampolineEnd - SMPTrampolineStart));
+
+		for(auto& lapic : apic->GetTable()->localAPICs)
+		{
+			if(!(lapic.flags & 0x1) || lapic.ACPIId == BootProcessor.apicid)
+				continue;
+
+			if(NumCPUs == MaxCPUs)
+			{
+				Log(1, "More than %d processors, ignoring the rest", MaxCPUs);
+				break;
+			}
+
+			StartAP(lapic.ACPIId);
+		}
+
+		Log("%d processor%s online", NumCPUs, NumCPUs == 1 ? "" : "s");
+	}
+}
+}
+}
@@ -0,0 +1,121 @@
+// Trampoline.s
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+
+// where the application processors start.
+// SMP::StartAPs() copies everything between SMPTrampolineStart and SMPTrampolineEnd to SMPTrampolineAddress,
+// fills in the parameters at the end, then points each processor at it with a startup IPI.
+// it has to be position-independent in 16-bit mode, and uses absolute addresses (relative to the copy) after that.
+
+// keep in sync with SMPTrampolineAddress in Kernel.hpp.
+.set TrampolineBase, 0x70000
+
+.global SMPTrampolineStart
+.global SMPTrampolineEnd
+.global SMPTrampolineCR3
+.global SMPTrampolineStack
+.global SMPTrampolineEntry
+.global SMPTrampolineCPU
+
+.section .text
+.code16
+
+SMPTrampolineStart:
+	cli
+	cld
+
+	// cs is TrampolineBase >> 4, so everything below is relative to the start of the copy.
+	mov %cs, %ax
+	mov %ax, %ds
+	mov %ax, %es
+	mov %ax, %ss
+
+	lgdtl TrampolineGDTPointer - SMPTrampolineStart
+
+	// protected mode
+	mov %cr0, %eax
+	orl $0x1, %eax
+	mov %eax, %cr0
+
+	ljmpl $0x08, $(Trampoline32 - SMPTrampolineStart + TrampolineBase)
+
+
+.code32
+Trampoline32:
+	mov $0x10, %ax
+	mov %ax, %ds
+	mov %ax, %es
+	mov %ax, %ss
+
+	// PAE, and OSFXSR/OSXMMEXCPT like the boot processor.
+	mov %cr4, %eax
+	orl $0x620, %eax
+	mov %eax, %cr4
+
+	// the kernel's page tables, which identity map this page.
+	mov (SMPTrampolineCR3 - SMPTrampolineStart + TrampolineBase), %eax
+	mov %eax, %cr3
+
+	// long mode, syscall/sysret and NX -- same as the loader.
+	mov $0xC0000080, %ecx
+	rdmsr
+	orl $0x901, %eax
+	wrmsr
+
+	// paging on, with CR0.WP so the kernel can't write to read-only (copy-on-write) pages either;
+	// clear CR0.EM and set CR0.MP for SSE.
+	mov %cr0, %eax
+	orl $0x80010002, %eax
+	andl $0xFFFFFFFB, %eax
+	mov %eax, %cr0
+
+	ljmp $0x18, $(Trampoline64 - SMPTrampolineStart + TrampolineBase)
+
+
+.code64
+Trampoline64:
+	mov $0x10, %ax
+	mov %ax, %ds
+	mov %ax, %es
+	mov %ax, %ss
+
+	movq (SMPTrampolineStack - SMPTrampolineStart + TrampolineBase), %rsp
+	movq (SMPTrampolineCPU - SMPTrampolineStart + TrampolineBase), %rdi
+	movq $0x0, %rbp
+
+	// into the higher half, never to return.
+	movq (SMPTrampolineEntry - SMPTrampolineStart + TrampolineBase), %rax
+	call *%rax
+
+	cli
+TrampolineHalt:
+	hlt
+	jmp TrampolineHalt
+
+
+
+.align 16
+TrampolineGDT:
+	.quad 0x0000000000000000		// null
+	.quad 0x00CF9A000000FFFF		// 0x08: 32-bit code
+	.quad 0x00CF92000000FFFF		// 0x10: data
+	.quad 0x00AF9A000000FFFF		// 0x18: 64-bit code
+
+TrampolineGDTPointer:
+	.word TrampolineGDTPointer - TrampolineGDT - 1
+	.long TrampolineGDT - SMPTrampolineStart + TrampolineBase
+
+
+// filled in by StartAPs() in the copy, for each processor.
+.align 8
+SMPTrampolineCR3:
+	.quad 0
+SMPTrampolineStack:
+	.quad 0
+SMPTrampolineEntry:
+	.quad 0
+SMPTrampolineCPU:
+	.quad 0
+
+SMPTrampolineEnd:
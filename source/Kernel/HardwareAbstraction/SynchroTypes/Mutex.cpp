@@ -35,10 +35,14 @@ namespace Kernel
 			return;
 		}
 
-		while(__sync_lock_test_and_set(&mtx.lock, 1))
-			BLOCK();
+		// nothing wakes a thread blocked on a mutex, so give up the timeslice instead.
+		// the owner might be running on another processor, so it's worth a few spins first.
+		for(int spins = 0; __sync_lock_test_and_set(&mtx.lock, 1); spins++)
+		{
+			if(spins < 64)	asm volatile("pause");
+			else			YieldCPU();
+		}
 
-		__sync_lock_test_and_set(&mtx.lock, 1);
 		mtx.owner = GetCurrentThread();
 		mtx.recursion = 1;
 	}
@@ -81,65 +85,111 @@ namespace Kernel
 
 
 	// id-based, as usual.
-	// for userspace.
+	// for userspace. the map is shared by every process, and syscalls run on every processor at once, so it's
+	// behind its own lock; the lookup only holds it long enough to find the mutex, not to lock or unlock it.
 	static rde::hash_map<pthread_mutex_t, Mutex*>* mtxmap;
 	static pthread_mutex_t curmtxid = 0;
+	static Mutex MapLock;
 
-	static bool __checkmap(pthread_mutex_t id)
+	// the id lives in userspace, so it comes in through a fault-safe copy.
+	static Mutex* __lookup(const pthread_mutex_t* mtx)
 	{
+		pthread_mutex_t id = 0;
+		if(!HardwareAbstraction::MemoryManager::Virtual::CopyFromUser(&id, mtx, sizeof(pthread_mutex_t)))
+		{
+			SetThreadErrno(EFAULT);
+			return 0;
+		}
+
+		AutoMutex lk(MapLock);
 		if(!mtxmap || mtxmap->find(id) == mtxmap->end())
 		{
 			SetThreadErrno(EINVAL);
-			return false;
+			return 0;
 		}
-		return true;
+
+		return (*mtxmap)[id];
 	}
 
 	extern "C" void Syscall_CreateMutex(pthread_mutex_t* mtx, const pthread_mutexattr_t* attr)
 	{
-		*mtx = curmtxid++;
-		if(!mtxmap)
-			mtxmap = new rde::hash_map<pthread_mutex_t, Mutex*>();
+		using namespace HardwareAbstraction::MemoryManager;
+
+		pthread_mutexattr_t kattr;
+		if(attr != NULL && !Virtual::CopyFromUser(&kattr, attr, sizeof(kattr)))
+		{
+			SetThreadErrno(EFAULT);
+			return;
+		}
 
 		Mutex* m = new Mutex;
 		if(attr != NULL)
-			m->type = attr->type;
+			m->type = kattr.type;
 
 		else
 			m->type = PTHREAD_MUTEX_DEFAULT;
 
-		(*mtxmap)[*mtx] = m;
+		pthread_mutex_t id = 0;
+		{
+			AutoMutex lk(MapLock);
+			if(!mtxmap)
+				mtxmap = new rde::hash_map<pthread_mutex_t, Mutex*>();
+
+			id = curmtxid++;
+			(*mtxmap)[id] = m;
+		}
+
+		if(!Virtual::CopyToUser(mtx, &id, sizeof(id)))
+		{
+			{
+				AutoMutex lk(MapLock);
+				mtxmap->erase(id);
+			}
+
+			delete m;
+			SetThreadErrno(EFAULT);
+		}
 	}
 
 	extern "C" void Syscall_DestroyMutex(pthread_mutex_t* mtx)
 	{
-		pthread_mutex_t id = *mtx;
-		if(!__checkmap(id))
+		pthread_mutex_t id = 0;
+		if(!HardwareAbstraction::MemoryManager::Virtual::CopyFromUser(&id, mtx, sizeof(pthread_mutex_t)))
+		{
+			SetThreadErrno(EFAULT);
 			return;
+		}
 
-		Mutex* m = (*mtxmap)[id];
-		assert(m);
-
-		if(m->lock)
+		Mutex* m = 0;
 		{
-			SetThreadErrno(EBUSY);
-			return;
+			AutoMutex lk(MapLock);
+			if(!mtxmap || mtxmap->find(id) == mtxmap->end())
+			{
+				SetThreadErrno(EINVAL);
+				return;
+			}
+
+			m = (*mtxmap)[id];
+			assert(m);
+
+			if(m->lock)
+			{
+				SetThreadErrno(EBUSY);
+				return;
+			}
+
+			mtxmap->erase(id);
 		}
 
-		mtxmap->erase(id);
 		delete m;
 	}
 
 	extern "C" int64_t Syscall_LockMutex(pthread_mutex_t* mtx)
 	{
-		assert(mtx);
-		pthread_mutex_t id = *mtx;
-		if(!__checkmap(id))
-			return -1;
-
 		// get the mutex object
-		Mutex* m = (*mtxmap)[id];
-		assert(m);
+		Mutex* m = __lookup(mtx);
+		if(!m)
+			return -1;
 
 		// depending on our type:
 		if(m->type == PTHREAD_MUTEX_NORMAL || m->type == PTHREAD_MUTEX_ERRORCHECK)
@@ -157,14 +207,10 @@ namespace Kernel
 
 	extern "C" int64_t Syscall_UnlockMutex(pthread_mutex_t* mtx)
 	{
-		assert(mtx);
-		pthread_mutex_t id = *mtx;
-		if(!__checkmap(id))
-			return -1;
-
 		// get the mutex object
-		Mutex* m = (*mtxmap)[id];
-		assert(m);
+		Mutex* m = __lookup(mtx);
+		if(!m)
+			return -1;
 
 		if(m->owner != GetCurrentThread())
 		{
@@ -178,14 +224,10 @@ namespace Kernel
 
 	extern "C" int64_t Syscall_TryLockMutex(pthread_mutex_t* mtx)
 	{
-		assert(mtx);
-		pthread_mutex_t id = *mtx;
-		if(!__checkmap(id))
-			return -1;
-
 		// get the mutex object
-		Mutex* m = (*mtxmap)[id];
-		assert(m);
+		Mutex* m = __lookup(mtx);
+		if(!m)
+			return -1;
 
 		bool result = TryLockMutex(*m);
 		if(result)
@@ -198,27 +240,3 @@ namespace Kernel
 		}
 	}
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
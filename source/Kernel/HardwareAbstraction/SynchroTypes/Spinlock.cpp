@@ -0,0 +1,104 @@
+// Spinlock.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+
+#include <Kernel.hpp>
+#include <HardwareAbstraction/SMP.hpp>
+#include <HardwareAbstraction/MemoryManager/Virtual.hpp>
+
+using namespace Kernel::HardwareAbstraction::Multitasking;
+
+namespace Kernel
+{
+	#define NoOwner		((void*) -1)
+
+	static uint64_t SaveAndDisableInterrupts()
+	{
+		uint64_t flags = 0;
+		asm volatile("pushfq; pop %[fl]; cli" : [fl]"=r"(flags) :: "memory");
+		return flags;
+	}
+
+	static void RestoreInterrupts(uint64_t flags)
+	{
+		if(flags & 0x200)
+			asm volatile("sti" ::: "memory");
+	}
+
+	// processors that haven't scheduled yet have no current thread, and a shared null owner would let two of them
+	// both take the lock "recursively" -- so they're told apart by their cpu block instead.
+	static void* CurrentOwner()
+	{
+		Thread* t = GetCurrentThread();
+		return t ? (void*) t : (void*) HardwareAbstraction::SMP::GetCurrentCPU();
+	}
+
+	void LockSpinlock(Spinlock& sl)
+	{
+		uint64_t flags = SaveAndDisableInterrupts();
+
+		// the thread can't move while interrupts are off, so this is stable.
+		void* cur = CurrentOwner();
+		if(sl.lock && sl.owner == cur)
+		{
+			sl.recursion++;
+			return;
+		}
+
+		// the holder might be waiting for us to flush our tlb, and we can't take its interrupt.
+		while(__sync_lock_test_and_set(&sl.lock, 1))
+		{
+			while(sl.lock)
+			{
+				HardwareAbstraction::MemoryManager::Virtual::ServiceTLBShootdowns();
+				asm volatile("pause");
+			}
+		}
+
+		sl.owner = cur;
+		sl.recursion = 1;
+		sl.flags = flags;
+	}
+
+	bool TryLockSpinlock(Spinlock& sl)
+	{
+		uint64_t flags = SaveAndDisableInterrupts();
+
+		void* cur = CurrentOwner();
+		if(sl.lock && sl.owner == cur)
+		{
+			sl.recursion++;
+			return true;
+		}
+
+		if(__sync_lock_test_and_set(&sl.lock, 1))
+		{
+			RestoreInterrupts(flags);
+			return false;
+		}
+
+		sl.owner = cur;
+		sl.recursion = 1;
+		sl.flags = flags;
+
+		return true;
+	}
+
+	void UnlockSpinlock(Spinlock& sl)
+	{
+		if(sl.recursion > 1)
+		{
+			sl.recursion--;
+			return;
+		}
+
+		uint64_t flags = sl.flags;
+
+		sl.owner = NoOwner;
+		sl.recursion = 0;
+		__sync_lock_release(&sl.lock);
+
+		RestoreInterrupts(flags);
+	}
+}
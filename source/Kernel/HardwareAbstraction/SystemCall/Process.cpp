@@ -4,6 +4,7 @@
 
 #include <Kernel.hpp>
 #include <HardwareAbstraction/LoadBinary.hpp>
+#include <errno.h>
 
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wunused-macros"
@@ -61,6 +62,20 @@ namespace SystemCalls
 		return ret;
 	}
 
+	extern "C" int64_t Syscall_MUnmapAnon(uint64_t addr, uint64_t size)
+	{
+		using namespace MemoryManager;
+
+		// only whole mappings, the same size they were made.
+		if((addr & 0xFFF) || size == 0 || !Virtual::FreeAnonymousPage(addr, (size + 0xFFF) / 0x1000))
+		{
+			Multitasking::SetThreadErrno(EINVAL);
+			return -1;
+		}
+
+		return 0;
+	}
+
 	extern "C" void Syscall_Sleep(int64_t milliseconds)
 	{
 		Multitasking::Sleep(milliseconds);
@@ -78,16 +93,31 @@ namespace SystemCalls
 
 	extern "C" pid_t Syscall_CreateThread(uint64_t ptr, pthread_attr_t* attr)
 	{
+		pthread_attr_t kattr;
+		if(attr && !MemoryManager::Virtual::CopyFromUser(&kattr, attr, sizeof(kattr)))
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return -1;
+		}
+
 		void (*t)() = (void(*)())(ptr);
 		Multitasking::Process* p = Multitasking::GetCurrentProcess();
 		Multitasking::Thread* thr = 0;
-		Multitasking::AddToQueue(thr = Multitasking::CreateThread(p, t, attr));
+		Multitasking::AddToQueue(thr = Multitasking::CreateThread(p, t, attr ? &kattr : 0));
 		return thr->ThreadID;
 	}
 
 	extern "C" pid_t Syscall_SpawnProcess(const char* ExecutableFilename, const char* ProcessName)
 	{
-		auto proc = LoadBinary::Load(ExecutableFilename, ProcessName);
+		char path[MaxUserPath];
+		char name[MaxUserPath];
+		if(!MemoryManager::Virtual::CopyPathFromUser(path, ExecutableFilename, sizeof(path))
+			|| !MemoryManager::Virtual::CopyPathFromUser(name, ProcessName, sizeof(name)))
+		{
+			return 0;
+		}
+
+		auto proc = LoadBinary::Load(path, name);
 		if(!proc)
 			return 0;
 
@@ -51,8 +51,16 @@ HandleSyscall:
 
 
 		edit:
+		the gate is an interrupt gate, so we come in with interrupts off. that lets us swap in the kernel's gs
+		before anything can interrupt us, and we turn them back on right after.
 	*/
 
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
+	sti
+
 	push %rbp
 	mov %rsp, %rbp
 
@@ -169,11 +177,20 @@ CleanUp:
 	pop %r15
 
 
-	// any errno set by a syscall is stored in 0x2610 and preserved across context switches.
+	// no interrupts from here: we need to read errno on the processor we're leaving from,
+	// and nothing may run between the swapgs and the iretq.
+	cli
+
+	// any errno set by a syscall is stored in %gs:24 (CPU::Errno) and preserved across context switches.
 	// since all accesses to this are done via asm, we can just fetch the value out in userspace.
-	movq 0x2610, %r13
+	movq %gs:24, %r13
 
 	pop %rbp
+
+	testb $3, 8(%rsp)
+	jz 1f
+	swapgs
+1:
 	iretq
 
 
@@ -190,6 +207,10 @@ KillCrashedThread:
 	call Syscall_TerminateCrashedThread
 	jmp CleanUp
 
+HeapProfile:
+	call Syscall_HeapProfile
+	jmp CleanUp
+
 
 
 
@@ -211,9 +232,11 @@ SendSignalToThread:
 	jmp CleanUp
 
 SendMessage:
+	call Syscall_SendMessage
 	jmp CleanUp
 
 ReceiveMessage:
+	call Syscall_ReceiveMessage
 	jmp CleanUp
 
 Sleep:
@@ -276,6 +299,46 @@ ForkProcess:
 	call Syscall_ForkProcess
 	jmp CleanUp
 
+CreateChannel:
+	call Syscall_CreateChannel
+	jmp CleanUp
+
+OpenChannel:
+	call Syscall_OpenChannel
+	jmp CleanUp
+
+CloseChannel:
+	call Syscall_CloseChannel
+	jmp CleanUp
+
+ChannelWait:
+	call Syscall_ChannelWait
+	jmp CleanUp
+
+ChannelWake:
+	call Syscall_ChannelWake
+	jmp CleanUp
+
+OpenMessageQueue:
+	call Syscall_OpenMessageQueue
+	jmp CleanUp
+
+UnlinkMessageQueue:
+	call Syscall_UnlinkMessageQueue
+	jmp CleanUp
+
+MessageQueueAttr:
+	call Syscall_MessageQueueAttr
+	jmp CleanUp
+
+ChannelSize:
+	call Syscall_ChannelSize
+	jmp CleanUp
+
+ThreadAlive:
+	call Syscall_ThreadAlive
+	jmp CleanUp
+
 
 
 
@@ -349,6 +412,22 @@ ConnectIPCSocket:
 	call Syscall_ConnectIPCSocket
 	jmp CleanUp
 
+CreateEventPoll:
+	call Syscall_CreateEventPoll
+	jmp CleanUp
+
+ControlEventPoll:
+	call Syscall_ControlEventPoll
+	jmp CleanUp
+
+WaitEventPoll:
+	call Syscall_WaitEventPoll
+	jmp CleanUp
+
+MemoryUnmapAnonymous:
+	call Syscall_MUnmapAnon
+	jmp CleanUp
+
 
 .section .data
 
@@ -363,6 +442,7 @@ SyscallTable0:
 	.quad	ExitProc			// 0000
 	.quad	KillCrashedThread	// 0001
 	.quad	Fail				// 0002
+	.quad	HeapProfile			// 0003
 
 EndSyscallTable0:
 
@@ -392,6 +472,16 @@ SyscallTable1:
 	.quad	UnlockMutex			// 4018
 	.quad	TryLockMutex		// 4019
 	.quad	ForkProcess			// 4020
+	.quad	CreateChannel		// 4021
+	.quad	OpenChannel			// 4022
+	.quad	CloseChannel		// 4023
+	.quad	ChannelWait			// 4024
+	.quad	ChannelWake			// 4025
+	.quad	OpenMessageQueue	// 4026
+	.quad	UnlinkMessageQueue	// 4027
+	.quad	MessageQueueAttr	// 4028
+	.quad	ChannelSize			// 4029
+	.quad	ThreadAlive			// 4030
 EndSyscallTable1:
 
 
@@ -415,6 +505,10 @@ SyscallTable2:
 	.quad	ConnectNetSocket	// 8013
 	.quad	BindIPCSocket		// 8014
 	.quad	ConnectIPCSocket	// 8015
+	.quad	CreateEventPoll		// 8016
+	.quad	ControlEventPoll	// 8017
+	.quad	WaitEventPoll		// 8018
+	.quad	MemoryUnmapAnonymous	// 8019
 EndSyscallTable2:
 
 
@@ -16,8 +16,12 @@ namespace SystemCalls
 {
 	extern "C" fd_t Syscall_OpenAny(const char* path, uint64_t flags)
 	{
+		char kpath[MaxUserPath];
+		if(!MemoryManager::Virtual::CopyPathFromUser(kpath, path, sizeof(kpath)))
+			return -1;
+
 		// handle only files for now.
-		return OpenFile(path, (int) flags);
+		return OpenFile(kpath, (int) flags);
 	}
 
 	extern "C" fd_t Syscall_OpenSocket(uint64_t domain, uint64_t type, uint64_t protocol)
@@ -57,12 +61,20 @@ namespace SystemCalls
 
 	extern "C" err_t Syscall_BindIPCSocket(fd_t fd, const char* path)
 	{
-		return Network::BindSocket(fd, path);
+		char kpath[MaxUserPath];
+		if(!MemoryManager::Virtual::CopyPathFromUser(kpath, path, sizeof(kpath)))
+			return -1;
+
+		return Network::BindSocket(fd, kpath);
 	}
 
 	extern "C" err_t Syscall_ConnectIPCSocket(fd_t fd, const char* path)
 	{
-		return Network::ConnectSocket(fd, path);
+		char kpath[MaxUserPath];
+		if(!MemoryManager::Virtual::CopyPathFromUser(kpath, path, sizeof(kpath)))
+			return -1;
+
+		return Network::ConnectSocket(fd, kpath);
 	}
 
 
@@ -81,13 +93,33 @@ namespace SystemCalls
 		Flush(fd);
 	}
 
+	// the drivers touch the buffer directly, so make sure all of it is there first: populated, and with its own
+	// copies of any cow pages if they're going to write to it.
+	static bool CheckBuffer(const void* dat, uint64_t size, bool writable)
+	{
+		using namespace MemoryManager;
+		if(!Virtual::IsUserRange(dat, size) || !Virtual::ScatterList((uint64_t) dat, size, 0, writable).Check())
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return false;
+		}
+
+		return true;
+	}
+
 	extern "C" uint64_t Syscall_ReadAny(fd_t fd, const void* dat, uint64_t size)
 	{
+		if(!CheckBuffer(dat, size, true))
+			return (uint64_t) -1;
+
 		return Read(fd, (void*) dat, size);
 	}
 
 	extern "C" uint64_t Syscall_WriteAny(fd_t fd, const void* dat, uint64_t size)
 	{
+		if(!CheckBuffer(dat, size, false))
+			return (uint64_t) -1;
+
 		return Write(fd, (void*) dat, size);
 	}
 
@@ -98,7 +130,17 @@ namespace SystemCalls
 
 	extern "C" int Syscall_StatAny(fd_t fd, struct stat* st, bool statlink)
 	{
-		return Stat(fd, st, statlink);
+		struct stat ks;
+		Memory::Set(&ks, 0, sizeof(ks));
+
+		int ret = Stat(fd, &ks, statlink);
+		if(ret == 0 && !MemoryManager::Virtual::CopyToUser(st, &ks, sizeof(ks)))
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return -1;
+		}
+
+		return ret;
 	}
 
 	extern "C" uint64_t Syscall_GetSeekPos(fd_t fd)
@@ -6,9 +6,12 @@
 #include <HardwareAbstraction/VideoOutput.hpp>
 #include <Console.hpp>
 #include <Memory.hpp>
+#include <HardwareAbstraction/MemoryManager/KernelHeap.hpp>
+#include <stdlib.h>
 
 using namespace Library;
 using namespace Kernel::HardwareAbstraction::Devices;
+using namespace Kernel::HardwareAbstraction::MemoryManager;
 
 namespace Kernel {
 namespace HardwareAbstraction {
@@ -32,18 +35,26 @@ namespace LinearFramebuffer
 
 	#define CurrentFont			Font8x16_Thick
 
+	// everything draws into the back buffer (Kernel::GetFramebufferAddress(), plain cacheable ram), and
+	// RefreshBuffer() copies whatever was touched since the last refresh out to the real framebuffer.
+	// video memory is uncached (or at best write-combined), so reading it back -- which is what scrolling
+	// used to do -- is horrendously slow; with the back buffer the lfb is only ever written, in whole spans.
 
-	static void* memset32(void* dst, uint32_t val, uint64_t len)
+	// if more regions than this pile up between refreshes, they get collapsed into their bounding box.
+	#define MaxDirtyRegions		32
+
+	struct Rect
 	{
-		uintptr_t d0 = 0;
-		asm volatile(
-			"rep stosl"
-			:"=&D" (d0), "+&c" (len)
-			:"0" (dst), "a" (val)
-			:"memory");
+		uint16_t x1, y1;
+		uint16_t x2, y2;	// exclusive
+	};
 
-		return dst;
-	}
+	static Rect DirtyRegions[MaxDirtyRegions];
+	static uint64_t NumDirtyRegions = 0;
+
+	// these run from interrupt context too (panics, mostly), and from every processor, so the dirty list
+	// is behind a spinlock (which keeps interrupts off while it's held) rather than a mutex.
+	static Spinlock DirtyLock;
 
 	void Initialise()
 	{
@@ -70,18 +81,31 @@ namespace LinearFramebuffer
 			pos *= 4;	// 4 bytes per pixel
 
 			PutPixelAtAddr(pos, Colour);
+			MarkDirty(x, y, 1, 1);
 		}
 	}
 
+	// x / 255, exact for anything up to 255 * 255.
+	static inline uint32_t Div255(uint32_t x)
+	{
+		return (x + 1 + (x >> 8)) >> 8;
+	}
+
 	uint32_t BlendPixels(uint32_t bottom, uint32_t top)
 	{
-		uint8_t a = _ALP(top);
-		uint8_t b = (uint8_t)(((uint32_t)_ALP(bottom) * (255 - a)) / 255);
-		uint8_t alp = a + b;
-		uint8_t red = alp ? (uint8_t)(uint32_t)((_RED(bottom) * b + _RED(top) * a) / alp) : 0;
-		uint8_t gre = alp ? (uint8_t)(uint32_t)((_GRE(bottom) * b + _GRE(top) * a) / alp) : 0;
-		uint8_t blu = alp ? (uint8_t)(uint32_t)((_BLU(bottom) * b + _BLU(top) * a) / alp) : 0;
-		return GetRGBA(red, gre, blu, alp);
+		uint32_t a = _ALP(top);
+		if(a == 0xFF)	return top;
+
+		uint32_t b = Div255(_ALP(bottom) * (255 - a));
+		uint32_t alp = a + b;
+		if(alp == 0)	return 0;
+
+		// one division instead of three: x * ceil(2^24 / alp) >> 24 is exactly x / alp while x <= 255 * alp.
+		uint64_t recip = ((1ULL << 24) + alp - 1) / alp;
+		uint8_t red = (uint8_t) (((_RED(bottom) * b + _RED(top) * a) * recip) >> 24);
+		uint8_t gre = (uint8_t) (((_GRE(bottom) * b + _GRE(top) * a) * recip) >> 24);
+		uint8_t blu = (uint8_t) (((_BLU(bottom) * b + _BLU(top) * a) * recip) >> 24);
+		return GetRGBA(red, gre, blu, (uint8_t) alp);
 	}
 
 	uint32_t GetRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
@@ -89,48 +113,354 @@ namespace LinearFramebuffer
 		return (a * 0x1000000) + (r * 0x10000) + (g * 0x100) + (b * 0x1);
 	}
 
+	// glyphs are expanded once into 32bpp tiles for a given (foreground, background) pair, so drawing
+	// a character is just CharHeight row copies instead of decoding the font a bit at a time.
+	// each set holds all 256 glyphs in one colour pair; tiles are expanded on first use.
+	#define GlyphCacheSets		4
+	#define TileStride			12		// pixels per tile row: CharWidth, rounded up
+	#define TileSize			(CharHeight * TileStride)
+	#define MaxStringChunk		64
+
+	struct GlyphCacheSet
+	{
+		uint32_t fg;
+		uint32_t bg;
+		uint64_t lastuse;
+		uint64_t present[256 / 64];
+		uint32_t* tiles;
+	};
+
+	static GlyphCacheSet GlyphCache[GlyphCacheSets];
+	static uint64_t GlyphCacheClock = 0;
+
+	static Spinlock GlyphLock;
+
+	// callers must hold GlyphLock, so the set can't be evicted (by this or any other processor) from under them.
+	// the heap can sleep, which it mustn't do under a spinlock, so tiles for a new set come from the caller
+	// ('spare', allocated beforehand); if it's needed, it's taken (and *spare zeroed).
+
+	static GlyphCacheSet* GetGlyphSet(uint32_t fg, uint32_t bg, uint32_t** spare)
+	{
+		GlyphCacheSet* victim = &GlyphCache[0];
+		for(uint64_t i = 0; i < GlyphCacheSets; i++)
+		{
+			GlyphCacheSet* set = &GlyphCache[i];
+			if(set->tiles && set->fg == fg && set->bg == bg)
+			{
+				set->lastuse = ++GlyphCacheClock;
+				return set;
+			}
+
+			if(set->lastuse < victim->lastuse)
+				victim = set;
+		}
+
+		if(!victim->tiles)
+		{
+			if(!*spare)
+				return 0;
+
+			victim->tiles = *spare;
+			*spare = 0;
+		}
+
+		victim->fg = fg;
+		victim->bg = bg;
+		victim->lastuse = ++GlyphCacheClock;
+		Memory::Set(victim->present, 0, sizeof(victim->present));
+
+		return victim;
+	}
+
+	static uint32_t* GetGlyphTile(GlyphCacheSet* set, uint8_t c)
+	{
+		uint32_t* tile = set->tiles + (c * TileSize);
+		if(set->present[c / 64] & (1ULL << (c % 64)))
+			return tile;
+
+		uint32_t* row = tile;
+		for(int r = 0; r < CharHeight; r++)
+		{
+			uint8_t data = CurrentFont[c][r];
+			for(int col = 0; col < CharWidth; col++)
+				row[col] = (col < 8 && (data & (0x80 >> col))) ? set->fg : set->bg;
+
+			row += TileStride;
+		}
+
+		set->present[c / 64] |= (1ULL << (c % 64));
+		return tile;
+	}
+
+	// one row of one glyph; the back buffer is ordinary memory, so unaligned stores are fine.
+	// general registers only: nothing saves the sse state of whoever we interrupted.
+	static inline void BlitTileRow(uint32_t* dst, uint32_t* src)
+	{
+		uint64_t a, b, c, d;
+		asm volatile(
+			"movq  0(%4), %0\n"
+			"movq  8(%4), %1\n"
+			"movq 16(%4), %2\n"
+			"movq 24(%4), %3\n"
+			"movq %0,  0(%5)\n"
+			"movq %1,  8(%5)\n"
+			"movq %2, 16(%5)\n"
+			"movq %3, 24(%5)\n"
+			"movl 32(%4), %k0\n"
+			"movl %k0, 32(%5)\n"
+			: "=&r"(a), "=&r"(b), "=&r"(c), "=&r"(d) : "r"(src), "r"(dst) : "memory");
+	}
+
+	// fallback for when there's no memory for the cache, or the glyph hangs off the edge of the screen.
+	static void DrawCharSlow(uint8_t c, uint16_t x, uint16_t y, uint32_t Colour)
+	{
+		uint32_t* rowAddress = (uint32_t*) Kernel::GetFramebufferAddress() + y * GetResX() + x;
+		for(int row = 0; row < CharHeight && y + row < ResY; row++)
+		{
+			uint8_t data = CurrentFont[c][row];
+			for(int col = 0; col < CharWidth && x + col < ResX; col++)
+				rowAddress[col] = (col < 8 && (data & (0x80 >> col))) ? Colour : backColour;
+
+			rowAddress += GetResX();
+		}
+	}
+
 	void DrawChar(uint8_t c, uint16_t x, uint16_t y, uint32_t Colour)
+	{
+		if(!c)
+			return;
+
+		DrawString((const char*) &c, 1, x, y, Colour);
+	}
+
+	void DrawString(const char* str, uint64_t length, uint16_t x, uint16_t y, uint32_t Colour)
 	{
 		if(!Console::IsInitialised())
 			return;
 
-		if(!c)
+		if(x >= ResX || y >= ResY || length == 0)
 			return;
 
-		if(c == ' ')
-		{
-			for(uint64_t i = y; i < (uint64_t) (y + CharHeight); i++)
-				memset32((void*) (Kernel::GetFramebufferAddress() + (i * GetResX() + x) * 4), backColour, 4);
-		}
+		// only whole glyphs take the fast path; a partial one at the right (or bottom) edge is drawn slowly.
+		uint64_t whole = (y + CharHeight <= ResY) ? (ResX - x) / CharWidth : 0;
 
-		uint32_t* rowAddress = 0;
+		uint64_t count = __min(length, whole);
+		uint32_t* fb = (uint32_t*) Kernel::GetFramebufferAddress();
 
-		rowAddress = (uint32_t *) Kernel::GetFramebufferAddress() + y * GetResX() + x;
-		for(int row = 0; row < CharHeight; row++)
+		uint64_t done = 0;
+		while(done < count)
 		{
-			uint8_t data = CurrentFont[c][row];
-			uint32_t* columnAddress = rowAddress;
+			uint64_t n = __min(count - done, (uint64_t) MaxStringChunk);
+			uint32_t* tiles[MaxStringChunk];
+
+			// sets fill up in order, so while the last one is empty we might need the memory. it's only a hint:
+			// whatever happens, GetGlyphSet() sorts it out under the lock.
+			uint32_t* spare = 0;
+			if(!GlyphCache[GlyphCacheSets - 1].tiles)
+				spare = (uint32_t*) KernelHeap::AllocateChunk(256 * TileSize * 4);
 
-			int col = 0;
-			for(data = CurrentFont[c][row]; col < CharWidth; data <<= 1, col++)
+			LockSpinlock(GlyphLock);
+
+			GlyphCacheSet* set = GetGlyphSet(Colour, backColour, &spare);
+			if(!set)
 			{
-				if((data & 0x80) != 0)
-				{
-					*columnAddress = Colour;
-				}
-				else
+				UnlockSpinlock(GlyphLock);
+				break;
+			}
+
+			for(uint64_t i = 0; i < n; i++)
+				tiles[i] = GetGlyphTile(set, (uint8_t) str[done + i]);
+
+			// go row by row across the whole run, so the stores into the back buffer stay sequential.
+			uint32_t* rowAddress = fb + (y * ResX) + x + (done * CharWidth);
+			for(uint64_t row = 0; row < CharHeight; row++)
+			{
+				uint32_t* dst = rowAddress;
+				for(uint64_t i = 0; i < n; i++)
 				{
-					*columnAddress = 0;
+					BlitTileRow(dst, tiles[i] + (row * TileStride));
+					dst += CharWidth;
 				}
-				columnAddress++;
+
+				rowAddress += ResX;
 			}
-			rowAddress += GetResX();
+
+			UnlockSpinlock(GlyphLock);
+			done += n;
+
+			// someone else filled the last set first.
+			if(spare)
+				KernelHeap::FreeChunk(spare);
+		}
+
+		for(uint64_t i = done; i < length; i++)
+		{
+			uint64_t cx = x + (i * CharWidth);
+			if(cx >= ResX)
+				break;
+
+			DrawCharSlow((uint8_t) str[i], (uint16_t) cx, y, Colour);
+		}
+
+		MarkDirty(x, y, (uint16_t) __min(length * CharWidth, (uint64_t) ResX), CharHeight);
+	}
+
+	void MarkDirty(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+	{
+		if(x >= ResX || y >= ResY || w == 0 || h == 0)
+			return;
+
+		Rect r;
+		r.x1 = x;
+		r.y1 = y;
+		r.x2 = (uint16_t) ((uint32_t) x + w > ResX ? ResX : x + w);
+		r.y2 = (uint16_t) ((uint32_t) y + h > ResY ? ResY : y + h);
+
+		LockSpinlock(DirtyLock);
+
+		// text goes out one cell at a time, left to right; anything that overlaps or touches an existing
+		// region just grows it, so a whole line of output ends up as a single rect.
+		for(uint64_t i = 0; i < NumDirtyRegions; i++)
+		{
+			Rect& d = DirtyRegions[i];
+			if(r.x1 <= d.x2 && d.x1 <= r.x2 && r.y1 <= d.y2 && d.y1 <= r.y2)
+			{
+				d.x1 = r.x1 < d.x1 ? r.x1 : d.x1;
+				d.y1 = r.y1 < d.y1 ? r.y1 : d.y1;
+				d.x2 = r.x2 > d.x2 ? r.x2 : d.x2;
+				d.y2 = r.y2 > d.y2 ? r.y2 : d.y2;
+
+				UnlockSpinlock(DirtyLock);
+				return;
+			}
+		}
+
+		if(NumDirtyRegions == MaxDirtyRegions)
+		{
+			// out of slots: fold everything into the first one.
+			for(uint64_t i = 1; i < NumDirtyRegions; i++)
+			{
+				Rect& d = DirtyRegions[i];
+				r.x1 = d.x1 < r.x1 ? d.x1 : r.x1;
+				r.y1 = d.y1 < r.y1 ? d.y1 : r.y1;
+				r.x2 = d.x2 > r.x2 ? d.x2 : r.x2;
+				r.y2 = d.y2 > r.y2 ? d.y2 : r.y2;
+			}
+
+			Rect& d = DirtyRegions[0];
+			d.x1 = r.x1 < d.x1 ? r.x1 : d.x1;
+			d.y1 = r.y1 < d.y1 ? r.y1 : d.y1;
+			d.x2 = r.x2 > d.x2 ? r.x2 : d.x2;
+			d.y2 = r.y2 > d.y2 ? r.y2 : d.y2;
+
+			NumDirtyRegions = 1;
+		}
+		else
+		{
+			DirtyRegions[NumDirtyRegions++] = r;
+		}
+
+		UnlockSpinlock(DirtyLock);
+	}
+
+	void InsertDirtyRegion(DirtyRegion* r)
+	{
+		MarkDirty((uint16_t) r->GetX(), (uint16_t) r->GetY(), (uint16_t) r->GetWidth(), (uint16_t) r->GetHeight());
+	}
+
+	bool IsDirty()
+	{
+		return NumDirtyRegions > 0;
+	}
+
+	// copies a span out to video memory with non-temporal stores -- we never read the lfb back, so there's
+	// no point pulling it through the cache (and evicting everything else) on the way. movnti works from
+	// general registers, so this runs on the flush thread without touching anyone's sse state.
+	static void StreamCopy(uint8_t* dst, uint8_t* src, uint64_t bytes)
+	{
+		if(((uintptr_t) dst | (uintptr_t) src) & 0x7)
+		{
+			Memory::Copy(dst, src, bytes);
+			return;
+		}
+
+		while(bytes >= 32)
+		{
+			uint64_t a, b, c, d;
+			asm volatile(
+				"movq   0(%4), %0\n"
+				"movq   8(%4), %1\n"
+				"movq  16(%4), %2\n"
+				"movq  24(%4), %3\n"
+				"movnti %0,  0(%5)\n"
+				"movnti %1,  8(%5)\n"
+				"movnti %2, 16(%5)\n"
+				"movnti %3, 24(%5)\n"
+				: "=&r"(a), "=&r"(b), "=&r"(c), "=&r"(d) : "r"(src), "r"(dst) : "memory");
+
+			dst += 32;
+			src += 32;
+			bytes -= 32;
 		}
+
+		while(bytes >= 8)
+		{
+			uint64_t a;
+			asm volatile(
+				"movq   (%1), %0\n"
+				"movnti %0, (%2)\n"
+				: "=&r"(a) : "r"(src), "r"(dst) : "memory");
+
+			dst += 8;
+			src += 8;
+			bytes -= 8;
+		}
+
+		if(bytes > 0)
+			Memory::Copy(dst, src, bytes);
 	}
 
 	void RefreshBuffer()
 	{
+		uint8_t* back = (uint8_t*) Kernel::GetFramebufferAddress();
+		uint8_t* lfb = (uint8_t*) Kernel::GetTrueLFBAddress();
+
+		// no back buffer (the allocation failed), so everything already went straight to the screen.
+		if(back == lfb || NumDirtyRegions == 0)
+			return;
+
+		// take a snapshot, so drawing can carry on while we copy. anything drawn from here on is simply
+		// marked dirty again and goes out with the next refresh.
+		Rect regions[MaxDirtyRegions];
+		uint64_t count = 0;
+		{
+			LockSpinlock(DirtyLock);
+
+			count = NumDirtyRegions;
+			Memory::Copy(regions, DirtyRegions, count * sizeof(Rect));
+			NumDirtyRegions = 0;
+
+			UnlockSpinlock(DirtyLock);
+		}
+
+		uint64_t pitch = (uint64_t) ResX * 4;
+		for(uint64_t i = 0; i < count; i++)
+		{
+			// widen to 4-pixel (16 byte) boundaries, so each span is whole 8-byte stores.
+			uint64_t x1 = regions[i].x1 & ~0x3;
+			uint64_t x2 = (regions[i].x2 + 3) & ~0x3;
+			if(x2 > ResX)
+				x2 = ResX;
+
+			for(uint64_t y = regions[i].y1; y < regions[i].y2; y++)
+			{
+				uint64_t ofs = (y * pitch) + (x1 * 4);
+				StreamCopy(lfb + ofs, back + ofs, (x2 - x1) * 4);
+			}
+		}
 
+		// non-temporal stores are weakly ordered; make sure they've all landed.
+		asm volatile("sfence" ::: "memory");
 	}
 
 	uint16_t GetResX()
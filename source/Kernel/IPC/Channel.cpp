@@ -0,0 +1,359 @@
+// Channel.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <Kernel.hpp>
+#include <IPC.hpp>
+#include <HardwareAbstraction/MemoryManager.hpp>
+#include <HardwareAbstraction/Multitasking.hpp>
+#include <orionx/Channel.hpp>
+#include <rdestl/rdestl.h>
+#include <errno.h>
+
+using namespace Library;
+using namespace Kernel::HardwareAbstraction;
+using namespace Kernel::HardwareAbstraction::MemoryManager;
+
+// shared-memory ring channels; the layout and the userspace half are in orionx/Channel.hpp.
+// all the kernel does is map the pages, and put one side to sleep until the other moves its index.
+
+// the header page comes from the kernel heap, so we can always look at it ourselves, without caring whose
+// address space we're in (or whether whoever's asking still has it mapped).
+
+namespace Kernel {
+namespace IPC
+{
+	struct Channel
+	{
+		rde::string name;
+		uint64_t size;				// of the ring, in bytes
+
+		uint8_t* chunk;				// heap allocation holding the header page
+		ChannelHeader* header;
+		uint64_t* phys;				// header page, then the ring
+
+		// attachments, plus threads in the middle of ChannelWait().
+		uint64_t refs;
+
+		Multitasking::WaitQueue readers;	// waiting for data
+		Multitasking::WaitQueue writers;	// waiting for space
+	};
+
+	struct Attachment
+	{
+		Channel* channel;
+		pid_t pid;
+		uint64_t addr;
+	};
+
+	static rde::hash_map<rde::string, Channel*>* channelMap = 0;
+	static rde::vector<Attachment>* attachments = 0;
+	static Mutex channelLock;
+
+	// everything below is called with channelLock held.
+
+	static uint64_t MappedPages(Channel* ch)
+	{
+		return 1 + (2 * (ch->size / 0x1000));
+	}
+
+	// the header, then the ring, then the ring again.
+	static uint64_t Map(Channel* ch, Multitasking::Process* proc)
+	{
+		uint64_t ringpages = ch->size / 0x1000;
+		uint64_t virt = Virtual::AllocateVirtual(MappedPages(ch), 0, &proc->VAS, I_SharedPages | 0x07);
+
+		Virtual::MapAddress(virt, ch->phys[0], 0x07, proc->VAS.PML4);
+		for(uint64_t i = 0; i < ringpages; i++)
+		{
+			Virtual::MapAddress(virt + ((1 + i) * 0x1000), ch->phys[1 + i], 0x07, proc->VAS.PML4);
+			Virtual::MapAddress(virt + ((1 + ringpages + i) * 0x1000), ch->phys[1 + i], 0x07, proc->VAS.PML4);
+		}
+
+		return virt;
+	}
+
+	static void Unmap(Channel* ch, uint64_t virt, Multitasking::Process* proc)
+	{
+		Virtual::UnmapRegion(virt, MappedPages(ch), proc->VAS.PML4);
+		Virtual::FreeVirtual(virt, MappedPages(ch), &proc->VAS);
+	}
+
+	static void Put(Channel* ch)
+	{
+		assert(ch->refs > 0);
+		if(--ch->refs > 0)
+			return;
+
+		channelMap->erase(ch->name);
+
+		for(uint64_t i = 1; i < 1 + (ch->size / 0x1000); i++)
+			Physical::FreePage(ch->phys[i]);
+
+		delete[] ch->phys;
+		delete[] ch->chunk;
+		delete ch;
+	}
+
+	static Attachment* FindAttachment(uint64_t addr)
+	{
+		pid_t pid = Multitasking::GetCurrentProcessID();
+		for(auto& a : *attachments)
+		{
+			if(a.pid == pid && a.addr == addr)
+				return &a;
+		}
+
+		return 0;
+	}
+
+	static void Initialise()
+	{
+		if(!channelMap)		channelMap = new rde::hash_map<rde::string, Channel*>();
+		if(!attachments)	attachments = new rde::vector<Attachment>();
+	}
+
+	static uint64_t Attach(Channel* ch)
+	{
+		Multitasking::Process* proc = Multitasking::GetCurrentProcess();
+
+		Attachment a;
+		a.channel	= ch;
+		a.pid		= proc->ProcessID;
+		a.addr		= Map(ch, proc);
+
+		attachments->push_back(a);
+		return a.addr;
+	}
+
+
+
+	// copies the name in from userspace; false (with errno set) if it's bad.
+	static bool CopyName(const char* user, rde::string* name)
+	{
+		char buf[CHANNEL_NAME_MAX];
+		int64_t len = Virtual::CopyStringFromUser(buf, user, CHANNEL_NAME_MAX);
+		if(len < 0)
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return false;
+		}
+		else if(len == 0 || len >= CHANNEL_NAME_MAX)
+		{
+			Multitasking::SetThreadErrno(EINVAL);
+			return false;
+		}
+
+		*name = rde::string(buf);
+		return true;
+	}
+
+	// nobody sleeping on it will ever be woken by the other side now.
+	static void MarkClosed(Channel* ch)
+	{
+		ch->header->closed = 1;
+		__sync_synchronize();
+
+		Multitasking::WakeAll(ch->readers);
+		Multitasking::WakeAll(ch->writers);
+	}
+
+
+
+	extern "C" uint64_t Syscall_CreateChannel(const char* _name, uint64_t size)
+	{
+		if(size == 0 || size > CHANNEL_MAX_SIZE)
+		{
+			Multitasking::SetThreadErrno(EINVAL);
+			return 0;
+		}
+
+		rde::string name;
+		if(!CopyName(_name, &name))
+			return 0;
+
+		// offsets into the ring are taken modulo its size.
+		uint64_t ringsize = 0x1000;
+		while(ringsize < size)
+			ringsize *= 2;
+
+		AutoMutex lk(channelLock);
+		Initialise();
+
+		if(channelMap->find(name) != channelMap->end())
+		{
+			Multitasking::SetThreadErrno(EEXIST);
+			return 0;
+		}
+
+		Channel* ch = new Channel();
+		ch->name	= name;
+		ch->size	= ringsize;
+		ch->refs	= 1;
+		ch->phys	= new uint64_t[1 + (ringsize / 0x1000)];
+
+		ch->chunk	= new uint8_t[0x2000];
+		ch->header	= (ChannelHeader*) (((uint64_t) ch->chunk + 0xFFF) & I_AlignMask);
+		ch->phys[0]	= Virtual::LookupMapping((uint64_t) ch->header, (Virtual::PageMapStructure*) GetKernelCR3()) & I_AlignMask;
+
+		for(uint64_t i = 1; i < 1 + (ringsize / 0x1000); i++)
+			ch->phys[i] = Physical::AllocatePage();
+
+		Memory::Set(ch->header, 0, 0x1000);
+		ch->header->size = ringsize;
+
+		uint64_t addr = Attach(ch);
+
+		// nobody else can see it until it's in the map, so clear it now.
+		Memory::Set((void*) (addr + CHANNEL_HEADER_SIZE), 0, ringsize);
+
+		(*channelMap)[name] = ch;
+		return addr;
+	}
+
+	extern "C" uint64_t Syscall_OpenChannel(const char* _name)
+	{
+		rde::string name;
+		if(!CopyName(_name, &name))
+			return 0;
+
+		AutoMutex lk(channelLock);
+		Initialise();
+
+		auto it = channelMap->find(name);
+		if(it == channelMap->end())
+		{
+			Multitasking::SetThreadErrno(ENOENT);
+			return 0;
+		}
+
+		Channel* ch = it->second;
+		ch->refs++;
+
+		return Attach(ch);
+	}
+
+	extern "C" int64_t Syscall_CloseChannel(uint64_t addr)
+	{
+		AutoMutex lk(channelLock);
+		Initialise();
+
+		Attachment* a = FindAttachment(addr);
+		if(!a)
+		{
+			Multitasking::SetThreadErrno(EINVAL);
+			return -1;
+		}
+
+		Channel* ch = a->channel;
+		attachments->erase(a);
+
+		Unmap(ch, addr, Multitasking::GetCurrentProcess());
+
+		// the other side, and any of our threads still waiting on it, would never hear about it otherwise.
+		MarkClosed(ch);
+
+		Put(ch);
+		return 0;
+	}
+
+	// sleeps until the producer's head (CHANNEL_DATA) or the consumer's tail (CHANNEL_SPACE) moves from 'expected'.
+	// returns straight away if it already has; either way, the caller checks the ring again.
+	// fails with EPIPE once the channel has been closed, since then nothing is ever going to move.
+	extern "C" int64_t Syscall_ChannelWait(uint64_t addr, uint64_t which, uint64_t expected)
+	{
+		Channel* ch = 0;
+		{
+			AutoMutex lk(channelLock);
+			Initialise();
+
+			Attachment* a = FindAttachment(addr);
+			if(!a || (which != CHANNEL_DATA && which != CHANNEL_SPACE))
+			{
+				Multitasking::SetThreadErrno(EINVAL);
+				return -1;
+			}
+
+			ch = a->channel;
+			ch->refs++;
+		}
+
+		Multitasking::WaitQueue& wq = (which == CHANNEL_DATA ? ch->readers : ch->writers);
+		volatile uint64_t* index = (which == CHANNEL_DATA ? &ch->header->head : &ch->header->tail);
+
+		// MarkClosed() sets the flag before it takes this lock to wake us, so checking it here can't miss it.
+		LockSpinlock(wq.lock);
+		if(*index == expected && !ch->header->closed)
+			Multitasking::SleepOn(wq);
+
+		bool closed = ch->header->closed;
+		UnlockSpinlock(wq.lock);
+
+		AutoMutex lk(channelLock);
+		Put(ch);
+
+		if(closed)
+		{
+			Multitasking::SetThreadErrno(EPIPE);
+			return -1;
+		}
+
+		return 0;
+	}
+
+	extern "C" int64_t Syscall_ChannelWake(uint64_t addr, uint64_t which)
+	{
+		AutoMutex lk(channelLock);
+		Initialise();
+
+		Attachment* a = FindAttachment(addr);
+		if(!a || (which != CHANNEL_DATA && which != CHANNEL_SPACE))
+		{
+			Multitasking::SetThreadErrno(EINVAL);
+			return -1;
+		}
+
+		Multitasking::WakeAll(which == CHANNEL_DATA ? a->channel->readers : a->channel->writers);
+		return 0;
+	}
+
+	// the header's copy of the size is in shared memory, so a side that doesn't trust the other one asks us.
+	extern "C" uint64_t Syscall_ChannelSize(uint64_t addr)
+	{
+		AutoMutex lk(channelLock);
+		Initialise();
+
+		Attachment* a = FindAttachment(addr);
+		if(!a)
+		{
+			Multitasking::SetThreadErrno(EINVAL);
+			return 0;
+		}
+
+		return a->channel->size;
+	}
+
+	void CloseChannels(Multitasking::Process* p)
+	{
+		AutoMutex lk(channelLock);
+		Initialise();
+
+		// don't bother unmapping; the address space is going away anyway.
+		for(size_t i = 0; i < attachments->size(); )
+		{
+			Attachment& a = (*attachments)[i];
+			if(a.pid != p->ProcessID)
+			{
+				i++;
+				continue;
+			}
+
+			Channel* ch = a.channel;
+			attachments->erase(attachments->begin() + i);
+
+			MarkClosed(ch);
+			Put(ch);
+		}
+	}
+}
+}
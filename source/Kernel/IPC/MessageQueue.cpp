@@ -0,0 +1,696 @@
+// MessageQueue.cpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#include <Kernel.hpp>
+#include <IPC.hpp>
+#include <HardwareAbstraction/Multitasking.hpp>
+#include <HardwareAbstraction/Filesystems/Poll.hpp>
+#include <rdestl/rdestl.h>
+#include <errno.h>
+#include <mqueue.h>
+#include <sys/stat.h>
+
+using namespace Kernel::HardwareAbstraction;
+using namespace Kernel::HardwareAbstraction::Filesystems;
+
+// posix message queues. every slot is allocated when the queue is created; sending takes a slot off the free list,
+// fills it, and links it onto the list for its priority, and receiving does the reverse. none of that allocates.
+
+// the message itself is copied with no locks held, since the other end of the copy is userspace and can fault.
+// the locks only cover moving slots between lists: the free list belongs to the senders' wait queue lock,
+// and the priority lists to the receivers'. if the copy does fault, the slot goes back where it came from.
+
+// anyone about to block holds a reference, so closing the descriptor from another thread can't free the queue
+// out from under them.
+
+namespace Kernel {
+namespace IPC
+{
+	#define DefaultMaxMessages		10
+	#define DefaultMessageSize		8192
+	#define MaxMessageSize			0x10000
+	#define MaxQueueName			64
+
+	using namespace MemoryManager;
+
+	struct Slot
+	{
+		Slot* next;
+		uint64_t length;
+		uint64_t priority;
+
+		uint8_t data[];
+	};
+
+	struct MessageQueue
+	{
+		rde::string name;
+
+		uint64_t maxmsg;
+		uint64_t msgsize;
+		uint64_t slotsize;
+		uint8_t* slots;
+
+		// under senders.lock
+		Slot* free;
+
+		// under receivers.lock; bit n of 'ready' is set when there's something at priority n.
+		Slot* heads[MQ_PRIO_MAX];
+		Slot* tails[MQ_PRIO_MAX];
+		uint32_t ready;
+		uint64_t count;
+
+		// open descriptors, plus one for the name until it's unlinked.
+		uint64_t refs;
+
+		Multitasking::WaitQueue senders;		// waiting for a free slot
+		Multitasking::WaitQueue receivers;		// waiting for a message
+
+		// for event polls only; nobody sleeps on its wait queue.
+		PollSource poll;
+	};
+
+	static rde::hash_map<rde::string, MessageQueue*>* queueMap = 0;
+	static Mutex queueLock;
+
+	static Slot* GetSlot(MessageQueue* mq, uint64_t i)
+	{
+		return (Slot*) (mq->slots + (i * mq->slotsize));
+	}
+
+	static MessageQueue* CreateQueue(const rde::string& name, uint64_t maxmsg, uint64_t msgsize)
+	{
+		MessageQueue* mq = new MessageQueue();
+		mq->name		= name;
+		mq->maxmsg		= maxmsg;
+		mq->msgsize		= msgsize;
+		mq->slotsize	= (sizeof(Slot) + msgsize + 0xF) & ~((uint64_t) 0xF);
+		mq->slots		= new uint8_t[maxmsg * mq->slotsize];
+		mq->free		= 0;
+		mq->ready		= 0;
+		mq->count		= 0;
+		mq->refs		= 1;
+
+		for(uint64_t i = 0; i < MQ_PRIO_MAX; i++)
+		{
+			mq->heads[i] = 0;
+			mq->tails[i] = 0;
+		}
+
+		for(uint64_t i = maxmsg; i > 0; i--)
+		{
+			Slot* s = GetSlot(mq, i - 1);
+			s->next = mq->free;
+			mq->free = s;
+		}
+
+		return mq;
+	}
+
+	// with queueLock held.
+	static void Put(MessageQueue* mq)
+	{
+		assert(mq->refs > 0);
+		if(--mq->refs > 0)
+			return;
+
+		delete[] mq->slots;
+		delete mq;
+	}
+
+	// the queue behind a node, with a reference for the caller to Release(); 0 if it's been closed.
+	static MessageQueue* Acquire(VFS::vnode* node)
+	{
+		AutoMutex lk(queueLock);
+
+		MessageQueue* mq = (MessageQueue*) node->info->data;
+		if(mq) mq->refs++;
+
+		return mq;
+	}
+
+	static void Release(MessageQueue* mq)
+	{
+		AutoMutex lk(queueLock);
+		Put(mq);
+	}
+
+	// syscalls only ever hand us userspace pointers (the entry points check), but read() and write() from inside
+	// the kernel can come with kernel ones.
+	static bool CopyIn(void* dst, const void* src, size_t len)
+	{
+		if(Virtual::IsUserRange(src, len))
+			return Virtual::CopyFromUser(dst, src, len);
+
+		Memory::Copy(dst, src, len);
+		return true;
+	}
+
+	static bool CopyOut(void* dst, const void* src, size_t len)
+	{
+		if(Virtual::IsUserRange(dst, len))
+			return Virtual::CopyToUser(dst, src, len);
+
+		Memory::Copy(dst, src, len);
+		return true;
+	}
+
+	// "/name" and "name" are the same queue; anything else with a slash in it isn't a queue.
+	// 'path' is a kernel string; see CopyPath() for ones from userspace.
+	static bool GetName(const char* path, rde::string& out)
+	{
+		if(!path)
+			return false;
+
+		if(path[0] == '/')
+			path++;
+
+		out = rde::string(path);
+		if(out.length() == 0 || out.length() >= MaxQueueName)
+			return false;
+
+		for(size_t i = 0; i < out.length(); i++)
+		{
+			if(out[i] == '/')
+				return false;
+		}
+
+		return true;
+	}
+
+	// with room for the leading slash.
+	static bool CopyPath(const char* user, char (&buf)[MaxQueueName + 1])
+	{
+		int64_t len = Virtual::CopyStringFromUser(buf, user, sizeof(buf));
+		if(len < 0)
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return false;
+		}
+		else if(len == sizeof(buf))
+		{
+			Multitasking::SetThreadErrno(EINVAL);
+			return false;
+		}
+
+		return true;
+	}
+
+	// takes a reference; Release() it when done.
+	static MessageQueue* GetQueue(fd_t fd, VFS::fileentry** fe)
+	{
+		VFS::fileentry* f = VFS::FileEntryFromFD(&Multitasking::GetCurrentProcess()->iocontext, fd);
+		MessageQueue* mq = 0;
+
+		if(!f || f->node->info->driver->GetType() != FSDriverType::MessageQueue || !(mq = Acquire(f->node)))
+		{
+			Multitasking::SetThreadErrno(EBADF);
+			return 0;
+		}
+
+		if(fe) *fe = f;
+		return mq;
+	}
+
+	static bool GetDeadline(const struct timespec* abstime, uint64_t* deadline)
+	{
+		struct timespec ts;
+		if(!Virtual::CopyFromUser(&ts, abstime, sizeof(ts)))
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return false;
+		}
+
+		if(ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000)
+		{
+			Multitasking::SetThreadErrno(EINVAL);
+			return false;
+		}
+
+		*deadline = ((uint64_t) ts.tv_sec * 1000) + ((uint64_t) ts.tv_nsec / 1000000);
+		return true;
+	}
+
+	// how many milliseconds until the (absolute, realtime) deadline; 0 if there isn't one, -1 if it's passed.
+	static int64_t Remaining(bool hasdeadline, uint64_t deadline)
+	{
+		if(!hasdeadline)
+			return 0;
+
+		uint64_t now = Time::Now();
+		return deadline > now ? (int64_t) (deadline - now) : -1;
+	}
+
+	static int64_t Send(MessageQueue* mq, const void* msg, size_t len, uint64_t prio, bool nonblock, bool hasdeadline, uint64_t deadline)
+	{
+		if(len > mq->msgsize)
+		{
+			Multitasking::SetThreadErrno(EMSGSIZE);
+			return -1;
+		}
+
+		if(prio >= MQ_PRIO_MAX)
+		{
+			Multitasking::SetThreadErrno(EINVAL);
+			return -1;
+		}
+
+		LockSpinlock(mq->senders.lock);
+		while(!mq->free)
+		{
+			int64_t timeout = Remaining(hasdeadline, deadline);
+			if(nonblock || timeout < 0)
+			{
+				UnlockSpinlock(mq->senders.lock);
+				Multitasking::SetThreadErrno(nonblock ? EAGAIN : ETIMEDOUT);
+				return -1;
+			}
+
+			Multitasking::SleepOn(mq->senders, (uint64_t) timeout);
+		}
+
+		Slot* s = mq->free;
+		mq->free = s->next;
+		UnlockSpinlock(mq->senders.lock);
+
+		if(!CopyIn(s->data, msg, len))
+		{
+			LockSpinlock(mq->senders.lock);
+			s->next = mq->free;
+			mq->free = s;
+			UnlockSpinlock(mq->senders.lock);
+
+			// someone else might have gone to sleep while we had it.
+			Multitasking::WakeOne(mq->senders);
+			Multitasking::SetThreadErrno(EFAULT);
+			return -1;
+		}
+
+		s->next = 0;
+		s->length = len;
+		s->priority = prio;
+
+		LockSpinlock(mq->receivers.lock);
+		{
+			if(mq->tails[prio])	mq->tails[prio]->next = s;
+			else				mq->heads[prio] = s;
+
+			mq->tails[prio] = s;
+			mq->ready |= (1U << prio);
+			mq->count++;
+		}
+		UnlockSpinlock(mq->receivers.lock);
+
+		Multitasking::WakeOne(mq->receivers);
+		NotifyPoll(mq->poll, EPOLLIN);
+		return 0;
+	}
+
+	static int64_t Receive(MessageQueue* mq, void* buf, size_t len, uint32_t* prio, bool nonblock, bool hasdeadline, uint64_t deadline)
+	{
+		if(len < mq->msgsize)
+		{
+			Multitasking::SetThreadErrno(EMSGSIZE);
+			return -1;
+		}
+
+		LockSpinlock(mq->receivers.lock);
+		while(!mq->ready)
+		{
+			int64_t timeout = Remaining(hasdeadline, deadline);
+			if(nonblock || timeout < 0)
+			{
+				UnlockSpinlock(mq->receivers.lock);
+				Multitasking::SetThreadErrno(nonblock ? EAGAIN : ETIMEDOUT);
+				return -1;
+			}
+
+			Multitasking::SleepOn(mq->receivers, (uint64_t) timeout);
+		}
+
+		// highest priority first, oldest first within that.
+		uint64_t p = 31 - (uint64_t) __builtin_clz(mq->ready);
+
+		Slot* s = mq->heads[p];
+		mq->heads[p] = s->next;
+		if(!mq->heads[p])
+		{
+			mq->tails[p] = 0;
+			mq->ready &= ~(1U << p);
+		}
+
+		mq->count--;
+		UnlockSpinlock(mq->receivers.lock);
+
+		uint64_t ret = s->length;
+		uint32_t pr = (uint32_t) s->priority;
+
+		if(!CopyOut(buf, s->data, s->length) || (prio && !CopyOut(prio, &pr, sizeof(pr))))
+		{
+			// put it back at the front, so it's the next one out again.
+			LockSpinlock(mq->receivers.lock);
+			{
+				s->next = mq->heads[p];
+				mq->heads[p] = s;
+				if(!mq->tails[p])
+					mq->tails[p] = s;
+
+				mq->ready |= (1U << p);
+				mq->count++;
+			}
+			UnlockSpinlock(mq->receivers.lock);
+
+			Multitasking::WakeOne(mq->receivers);
+			Multitasking::SetThreadErrno(EFAULT);
+			return -1;
+		}
+
+		LockSpinlock(mq->senders.lock);
+		s->next = mq->free;
+		mq->free = s;
+		UnlockSpinlock(mq->senders.lock);
+
+		Multitasking::WakeOne(mq->senders);
+		NotifyPoll(mq->poll, EPOLLOUT);
+		return (int64_t) ret;
+	}
+
+
+
+	extern "C" fd_t Syscall_OpenMessageQueue(const char* path, int flags, const struct mq_attr* _attr)
+	{
+		char buf[MaxQueueName + 1];
+		if(!CopyPath(path, buf))
+			return -1;
+
+		rde::string name;
+		if(!GetName(buf, name))
+		{
+			Multitasking::SetThreadErrno(EINVAL);
+			return -1;
+		}
+
+		uint64_t maxmsg = DefaultMaxMessages;
+		uint64_t msgsize = DefaultMessageSize;
+
+		if((flags & O_CREAT) && _attr)
+		{
+			struct mq_attr attr;
+			if(!Virtual::CopyFromUser(&attr, _attr, sizeof(attr)))
+			{
+				Multitasking::SetThreadErrno(EFAULT);
+				return -1;
+			}
+
+			if(attr.mq_maxmsg <= 0 || attr.mq_maxmsg > MaxMessages || attr.mq_msgsize <= 0 || attr.mq_msgsize > MaxMessageSize)
+			{
+				Multitasking::SetThreadErrno(EINVAL);
+				return -1;
+			}
+
+			maxmsg = (uint64_t) attr.mq_maxmsg;
+			msgsize = (uint64_t) attr.mq_msgsize;
+		}
+
+		VFS::Filesystem* fs = VFS::GetFilesystemAtPath(VFS::FS_MQUEUE_MOUNTPOINT);
+		assert(fs);
+		assert(fs->driver);
+
+		AutoMutex lk(queueLock);
+		if(!queueMap) queueMap = new rde::hash_map<rde::string, MessageQueue*>();
+
+		MessageQueue* mq = 0;
+
+		auto it = queueMap->find(name);
+		if(it != queueMap->end())
+		{
+			if((flags & O_CREAT) && (flags & O_EXCL))
+			{
+				Multitasking::SetThreadErrno(EEXIST);
+				return -1;
+			}
+
+			mq = it->second;
+		}
+		else
+		{
+			if(!(flags & O_CREAT))
+			{
+				Multitasking::SetThreadErrno(ENOENT);
+				return -1;
+			}
+
+			// this one's for the name.
+			mq = CreateQueue(name, maxmsg, msgsize);
+			(*queueMap)[name] = mq;
+		}
+
+		mq->refs++;
+
+		VFS::vnode* node = VFS::CreateNode(fs->driver);
+		node->type = VFS::VNodeType::File;
+		node->info->data = (void*) mq;
+
+		VFS::fileentry* fe = VFS::Open(&Multitasking::GetCurrentProcess()->iocontext, node, flags & ~O_CREAT);
+		assert(fe);
+
+		return fe->fd;
+	}
+
+	static int64_t Unlink(const char* path)
+	{
+		rde::string name;
+		if(!GetName(path, name))
+		{
+			Multitasking::SetThreadErrno(EINVAL);
+			return -1;
+		}
+
+		AutoMutex lk(queueLock);
+		if(!queueMap)
+		{
+			Multitasking::SetThreadErrno(ENOENT);
+			return -1;
+		}
+
+		auto it = queueMap->find(name);
+		if(it == queueMap->end())
+		{
+			Multitasking::SetThreadErrno(ENOENT);
+			return -1;
+		}
+
+		// anyone who has it open can keep using it; it just can't be opened again.
+		MessageQueue* mq = it->second;
+		queueMap->erase(it);
+
+		Put(mq);
+		return 0;
+	}
+
+	extern "C" int64_t Syscall_UnlinkMessageQueue(const char* path)
+	{
+		char buf[MaxQueueName + 1];
+		if(!CopyPath(path, buf))
+			return -1;
+
+		return Unlink(buf);
+	}
+
+	extern "C" int64_t Syscall_SendMessage(fd_t fd, const void* msg, size_t len, uint64_t prio, const struct timespec* abstime)
+	{
+		if(!Virtual::IsUserRange(msg, len))
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return -1;
+		}
+
+		// read the deadline now; we can't touch userspace once we've got a spinlock.
+		uint64_t deadline = 0;
+		if(abstime && !GetDeadline(abstime, &deadline))
+			return -1;
+
+		VFS::fileentry* fe = 0;
+		MessageQueue* mq = GetQueue(fd, &fe);
+		if(!mq)
+			return -1;
+
+		int64_t ret = Send(mq, msg, len, prio, fe->flags & O_NONBLOCK, abstime != 0, deadline);
+
+		Release(mq);
+		return ret;
+	}
+
+	extern "C" int64_t Syscall_ReceiveMessage(fd_t fd, void* buf, size_t len, uint32_t* prio, const struct timespec* abstime)
+	{
+		if(!Virtual::IsUserRange(buf, len) || (prio && !Virtual::IsUserRange(prio, sizeof(uint32_t))))
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return -1;
+		}
+
+		uint64_t deadline = 0;
+		if(abstime && !GetDeadline(abstime, &deadline))
+			return -1;
+
+		VFS::fileentry* fe = 0;
+		MessageQueue* mq = GetQueue(fd, &fe);
+		if(!mq)
+			return -1;
+
+		int64_t ret = Receive(mq, buf, len, prio, fe->flags & O_NONBLOCK, abstime != 0, deadline);
+
+		Release(mq);
+		return ret;
+	}
+
+	// mq_getattr and mq_setattr; only O_NONBLOCK can be changed, and that belongs to the descriptor.
+	extern "C" int64_t Syscall_MessageQueueAttr(fd_t fd, const struct mq_attr* newattr, struct mq_attr* oldattr)
+	{
+		struct mq_attr na;
+		if(newattr && !Virtual::CopyFromUser(&na, newattr, sizeof(na)))
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return -1;
+		}
+
+		VFS::fileentry* fe = 0;
+		MessageQueue* mq = GetQueue(fd, &fe);
+		if(!mq)
+			return -1;
+
+		struct mq_attr oa;
+		oa.mq_flags		= (long) (fe->flags & O_NONBLOCK);
+		oa.mq_maxmsg	= (long) mq->maxmsg;
+		oa.mq_msgsize	= (long) mq->msgsize;
+		oa.mq_curmsgs	= (long) mq->count;
+
+		Release(mq);
+
+		if(oldattr && !Virtual::CopyToUser(oldattr, &oa, sizeof(oa)))
+		{
+			Multitasking::SetThreadErrno(EFAULT);
+			return -1;
+		}
+
+		if(newattr)
+		{
+			if(na.mq_flags & O_NONBLOCK)	fe->flags |= O_NONBLOCK;
+			else							fe->flags &= ~((uint64_t) O_NONBLOCK);
+		}
+
+		return 0;
+	}
+
+
+
+
+	MessageQueueFS::MessageQueueFS() : FSDriver(nullptr, FSDriverType::MessageQueue)
+	{
+		this->_seekable = false;
+	}
+
+	MessageQueueFS::~MessageQueueFS()
+	{
+	}
+
+	// queues are only created through mq_open.
+	bool MessageQueueFS::Create(VFS::vnode*, const char*, uint64_t, uint64_t)
+	{
+		return false;
+	}
+
+	bool MessageQueueFS::Delete(VFS::vnode*, const char* path)
+	{
+		return Unlink(path + strlen(VFS::FS_MQUEUE_MOUNTPOINT)) == 0;
+	}
+
+	// so a plain open() of /dev/_mq/name works too, for queues that already exist.
+	bool MessageQueueFS::Traverse(VFS::vnode* node, const char* path, char**)
+	{
+		rde::string name;
+		if(!GetName(path + strlen(VFS::FS_MQUEUE_MOUNTPOINT), name))
+			return false;
+
+		AutoMutex lk(queueLock);
+		if(!queueMap)
+			return false;
+
+		auto it = queueMap->find(name);
+		if(it == queueMap->end())
+			return false;
+
+		it->second->refs++;
+		node->info->data = (void*) it->second;
+		return true;
+	}
+
+	// read() and write() are blocking receive and send, at priority 0.
+	size_t MessageQueueFS::Read(VFS::vnode* node, void* buf, off_t, size_t length)
+	{
+		MessageQueue* mq = Acquire(node);
+		if(!mq)
+			return 0;
+
+		int64_t ret = Receive(mq, buf, length, 0, false, false, 0);
+
+		Release(mq);
+		return ret < 0 ? 0 : (size_t) ret;
+	}
+
+	size_t MessageQueueFS::Write(VFS::vnode* node, const void* buf, off_t, size_t length)
+	{
+		MessageQueue* mq = Acquire(node);
+		if(!mq)
+			return 0;
+
+		int64_t ret = Send(mq, buf, length, 0, false, false, 0);
+
+		Release(mq);
+		return ret < 0 ? 0 : length;
+	}
+
+	void MessageQueueFS::Flush(VFS::vnode*)
+	{
+	}
+
+	void MessageQueueFS::Stat(VFS::vnode* node, struct stat* st, bool)
+	{
+		MessageQueue* mq = (MessageQueue*) node->info->data;
+		st->st_size = (off_t) (mq->count * mq->msgsize);
+	}
+
+	void MessageQueueFS::Close(VFS::vnode* node)
+	{
+		MessageQueue* mq = (MessageQueue*) node->info->data;
+		if(!mq)
+			return;
+
+		AutoMutex lk(queueLock);
+		node->info->data = 0;
+		Put(mq);
+	}
+
+	rde::vector<VFS::vnode*> MessageQueueFS::ReadDir(VFS::vnode*)
+	{
+		return rde::vector<VFS::vnode*>();
+	}
+
+	// neither of these take locks; a stale answer is fine, since the wait asks again.
+	uint32_t MessageQueueFS::Poll(VFS::vnode* node)
+	{
+		MessageQueue* mq = (MessageQueue*) node->info->data;
+		if(!mq)
+			return EPOLLERR;
+
+		return (mq->ready ? EPOLLIN : 0) | (mq->free ? EPOLLOUT : 0);
+	}
+
+	PollSource* MessageQueueFS::GetPollSource(VFS::vnode* node)
+	{
+		MessageQueue* mq = (MessageQueue*) node->info->data;
+		return mq ? &mq->poll : 0;
+	}
+}
+}
@@ -32,7 +32,8 @@ namespace IPC
 
 		Multitasking::Thread* thread = Multitasking::GetThread(tid);
 
-		if(!thread || !thread->Parent)
+		// dead threads stay registered until they're joined, but there's nobody left to signal.
+		if(!thread || !thread->Parent || thread->State == STATE_DEAD)
 		{
 			Log(1, "Invalid target thread - %d", tid);
 			Multitasking::SetThreadErrno(ESRCH);
@@ -77,34 +78,14 @@ namespace IPC
 		*/
 
 		uint64_t ptr = thread->StackPointer;
-		uint64_t ustack = 0;
-		if(thread->Parent != Multitasking::GetCurrentProcess())
+		bool other = (thread->Parent != Multitasking::GetCurrentProcess());
+		if(other)
 		{
-			// map kernel stack
-			{
-				// map.
-				uint64_t s = thread->StackPointer;
-				uint64_t diff = s - (s & ((uint64_t) ~0xFFF));
-
-				uint64_t p1 = Virtual::GetMapping(s & ((uint64_t) ~0xFFF), thread->Parent->VAS.PML4);
-				ptr = Virtual::AllocateVirtual();
-				Virtual::MapAddress(ptr, p1, 0x7);
-
-				ptr += diff;
-			}
-
-			// also need to map the user stack.
-			{
-				// map.
-				uint64_t s = *((uint64_t*) (ptr + 144));
-				uint64_t diff = s - (s & ((uint64_t) ~0xFFF));
+			// get at its kernel stack through the direct map.
+			uint64_t s = thread->StackPointer;
+			uint64_t p1 = Virtual::GetMapping(s & ((uint64_t) ~0xFFF), thread->Parent->VAS.PML4);
 
-				uint64_t p1 = Virtual::GetMapping(s & ((uint64_t) ~0xFFF), thread->Parent->VAS.PML4);
-				ustack = Virtual::AllocateVirtual();
-				Virtual::MapAddress(ustack, p1, 0x7);
-
-				ustack += diff;
-			}
+			ptr = (uint64_t) Virtual::PhysToDirect(p1 & I_AlignMask) + (s & 0xFFF);
 		}
 
 		sighandler_t handler = tproc->SignalHandlers[signum];
@@ -115,24 +96,23 @@ namespace IPC
 		{
 			uint64_t oldrip					= *((uint64_t*) (ptr + 120));
 
-			*((uint64_t*) (ptr + 120))		= (uint64_t) handler;
-			*((uint64_t*) (ptr + 0))		= (uint64_t) signum;		// signum
-
-			*((uint64_t*) (ptr + 144))		-= 0x8;
-			*((uint64_t*) (*((uint64_t*) (ptr + 144))))	= oldrip;
-
+			// the user stack might be in its address space, not ours; either way it's userspace's, so it might
+			// not be there at all. leave the thread as it was if it isn't.
+			uint64_t usp = *((uint64_t*) (ptr + 144)) - 0x8;
+			bool pushed = false;
+			if(other)	pushed = Virtual::CopyFromKernel((uint64_t) &oldrip, usp, sizeof(uint64_t), &thread->Parent->VAS);
+			else		pushed = Virtual::CopyToUser((void*) usp, &oldrip, sizeof(uint64_t));
 
-
-			// should be done, time to clean up.
-			if(thread->Parent != Multitasking::GetCurrentProcess())
+			if(!pushed)
 			{
-				Virtual::FreeVirtual(ustack & ((uint64_t) ~0xFFF), 1);
-				Virtual::FreeVirtual(ptr & ((uint64_t) ~0xFFF), 1);
-
-				Virtual::UnmapAddress(ptr & ((uint64_t) ~0xFFF));
-				Virtual::UnmapAddress(ustack & ((uint64_t) ~0xFFF));
+				Log(1, "Could not deliver signal %d to thread %d: bad user stack (%x)", signum, thread->ThreadID, usp);
+				return;
 			}
 
+			*((uint64_t*) (ptr + 120))		= (uint64_t) handler;
+			*((uint64_t*) (ptr + 0))		= (uint64_t) signum;		// signum
+			*((uint64_t*) (ptr + 144))		= usp;
+
 			Multitasking::WakeForMessage(thread);
 		}
 		else
@@ -206,20 +186,21 @@ namespace IPC
 				0x18 extra bytes to spare.
 			*/
 
-			// store where we were interrupted.
+			// store where we were interrupted, then push it, the old rdi and _sighandler (in that order) onto the
+			// user stack, all at once so a bad stack leaves everything as it was.
 			uint64_t oldrip					= *(rbp + 9);
+			uint64_t frame[3]				= { (uint64_t) _sighandler, *(rbp + 6), oldrip };
+			uint64_t usp					= *(rbp + 12) - sizeof(frame);
+
+			if(!Virtual::CopyToUser((void*) usp, frame, sizeof(frame)))
+			{
+				Log(1, "Could not deliver signal %d to thread %d: bad user stack (%x)", signum, thread->ThreadID, usp);
+				return;
+			}
 
 			// modify.
 			*(rbp + 9)						= (uint64_t) handler;
-
-			*(rbp + 12)						-= 0x8;
-			*((uint64_t*) (*(rbp + 12)))	= oldrip;
-
-			*(rbp + 12)						-= 0x8;
-			*((uint64_t*) (*(rbp + 12)))	= *(rbp + 6);
-
-			*(rbp + 12)						-= 0x8;
-			*((uint64_t*) (*(rbp + 12)))	= (uint64_t) _sighandler;
+			*(rbp + 12)						= usp;
 
 			// modify rdi (signum)
 			*(rbp + 6) = (uint64_t) signum;
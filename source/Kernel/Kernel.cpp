@@ -117,6 +117,9 @@ namespace Kernel
 			Memory::Set((void*) start, 0, length);
 		}
 
+		// per-processor data lives behind %gs; set that up before anything asks for the current thread.
+		SMP::Initialise();
+
 
 		// check.
 		assert(MultibootMagic == 0x2BADB002);
@@ -193,6 +196,9 @@ namespace Kernel
 			UHALT();
 		}
 
+		// needs to know about pcids.
+		Virtual::InitialiseTLB();
+
 		// check if we have enough memory.
 		if(K_SystemMemoryInBytes < 0x02000000)
 		{
@@ -212,6 +218,9 @@ namespace Kernel
 			Log("Memory map relocation complete");
 		}
 
+		// needs the memory map, and cpuid for 1gb pages.
+		Virtual::InitialiseDirectMap();
+
 
 		PrintFmt("Loading [mx]...\n");
 		Log("Initialising Kernel subsystem");
@@ -224,8 +233,8 @@ namespace Kernel
 		// tss on page 337 of manual. (AMD Vol. 3)
 		// Setup the TSS. this will mostly be void once the scheduler initialises.
 		{
-			*((uint64_t*) (0x2504)) = 0x0000000000060000;
-			*((uint64_t*) (0x2524)) = 0x0000000000040000;
+			SMP::GetCurrentCPU()->tss->rsp0 = 0x0000000000060000;
+			SMP::GetCurrentCPU()->tss->ist[0] = 0x0000000000040000;
 
 			Log("TSS installed");
 		}
@@ -239,7 +248,8 @@ namespace Kernel
 			HardwareAbstraction::Interrupts::SetGate(0xF7, (uint64_t) TaskSwitcherCoOp, 0x08, 0xEE);
 
 			// handles... syscalls, duh.
-			HardwareAbstraction::Interrupts::SetGate(SyscallNumber, (uint64_t) HandleSyscall, 0x08, 0xEF);
+			// an interrupt gate (not a trap gate), so HandleSyscall can swapgs before anything interrupts it.
+			HardwareAbstraction::Interrupts::SetGate(SyscallNumber, (uint64_t) HandleSyscall, 0x08, 0xEE);
 			Log("Syscalls are available on interrupt %2x", SyscallNumber);
 
 
@@ -247,7 +257,11 @@ namespace Kernel
 			using Kernel::HardwareAbstraction::Multitasking::Process;
 
 			KernelProcess = Multitasking::CreateProcess("mx_kernel", 0x0, KernelCoreThread, 2);
-			Multitasking::AddToQueue(Multitasking::CreateKernelThread(Idle, 0));
+			Thread* idle = Multitasking::CreateKernelThread(Idle, 0);
+			idle->flags |= FLAG_PINNED;
+			SMP::GetCurrentCPU()->IdleThread = idle;
+
+			Multitasking::AddToQueue(idle);
 			Multitasking::AddToQueue(KernelProcess);
 
 			asm volatile("sti");
@@ -263,6 +277,9 @@ namespace Kernel
 
 		Log("[mx] kernel online, initialising subsystems");
 
+		// from here on, Log() only queues; a low-priority thread does the slow serial output.
+		InitialiseLogDrain();
+
 		// after everything is done, make sure shit works
 		{
 			uint64_t h = KernelHeap::GetFirstHeapPhysPage();
@@ -272,6 +289,10 @@ namespace Kernel
 
 
 
+		// the local apic needs to be up before any device is told to send it messages.
+		ACPI::Initialise();
+		Log("ACPI enumeration complete");
+
 		// Initialise the other, less-essential things.
 		PCI::Initialise();
 		Log("PCI devices enumerated");
@@ -280,11 +301,20 @@ namespace Kernel
 		IO::Initialise();
 		Log("IO scheduler online");
 
+		// needs the MADT from above; and before the drivers, so they can aim interrupts at every processor.
+		SMP::StartAPs();
+
 		Storage::ATA::Initialise();
 		Log("ATA driver online");
 
-		ACPI::Initialise();
-		Log("ACPI enumeration complete");
+		Storage::AHCI::Initialise();
+		Log("AHCI driver online");
+
+		Storage::VirtioBlock::Initialise();
+		Log("Virtio block driver online");
+
+		Storage::NVMe::Initialise();
+		Log("NVMe driver online");
 
 		JobDispatch::Initialise();
 		Log("Central Job Dispatcher started");
@@ -324,7 +354,20 @@ namespace Kernel
 			using PCI::PCIDevice;
 			PCIDevice* nic = PCI::GetDeviceByClassSubclass(0x02, 0xFF);
 
-			if(PCI::MatchVendorDevice(nic, 0x10EC, 0x8139))
+			// prefer virtio, since it's not emulating anything.
+			rde::list<PCIDevice*>* virtio = PCI::SearchByVendorDevice(0x1AF4, 0x1000);
+
+			if(virtio->size() > 0)
+			{
+				Log("Virtio NIC found, initialising driver...");
+				DeviceManager::AddDevice(new NIC::VirtioNet(virtio->front()), DeviceType::EthernetNIC);
+			}
+			else if(PCI::MatchVendorDevice(nic, 0x8086, 0x100E))
+			{
+				Log("Intel E1000 NIC found, initialising driver...");
+				DeviceManager::AddDevice(new NIC::E1000(nic), DeviceType::EthernetNIC);
+			}
+			else if(PCI::MatchVendorDevice(nic, 0x10EC, 0x8139))
 			{
 				Log("Realtek RTL8139 NIC found, initialising driver...");
 				DeviceManager::AddDevice(new NIC::RTL8139(nic), DeviceType::EthernetNIC);
@@ -385,6 +428,19 @@ namespace Kernel
 					Virtual::MapRegion(LFBAddr, LFBAddr, bytes, 0x07);
 				}
 
+				// draw into a back buffer in normal memory, and only copy what changed out to the real
+				// framebuffer (see LinearFramebuffer::RefreshBuffer()). if we can't get one, just draw directly.
+				{
+					uint64_t bytes = (uint64_t) VideoOutput::LinearFramebuffer::GetResX() * VideoOutput::LinearFramebuffer::GetResY() * 4;
+					uint64_t buf = (uint64_t) KernelHeap::AllocateChunk(bytes + 64);
+
+					if(buf)
+					{
+						LFBBufferAddr = (buf + 63) & ~((uint64_t) 63);
+						Memory::Set((void*) LFBBufferAddr, 0x00, bytes);
+					}
+				}
+
 				Log("Video mode set");
 			}
 			Console::Initialise();
@@ -404,7 +460,15 @@ namespace Kernel
 
 			// todo: detect fs type.
 			{
-				Devices::Storage::ATADrive* f1 = Devices::Storage::ATADrive::ATADrives->front();
+				// the first disk with anything on it, ide or ahci.
+				Devices::Storage::StorageDevice* f1 = 0;
+				for(uid_t i = 0; (f1 = Devices::Storage::GetStorageDevice(i)) != 0; i++)
+				{
+					if(f1->Partitions.size() > 0)
+						break;
+				}
+
+				assert(f1);
 				FSDriverFAT* fs = new FSDriverFAT(f1->Partitions.front());
 
 				// mount root fs from partition 0 at /
@@ -488,7 +552,7 @@ namespace Kernel
 			const char* path = "/System/Library/LaunchDaemons/displayd.mxa";
 			auto proc = LoadBinary::Load(path, "displayd",
 				(void*) 5, (void*) new uint64_t[5] { (uint64_t) path,
-				GetFramebufferAddress(), LinearFramebuffer::GetResX(), LinearFramebuffer::GetResY(), 32 });
+				GetTrueLFBAddress(), LinearFramebuffer::GetResX(), LinearFramebuffer::GetResY(), 32 });
 
 			Multitasking::AddToQueue(proc);
 
@@ -588,14 +652,11 @@ namespace Kernel
 				uint8_t* output = new uint8_t[256];
 				while(true)
 				{
-					if(GetSocketBufferFill(aSock) > 0)
-					{
-						memset(output, 0, 256);
-						size_t read = ReadSocket(aSock, output, 256);
+					memset(output, 0, 256);
+					size_t read = ReadSocketBlocking(aSock, output, 256);
 
-						output[(read == 256) ? (read - 1) : read] = 0;
-						PrintFmt("%s", output);
-					}
+					output[(read == 256) ? (read - 1) : read] = 0;
+					PrintFmt("%s", output);
 				}
 			};
 
@@ -677,19 +738,8 @@ namespace Kernel
 
 			while(true)
 			{
-				HardwareAbstraction::Multitasking::DisableScheduler();
-				uint16_t x = Console::GetCursorX();
-				uint16_t y = Console::GetCursorY();
-
-				Console::MoveCursor(xpos, 0);
-
-				if(state % 2 == 0)		Console::PrintChar('+');
-				else if(state % 2 == 1)	Console::PrintChar(' ');
-
+				Console::PrintCharAt(state % 2 == 0 ? '+' : ' ', xpos, 0);
 				state++;
-				Console::MoveCursor(x, y);
-
-				HardwareAbstraction::Multitasking::EnableScheduler();
 
 				SLEEP(250);
 			}
@@ -708,9 +758,10 @@ namespace Kernel
 	void HaltSystem(const char* message, const char* filename, uint64_t line, const char* reason)
 	{
 		Log("System Halted: %s, %s:%d, RA(0): %p, RA(1): %p", message, filename, line, __builtin_return_address(0));
+		FlushLog();
 
 		PrintFmt("\n\nFATAL ERROR: %s\nReason: %s\n%s -- Line %d (%x)\n\n[mx] has met an unresolvable error, and will now halt.", message, !reason ? "None" : reason, filename, line, __builtin_return_address(0), __builtin_return_address(1));
-
+		Console::Flush();
 
 		UHALT();
 	}
@@ -718,9 +769,10 @@ namespace Kernel
 	void HaltSystem(const char* message, const char* filename, const char* line, const char* reason)
 	{
 		Log("System Halted: %s, %s:%s, RA(0): %p, RA(1): %p", message, filename, line, __builtin_return_address(0));
+		FlushLog();
 
 		PrintFmt("\n\nFATAL ERROR: %s\nReason: %s\n%s -- Line %s (%x)\n\n[mx] has met an unresolvable error, and will now halt.", message, !reason ? "None" : reason, filename, line, __builtin_return_address(0), __builtin_return_address(1));
-
+		Console::Flush();
 		UHALT();
 	}
 
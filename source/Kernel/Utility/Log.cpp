@@ -7,9 +7,12 @@
 #include <StandardIO.hpp>
 #include <Console.hpp>
 #include <HardwareAbstraction/Devices/SerialPort.hpp>
+#include <HardwareAbstraction/SMP.hpp>
 
 using namespace Library;
 
+extern "C" uint64_t KernelEnd;
+
 namespace Kernel
 {
 	// 0 = Info
@@ -17,59 +20,526 @@ namespace Kernel
 	// 2 = Severe
 	// 3 = Critical
 
-	void pfso(uint8_t c)
+	// Log() doesn't format anything. it drops a binary record (format pointer, raw argument words
+	// and a timestamp) into a lock-free ring, and LogDrainThread() formats and pushes it out to the
+	// serial port (and console) later, at low priority. hot paths only pay for a handful of stores.
+	//
+	// until the drain thread is up, and for severe/critical messages, the caller drains the ring
+	// itself so nothing is delayed.
+	//
+	// every processor has its own ring (hung off its gs block), so processors logging at the same time
+	// don't fight over the same head. a thread that migrates halfway through Log() just lands in the
+	// other processor's ring, which is fine -- reserving is a cas either way. the drain merges the rings
+	// back together by timestamp.
+
+	#define LOGRING_ENTRIES		256			// must be a power of two
+	#define LOGRING_MAXARGS		12
+	#define LOGRING_POOLSIZE	160
+
+	#define LOGREC_FMTINPOOL	0x1
+
+	struct LogRecord
 	{
-		Kernel::HardwareAbstraction::Devices::SerialPort::WriteChar(c);
+		// slot state, relative to the lap (pos & ~(LOGRING_ENTRIES - 1)) it is used in:
+		// lap + 0 => free, lap + 1 => published, lap + LOGRING_ENTRIES => consumed (free for the next lap).
+		// this way a zeroed ring in the BSS is already valid.
+		volatile uint64_t sequence;
+		uint64_t timestamp;
+		const char* format;
+
+		uint8_t level;
+		uint8_t flags;
+		uint8_t numargs;
+		uint8_t poolused;
+		uint16_t stringmask;		// bit n set => args[n] is an offset into 'pool'
+
+		uint64_t args[LOGRING_MAXARGS];
+		char pool[LOGRING_POOLSIZE];
+	};
+
+	struct LogRing
+	{
+		volatile uint64_t head;
+		volatile uint64_t tail;
+		volatile uint64_t dropped;
+		uint64_t droppedreported;
+
+		LogRecord records[LOGRING_ENTRIES];
+	};
+
+	// the boot processor's ring lives in the bss, so logging works before the heap does.
+	static LogRing BootRing;
+	static volatile uint64_t DrainLock = 0;
+	static bool DrainThreadOnline = false;
+
+	static const char* LevelPrefixes[] = { "[INFO]: ", "[WARN]: ", "[SEVR]: ", "[CRIT]: " };
+
+
+	static bool PushArgument(LogRecord* rec, uint64_t value)
+	{
+		if(rec->numargs == LOGRING_MAXARGS)
+			return false;
+
+		rec->args[rec->numargs++] = value;
+		return true;
 	}
 
-	void pfsc(uint8_t c)
+	static bool PushString(LogRecord* rec, const char* str)
 	{
-		Kernel::HardwareAbstraction::Devices::SerialPort::WriteChar(c);
-		Kernel::Console::PrintChar(c);
+		// null strings stay null, the formatter prints "(null)".
+		if(!str)
+			return PushArgument(rec, 0);
+
+		// pool is full.
+		if(rec->poolused >= LOGRING_POOLSIZE)
+			return false;
+
+		size_t len = strlen(str);
+		if(rec->poolused + len + 1 > LOGRING_POOLSIZE)
+			len = LOGRING_POOLSIZE - rec->poolused - 1;
+
+		uint8_t ofs = rec->poolused;
+		memcpy(rec->pool + ofs, str, len);
+		rec->pool[ofs + len] = 0;
+		rec->poolused = (uint8_t) (ofs + len + 1);
+
+		rec->stringmask |= (uint16_t) (1 << rec->numargs);
+		return PushArgument(rec, ofs);
 	}
 
+	// walks the format the same way _vprintf_callback() does, pulling out one 64-bit word per argument.
+	// strings are copied into the record, since they frequently live on the caller's stack.
+	// returns false if the message can't be represented this way.
+	static bool CaptureArguments(LogRecord* rec, const char* fmt, va_list args)
+	{
+		for(const char* f = fmt; *f; f++)
+		{
+			if(*f != '%')
+				continue;
+
+			if(*(++f) == '%')
+				continue;
 
-	void Log(uint8_t level, const char* str, va_list args)
+			while(*f && strchr("#0- +'I", *f))
+				f++;
+
+			if(*f == '*')
+			{
+				if(!PushArgument(rec, (uint64_t) va_arg(args, int)))
+					return false;
+
+				f++;
+			}
+			else
+			{
+				while('0' <= *f && *f <= '9')
+					f++;
+			}
+
+			if(*f == '.')
+			{
+				f++;
+				if(*f == '*')
+				{
+					if(!PushArgument(rec, (uint64_t) va_arg(args, int)))
+						return false;
+
+					f++;
+				}
+				else
+				{
+					if(*f == '-')
+						f++;
+
+					while('0' <= *f && *f <= '9')
+						f++;
+				}
+			}
+
+			bool haslength = false;
+			while(*f && strchr("hlLjzt", *f))
+			{
+				// long doubles don't fit in a slot.
+				if(*f == 'L')
+					return false;
+
+				haslength = true;
+				f++;
+			}
+
+			switch(*f)
+			{
+				case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'p':
+					if(!PushArgument(rec, va_arg(args, uint64_t)))
+						return false;
+
+					break;
+
+				case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+				{
+					double d = va_arg(args, double);
+
+					uint64_t bits = 0;
+					memcpy(&bits, &d, sizeof(double));
+
+					if(!PushArgument(rec, bits))
+						return false;
+
+					break;
+				}
+
+				case 'c':
+				case 's':
+				case 'm':
+					// the formatter rejects these with a length modifier, and stops consuming arguments.
+					if(haslength)
+						return true;
+
+					if(*f == 'c' && !PushArgument(rec, (uint64_t) va_arg(args, int)))
+						return false;
+
+					else if(*f != 'c' && !PushString(rec, va_arg(args, const char*)))
+						return false;
+
+					break;
+
+				// %n would write through a pointer that's long gone by the time we format.
+				case 'n':
+					return false;
+
+				// anything else makes the formatter give up and print the rest literally.
+				default:
+					return true;
+			}
+
+			if(!*f)
+				break;
+		}
+
+		return true;
+	}
+
+
+	static LogRecord* ReserveRecord(LogRing* ring, uint64_t* lapout)
 	{
-		if(!ENABLELOGGING)
+		uint64_t pos = ring->head;
+		while(true)
+		{
+			LogRecord* rec = &ring->records[pos & (LOGRING_ENTRIES - 1)];
+			uint64_t lap = pos & ~((uint64_t) LOGRING_ENTRIES - 1);
+			int64_t diff = (int64_t) (rec->sequence - lap);
+
+			if(diff == 0)
+			{
+				if(__sync_bool_compare_and_swap(&ring->head, pos, pos + 1))
+				{
+					*lapout = lap;
+					return rec;
+				}
+
+				pos = ring->head;
+			}
+			else if(diff < 0)
+			{
+				// the drain hasn't caught up with this slot yet; the ring is full.
+				__sync_add_and_fetch(&ring->dropped, 1);
+				return 0;
+			}
+			else
+			{
+				pos = ring->head;
+			}
+		}
+	}
+
+	static void FillRecord(LogRecord* rec, uint8_t level, const char* fmt, va_list args)
+	{
+		rec->timestamp	= Time::Now();
+		rec->level		= level > 3 ? 3 : level;
+		rec->format		= fmt;
+		rec->flags		= 0;
+		rec->numargs	= 0;
+		rec->poolused	= 0;
+		rec->stringmask	= 0;
+
+		// format strings that don't live in the kernel image (eg. built at runtime) get copied too.
+		bool stable = (uint64_t) fmt >= 0xFFFFFFFF80000000 && (uint64_t) fmt < (uint64_t) &KernelEnd;
+
+		va_list copy;
+		va_copy(copy, args);
+
+		bool ok = false;
+		if(stable)
+		{
+			ok = CaptureArguments(rec, fmt, copy);
+		}
+		else
+		{
+			size_t len = strlen(fmt);
+			if(len + 1 < LOGRING_POOLSIZE / 2)
+			{
+				memcpy(rec->pool, fmt, len + 1);
+				rec->poolused = (uint8_t) (len + 1);
+				rec->flags |= LOGREC_FMTINPOOL;
+
+				ok = CaptureArguments(rec, fmt, copy);
+			}
+		}
+
+		va_end(copy);
+
+		// fallback: format it right now and store the text.
+		if(!ok)
+		{
+			_vsnprintf(rec->pool, LOGRING_POOLSIZE, fmt, args);
+
+			rec->format		= "%s";
+			rec->flags		= 0;
+			rec->numargs	= 1;
+			rec->args[0]	= 0;
+			rec->stringmask	= 0x1;
+			rec->poolused	= LOGRING_POOLSIZE;
+		}
+	}
+
+
+	// x86_64 SysV: va_list is a one-element array of this. marking the register save areas as used up
+	// and pointing the overflow area at our argument words makes va_arg() walk them in 8-byte slots,
+	// which is exactly how CaptureArguments() laid them out.
+	struct SysVVaList
+	{
+		uint32_t gp_offset;
+		uint32_t fp_offset;
+		void* overflow_arg_area;
+		void* reg_save_area;
+	};
+
+	static void FormatRecord(LogRecord* rec, char* out, size_t outlen)
+	{
+		uint64_t args[LOGRING_MAXARGS];
+		for(uint8_t i = 0; i < rec->numargs; i++)
+			args[i] = (rec->stringmask & (1 << i)) ? (uint64_t) (rec->pool + rec->args[i]) : rec->args[i];
+
+		const char* fmt = (rec->flags & LOGREC_FMTINPOOL) ? rec->pool : rec->format;
+
+		size_t ofs = (size_t) _snprintf(out, outlen, "%s", LevelPrefixes[rec->level]);
+
+		va_list list;
+		SysVVaList* raw = (SysVVaList*) list;
+		raw->gp_offset = 48;
+		raw->fp_offset = 176;
+		raw->overflow_arg_area = args;
+		raw->reg_save_area = 0;
+
+		if(ofs < outlen)
+			_vsnprintf(out + ofs, outlen - ofs, fmt, list);
+	}
+
+	static void EmitLine(uint8_t level, const char* line)
+	{
+		using namespace Kernel::HardwareAbstraction::Devices;
+
+		SerialPort::WriteString(line);
+		SerialPort::WriteChar('\n');
+
+		if(level >= 2)
+		{
+			for(const char* c = line; *c; c++)
+				Console::PrintChar((uint8_t) *c);
+
+			Console::PrintChar('\n');
+		}
+	}
+
+	static LogRing* GetRing(uint64_t id)
+	{
+		if(id == 0)
+			return &BootRing;
+
+		HardwareAbstraction::SMP::CPU* cpu = HardwareAbstraction::SMP::GetCPU(id);
+		return cpu ? cpu->logring : 0;
+	}
+
+	static LogRing* CurrentRing()
+	{
+		LogRing* ring = HardwareAbstraction::SMP::GetCurrentCPU()->logring;
+		return ring ? ring : &BootRing;
+	}
+
+	LogRing* CreateLogRing()
+	{
+		LogRing* ring = new LogRing;
+		Memory::Set(ring, 0, sizeof(LogRing));
+
+		return ring;
+	}
+
+	// the ring has to be unreachable through its cpu by now; holding the drain lock means nobody's still reading it.
+	void DestroyLogRing(LogRing* ring)
+	{
+		while(__sync_lock_test_and_set(&DrainLock, 1))
+			asm volatile("pause");
+
+		delete ring;
+		__sync_lock_release(&DrainLock);
+	}
+
+	// the record at the tail, if it's been published.
+	static LogRecord* PeekRecord(LogRing* ring, uint64_t* posout)
+	{
+		uint64_t pos = ring->tail;
+		LogRecord* rec = &ring->records[pos & (LOGRING_ENTRIES - 1)];
+		uint64_t lap = pos & ~((uint64_t) LOGRING_ENTRIES - 1);
+
+		// empty, or the producer hasn't finished writing it yet.
+		if(rec->sequence != lap + 1)
+			return 0;
+
+		*posout = pos;
+		return rec;
+	}
+
+	// normally only the holder of DrainLock gets here, but FlushLog() can't always wait for it -- so the record is
+	// claimed by moving the tail before it's touched, and two consumers never get the same one.
+	static bool DrainOne(LogRing* ring)
+	{
+		uint64_t pos = 0;
+		LogRecord* rec = PeekRecord(ring, &pos);
+		if(!rec)
+			return false;
+
+		if(!__sync_bool_compare_and_swap(&ring->tail, pos, pos + 1))
+			return true;
+
+		uint64_t lap = pos & ~((uint64_t) LOGRING_ENTRIES - 1);
+
+		char line[512];
+		FormatRecord(rec, line, sizeof(line));
+		uint8_t level = rec->level;
+
+		__sync_synchronize();
+		rec->sequence = lap + LOGRING_ENTRIES;
+
+		EmitLine(level, line);
+		return true;
+	}
+
+	static void ReportDropped(LogRing* ring)
+	{
+		uint64_t reported = ring->droppedreported;
+		uint64_t dropped = ring->dropped;
+
+		if(dropped == reported || !__sync_bool_compare_and_swap(&ring->droppedreported, reported, dropped))
 			return;
 
-		if(LOGSPAM)
-			level = 3;
+		char line[64];
+		_snprintf(line, sizeof(line), "[WARN]: log ring overflowed, %ld records dropped", dropped - reported);
+		EmitLine(1, line);
+	}
+
+	static void DrainRings(bool force)
+	{
+		if(__sync_lock_test_and_set(&DrainLock, 1))
+		{
+			if(!force)
+				return;
+
+			// called on the way down: give whoever has the lock a moment, but they might not be coming back.
+			for(uint64_t spins = 0; spins < 10000000 && __sync_lock_test_and_set(&DrainLock, 1); spins++)
+				asm volatile("pause");
+		}
 
-		switch(level)
+		// oldest first, across every processor's ring.
+		while(true)
 		{
-			case 0:
-			default:
-				StdIO::PrintFmt(pfso, "[INFO]: ");
+			LogRing* oldest = 0;
+			uint64_t timestamp = 0;
 
-				StdIO::PrintFmt(pfso, str, args);
-				StdIO::PrintFmt(pfso, "\n");
-				break;
+			for(uint64_t i = 0; i < MaxCPUs; i++)
+			{
+				LogRing* ring = GetRing(i);
+				uint64_t pos = 0;
 
-			case 1:
-				StdIO::PrintFmt(pfso, "[WARN]: ");
+				LogRecord* rec = ring ? PeekRecord(ring, &pos) : 0;
+				if(rec && (!oldest || rec->timestamp < timestamp))
+				{
+					oldest = ring;
+					timestamp = rec->timestamp;
+				}
+			}
 
-				StdIO::PrintFmt(pfso, str, args);
-				StdIO::PrintFmt(pfso, "\n");
+			if(!oldest)
 				break;
 
-			case 2:
-				StdIO::PrintFmt(pfsc, "[SEVR]: ");
+			DrainOne(oldest);
+		}
 
-				StdIO::PrintFmt(pfsc, str, args);
-				StdIO::PrintFmt(pfsc, "\n");
-				break;
+		for(uint64_t i = 0; i < MaxCPUs; i++)
+		{
+			if(LogRing* ring = GetRing(i))
+				ReportDropped(ring);
+		}
 
-			case 3:
-				StdIO::PrintFmt(pfsc, "[CRIT]: ");
+		__sync_lock_release(&DrainLock);
+	}
 
-				StdIO::PrintFmt(pfsc, str, args);
-				StdIO::PrintFmt(pfsc, "\n");
-				break;
+	static void LogDrainThread()
+	{
+		while(true)
+		{
+			DrainRings(false);
+			SLEEP(20);
 		}
 	}
 
+	void InitialiseLogDrain()
+	{
+		using namespace Kernel::HardwareAbstraction;
+
+		Multitasking::AddToQueue(Multitasking::CreateKernelThread(LogDrainThread, 0));
+		DrainThreadOnline = true;
+	}
+
+	void FlushLog()
+	{
+		DrainRings(true);
+	}
+
+	uint64_t GetDroppedLogRecords()
+	{
+		uint64_t ret = 0;
+		for(uint64_t i = 0; i < MaxCPUs; i++)
+		{
+			if(LogRing* ring = GetRing(i))
+				ret += ring->dropped;
+		}
+
+		return ret;
+	}
+
+
+	void Log(uint8_t level, const char* str, va_list args)
+	{
+		if(!ENABLELOGGING)
+			return;
+
+		if(LOGSPAM)
+			level = 3;
+
+		uint64_t lap = 0;
+		LogRecord* rec = ReserveRecord(CurrentRing(), &lap);
+		if(rec)
+		{
+			FillRecord(rec, level, str, args);
+
+			__sync_synchronize();
+			rec->sequence = lap + 1;
+		}
+
+		if(!DrainThreadOnline || level >= 2)
+			DrainRings(false);
+	}
+
 	void Log(uint8_t level, const char* str, ...)
 	{
 		va_list args;
@@ -368,19 +368,8 @@ namespace Time
 			uint64_t state = 0;
 			while(true)
 			{
-				HardwareAbstraction::Multitasking::DisableScheduler();
-				uint16_t x = Console::GetCursorX();
-				uint16_t y = Console::GetCursorY();
-
-				Console::MoveCursor(xpos, 0);
-
-				if(state % 2 == 0)		PrintString("-");
-				else if(state % 2 == 1)	PrintString("|");
-
+				Console::PrintCharAt(state % 2 == 0 ? '-' : '|', xpos, 0);
 				state++;
-				Console::MoveCursor(x, y);
-
-				HardwareAbstraction::Multitasking::EnableScheduler();
 
 				SLEEP(500);
 			}
@@ -8,11 +8,15 @@
 
 namespace Kernel
 {
+	namespace HardwareAbstraction { namespace Filesystems { struct PollSource; } }
+
 	namespace Console
 	{
 		void Initialise();
 		bool IsInitialised();
+		void Flush();
 		void PrintChar(uint8_t c);
+		void PrintString(const char* str, uint64_t length);
 		void ClearScreen();
 		void Scroll();
 		void ScrollDown(uint64_t lines);
@@ -20,6 +24,7 @@ namespace Kernel
 		void SetColour(uint32_t Colour);
 		uint32_t GetColour();
 		void MoveCursor(uint16_t x, uint16_t y);
+		void PrintCharAt(uint8_t c, uint16_t x, uint16_t y);
 		uint16_t GetCharsPerLine();
 		uint16_t GetCharsPerColumn();
 		uint16_t GetCharsPerPage();
@@ -42,6 +47,9 @@ namespace Kernel
 				size_t buffersize;
 				rde::vector<uint8_t> buffer;
 				rde::vector<uint8_t> internalbuffer;
+
+				// notified when 'buffer' gets something to read.
+				HardwareAbstraction::Filesystems::PollSource* poll;
 		};
 
 		void Initialise();
@@ -49,6 +57,9 @@ namespace Kernel
 		uint64_t WriteTTY(long ttyid, uint8_t* data, uint64_t length);
 		uint64_t ReadTTY(long ttyid, uint8_t* data, uint64_t length);
 		uint64_t ConfigureTTY(uint64_t configkey, void* data);
+
+		uint32_t PollTTY(long ttyid);
+		HardwareAbstraction::Filesystems::PollSource* GetTTYPollSource(long ttyid);
 	}
 }
 
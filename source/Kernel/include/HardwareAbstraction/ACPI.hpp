@@ -72,7 +72,8 @@ namespace HardwareAbstraction
 			HPET,
 			SSDT,
 			APIC,
-			FADT
+			FADT,
+			MCFG
 		};
 
 		struct SDTable
@@ -144,8 +145,26 @@ namespace HardwareAbstraction
 			uint32_t	physLocalControllerAddr;
 			uint32_t	flags;
 
-			// fuck all
-			rde::vector<APICStructs::APICStruct*> structs;
+			rde::vector<APICStructs::LocalAPIC> localAPICs;
+			rde::vector<APICStructs::IOAPIC> ioAPICs;
+		};
+
+		// where pci express config space is mapped in memory, per segment group.
+		struct MCFGTable : SDTable
+		{
+			MCFGTable(uint64_t address, SystemDescriptionTable* sdtable);
+
+			struct Allocation
+			{
+				uint64_t	baseAddress;
+				uint16_t	segmentGroup;
+				uint8_t		startBus;
+				uint8_t		endBus;
+				uint32_t	reserved;
+
+			} __attribute__ ((packed));
+
+			rde::vector<Allocation> allocations;
 		};
 	}
 }
@@ -163,6 +163,14 @@ namespace CPUID
 
 
 
+			// EBX Flags, EAX = 0x7
+			bool FSGSBase()						{ return this->_Features_Extended & (1 <<  0); }
+			bool SupervisorExecProtection()		{ return this->_Features_Extended & (1 <<  7); }
+			bool EnhancedRepMovsb()				{ return this->_Features_Extended & (1 <<  9); }
+			bool InvalidatePCID()				{ return this->_Features_Extended & (1 << 10); }
+
+
+
 			char _VendorID[13];
 			char _BrandString[49];
 			uint32_t _Features_ECX;
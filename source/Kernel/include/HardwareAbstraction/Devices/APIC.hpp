@@ -15,10 +15,39 @@ namespace Devices
 	{
 		public:
 			explicit APIC(ACPI::APICTable* table);
-
+			ACPI::APICTable* GetTable() { return this->table; }
 
 		private:
+			ACPI::APICTable* table;
 	};
+
+	// the processor-local half; each processor sees its own registers at the same (identity mapped) address.
+	namespace LocalAPIC
+	{
+		#define LAPIC_REG_ID			0x020
+		#define LAPIC_REG_EOI			0x0B0
+		#define LAPIC_REG_SPURIOUS		0x0F0
+		#define LAPIC_REG_ICR_LOW		0x300
+		#define LAPIC_REG_ICR_HIGH		0x310
+		#define LAPIC_REG_TIMER			0x320
+		#define LAPIC_REG_TIMER_INIT	0x380
+		#define LAPIC_REG_TIMER_COUNT	0x390
+		#define LAPIC_REG_TIMER_DIV		0x3E0
+
+		void Initialise(uint64_t physaddr);
+		void EnableOnThisCPU();
+
+		uint64_t GetBaseAddress();
+		uint32_t GetID();
+
+		void SendEOI();
+		void SendInit(uint32_t apicid);
+		void SendStartup(uint32_t apicid, uint8_t page);
+		void SendFixedIPI(uint32_t apicid, uint8_t vector);
+
+		void CalibrateTimer();
+		void StartTimer(uint8_t vector, uint64_t milliseconds);
+	}
 }
 }
 }
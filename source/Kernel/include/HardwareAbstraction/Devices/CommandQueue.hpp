@@ -0,0 +1,78 @@
+// CommandQueue.hpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+#include <stdint.h>
+#include <HardwareAbstraction/Multitasking.hpp>
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Devices {
+namespace Storage
+{
+	// up to 64 places a device's commands go (ahci's command slots, virtio's request headers, nvme's command ids).
+	// whoever claims one owns it until Release(); the interrupt handler marks them done (and failed), under the lock.
+	struct CommandSlots
+	{
+		virtual ~CommandSlots() { }
+
+		// under waiters.lock.
+		uint64_t mask = 0;
+		uint64_t busy = 0;
+		uint64_t done = 0;
+		uint64_t failed = 0;
+
+		// for slots to finish, and for slots to become free.
+		Multitasking::WaitQueue waiters;
+
+		// with a non-zero interval, Wait() calls Poll() at least that often, in case an interrupt went missing.
+		uint64_t pollinterval = 0;
+		virtual void Poll() { }
+
+		bool ClaimLocked(uint64_t* slot);
+		bool TryClaim(uint64_t* slot);
+		void WaitForFree();
+
+		// waits for 'slot' to finish, and says whether it worked. it stays claimed until Release().
+		bool Wait(uint64_t slot);
+		void Release(uint64_t slot);
+	};
+
+	// a device that takes a request as commands of up to 'maxbytes' each. requests are issued in the caller's own
+	// context (see IODevice::QueuesInternally()), so concurrent callers each get their own slots, and just sleep
+	// until theirs are done.
+	class CommandQueue
+	{
+		public:
+			CommandQueue(uint32_t sectorsize, uint64_t maxbytes, uint64_t alignment)
+				: sectorsize(sectorsize), maxbytes(maxbytes), alignment(alignment) { }
+
+			virtual ~CommandQueue() { }
+
+			// claims a slot and puts 'len' bytes at 'buf' (checked, and pinned if it's userspace's) in it, but needn't
+			// tell the device yet. 1 if it's in, 0 if there's no room right now, -1 if it can't go in at all.
+			virtual int TryStart(uint64_t lba, uint64_t buf, size_t len, bool write, uint64_t* slot) = 0;
+
+			// sleeps until TryStart() might find room; only called with nothing of ours in flight.
+			virtual void WaitForRoom(uint64_t buf, size_t len, bool write) = 0;
+
+			// tells the device about everything started since the last time.
+			virtual void Flush() { }
+
+			// waits for 'slot' to finish, then gives it back.
+			virtual bool Finish(uint64_t slot) = 0;
+
+			uint32_t sectorsize;
+			uint64_t maxbytes;
+
+			// buffers that aren't aligned to this (or aren't whole sectors) go through a bounce buffer.
+			uint64_t alignment;
+	};
+
+	// the whole request. false if it didn't work, with errno set to EFAULT if that was the buffer's fault.
+	bool TransferBlocks(CommandQueue* q, uint64_t lba, uint64_t buf, size_t bytes, bool write);
+}
+}
+}
+}
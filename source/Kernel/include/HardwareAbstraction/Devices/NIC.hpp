@@ -8,6 +8,8 @@
 #include <GlobalTypes.hpp>
 #include <Synchro.hpp>
 #include <HardwareAbstraction/Devices/StorageDevice.hpp>
+#include <HardwareAbstraction/Devices/Virtio.hpp>
+#include <HardwareAbstraction/Multitasking.hpp>
 #pragma once
 
 namespace Kernel {
@@ -27,6 +29,9 @@ namespace NIC
 			virtual uint64_t GetHardwareType() = 0;
 			virtual void HandleInterrupt() = 0;
 
+			// whether the card already checked the tcp/udp checksum of the packet being handled right now.
+			virtual bool ChecksumVerified() { return false; }
+
 		protected:
 			Devices::PCI::PCIDevice* pcidev;
 			uint8_t MAC[6];
@@ -65,6 +70,100 @@ namespace NIC
 			DMAAddr TransmitBuffers[4];
 			Mutex* transmitbuffermtx[4];
 	};
+
+
+	class VirtioNet : public GenericNIC
+	{
+		public:
+			explicit VirtioNet(PCI::PCIDevice* pcidev);
+			virtual ~VirtioNet() override;
+			virtual void Reset() override;
+			virtual void SendData(uint8_t* data, uint64_t bytes) override;
+			virtual uint8_t* GetMAC() override;
+			virtual uint64_t GetHardwareType() override;
+			virtual void HandleInterrupt() override;
+			virtual bool ChecksumVerified() override;
+			virtual bool QueuesInternally() override { return true; }
+			virtual IOResult Read(uint64_t position, uint64_t outbuf, size_t bytes) override;
+			virtual IOResult Write(uint64_t position, uint64_t outbuf, size_t bytes) override;
+
+			void HandleReceive();
+
+		private:
+			void Refill();
+			void ReapTransmit();
+
+			Virtio::Transport* transport;
+			Virtio::Queue* rxqueue;
+			Virtio::Queue* txqueue;
+
+			uint64_t hdrsize;
+			bool mergeable;
+			bool checksumok;
+
+			DMAAddr rxbuffers;
+			uint16_t rxcount;
+			uint16_t* rxfree;
+			uint16_t rxnumfree;
+
+			// what Reap() found, for HandleReceive() to go through outside the lock.
+			uint16_t* rxdone;
+			uint32_t* rxlengths;
+			uint16_t rxnumdone;
+
+			// under rxlock; so the interrupt handler only queues one job at a time.
+			bool rxscheduled;
+			Spinlock rxlock;
+
+			DMAAddr txbuffers;
+			uint16_t txcount;
+			uint16_t* txfree;
+			uint16_t txnumfree;
+
+			// senders between taking a buffer and posting it. the last one out kicks, for all of them.
+			uint64_t txsenders;
+			Multitasking::WaitQueue txwait;
+	};
+
+
+	class E1000 : public GenericNIC
+	{
+		public:
+			explicit E1000(PCI::PCIDevice* pcidev);
+			virtual ~E1000() override;
+			virtual void Reset() override;
+			virtual void SendData(uint8_t* data, uint64_t bytes) override;
+			virtual uint8_t* GetMAC() override;
+			virtual uint64_t GetHardwareType() override;
+			virtual void HandleInterrupt() override;
+			virtual bool QueuesInternally() override { return true; }
+			virtual IOResult Read(uint64_t position, uint64_t outbuf, size_t bytes) override;
+			virtual IOResult Write(uint64_t position, uint64_t outbuf, size_t bytes) override;
+
+			void HandleReceive();
+
+		private:
+			void ReclaimTransmit();
+
+			volatile uint8_t* regs;
+
+			DMAAddr rxring;
+			DMAAddr rxbuffers;
+			uint16_t rxnext;
+
+			// under rxlock; so the interrupt handler only queues one job at a time.
+			bool rxscheduled;
+			Spinlock rxlock;
+
+			DMAAddr txring;
+			DMAAddr txbuffers;
+			uint16_t txtail;
+			uint16_t txclean;
+
+			// senders between taking a descriptor and filling it in. the last one out moves the tail, for all of them.
+			uint64_t txsenders;
+			Multitasking::WaitQueue txwait;
+	};
 }
 }
 }
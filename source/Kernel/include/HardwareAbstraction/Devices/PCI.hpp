@@ -43,6 +43,19 @@ namespace Devices
 			uint32_t GetRegisterData(uint16_t Offset, uint8_t FirstBit, uint8_t Length);
 			void WriteRegisterData(uint16_t Offset, uint8_t FirstBit, uint8_t Length, uint32_t Value);
 
+			// offset of the capability in config space, or 0 if the device doesn't have it.
+			uint8_t FindCapability(uint8_t id);
+
+			// the same, for the ones past the first 256 bytes; only there when config space is memory-mapped.
+			uint16_t FindExtendedCapability(uint16_t id);
+
+			// message signalled interrupts. msi goes to the processor that sets it up, and each msi-x entry to the
+			// local apic it's given. either one turns the pin off; DisableMSIX() turns it back on.
+			bool EnableMSI(uint8_t vector);
+			uint16_t GetMSIXCount();
+			bool EnableMSIX(uint16_t entry, uint8_t vector, uint32_t apicid);
+			void DisableMSIX();
+
 			void PrintPCIDeviceInfo();
 			static rde::list<PCIDevice*>* PCIDevices;
 
@@ -58,11 +71,14 @@ namespace Devices
 			uint16_t DeviceID;
 
 			uint8_t ProgIF;
+			uint8_t HeaderType;
 
 			uint32_t Address;
 
 			uint8_t InterruptPin;
 			uint8_t InterruptLine;
+
+			volatile uint32_t* MSIXTable;
 		};
 
 
@@ -70,9 +86,13 @@ namespace Devices
 		#define MAXSLOT		32
 		#define MAXFUNC		8
 
+		#define PCI_CAP_MSI		0x05
+		#define PCI_CAP_MSIX	0x11
+
 
 
 		void Initialise();
+		bool HasExtendedConfig();
 		uint32_t MakeAddr(uint16_t Bus, uint16_t Slot, uint16_t Function);
 		uint32_t ReadConfig32(uint32_t Address, uint16_t Offset);
 		uint16_t ReadConfig16(uint32_t Address, uint16_t Offset);
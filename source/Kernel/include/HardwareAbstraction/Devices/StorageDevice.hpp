@@ -42,6 +42,10 @@ namespace HardwareAbstraction
 				virtual ~IODevice();
 				virtual IOResult Read(uint64_t position, uint64_t outbuf, size_t bytes) = 0;
 				virtual IOResult Write(uint64_t position, uint64_t outbuf, size_t bytes) = 0;
+
+				// devices that can have several requests in flight take them in the caller's own context, reading
+				// straight into (or writing straight from) the caller's buffer, and report no allocatedBuffer.
+				virtual bool QueuesInternally() { return false; }
 		};
 
 		namespace Storage
@@ -50,6 +54,9 @@ namespace HardwareAbstraction
 			{
 				Invalid,
 				ATAHardDisk,
+				AHCIHardDisk,
+				VirtioDisk,
+				NVMeDisk,
 			};
 
 			enum class PartitionTableType
@@ -175,7 +182,84 @@ namespace HardwareAbstraction
 			};
 
 
+			namespace AHCI
+			{
+				struct Port;
+				void Initialise();
+			}
+
+			class AHCIDrive : public StorageDevice
+			{
+				public:
+					explicit AHCIDrive(AHCI::Port* port);
+					virtual ~AHCIDrive() { }
+
+					uint64_t GetSectors();
+					uint32_t GetSectorSize();
+
+					virtual bool QueuesInternally() override { return true; }
+					virtual IOResult Read(uint64_t LBA, uint64_t Buffer, size_t Bytes) override;
+					virtual IOResult Write(uint64_t LBA, uint64_t Data, size_t Bytes) override;
+
+					static rde::vector<AHCIDrive*>* AHCIDrives;
+
+				private:
+					AHCI::Port* port;
+			};
+
+			namespace VirtioBlock
+			{
+				struct Device;
+				void Initialise();
+			}
+
+			class VirtioBlockDrive : public StorageDevice
+			{
+				public:
+					explicit VirtioBlockDrive(VirtioBlock::Device* dev);
+					virtual ~VirtioBlockDrive() { }
+
+					uint64_t GetSectors();
+					uint32_t GetSectorSize();
+
+					virtual bool QueuesInternally() override { return true; }
+					virtual IOResult Read(uint64_t LBA, uint64_t Buffer, size_t Bytes) override;
+					virtual IOResult Write(uint64_t LBA, uint64_t Data, size_t Bytes) override;
+
+					static rde::vector<VirtioBlockDrive*>* VirtioBlockDrives;
+
+				private:
+					VirtioBlock::Device* dev;
+			};
+
+			namespace NVMe
+			{
+				struct Namespace;
+				void Initialise();
+			}
+
+			class NVMeDrive : public StorageDevice
+			{
+				public:
+					explicit NVMeDrive(NVMe::Namespace* ns);
+					virtual ~NVMeDrive() { }
+
+					uint64_t GetSectors();
+					uint32_t GetSectorSize();
+
+					virtual bool QueuesInternally() override { return true; }
+					virtual IOResult Read(uint64_t LBA, uint64_t Buffer, size_t Bytes) override;
+					virtual IOResult Write(uint64_t LBA, uint64_t Data, size_t Bytes) override;
+
+					static rde::vector<NVMeDrive*>* NVMeDrives;
+
+				private:
+					NVMe::Namespace* ns;
+			};
+
+
 			void AddStorageDevice(StorageDevice* dev);
+			StorageDevice* GetStorageDevice(uid_t diskid);
 
 
 
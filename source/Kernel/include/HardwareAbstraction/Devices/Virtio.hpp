@@ -0,0 +1,120 @@
+// Virtio.hpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+#include <stdint.h>
+#include <HardwareAbstraction/Devices/PCI.hpp>
+
+#define VIRTIO_STATUS_ACKNOWLEDGE	0x01
+#define VIRTIO_STATUS_DRIVER		0x02
+#define VIRTIO_STATUS_DRIVER_OK		0x04
+#define VIRTIO_STATUS_FAILED		0x80
+
+#define VIRTIO_F_EVENT_IDX			(1U << 29)
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Devices {
+namespace Virtio
+{
+	// the legacy pci transport, which is everything in the first io bar. qemu's (transitional) devices all have it.
+	class Transport
+	{
+		public:
+			explicit Transport(PCI::PCIDevice* pci);
+
+			uint32_t GetFeatures();
+			void SetFeatures(uint32_t features);
+
+			void AddStatus(uint8_t status);
+			void Reset();
+
+			// reading it acknowledges the interrupt. with msi-x, interrupts are only ever ours, so don't bother.
+			uint8_t ReadISR();
+
+			// sends every queue's interrupts to msi-x entry 0, as 'vector', instead of the pin (config changes don't
+			// interrupt at all). after the queues are set up, before DRIVER_OK; false if it's still on the pin.
+			bool UseMSIX(uint8_t vector, uint16_t queues);
+			bool UsingMSIX();
+
+			uint8_t ReadConfig8(uint16_t offset);
+			uint16_t ReadConfig16(uint16_t offset);
+			uint32_t ReadConfig32(uint16_t offset);
+			uint64_t ReadConfig64(uint16_t offset);
+
+			// returns the queue's size, 0 if it doesn't exist.
+			uint16_t SelectQueue(uint16_t index);
+			void SetQueueAddress(uint64_t phys);
+			void Notify(uint16_t index);
+
+			PCI::PCIDevice* pci;
+
+		private:
+			uint16_t ioaddr;
+			uint16_t configbase;
+			bool msix;
+	};
+
+	// one piece of a request; 'writable' if the device writes to it.
+	struct Segment
+	{
+		uint64_t phys;
+		uint32_t length;
+		bool writable;
+	};
+
+	// a split virtqueue. it doesn't lock anything itself; the driver serialises Post(), Kick() and Reap(), and
+	// since Reap() normally runs in the interrupt handler, that means a spinlock.
+	class Queue
+	{
+		public:
+			Queue(Transport* transport, uint16_t index);
+
+			// puts a request together as a descriptor chain and makes it available, but doesn't tell the device.
+			// false if there aren't 'count' free descriptors right now.
+			bool Post(const Segment* segs, uint16_t count, void* cookie);
+
+			// tells the device about everything posted since the last kick, unless it said not to bother.
+			void Kick();
+
+			// calls 'done' for every request the device has finished with, and returns how many there were.
+			uint64_t Reap(void (*done)(void* cookie, uint32_t length, void* arg), void* arg);
+
+			// whether there's anything for Reap() to do.
+			bool Pending();
+
+			// once VIRTIO_F_EVENT_IDX is negotiated, before anything's posted.
+			void UseEventIndex();
+
+			// asks the device not to interrupt for this queue, or to start again. EnableInterrupts() returns false
+			// if something finished in the meantime, since that won't interrupt; Reap() it yourself.
+			void DisableInterrupts();
+			bool EnableInterrupts();
+
+			uint16_t GetSize();
+			uint16_t GetFree();
+
+		private:
+			Transport* transport;
+			uint16_t index;
+			uint16_t size;
+
+			struct Descriptor* desc;
+			struct AvailableRing* avail;
+			struct UsedRing* used;
+
+			uint16_t freehead;
+			uint16_t numfree;
+			uint16_t lastused;
+			uint16_t lastkick;
+
+			bool eventidx;
+			bool interrupts;
+
+			void** cookies;
+	};
+}
+}
+}
+}
@@ -42,6 +42,9 @@ namespace Kernel
 					virtual void Close(VFS::vnode* node) override;
 
 					virtual rde::vector<VFS::vnode*> ReadDir(VFS::vnode* node) override;
+
+					virtual uint32_t Poll(VFS::vnode* node) override;
+					virtual PollSource* GetPollSource(VFS::vnode* node) override;
 			};
 
 			class FSDriverStdout : public FSDriver
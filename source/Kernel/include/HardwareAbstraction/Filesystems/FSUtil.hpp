@@ -26,6 +26,7 @@ namespace Filesystems
 {
 	class FSDriver;
 	struct IOContext;
+	struct PollSource;
 
 	enum Attributes
 	{
@@ -88,6 +89,8 @@ namespace Filesystems
 		extern const char* FS_STDOUT_MOUNTPOINT;
 		extern const char* FS_STDERR_MOUNTPOINT;
 		extern const char* FS_SOCKET_MOUNTPOINT;
+		extern const char* FS_MQUEUE_MOUNTPOINT;
+		extern const char* FS_EPOLL_MOUNTPOINT;
 
 
 
@@ -141,7 +144,9 @@ namespace Filesystems
 		Invalid = 0,
 		Physical,
 		Virtual,
-		Socket
+		Socket,
+		MessageQueue,
+		EventPoll
 	};
 
 	struct IOContext
@@ -166,6 +171,11 @@ namespace Filesystems
 			// returns a list of items inside the directory, as vnodes.
 			virtual rde::vector<VFS::vnode*> ReadDir(VFS::vnode* node);
 
+			// for event polls (see Poll.cpp): the EPOLL* bits that are true right now, and where to hear about changes.
+			// by default everything is always ready, and never changes.
+			virtual uint32_t Poll(VFS::vnode* node);
+			virtual PollSource* GetPollSource(VFS::vnode* node);
+
 			virtual dev_t GetID() final { return this->fsid; }
 			virtual FSDriverType GetType() final { return this->_type; }
 			virtual bool Seekable() final { return this->_seekable; }
@@ -0,0 +1,50 @@
+// Poll.hpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+#include <stdint.h>
+#include <HardwareAbstraction/Multitasking.hpp>
+#include <sys/epoll.h>
+
+namespace Kernel {
+namespace HardwareAbstraction {
+namespace Filesystems
+{
+	struct PollWatch;
+
+	// something behind an fd that can become readable or writable.
+	// threads blocking on it directly sleep on 'waiters'; event polls hang their watches off 'watches', under waiters.lock.
+	struct PollSource
+	{
+		Multitasking::WaitQueue waiters;
+		PollWatch* watches = 0;
+	};
+
+	// call after the state changes, with the EPOLL* bits that might have become true.
+	// doesn't sleep or allocate, so it's fine to call from anywhere.
+	void NotifyPoll(PollSource& src, uint32_t events);
+
+	// removes a vnode from every event poll watching it; VFS::Close() does this.
+	void ForgetPolls(VFS::vnode* node);
+
+	class EventPollFS : public FSDriver
+	{
+		public:
+			EventPollFS();
+
+			virtual ~EventPollFS() override;
+			virtual bool Create(VFS::vnode* node, const char* path, uint64_t flags, uint64_t perms) override;
+			virtual bool Delete(VFS::vnode* node, const char* path) override;
+			virtual bool Traverse(VFS::vnode* node, const char* path, char** symlink) override;
+			virtual size_t Read(VFS::vnode* node, void* buf, off_t offset, size_t length) override;
+			virtual size_t Write(VFS::vnode* node, const void* buf, off_t offset, size_t length) override;
+			virtual void Flush(VFS::vnode* node) override;
+			virtual void Stat(VFS::vnode* node, struct stat* stat, bool statlink) override;
+			virtual void Close(VFS::vnode* node) override;
+
+			virtual rde::vector<VFS::vnode*> ReadDir(VFS::vnode* node) override;
+	};
+}
+}
+}
@@ -9,8 +9,9 @@ namespace HardwareAbstraction {
 namespace IO
 {
 	void Initialise();
-	void Read(Devices::IODevice* dev, uint64_t pos, uint64_t buf, uint64_t bytes);
-	void Write(Devices::IODevice* dev, uint64_t pos, uint64_t buf, uint64_t bytes);
+	// both block until it's done; false if the device failed, or the buffer wasn't all there.
+	bool Read(Devices::IODevice* dev, uint64_t pos, uint64_t buf, uint64_t bytes);
+	bool Write(Devices::IODevice* dev, uint64_t pos, uint64_t buf, uint64_t bytes);
 
 
 	// non blocking.
@@ -9,6 +9,8 @@
 namespace Kernel {
 namespace HardwareAbstraction
 {
+	namespace Devices { namespace PCI { class PCIDevice; } }
+
 	namespace Interrupts
 	{
 		struct RegisterStruct_type
@@ -35,6 +37,9 @@ namespace HardwareAbstraction
 				void* arg;
 		};
 
+		// how many devices can share one line (or vector).
+		#define MaxHandlersPerVector	16
+
 		class IRQHandlerPlugList
 		{
 			public:
@@ -45,17 +50,26 @@ namespace HardwareAbstraction
 
 				uint64_t IRQNum;
 				rde::vector<IRQHandlerPlug*> HandlerList;
-		};
 
+				// adding a handler can move the list, so dispatch copies it out under this.
+				Spinlock lock;
+		};
 
-		extern rde::vector<IRQHandlerPlugList*>* IRQHandlerList;
 
 		void SetGate(uint8_t num, uint64_t base, uint16_t sel, uint8_t flags);
 		void Initialise();
+		void LoadIDT();
 		void InstallDefaultHandlers();
 		void InstallIRQHandler(uint64_t irq, void(*handler)(void*), void* arg = 0);
 		void UninstallIRQHandler(uint64_t irq);
 
+		// irq lines are just vectors 32 to 47; devices that can send their own messages get one of these instead.
+		uint8_t AllocateVector();
+		void InstallVectorHandler(uint8_t vector, void(*handler)(void*), void* arg = 0);
+
+		// a vector to itself if the device can send (plain) msi, otherwise the probably-shared pin. true for msi.
+		bool InstallDeviceHandler(Devices::PCI::PCIDevice* dev, void(*handler)(void*), void* arg = 0);
+
 		void MaskInterrupt(uint8_t interrupt);
 		void UnmaskInterrupt(uint8_t interrupt);
 	}
@@ -29,6 +29,25 @@ namespace MemoryManager
 
 		uint64_t GetFirstHeapMetadataPhysPage();
 		uint64_t GetFirstHeapPhysPage();
+
+		// heap profiling; reports go to the kernel log.
+		// these are also reachable through syscall 0003, with the HEAPPROF_* ops below, but only for processes the
+		// kernel started itself (anyone else gets EPERM).
+		void SetProfiling(bool enabled);
+		bool IsProfiling();
+		void ResetProfile();
+		uint64_t TakeProfileSnapshot();
+		void PrintProfile(uint64_t top);
+		void DiffProfileSnapshots(uint64_t older, uint64_t newer);
+		void ReportLeaks(uint64_t minCount);
+
+		#define HEAPPROF_DISABLE	0
+		#define HEAPPROF_ENABLE		1
+		#define HEAPPROF_RESET		2
+		#define HEAPPROF_SNAPSHOT	3
+		#define HEAPPROF_PRINT		4
+		#define HEAPPROF_DIFF		5
+		#define HEAPPROF_LEAKS		6
 	}
 }
 }
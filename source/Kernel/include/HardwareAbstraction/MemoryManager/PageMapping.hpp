@@ -15,9 +15,22 @@
 #define I_ReadWrite		0x02
 #define I_UserAccess	0x04
 #define I_AlignMask		0xFFFFFFFFFFFFF000
+#define I_CacheDisable	0x18	// pcd | pwt, for device memory
 #define I_NoExecute		0
 #define I_CopyOnWrite	0x800	// bit 11
 #define I_SwappedPage	0x400	// bit 10
+#define I_LargePage		0x80	// bit 7, only in pdpt and pd entries -- maps 1gb or 2mb directly
+
+#define I_LargePageSize	0x200000
+#define I_HugePageSize	0x40000000
+
+// all of physical memory is mapped here, in the shared top pml4 slot, up to where the kernel starts.
+#define I_DirectMapBase		0xFFFFFF8000000000
+#define I_DirectMapLength	0x0000007F80000000
+
+// userspace gets the lower half, minus the bottom 1gb (which is the kernel's in every address space).
+#define I_UserSpaceBase		0x0000000040000000
+#define I_UserSpaceEnd		0x0000800000000000
 
 
 #define I_RECURSIVE_SLOT	500
@@ -32,6 +45,11 @@
 
 namespace Kernel {
 namespace HardwareAbstraction {
+namespace SMP
+{
+	struct CPU;
+}
+
 namespace MemoryManager {
 namespace Virtual
 {
@@ -42,6 +60,14 @@ namespace Virtual
 
 	struct VirtualAddressSpace;
 
+	// the last page table a lookup went through, so that walking consecutive pages costs one read each.
+	// only good for as long as nothing unmaps anything in that address space.
+	struct PageWalkCache
+	{
+		PageMapStructure* pml4 = 0;
+		PageMapStructure* pt = 0;
+		uint64_t base = 0;
+	};
 
 
 	void Initialise();
@@ -61,7 +87,7 @@ namespace Virtual
 	void UnmapAddress(uint64_t VirtAddr, PageMapStructure* PML4);
 	void UnmapAddress(uint64_t VirtAddr, bool DoNotUnmap);
 
-	void MapRegion(uint64_t VirtAddr, uint64_t PhysAddr, uint64_t LengthInPages, uint64_t Flags, PageMapStructure* PML4 = 0);
+	void MapRegion(uint64_t VirtAddr, uint64_t PhysAddr, uint64_t LengthInPages, uint64_t Flags, PageMapStructure* PML4 = 0, bool Huge = false);
 	void UnmapRegion(uint64_t VirtAddr, uint64_t LengthInPages, PageMapStructure* PML4 = 0);
 
 	void MarkCOW(uint64_t VirtAddr, VirtualAddressSpace* vas = 0);
@@ -71,8 +97,17 @@ namespace Virtual
 	void UnmarkCOW(uint64_t VirtAddr, PageMapStructure* pml);
 
 	uint64_t GetMapping(uint64_t VirtAddr, PageMapStructure* VAS);
+	uint64_t LookupMapping(uint64_t VirtAddr, PageMapStructure* PML4);
+	uint64_t LookupMapping(uint64_t VirtAddr, PageMapStructure* PML4, PageWalkCache* cache);
 	uint64_t* GetPageTableEntry(uint64_t va, PageMapStructure* VAS, PageMapStructure** pdpt, PageMapStructure** pd, PageMapStructure** pt);
 
+	// TLB.cpp
+	void InitialiseTLB();
+	uint64_t SwitchContext(SMP::CPU* cpu, PageMapStructure* PML4);
+	void InvalidateRange(uint64_t VirtAddr, uint64_t LengthInPages, PageMapStructure* PML4);
+	void ForgetContext(PageMapStructure* PML4);
+	void ServiceTLBShootdowns();
+
 }
 }
 }
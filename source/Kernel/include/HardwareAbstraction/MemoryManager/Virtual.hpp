@@ -18,6 +18,8 @@
 #define I_NoExecute		0
 #define I_CopyOnWrite	0x800	// bit 11
 #define I_SwappedPage	0x400	// bit 10
+#define I_DemandPaged	0x200	// bit 9, only in MemRegion::phys -- pages are allocated on first touch
+#define I_SharedPages	0x100	// bit 8, only in MemRegion::phys -- pages belong to something else (ie. an ipc channel)
 
 
 #define I_RECURSIVE_SLOT	500
@@ -50,6 +52,9 @@ namespace Virtual
 		uint64_t used : 1;
 		uint64_t phys;
 
+		// dma in progress to (part of) it; see PinRange().
+		uint64_t pins;
+
 		bool operator==(MemRegion& other)
 		{
 			return other.start == this->start && other.length == this->length && other.phys == this->phys;
@@ -107,9 +112,10 @@ namespace Virtual
 	};
 
 	uint64_t AllocatePage(uint64_t size = 1, uint64_t addr = 0, uint64_t flags = 0x7);
-	uint64_t AllocateVirtual(uint64_t size = 1, uint64_t addr = 0, VirtualAddressSpace* vas = 0, uint64_t phys = 0);
+	uint64_t AllocateVirtual(uint64_t size = 1, uint64_t addr = 0, VirtualAddressSpace* vas = 0, uint64_t phys = 0, uint64_t align = 0);
 
 	void FreePage(uint64_t addr, uint64_t size);
+	bool FreeAnonymousPage(uint64_t addr, uint64_t size);
 	void FreeVirtual(uint64_t addr, uint64_t size, VirtualAddressSpace* vas = 0);
 
 
@@ -117,17 +123,84 @@ namespace Virtual
 	void DestroyVAS(VirtualAddressSpace* vas);
 
 	uint64_t GetVirtualPhysical(uint64_t virt, VirtualAddressSpace* vas = 0);
+
+	uint64_t ReserveRegion(uint64_t size, uint64_t flags, VirtualAddressSpace* vas = 0);
+	void ReleaseRegion(uint64_t addr, uint64_t size, VirtualAddressSpace* vas = 0);
+	uint64_t PopulatePage(uint64_t virt, VirtualAddressSpace* vas = 0);
+	bool PinRange(uint64_t virt, size_t bytes, VirtualAddressSpace* vas = 0);
+	void UnpinRange(uint64_t virt, size_t bytes, VirtualAddressSpace* vas = 0);
 	void ForceInsertALPTuple(uint64_t addr, size_t sizeInPages, uint64_t phys, VirtualAddressSpace* vas = 0);
 	VirtualAddressSpace* CopyVAS(VirtualAddressSpace* src, VirtualAddressSpace* dest);
+	bool SplitCOW(uint64_t virt, VirtualAddressSpace* vas);
 	bool HandlePageFault(uint64_t cr2, uint64_t cr3, uint64_t errorcode);
 
 	uint64_t CreateVAS();
 
 
 
-	void CopyBetweenAddressSpaces(uint64_t fromAddr, uint64_t toAddr, size_t bytes, VirtualAddressSpace* from, VirtualAddressSpace* to);
-	void CopyFromKernel(uint64_t fromAddr, uint64_t toAddr, size_t bytes, VirtualAddressSpace* to);
-	void CopyToKernel(uint64_t fromAddr, uint64_t toAddr, size_t bytes, VirtualAddressSpace* from);
+	// DirectMap.cpp
+	void InitialiseDirectMap();
+	void* MapIO(uint64_t phys, uint64_t bytes);
+
+	static inline void* PhysToDirect(uint64_t phys)
+	{
+		return (void*) (phys + I_DirectMapBase);
+	}
+
+	// hands out a buffer in some address space as runs of physically contiguous memory, through the direct map.
+	// if the buffer can be touched directly (it's in the current address space, or in the kernel's), it's one run.
+	class ScatterList
+	{
+		public:
+			// 'writable' if something's going to write to the pages behind the page tables' back (ie. a device),
+			// so copy-on-write pages need their own copies first.
+			ScatterList(uint64_t virt, size_t bytes, VirtualAddressSpace* vas, bool writable = false);
+
+			// false once everything's been handed out.
+			bool Next(uint8_t** ptr, size_t* len);
+
+			// the same, but always as physical addresses (for dma).
+			bool NextPhysical(uint64_t* phys, size_t* len);
+
+			// the whole buffer as one pointer, if it's all one run; 0 otherwise. uses the list up either way.
+			uint8_t* Contiguous();
+
+			// whether Next() stopped early because part of the buffer isn't mapped (ie. EFAULT).
+			bool Failed();
+
+			// resolves every page up front (populating and splitting as it goes), and uses the list up.
+			// false if any of them isn't there.
+			bool Check();
+
+		private:
+			uint64_t Resolve(uint64_t virt);
+			size_t Run(uint64_t phys);
+
+			uint64_t virt;
+			size_t bytes;
+			bool direct;
+			bool writable;
+			bool failed;
+			VirtualAddressSpace* vas;
+			PageMapStructure* pml4;
+			PageWalkCache walk;
+	};
+
+	// false if part of either side isn't mapped.
+	bool CopyBetweenAddressSpaces(uint64_t fromAddr, uint64_t toAddr, size_t bytes, VirtualAddressSpace* from, VirtualAddressSpace* to);
+	bool CopyFromKernel(uint64_t fromAddr, uint64_t toAddr, size_t bytes, VirtualAddressSpace* to);
+	bool CopyToKernel(uint64_t fromAddr, uint64_t toAddr, size_t bytes, VirtualAddressSpace* from);
+
+	// UserAccess.cpp
+	// the longest path a syscall takes from userspace, nul included.
+	#define MaxUserPath		1024
+
+	bool IsUserRange(const void* addr, size_t bytes);
+	bool CopyToUser(void* user, const void* src, size_t bytes);
+	bool CopyFromUser(void* dst, const void* user, size_t bytes);
+	int64_t CopyStringFromUser(char* dst, const char* user, size_t max);
+	bool CopyPathFromUser(char* dst, const char* user, size_t max);
+	bool FixupException(uint64_t* rip);
 
 }
 }
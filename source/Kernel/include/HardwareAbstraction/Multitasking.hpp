@@ -8,6 +8,7 @@
 #include "Filesystems.hpp"
 #include "IPC.hpp"
 #include "MemoryManager/Virtual.hpp"
+#include "SMP.hpp"
 #include <Synchro.hpp>
 #include <defs/_pthreadstructs.h>
 #include <stl/vector.h>
@@ -27,6 +28,15 @@ namespace HardwareAbstraction
 	{
 		#define NUM_PRIO	4
 		struct Process;
+		struct Thread;
+
+		// threads waiting for something to happen; see WaitQueue.cpp.
+		struct WaitQueue
+		{
+			Spinlock lock;
+			Thread* head = 0;
+			Thread* tail = 0;
+		};
 
 		struct Thread
 		{
@@ -34,6 +44,8 @@ namespace HardwareAbstraction
 			uint64_t StackPointer	= 0;
 			uint64_t TopOfStack		= 0;
 			uint64_t StackSize		= 0;
+			uint64_t UserStack		= 0;
+			uint64_t UserStackSize	= 0;
 			uint32_t Sleep			= 0;
 			uint8_t Priority		= 0;
 			uint8_t flags			= 0;
@@ -41,11 +53,27 @@ namespace HardwareAbstraction
 			uint64_t State			= 0;
 
 			void* tlsptr			= 0;
+
+			// %fs points at tlsptr, so this is %fs:8. it's the c library's (its malloc cache lives here), so it
+			// doesn't have to borrow the program's tls.
+			void* libcslot			= 0;
+
 			Process* Parent			= 0;
 
 			// a bit hacky, but this stores the current thread errno.
 			int64_t currenterrno	= 0;
 
+			// the processor whose run queue holds us, and whether some processor is still on our stack.
+			SMP::CPU* Processor		= 0;
+			volatile uint64_t OnCPU	= 0;
+
+			// DisableScheduler() nesting; the timer won't preempt us while this is non-zero. it only keeps this
+			// thread on its processor -- everyone else keeps running, so it's no substitute for a lock.
+			uint64_t PreemptCount	= 0;
+
+			// register frame pushed by the syscall stub, for fork() to copy.
+			uint64_t SyscallFrame	= 0;
+
 			rde::list<uintptr_t> messagequeue;
 
 			ThreadRegisterState_type* CrashState = 0;
@@ -53,10 +81,22 @@ namespace HardwareAbstraction
 			rde::vector<Thread*> watchers;
 			rde::vector<Thread*> watching;
 
+			// the wait queue we're sleeping on, if any, and the next thread on it.
+			WaitQueue* WaitingOn	= 0;
+			Thread* WaitNext		= 0;
+
+			// if non-zero, the timer wakes us at this tick even if the wait queue doesn't.
+			uint64_t WakeDeadline	= 0;
+
+			// joiners, woken once the timer has marked us dead (under its lock, so they can free us right after).
+			WaitQueue Exited;
 
 			void* returnval = 0;
 			void (*funcpointer)() = 0;
 
+			// next on the list of dead, detached threads waiting to be freed.
+			Thread* ReapNext		= 0;
+
 			Thread() { }
 
 			Thread(const Thread&) = delete;
@@ -80,48 +120,44 @@ namespace HardwareAbstraction
 			sighandler_t* SignalHandlers = 0;
 
 			Process* Parent = 0;
+
+			// taken inside a run queue lock when a thread dies, so never the other way around.
+			Spinlock ThreadsLock;
 			rde::vector<Thread*> Threads;
 		};
 
 		void DisableScheduler();
 		void EnableScheduler();
 
+		bool SleepOn(WaitQueue& wq, uint64_t timeout = 0);
+		bool WakeOne(WaitQueue& wq);
+		void WakeAll(WaitQueue& wq);
+		void RemoveFromWaitQueue(Thread* t);
+
+		// one per processor.
 		struct RunQueue
 		{
-			RunQueue()
-			{
-				this->thelock = new Mutex();
-			}
+			RunQueue() { }
 
 			RunQueue(const RunQueue&) = delete;
 			RunQueue& operator = (const RunQueue&) = delete;
 
-			RunQueue(RunQueue&& copy)
-			{
-				this->thelock = copy.thelock;
-				copy.thelock = 0;
-			}
-
-			RunQueue& operator = (RunQueue&& copy)
+			void lock()
 			{
-				this->thelock = copy.thelock;
-				copy.thelock = 0;
-				return *this;
+				LockSpinlock(this->thelock);
 			}
 
-			void lock()
+			bool trylock()
 			{
-				DisableScheduler();
-				LockMutex(*this->thelock);
+				return TryLockSpinlock(this->thelock);
 			}
 
 			void unlock()
 			{
-				UnlockMutex(*this->thelock);
-				EnableScheduler();
+				UnlockSpinlock(this->thelock);
 			}
 
-			Mutex* thelock;
+			Spinlock thelock;
 			rde::vector<Thread*> queue[NUM_PRIO];
 		};
 
@@ -138,22 +174,36 @@ namespace HardwareAbstraction
 
 		#define FLAG_USERSPACE		0x1
 		#define FLAG_DETACHED		0x2
+		#define FLAG_PINNED			0x4
+		#define FLAG_JOINED			0x8
+		#define FLAG_REAPING		0x10
 		#define FLAG_DYING			0x80
 
 		extern rde::vector<Process*> ProcessList;
 		extern rde::vector<Thread*> SleepList;
+		extern Spinlock SleepListLock;
 
 		extern uint64_t NumThreads;
 		extern uint64_t NumProcesses;
-		extern bool SchedulerEnabled;
 
 		void Initialise();
 		RunQueue& GetRunQueue();
+		RunQueue& LockRunQueue(Thread* t);
 		uint64_t GetNumberOfThreads();
 		uint64_t GetCurrentCR3();
 		Thread* GetThread(pid_t id);
 		Process* GetProcess(pid_t id);
 
+		uint64_t AllocateKernelStack(uint64_t size);
+		void FreeKernelStack(uint64_t top, uint64_t size);
+		uint64_t AllocateUserStack(Process* p, uint64_t size);
+		void FreeUserStack(Process* p, uint64_t base, uint64_t size);
+
+		void RegisterThread(Thread* t);
+		void UnregisterThread(Thread* t);
+		void RegisterProcess(Process* p);
+		void UnregisterProcess(Process* p);
+
 		void SetTLS(uint64_t tlsptr);
 
 		pid_t GetCurrentThreadID();
@@ -173,6 +223,9 @@ namespace HardwareAbstraction
 		void Suspend(Thread* p);
 		void Resume(Thread* p);
 		void Kill(Thread* p);
+		void Cleanup(Thread* t);
+		void QueueReap(Thread* t);
+		void ReapDetachedThreads();
 		void TerminateCurrentThread(ThreadRegisterState_type* r);
 		extern "C" void ExitThread();
 		extern "C" void ExitThread_Userspace();
@@ -183,6 +236,7 @@ namespace HardwareAbstraction
 		void Suspend(Process* p);
 		void Resume(Process* p);
 		void Kill(Process* p);
+		void Cleanup(Process* p);
 
 		void Suspend(const char* p);
 		void Resume(const char* p);
@@ -7,6 +7,7 @@
 #include <HardwareAbstraction/Devices/NIC.hpp>
 #include <HardwareAbstraction/Filesystems.hpp>
 #include <HardwareAbstraction/Filesystems/FSUtil.hpp>
+#include <HardwareAbstraction/Filesystems/Poll.hpp>
 #include <orionx/PacketNetwork.hpp>
 #pragma once
 
@@ -397,7 +398,9 @@ namespace Network
 		Devices::NIC::GenericNIC* interface = 0;
 
 		rde::string ipcSocketPath;
-		rde::vector<pid_t> blockingProcs;
+
+		// whoever writes into recvbuffer notifies this afterwards.
+		Filesystems::PollSource poll;
 	};
 
 	class SocketVFS : public Filesystems::FSDriver
@@ -418,6 +421,9 @@ namespace Network
 			// returns a list of items inside the directory, as vnodes.
 			virtual rde::vector<Filesystems::VFS::vnode*> ReadDir(Filesystems::VFS::vnode* node) override;
 
+			virtual uint32_t Poll(Filesystems::VFS::vnode* node) override;
+			virtual Filesystems::PollSource* GetPollSource(Filesystems::VFS::vnode* node) override;
+
 
 			// unix-isms that we'll just have to implement for an easier time in userspace
 			void Connect(Filesystems::VFS::vnode* node, Library::IPv4Address remote, uint16_t remoteport);		// remote address
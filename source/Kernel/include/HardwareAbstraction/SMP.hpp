@@ -0,0 +1,103 @@
+// SMP.hpp
+// Copyright (c) 2014 - 2016, zhiayang@gmail.com
+// Licensed under the Apache License Version 2.0.
+
+#pragma once
+#include <stdint.h>
+
+namespace Kernel
+{
+	struct LogRing;
+}
+
+namespace Kernel {
+namespace HardwareAbstraction
+{
+	namespace Multitasking
+	{
+		struct Thread;
+		struct RunQueue;
+	}
+
+	namespace MemoryManager {
+	namespace Virtual
+	{
+		struct PageMapStructure;
+	}
+	}
+
+	namespace SMP
+	{
+		#define MaxCPUs				32
+		#define NumPCIDs			8
+
+		#define MSR_GS_BASE			0xC0000101
+		#define MSR_KERNEL_GS_BASE	0xC0000102
+
+		struct TaskStateSegment
+		{
+			uint32_t reserved0;
+			uint64_t rsp0;
+			uint64_t rsp1;
+			uint64_t rsp2;
+			uint64_t reserved1;
+			uint64_t ist[7];
+			uint64_t reserved2;
+			uint16_t reserved3;
+			uint16_t iomapbase;
+
+		} __attribute__ ((packed));
+
+		// one of these per processor, pointed to by the gs base while in the kernel.
+		// the first four fields are read through %gs by the assembly stubs, so don't move them.
+		struct CPU
+		{
+			CPU* self;								// %gs:0
+			uint64_t NewCR3;						// %gs:8 -- cr3 for the task switcher to load, 0 if unchanged
+			uint64_t ReturnToUser;					// %gs:16 -- 0xFADE if the task switcher is returning to ring 3
+			int64_t Errno;							// %gs:24 -- errno of the running thread, handed to userspace in %r13
+
+			uint32_t id;
+			uint32_t apicid;
+			volatile uint64_t online;
+
+			TaskStateSegment* tss;
+			uint64_t gdt[8];
+
+			Multitasking::RunQueue* runqueue;
+			Multitasking::Thread* CurrentThread;
+			Multitasking::Thread* PreviousThread;
+			Multitasking::Thread* PendingSleep;
+			Multitasking::Thread* IdleThread;
+
+			uint64_t CurrentCR3;
+			MemoryManager::Virtual::PageMapStructure* CurrentPML4T;
+			uint64_t ScheduleCount;
+			bool IsFirst;
+
+			// address spaces holding our process-context ids (id = index + 1), and the rest of the tlb state; see TLB.cpp.
+			volatile uint64_t pcids[NumPCIDs];
+			uint64_t nextpcid;
+			uint64_t kernelgen;
+			volatile uint64_t TLBRequests;
+			volatile uint64_t TLBShootdowns;
+
+			// this processor's half of the kernel log; null on the boot processor, which uses a static one.
+			LogRing* logring;
+		};
+
+		static inline CPU* GetCurrentCPU()
+		{
+			CPU* ret;
+			asm volatile("movq %%gs:0, %[ret]" : [ret]"=r"(ret));
+			return ret;
+		}
+
+		void Initialise();
+		void StartAPs();
+
+		uint64_t GetNumberOfCPUs();
+		CPU* GetCPU(uint64_t id);
+	}
+}
+}
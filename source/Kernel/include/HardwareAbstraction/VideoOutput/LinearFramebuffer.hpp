@@ -42,6 +42,9 @@ namespace VideoOutput
 		uint32_t BlendPixels(uint32_t bottom, uint32_t top);
 		uint32_t GetRGBA(uint8_t r, uint8_t g, uint8_t b, uint8_t a);
 		void DrawChar(uint8_t c, uint16_t x, uint16_t y, uint32_t Colour);
+		void DrawString(const char* str, uint64_t length, uint16_t x, uint16_t y, uint32_t Colour);
+		void MarkDirty(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+		bool IsDirty();
 		void RefreshBuffer();
 		uint16_t GetResX();
 		uint16_t GetResY();
@@ -10,8 +10,39 @@
 #define MaxMessages 256
 
 namespace Kernel {
+namespace HardwareAbstraction {
+namespace Multitasking
+{
+	struct Process;
+}
+}
+
 namespace IPC
 {
+	// shared-memory ring channels, see Channel.cpp.
+	void CloseChannels(HardwareAbstraction::Multitasking::Process* p);
+
+	// posix message queues live here, see MessageQueue.cpp.
+	class MessageQueueFS : public HardwareAbstraction::Filesystems::FSDriver
+	{
+		public:
+			MessageQueueFS();
+
+			virtual ~MessageQueueFS() override;
+			virtual bool Create(HardwareAbstraction::Filesystems::VFS::vnode* node, const char* path, uint64_t flags, uint64_t perms) override;
+			virtual bool Delete(HardwareAbstraction::Filesystems::VFS::vnode* node, const char* path) override;
+			virtual bool Traverse(HardwareAbstraction::Filesystems::VFS::vnode* node, const char* path, char** symlink) override;
+			virtual size_t Read(HardwareAbstraction::Filesystems::VFS::vnode* node, void* buf, off_t offset, size_t length) override;
+			virtual size_t Write(HardwareAbstraction::Filesystems::VFS::vnode* node, const void* buf, off_t offset, size_t length) override;
+			virtual void Flush(HardwareAbstraction::Filesystems::VFS::vnode* node) override;
+			virtual void Stat(HardwareAbstraction::Filesystems::VFS::vnode* node, struct stat* stat, bool statlink) override;
+			virtual void Close(HardwareAbstraction::Filesystems::VFS::vnode* node) override;
+
+			virtual rde::vector<HardwareAbstraction::Filesystems::VFS::vnode*> ReadDir(HardwareAbstraction::Filesystems::VFS::vnode* node) override;
+
+			virtual uint32_t Poll(HardwareAbstraction::Filesystems::VFS::vnode* node) override;
+			virtual HardwareAbstraction::Filesystems::PollSource* GetPollSource(HardwareAbstraction::Filesystems::VFS::vnode* node) override;
+	};
 }
 }
 
@@ -36,7 +36,8 @@
 #define FPLAddress					0xFFFFFF0000000000
 #define KernelHeapMetadata			0xFFFFFF1000000000
 #define KernelHeapAddress			0xFFFFFF2000000000
-#define TemporaryVirtualMapping		0x000000FF00000000
+#define KernelStackAddress			0xFFFFFF4000000000
+#define SMPTrampolineAddress		0x0000000000070000
 #define DefaultUserStackAddr		0xFFFFFFF0
 
 #define __ORIONX_KERNEL
@@ -44,6 +45,10 @@
 // Configurable sizes
 // As above, try not to mess with these
 #define DefaultRing3StackSize	0x20000
+#define KernelStackSize			0x4000
+#define KernelThreadStackSize	0x10000
+#define KernelStackWindow		0x4000000000
+#define DoubleFaultStackSize	0x2000
 
 // Global IRQ0 tickrate.
 #define GlobalTickRate		500
@@ -58,8 +63,15 @@
 #define ENABLELOGGING		1
 #define EXTRADELAY			1
 
+#define LocalTimerNumber	0xF0
+#define TLBShootdownNumber	0xF1
 #define SyscallNumber		0xF8
+#define SpuriousInterruptNumber	0xFF
 #define IPCNumber			0xF9
+
+// handed out to devices (msi) by Interrupts::AllocateVector(); the stubs for them are in InterruptHandlers.s.
+#define FirstDeviceVector	0x30
+#define LastDeviceVector	0xEF
 #define VolumeMountPoint	"/Volumes/"
 
 
@@ -109,6 +121,15 @@ namespace Kernel
 	void Log(uint8_t level, const char* str, ...);
 	void Log(const char* str, ...);
 
+	// log ring, in Utility/Log.cpp
+	struct LogRing;
+	LogRing* CreateLogRing();
+	void DestroyLogRing(LogRing* ring);
+
+	void InitialiseLogDrain();
+	void FlushLog();
+	uint64_t GetDroppedLogRecords();
+
 	extern const char* K_BinaryUnits[];
 
 	// global variables
@@ -47,6 +47,29 @@ namespace Kernel
 
 
 
+	// spins instead of yielding, and keeps interrupts off while held.
+	// for the scheduler's own structures, which get touched from interrupt context and across processors.
+	class Spinlock
+	{
+		Spinlock& operator=(Spinlock&)				= delete;
+		const Spinlock& operator=(const Spinlock&)	= delete;
+
+		public:
+			Spinlock() { }
+
+			// the holding thread, or the processor itself if it hasn't scheduled anything yet; -1 when free.
+			void* owner = (void*) -1;
+			uint64_t recursion = 0;
+			uint64_t lock = false;
+			uint64_t flags = 0;
+	};
+
+	bool TryLockSpinlock(Spinlock& lock);
+	void LockSpinlock(Spinlock& lock);
+	void UnlockSpinlock(Spinlock& lock);
+
+
+
 
 
 
@@ -153,9 +153,9 @@ SetPTEntry:
 	wrmsr
 
 
-	// Enable Paging, enter compatibility mode
+	// Enable Paging (and CR0.WP, so supervisor writes respect read-only pages), enter compatibility mode
 	mov %cr0, %eax
-	orl $0x80000000, %eax
+	orl $0x80010000, %eax
 	mov %eax, %cr0
 
 	// Load Long Mode GDT